@@ -12,6 +12,109 @@
 
 namespace av {
 
+AMTFrameCache::AMTFrameCache()
+    : shards()
+    , shardBudget(SIZE_MAX)
+    , hits(0)
+    , misses(0)
+    , evictions(0) {}
+
+void AMTFrameCache::setCapacity(int frames, size_t frameBytes) {
+    // バイト数をシャードで等分すると1シャード1枚程度になり直近のフレームが押し出されるので、
+    // シャードごとの枚数を切り上げた上で1枚の余裕を持たせ、前方デコードで直近frames枚が必ず残るようにする
+    const size_t shardFrames = (size_t)(std::max(frames, 0) + NUM_SHARDS - 1) / NUM_SHARDS + 1;
+    shardBudget = shardFrames * frameBytes;
+}
+
+bool AMTFrameCache::lookup(int n, PVideoFrame& frame) {
+    if (find(n, &frame)) {
+        hits++;
+        return true;
+    }
+    misses++;
+    return false;
+}
+
+bool AMTFrameCache::find(int n, PVideoFrame* frame) {
+    Shard& shard = shardOf(n);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(n);
+    if (it == shard.index.end()) {
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    if (frame) {
+        *frame = it->second->data;
+    }
+    return true;
+}
+
+void AMTFrameCache::put(int n, const PVideoFrame& frame, size_t bytes) {
+    Shard& shard = shardOf(n);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(n);
+    if (it != shard.index.end()) {
+        shard.bytes -= it->second->bytes;
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+    shard.lru.push_front(Entry{ n, frame, bytes });
+    shard.index[n] = shard.lru.begin();
+    shard.bytes += bytes;
+
+    // 容量を超えたら古いものから削除（今入れたものは残す）
+    const size_t budget = shardBudget;
+    while (shard.bytes > budget && shard.lru.size() > 1) {
+        const Entry& last = shard.lru.back();
+        shard.bytes -= last.bytes;
+        shard.index.erase(last.key);
+        shard.lru.pop_back();
+        evictions++;
+    }
+}
+
+int AMTFrameCache::findNearest(int n) {
+    // デコードに失敗した時しか呼ばれないので全シャードを走査する
+    int below = -1, above = -1;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const auto& entry : shard.lru) {
+            if (entry.key <= n) {
+                below = std::max(below, entry.key);
+            } else if (above < 0 || entry.key < above) {
+                above = entry.key;
+            }
+        }
+    }
+    const int nearest = (below >= 0) ? below : above;
+    if (nearest >= 0) {
+        find(nearest, nullptr);
+    }
+    return nearest;
+}
+
+void AMTFrameCache::clear() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.index.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
+
+bool AMTFrameCache::empty() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!shard.lru.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+AMTFrameCache::Stats AMTFrameCache::getStats() const {
+    return Stats{ hits.load(), misses.load(), evictions.load() };
+}
 
 const AVCodec* AMTSource::getHWAccelCodec(AVCodecID vcodecId) {
     switch (vcodecId) {
@@ -52,7 +155,7 @@ const AVCodec* AMTSource::getHWAccelCodec(AVCodecID vcodecId) {
 }
 
 void AMTSource::MakeCodecContext(IScriptEnvironment* env) {
-    AVCodecID vcodecId = videoStream->codecpar->codec_id;
+    AVCodecID vcodecId = dec->videoStream->codecpar->codec_id;
     const AVCodec *pCodec = getHWAccelCodec(vcodecId);
     if (pCodec == NULL) {
         ctx.warn(_T("指定されたデコーダが使用できないためデフォルトデコーダを使います"));
@@ -61,18 +164,18 @@ void AMTSource::MakeCodecContext(IScriptEnvironment* env) {
     if (pCodec == NULL) {
         env->ThrowError("Could not find decoder ...");
     }
-    codecCtx.Set(pCodec);
-    if (avcodec_parameters_to_context(codecCtx(), videoStream->codecpar) != 0) {
+    dec->codecCtx.Set(pCodec);
+    if (avcodec_parameters_to_context(dec->codecCtx(), dec->videoStream->codecpar) != 0) {
         env->ThrowError("avcodec_parameters_to_context failed");
     }
-    codecCtx()->pkt_timebase = videoStream->time_base;
-    codecCtx()->thread_count = GetFFmpegThreads((decodeThreads) ? decodeThreads : GetProcessorCount(), videoStream->codecpar->height);
+    dec->codecCtx()->pkt_timebase = dec->videoStream->time_base;
+    dec->codecCtx()->thread_count = GetFFmpegThreads((decodeThreads) ? decodeThreads : GetProcessorCount(), dec->videoStream->codecpar->height);
 
     // export_mvs for codecview
     //AVDictionary *opts = NULL;
     //av_dict_set(&opts, "flags2", "+export_mvs", 0);
 
-    if (avcodec_open2(codecCtx(), pCodec, NULL) != 0) {
+    if (avcodec_open2(dec->codecCtx(), pCodec, NULL) != 0) {
         env->ThrowError("avcodec_open2 failed");
     }
 }
@@ -84,34 +187,34 @@ void AMTSource::MakeFilterGraph(IScriptEnvironment* env) {
     const AVFilter *buffersink = avfilter_get_by_name("buffersink");
     FilterInOut outputs;
     FilterInOut inputs;
-    AVRational time_base = videoStream->time_base;
+    AVRational time_base = dec->videoStream->time_base;
 
-    filterGraph.Create();
-    bufferSrcCtx = nullptr;
-    bufferSinkCtx = nullptr;
+    dec->filterGraph.Create();
+    dec->bufferSrcCtx = nullptr;
+    dec->bufferSinkCtx = nullptr;
 
-    filterGraph()->nb_threads = 4;
+    dec->filterGraph()->nb_threads = 4;
 
     /* buffer video source: the decoded frames from the decoder will be inserted here. */
     snprintf(args, sizeof(args),
         "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-        codecCtx()->width, codecCtx()->height, codecCtx()->pix_fmt,
+        dec->codecCtx()->width, dec->codecCtx()->height, dec->codecCtx()->pix_fmt,
         time_base.num, time_base.den,
-        codecCtx()->sample_aspect_ratio.num, codecCtx()->sample_aspect_ratio.den);
+        dec->codecCtx()->sample_aspect_ratio.num, dec->codecCtx()->sample_aspect_ratio.den);
 
-    if (avfilter_graph_create_filter(&bufferSrcCtx, buffersrc, "in",
-        args, NULL, filterGraph()) < 0) {
+    if (avfilter_graph_create_filter(&dec->bufferSrcCtx, buffersrc, "in",
+        args, NULL, dec->filterGraph()) < 0) {
         env->ThrowError("avfilter_graph_create_filter failed (Cannot create buffer source)");
     }
 
     /* buffer video sink: to terminate the filter chain. */
-    if (avfilter_graph_create_filter(&bufferSinkCtx, buffersink, "out",
-        NULL, NULL, filterGraph()) < 0) {
+    if (avfilter_graph_create_filter(&dec->bufferSinkCtx, buffersink, "out",
+        NULL, NULL, dec->filterGraph()) < 0) {
         env->ThrowError("avfilter_graph_create_filter failed (Cannot create buffer sink)");
     }
 
-    if (av_opt_set_bin(bufferSinkCtx, "pix_fmts",
-        (uint8_t*)&codecCtx()->pix_fmt, sizeof(codecCtx()->pix_fmt),
+    if (av_opt_set_bin(dec->bufferSinkCtx, "pix_fmts",
+        (uint8_t*)&dec->codecCtx()->pix_fmt, sizeof(dec->codecCtx()->pix_fmt),
         AV_OPT_SEARCH_CHILDREN) < 0) {
         env->ThrowError("av_opt_set_bin failed (cannot set output pixel format)");
     }
@@ -128,7 +231,7 @@ void AMTSource::MakeFilterGraph(IScriptEnvironment* env) {
     * default.
     */
     outputs()->name = av_strdup("in");
-    outputs()->filter_ctx = bufferSrcCtx;
+    outputs()->filter_ctx = dec->bufferSrcCtx;
     outputs()->pad_idx = 0;
     outputs()->next = NULL;
 
@@ -139,16 +242,16 @@ void AMTSource::MakeFilterGraph(IScriptEnvironment* env) {
     * default.
     */
     inputs()->name = av_strdup("out");
-    inputs()->filter_ctx = bufferSinkCtx;
+    inputs()->filter_ctx = dec->bufferSinkCtx;
     inputs()->pad_idx = 0;
     inputs()->next = NULL;
 
-    if (avfilter_graph_parse_ptr(filterGraph(), filterdesc.c_str(),
+    if (avfilter_graph_parse_ptr(dec->filterGraph(), filterdesc.c_str(),
         &inputs(), &outputs(), NULL) < 0) {
         env->ThrowError("avfilter_graph_parse_ptr failed");
     }
 
-    if (avfilter_graph_config(filterGraph(), NULL) < 0) {
+    if (avfilter_graph_config(dec->filterGraph(), NULL) < 0) {
         env->ThrowError("avfilter_graph_config failed");
     }
 }
@@ -185,8 +288,8 @@ void AMTSource::MakeVideoInfo(const VideoFormat& vfmt, const AudioFormat& afmt)
 
 void AMTSource::UpdateVideoInfo(IScriptEnvironment* env) {
     // ビット深度は取得してないのでffmpegから取得する
-    const auto streamPixFmt = (AVPixelFormat)videoStream->codecpar->format;
-    const auto codecPixFmt = codecCtx()->pix_fmt;
+    const auto streamPixFmt = (AVPixelFormat)dec->videoStream->codecpar->format;
+    const auto codecPixFmt = dec->codecCtx()->pix_fmt;
     const int streamBitDepth = (streamPixFmt == AV_PIX_FMT_P010LE) ? 16 : av_pix_fmt_desc_get(streamPixFmt)->comp[0].depth;
     const int codecBitDepth = (codecPixFmt == AV_PIX_FMT_P010LE) ? 16 : av_pix_fmt_desc_get(codecPixFmt)->comp[0].depth;
     if (streamBitDepth > 8 && codecBitDepth > 8 && streamBitDepth < codecBitDepth) {
@@ -197,11 +300,13 @@ void AMTSource::UpdateVideoInfo(IScriptEnvironment* env) {
     } else {
         vi.pixel_type = toAVSFormat(codecPixFmt, env);
     }
+    cacheFrameBytes = (size_t)vi.BMPSize();
+    UpdateCacheBudget();
 
 #if ENABLE_FFMPEG_FILTER
-    if (bufferSinkCtx) {
+    if (dec->bufferSinkCtx) {
         // フィルタがあればフィルタの出力に更新
-        const AVFilterLink* outlink = bufferSinkCtx->inputs[0];
+        const AVFilterLink* outlink = dec->bufferSinkCtx->inputs[0];
         vi.pixel_type = toAVSFormat((AVPixelFormat)outlink->format, env);
 
         if (outlink->w != vi.width ||
@@ -212,9 +317,75 @@ void AMTSource::UpdateVideoInfo(IScriptEnvironment* env) {
 #endif
 }
 
+AMTSource::DecoderState::DecoderState(const tstring& srcpath) :
+    // i*.mpg は元の映像形式によらず PsStreamWriter が生成する MPEG-PS
+    inputCtx(srcpath, "mpeg"),
+    codecCtx(),
+#if ENABLE_FFMPEG_FILTER
+    filterGraph(),
+    bufferSrcCtx(),
+    bufferSinkCtx(),
+#endif
+    videoStream(nullptr),
+    lastDecodeFrame(-1),
+    prevFrame(),
+    nonBQPTable(),
+    lastUsed(0) {}
+
+void AMTSource::AddDecoder(IScriptEnvironment* env) {
+    std::unique_ptr<DecoderState> state(new DecoderState(srcpath));
+    if (avformat_find_stream_info(state->inputCtx(), NULL) < 0) {
+        env->ThrowError("avformat_find_stream_info failed");
+    }
+    state->videoStream = GetVideoStream(state->inputCtx());
+    if (state->videoStream == NULL) {
+        env->ThrowError("Could not find video stream ...");
+    }
+    decoders.push_back(std::move(state));
+    SelectDecoder(decoders.back().get());
+    ResetDecoder(env);
+}
+
+void AMTSource::SelectDecoder(DecoderState* state) {
+    dec = state;
+    dec->lastUsed = ++decoderUseCount;
+}
+
+AMTSource::DecoderState* AMTSource::FindForwardDecoder(int n) {
+    DecoderState* best = nullptr;
+    for (auto& state : decoders) {
+        const int last = state->lastDecodeFrame;
+        if (last != -1 && n > last && n < last + seekDistance) {
+            if (best == nullptr || last > best->lastDecodeFrame) {
+                best = state.get();
+            }
+        }
+    }
+    return best;
+}
+
+AMTSource::DecoderState* AMTSource::AcquireSeekDecoder(IScriptEnvironment* env) {
+    // まだ位置が決まっていないデコーダがあればそれを使う
+    for (auto& state : decoders) {
+        if (state->lastDecodeFrame == -1) {
+            return state.get();
+        }
+    }
+    if ((int)decoders.size() < maxDecoders) {
+        AddDecoder(env);
+        return dec;
+    }
+    // 一番使われていないデコーダを再利用する
+    auto lru = std::min_element(decoders.begin(), decoders.end(),
+        [](const std::unique_ptr<DecoderState>& a, const std::unique_ptr<DecoderState>& b) {
+        return a->lastUsed < b->lastUsed;
+    });
+    return lru->get();
+}
+
 void AMTSource::ResetDecoder(IScriptEnvironment* env) {
-    lastDecodeFrame = -1;
-    prevFrame = nullptr;
+    dec->lastDecodeFrame = -1;
+    dec->prevFrame = nullptr;
     MakeCodecContext(env);
 #if ENABLE_FFMPEG_FILTER
     if (filterdesc.size()) {
@@ -264,18 +435,18 @@ PVideoFrame AMTSource::MakeFrame(AVFrame* top, AVFrame* bottom, IScriptEnvironme
             env->BitBlt(qpframe->GetWritePtr(), qpframe->GetPitch(),
                 (const BYTE*)qp_table, qpvi.width, qpvi.width, qpvi.height);
             if (top->pict_type != AV_PICTURE_TYPE_B) {
-                nonBQPTable = qpframe;
+                dec->nonBQPTable = qpframe;
             }
 #if AVISYNTH_MODE == AVISYNTH_NEO
             ret->SetProperty("QP_Table", qpframe);
-            ret->SetProperty("QP_Table_Non_B", nonBQPTable);
+            ret->SetProperty("QP_Table_Non_B", dec->nonBQPTable);
             ret->SetProperty("QP_Stride", qp_stride ? qpframe->GetPitch() : 0);
             ret->SetProperty("QP_ScaleType", qp_scale_type);
 #elif AVISYNTH_MODE == AVISYNTH_PLUS
             int error;
             auto avsmap = env->getFramePropsRW(ret);
             env->propSetFrame(avsmap, "QP_Table", qpframe, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
-            env->propSetFrame(avsmap, "QP_Table_Non_B", nonBQPTable, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
+            env->propSetFrame(avsmap, "QP_Table_Non_B", dec->nonBQPTable, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
             env->propSetInt(avsmap, "QP_Stride", qp_stride ? qpframe->GetPitch() : 0, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
             env->propSetInt(avsmap, "QP_ScaleType", qp_scale_type, AVSPropAppendMode::PROPAPPENDMODE_REPLACE);
 #else
@@ -331,19 +502,31 @@ void AMTSource::MakeAndPutFrame(int n, Frame& top, Frame& bottom, IScriptEnviron
 }
 
 void AMTSource::PutFrame(int n, const PVideoFrame& frame) {
-    CacheFrame* pcache = new CacheFrame();
-    pcache->data = frame;
-    pcache->key = n;
-    frameCache[n] = pcache;
-    recentAccessed.push_front(pcache);
+    const size_t bytes = GetFrameBytes(frame);
+    // pitchのアラインメントでBMPSizeより大きいことがあるので、実際の大きさで容量を計算し直す
+    if (bytes > cacheFrameBytes) {
+        cacheFrameBytes = bytes;
+        UpdateCacheBudget();
+    }
+    frameCache.put(n, frame, bytes);
+}
 
-    if ((int)recentAccessed.size() > seekDistance * 3 / 2) {
-        // キャッシュから溢れたら削除
-        CacheFrame* pdel = recentAccessed.back();
-        frameCache.erase(pdel->key);
-        recentAccessed.pop_back();
-        delete pdel;
+size_t AMTSource::GetFrameBytes(const PVideoFrame& frame) const {
+    if (!frame) {
+        // 直接スキャン時の画像を持たない到達印も1フレーム分として数える
+        return (size_t)vi.BMPSize();
+    }
+    size_t bytes = (size_t)frame->GetPitch(PLANAR_Y) * frame->GetHeight(PLANAR_Y);
+    if (!vi.IsY()) {
+        bytes += (size_t)frame->GetPitch(PLANAR_U) * frame->GetHeight(PLANAR_U);
+        bytes += (size_t)frame->GetPitch(PLANAR_V) * frame->GetHeight(PLANAR_V);
     }
+    return bytes;
+}
+
+void AMTSource::UpdateCacheBudget() {
+    // 前方デコードでseekDistance分は戻れるように、その1.5倍を保持する
+    frameCache.setCapacity(seekDistance * 3 / 2, cacheFrameBytes);
 }
 
 int AMTSource::AVSFormatBitdepth(const int avsformat) {
@@ -375,14 +558,14 @@ int AMTSource::toAVSFormat(AVPixelFormat format, IScriptEnvironment* env) {
 #if ENABLE_FFMPEG_FILTER
 void AMTSource::InputFrameFilter(Frame* frame, bool enableOut, IScriptEnvironment* env) {
     /* push the decoded frame into the filtergraph */
-    if (av_buffersrc_add_frame_flags(bufferSrcCtx, frame ? (*frame)() : nullptr, 0) < 0) {
+    if (av_buffersrc_add_frame_flags(dec->bufferSrcCtx, frame ? (*frame)() : nullptr, 0) < 0) {
         env->ThrowError("av_buffersrc_add_frame_flags failed (Error while feeding the filtergraph)");
     }
 
     /* pull filtered frames from the filtergraph */
     while (1) {
         Frame filtered;
-        int ret = av_buffersink_get_frame(bufferSinkCtx, filtered());
+        int ret = av_buffersink_get_frame(dec->bufferSinkCtx, filtered());
         if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
             // もっと入力が必要 or もうフレームがない
             break;
@@ -397,7 +580,7 @@ void AMTSource::InputFrameFilter(Frame* frame, bool enableOut, IScriptEnvironmen
 }
 
 void AMTSource::OnFrameDecoded(Frame& frame, IScriptEnvironment* env) {
-    if (bufferSrcCtx) {
+    if (dec->bufferSrcCtx) {
         // フィルタ処理
         //frame()->pts = frame()->best_effort_timestamp;
         InputFrameFilter(&frame, true, env);
@@ -431,9 +614,9 @@ void AMTSource::OnFrameOutput(Frame& frame, IScriptEnvironment* env) {
         tailDiff = pts - frames.back().originalFramePTS;
         // 前の可能性もあるので、判定
         if (headDiff == 0 || headDiff > tailDiff) {
-            lastDecodeFrame = vi.num_frames;
+            dec->lastDecodeFrame = vi.num_frames;
         }
-        prevFrame = nullptr; // 連続でなくなる場合はnullリセット
+        dec->prevFrame = nullptr; // 連続でなくなる場合はnullリセット
         return;
     }
 
@@ -441,22 +624,21 @@ void AMTSource::OnFrameOutput(Frame& frame, IScriptEnvironment* env) {
         // 一致するフレームがない
         ctx.incrementCounter(AMT_ERR_UNKNOWN_PTS);
         ctx.warnF(_T("Unknown PTS frame %lld"), pts);
-        prevFrame = nullptr; // 連続でなくなる場合はnullリセット
+        dec->prevFrame = nullptr; // 連続でなくなる場合はnullリセット
         return;
     }
 
     int frameIndex = int(it - frames.begin());
-    auto cacheit = frameCache.find(frameIndex);
+    const bool cached = frameCache.find(frameIndex, nullptr);
 
     if (it->halfDelay) {
         // ディレイを適用させる
-        if (cacheit != frameCache.end()) {
+        if (cached) {
             // すでにキャッシュにある
-            UpdateAccessed(cacheit->second);
-            lastDecodeFrame = frameIndex;
-        } else if (prevFrame != nullptr) {
-            MakeAndPutFrame(frameIndex, *prevFrame, frame, env);
-            lastDecodeFrame = frameIndex;
+            dec->lastDecodeFrame = frameIndex;
+        } else if (dec->prevFrame != nullptr) {
+            MakeAndPutFrame(frameIndex, *dec->prevFrame, frame, env);
+            dec->lastDecodeFrame = frameIndex;
         } else {
             // 直前のフレームがないのでフレームを作れない
         }
@@ -464,57 +646,31 @@ void AMTSource::OnFrameOutput(Frame& frame, IScriptEnvironment* env) {
         // 次のフレームも同じフレームを参照してたらそれも出力
         auto next = it + 1;
         if (next != frames.end() && next->originalFramePTS == it->originalFramePTS) {
-            auto cachenext = frameCache.find(frameIndex + 1);
-            if (cachenext != frameCache.end()) {
+            if (frameCache.find(frameIndex + 1, nullptr)) {
                 // すでにキャッシュにある
-                UpdateAccessed(cachenext->second);
             } else {
                 MakeAndPutFrame(frameIndex + 1, frame, frame, env);
             }
-            lastDecodeFrame = frameIndex + 1;
+            dec->lastDecodeFrame = frameIndex + 1;
         }
     } else {
         // そのまま
-        if (cacheit != frameCache.end()) {
+        if (cached) {
             // すでにキャッシュにある
-            UpdateAccessed(cacheit->second);
         } else {
             MakeAndPutFrame(frameIndex, frame, frame, env);
         }
-        lastDecodeFrame = frameIndex;
-    }
-
-    prevFrame = std::unique_ptr<Frame>(new Frame(frame));
-}
-
-void AMTSource::UpdateAccessed(CacheFrame* frame) {
-    // recentAccessed にframeがあれば先頭に移動
-    auto target = std::find(recentAccessed.begin(), recentAccessed.end(), frame);
-    if (target != recentAccessed.end()) {
-        recentAccessed.erase(target);
+        dec->lastDecodeFrame = frameIndex;
     }
-    recentAccessed.push_front(frame);
-}
 
-void AMTSource::ClearFrameCache() {
-    while (!recentAccessed.empty()) {
-        CacheFrame* frame = recentAccessed.back();
-        frameCache.erase(frame->key);
-        recentAccessed.pop_back();
-        delete frame;
-    }
+    dec->prevFrame = std::unique_ptr<Frame>(new Frame(frame));
 }
 
 int AMTSource::ForceGetFrameIndex(int n) {
-    if (frameCache.size() == 0) {
-        return -1;
-    }
-    auto lb = frameCache.lower_bound(n);
-    if (lb == frameCache.end() || (lb->first != n && lb != frameCache.begin())) {
-        lb--;
+    if (frameCache.find(n, nullptr)) {
+        return n;
     }
-    UpdateAccessed(lb->second);
-    return lb->first;
+    return frameCache.findNearest(n);
 }
 
 void AMTSource::DecodeLoop(int goal, IScriptEnvironment* env) {
@@ -537,7 +693,7 @@ void AMTSource::DecodeLoop(int goal, IScriptEnvironment* env) {
     int64_t keyFramePTS = -1;
     auto isFrameReady = [&]() {
         // シーク後最初のフレームでないならOK
-        if (lastDecodeFrame != -1) return true;
+        if (dec->lastDecodeFrame != -1) return true;
         // キーフレームならOK
 #if LIBAVUTIL_VERSION_MAJOR >= 58
         if (frame()->flags & AV_FRAME_FLAG_KEY) return true;
@@ -550,17 +706,17 @@ void AMTSource::DecodeLoop(int goal, IScriptEnvironment* env) {
         return false;
         };
 
-    while (av_read_frame(inputCtx(), &packet) == 0) {
-        if (packet.stream_index == videoStream->index) {
+    while (av_read_frame(dec->inputCtx(), &packet) == 0) {
+        if (packet.stream_index == dec->videoStream->index) {
             if ((packet.flags & AV_PKT_FLAG_KEY) && keyFramePTS == -1) {
                 // 最初のキーフレームのPTSを覚えておく
                 keyFramePTS = packet.pts;
             }
-            if (avcodec_send_packet(codecCtx(), &packet) != 0) {
+            if (avcodec_send_packet(dec->codecCtx(), &packet) != 0) {
                 ctx.incrementCounter(AMT_ERR_DECODE_PACKET_FAILED);
                 ctx.warn(_T("avcodec_send_packet failed"));
             }
-            while (avcodec_receive_frame(codecCtx(), frame()) == 0) {
+            while (avcodec_receive_frame(dec->codecCtx(), frame()) == 0) {
                 // 最初はキーフレームまでスキップ
                 if (isFrameReady()) {
 #if ENABLE_FFMPEG_FILTER
@@ -572,12 +728,12 @@ void AMTSource::DecodeLoop(int goal, IScriptEnvironment* env) {
             }
         }
         av_packet_unref(&packet);
-        if (lastDecodeFrame >= goal) {
+        if (dec->lastDecodeFrame >= goal) {
             return;
         }
     }
 #if ENABLE_FFMPEG_FILTER
-    if (bufferSrcCtx) {
+    if (dec->bufferSrcCtx) {
         // ストリームは全て読み取ったのでフィルタをflush
         InputFrameFilter(nullptr, true, env);
     }
@@ -615,26 +771,19 @@ AMTSource::AMTSource(AMTContext& ctx,
     audioSamplesPerFrame(0),
     interlaced(false),
     outputQP(outputQP),
-    // i*.mpg は元の映像形式によらず PsStreamWriter が生成する MPEG-PS
-    inputCtx(srcpath, "mpeg"),
-    codecCtx(),
-#if ENABLE_FFMPEG_FILTER
-    filterGraph(),
-    bufferSrcCtx(),
-    bufferSinkCtx(),
-#endif
-    videoStream(nullptr),
+    srcpath(srcpath),
+    decoders(),
+    dec(nullptr),
+    maxDecoders(1),
+    decoderUseCount(0),
     storage(),
     frameCache(),
-    recentAccessed(),
     failedMap(),
     vi(),
     mutex(),
-    waveFile(audiopath, _T("rb")),
+    waveFile(audiopath),
     seekDistance(10),
-    lastDecodeFrame(-1),
-    prevFrame(),
-    nonBQPTable(),
+    cacheFrameBytes(0),
     convertPix(),
     directFrameCallback(),
     directScanUsed(false) {
@@ -645,21 +794,21 @@ AMTSource::AMTSource(AMTContext& ctx,
 #endif
     MakeVideoInfo(vfmt, afmt);
 
-    if (avformat_find_stream_info(inputCtx(), NULL) < 0) {
-        env->ThrowError("avformat_find_stream_info failed");
-    }
-    videoStream = GetVideoStream(inputCtx());
-    if (videoStream == NULL) {
-        env->ThrowError("Could not find video stream ...");
-    }
-
     // 初期化
-    ResetDecoder(env);
+    AddDecoder(env);
     UpdateVideoInfo(env);
+
+    if (dec->codecCtx()->codec == avcodec_find_decoder(dec->videoStream->codecpar->codec_id)) {
+        // ソフトウェアデコードの場合のみデコーダを増やす
+        maxDecoders = MAX_SW_DECODERS;
+    }
 }
 
 AMTSource::~AMTSource() {
-    ClearFrameCache();
+    const auto stats = frameCache.getStats();
+    ctx.debugF(_T("AMTSourceキャッシュ: ヒット %llu, ミス %llu, 破棄 %llu"),
+        (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.evictions);
+    frameCache.clear();
 }
 
 void AMTSource::TransferStreamInfo(std::unique_ptr<AMTSourceData>&& streamInfo) {
@@ -667,21 +816,29 @@ void AMTSource::TransferStreamInfo(std::unique_ptr<AMTSourceData>&& streamInfo)
 }
 
 PVideoFrame __stdcall AMTSource::GetFrame(int n, IScriptEnvironment* env) {
-    std::lock_guard<std::mutex> guard(mutex);
-
     if (directScanUsed) {
         env->ThrowError("[AMTSource] AVFrame直接スキャン後にGetFrameは呼び出せません");
     }
 
+    // キャッシュにあればデコーダのロックを取らずに返す
+    PVideoFrame frame;
+    if (frameCache.lookup(n, frame)) {
+        return frame;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    // フレームの追加・削除はこのロック内でしか行われないので、解決したフレームは取得できる
     const int resolved = ResolveFrame(n, env);
-    return (resolved < 0) ? env->NewVideoFrame(vi) : frameCache[resolved]->data;
+    if (resolved < 0 || !frameCache.find(resolved, &frame)) {
+        return env->NewVideoFrame(vi);
+    }
+    return frame;
 }
 
 int AMTSource::ResolveFrame(int n, IScriptEnvironment* env) {
     // キャッシュにあれば返す
-    auto it = frameCache.find(n);
-    if (it != frameCache.end()) {
-        UpdateAccessed(it->second);
+    if (frameCache.find(n, nullptr)) {
         return n;
     }
 
@@ -691,40 +848,46 @@ int AMTSource::ResolveFrame(int n, IScriptEnvironment* env) {
     }
 
     // キャッシュにないのでデコードする
-    if (lastDecodeFrame != -1 && n > lastDecodeFrame && n < lastDecodeFrame + seekDistance) {
+    DecoderState* forward = FindForwardDecoder(n);
+    if (forward != nullptr) {
         // 前にすすめる
+        SelectDecoder(forward);
         DecodeLoop(n, env);
     } else {
         // シークしてデコードする
+        SelectDecoder(AcquireSeekDecoder(env));
         int keyNum = frames[n].keyFrame;
         for (int i = 0; ; i++) {
             int64_t fileOffset = frames[keyNum].fileOffset / 188 * 188;
-            if (av_seek_frame(inputCtx(), -1, fileOffset, AVSEEK_FLAG_BYTE) < 0) {
+            if (av_seek_frame(dec->inputCtx(), -1, fileOffset, AVSEEK_FLAG_BYTE) < 0) {
                 THROW(FormatException, "av_seek_frame failed");
             }
             ResetDecoder(env);
             DecodeLoop(n, env);
-            if (frameCache.find(n) != frameCache.end()) {
+            if (frameCache.find(n, nullptr)) {
                 // デコード成功
-                seekDistance = std::max(seekDistance, n - keyNum);
+                if (n - keyNum > seekDistance) {
+                    seekDistance = n - keyNum;
+                    UpdateCacheBudget();
+                }
                 break;
             }
             if (keyNum <= 0) {
                 // これ以上戻れない
                 // nからlastDecodeFrameまでをデコード不可とする
-                registerFailedFrames(n, lastDecodeFrame, lastDecodeFrame, env);
+                registerFailedFrames(n, dec->lastDecodeFrame, dec->lastDecodeFrame, env);
                 break;
             }
-            if (lastDecodeFrame >= 0 && lastDecodeFrame < n) {
+            if (dec->lastDecodeFrame >= 0 && dec->lastDecodeFrame < n) {
                 // データが足りなくてゴールに到達できなかった
                 // このフレームより後ろは全てデコード不可とする
-                registerFailedFrames(lastDecodeFrame + 1, (int)frames.size(), lastDecodeFrame, env);
+                registerFailedFrames(dec->lastDecodeFrame + 1, (int)frames.size(), dec->lastDecodeFrame, env);
                 break;
             }
             if (i == 2) {
                 // デコード失敗
                 // nからlastDecodeFrameまでをデコード不可とする
-                registerFailedFrames(n, lastDecodeFrame, lastDecodeFrame, env);
+                registerFailedFrames(n, dec->lastDecodeFrame, dec->lastDecodeFrame, env);
                 break;
             }
             keyNum -= std::max(5, keyNum - frames[keyNum - 1].keyFrame);
@@ -750,7 +913,7 @@ void AMTSource::ScanFramesDirect(int begin, int end,
 
     std::lock_guard<std::mutex> guard(mutex);
     // 前回と異なるコールバックでも安全に再走査できるよう、画像を持たない到達印を破棄する
-    ClearFrameCache();
+    frameCache.clear();
     directScanUsed = true;
     try {
         directFrameCallback = frameCallback;
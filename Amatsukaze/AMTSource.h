@@ -17,11 +17,14 @@
 #include <mutex>
 #include <set>
 #include <deque>
+#include <list>
+#include <atomic>
 #include <unordered_map>
 #include <functional>
 #include "ConvertPix.h"
 #include "StreamReform.h"
 #include "ReaderWriterFFmpeg.h"
+#include "WaveWriter.h"
 
 namespace av {
 
@@ -42,6 +45,62 @@ struct AMTSourceData {
     std::vector<FilterAudioFrame> audioFrames;
 };
 
+// AMTSourceのデコード済みフレームキャッシュ
+// フレーム番号でシャードに分け、シャードごとのロックとLRUリストで管理する
+// ヒット時はデコーダのロックを取らずにフレームを返せるので、MTのフィルタから同時に呼ばれても詰まらない
+class AMTFrameCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    AMTFrameCache();
+
+    // 直近frames枚（1枚frameBytesバイト）を保持できる容量にする
+    // 超えたらシャードごとに古いものから捨てる
+    void setCapacity(int frames, size_t frameBytes);
+
+    // GetFrameからの問い合わせ（ヒット/ミスを数える）
+    bool lookup(int n, PVideoFrame& frame);
+    // あれば最近使ったことにしてtrueを返す（frameがnullptrでなければ取得もする）
+    bool find(int n, PVideoFrame* frame);
+    void put(int n, const PVideoFrame& frame, size_t bytes);
+    // n以下で最大のフレーム番号、なければnより大きい最小のフレーム番号を返す
+    // キャッシュが空なら-1
+    int findNearest(int n);
+    void clear();
+    bool empty();
+
+    Stats getStats() const;
+
+private:
+    enum { NUM_SHARDS = 8 };
+
+    struct Entry {
+        int key;
+        PVideoFrame data;
+        size_t bytes;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::list<Entry> lru; // 先頭が最近使ったもの
+        std::unordered_map<int, std::list<Entry>::iterator> index;
+        size_t bytes;
+        Shard() : bytes(0) {}
+    };
+
+    Shard& shardOf(int n) { return shards[(unsigned int)n % NUM_SHARDS]; }
+
+    std::array<Shard, NUM_SHARDS> shards;
+    std::atomic<size_t> shardBudget;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> evictions;
+};
+
 class AMTSource : public IClip, AMTObject {
 public:
     // AVFrameはコールバック内でのみ有効。呼び出し側では保持しないこと
@@ -59,26 +118,53 @@ private:
 
     bool outputQP; // QPテーブルを出力するか
 
-    InputContext inputCtx;
-    CodecContext codecCtx;
+    // デコーダ1つ分の状態
+    // 前後を行き来するスクリプトでシークと再デコードを繰り返さないよう、
+    // 別々のGOPに位置するデコーダを複数持って、一番近いものでデコードする
+    struct DecoderState {
+        InputContext inputCtx;
+        CodecContext codecCtx;
 
 #if ENABLE_FFMPEG_FILTER
-    FilterGraph filterGraph;
-    AVFilterContext* bufferSrcCtx;
-    AVFilterContext* bufferSinkCtx;
+        FilterGraph filterGraph;
+        AVFilterContext* bufferSrcCtx;
+        AVFilterContext* bufferSinkCtx;
 #endif
 
-    AVStream *videoStream;
+        AVStream *videoStream;
 
-    std::unique_ptr<AMTSourceData> storage;
+        // OnFrameDecodedで直前にデコードされたフレーム
+        // まだデコードしてない場合は-1
+        int lastDecodeFrame;
 
-    struct CacheFrame {
-        PVideoFrame data;
-        int key;
+        // codecCtxが直前にデコードしたフレーム番号
+        // まだデコードしてない場合はnullptr
+        std::unique_ptr<Frame> prevFrame;
+
+        // 直前のnon B QPテーブル
+        PVideoFrame nonBQPTable;
+
+        // 最後に使った順番（シーク時に一番使われていないものを再利用する）
+        uint64_t lastUsed;
+
+        DecoderState(const tstring& srcpath);
     };
 
-    std::map<int, CacheFrame*> frameCache;
-    std::deque<CacheFrame*> recentAccessed;
+    enum {
+        MAX_SW_DECODERS = 3, // HWデコーダはセッションを消費するので1つのみ
+    };
+
+    tstring srcpath;
+
+    std::vector<std::unique_ptr<DecoderState>> decoders;
+    // 現在デコードに使っているデコーダ
+    DecoderState* dec;
+    int maxDecoders;
+    uint64_t decoderUseCount;
+
+    std::unique_ptr<AMTSourceData> storage;
+
+    AMTFrameCache frameCache;
 
     // デコードできなかったフレームの置換先リスト
     std::map<int, int> failedMap;
@@ -87,25 +173,16 @@ private:
 
     std::mutex mutex;
 
-    File waveFile;
+    WaveStoreReader waveFile;
 
     int seekDistance;
-
-    // OnFrameDecodedで直前にデコードされたフレーム
-    // まだデコードしてない場合は-1
-    int lastDecodeFrame;
-
-    // codecCtxが直前にデコードしたフレーム番号
-    // まだデコードしてない場合はnullptr
-    std::unique_ptr<Frame> prevFrame;
-
-    // 直前のnon B QPテーブル
-    PVideoFrame nonBQPTable;
+    // キャッシュ容量の計算に使う1フレームのバイト数（pitch込みの実際の大きさ）
+    std::atomic<size_t> cacheFrameBytes;
 
     ConvertPixFuncs convertPix;
 
     DirectFrameCallback directFrameCallback;
-    bool directScanUsed;
+    std::atomic<bool> directScanUsed;
 
     const AVCodec* getHWAccelCodec(AVCodecID vcodecId);
 
@@ -121,6 +198,16 @@ private:
 
     void ResetDecoder(IScriptEnvironment* env);
 
+    void AddDecoder(IScriptEnvironment* env);
+
+    void SelectDecoder(DecoderState* state);
+
+    // 前方にデコードしてnに到達できるデコーダのうち一番近いもの。なければnullptr
+    DecoderState* FindForwardDecoder(int n);
+
+    // シークしてデコードするためのデコーダ
+    DecoderState* AcquireSeekDecoder(IScriptEnvironment* env);
+
     template <typename T>
     void Copy1(T* dst, const T* top, const T* bottom, int w, int h, int dpitch, int tpitch, int bpitch) {
         for (int y = 0; y < h; y += 2) {
@@ -218,9 +305,9 @@ private:
 
     void OnFrameOutput(Frame& frame, IScriptEnvironment* env);
 
-    void UpdateAccessed(CacheFrame* frame);
+    size_t GetFrameBytes(const PVideoFrame& frame) const;
 
-    void ClearFrameCache();
+    void UpdateCacheBudget();
 
     int ForceGetFrameIndex(int n);
 
@@ -64,7 +64,7 @@ extern "C" AMATSUKAZE_API const char* AvisynthPluginInit3(IScriptEnvironment* en
 
     env->AddFunction("AMTSource", "s[filter]s[outqp]b[threads]i", av::CreateAMTSource, 0);
 
-    env->AddFunction("AMTAnalyzeLogo", "cs[maskratio]i", logo::AMTAnalyzeLogo::Create, 0);
+    env->AddFunction("AMTAnalyzeLogo", "cs[maskratio]i[cachedir]s", logo::AMTAnalyzeLogo::Create, 0);
     env->AddFunction("AMTEraseLogo", "ccs[logof]s[mode]i[maxfade]i", logo::AMTEraseLogo::Create, 0);
 
     env->AddFunction("AMTDecimate", "c[duration]s", AMTDecimate::Create, 0);
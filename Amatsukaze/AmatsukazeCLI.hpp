@@ -45,6 +45,11 @@ static void printHelp(const tchar* bin) {
         "  -o|--output <パス>  出力ファイルパス\n"
         "  -s|--serviceid <数値> 処理するサービスIDを指定[]\n"
         "  -w|--work   <パス>  一時ファイルパス[./]\n"
+        "  --mmap-input        入力TSをメモリマップで読み込む（ローカルの高速ストレージ向け）\n"
+        "  --parallel-ts-analyze  TS解析で映像・音声のES解析をストリームごとに並列で行う\n"
+        "                      音声が2ストリーム以上ある場合は指定しなくても並列で行う\n"
+        "  --parallel-ts-split <数値|auto>  TS解析で入力を指定数の範囲に分割して並列に解析する[1]\n"
+        "                      字幕処理が有効な場合や入力が小さい場合は分割しない\n"
         "  -et|--encoder-type <タイプ>  使用エンコーダタイプ[x264]\n"
         "                      対応エンコーダ: x264,x265,QSVEnc,NVEnc,VCEEnc,SVT-AV1\n"
         "  -e|--encoder <パス> エンコーダパス[x264.exe]\n"
@@ -54,6 +59,8 @@ static void printHelp(const tchar* bin) {
         "  --muxer-add-encoder-cmd  mp4/mkv出力時にコンテナにエンコーダ名と追加オプションを記録する\n"
         "  --sar-in-container-only  SAR比をエンコーダに渡さず、mp4/mkvコンテナのみに記録する\n"
         "  --enc-parallel <数値>  エンコード分割並列数[1]\n"
+        "  --frame-ring <数値>  エンコーダへのフレーム転送を共有メモリリングで行う（スロット数、Linuxのみ）[0]\n"
+        "                      エンコーダ側はFrameRing.hのプロトコルに対応している必要がある\n"
         "  --sar w:h           SAR比の上書き (SVT-AV1使用時または --sar-in-container-only 有効時のみ有効)\n"
         "  -b|--bitrate a:b:f  ビットレート計算式 映像ビットレートkbps = f*(a*s+b)\n"
         "                      sは入力映像ビットレート、fは入力がH264の場合は入力されたfだが、\n"
@@ -75,10 +82,14 @@ static void printHelp(const tchar* bin) {
         "  -t|--timelineeditor  <パス>  timelineeditorへのパス（MP4でVFR出力する場合に必要）[timelineeditor.exe]\n"
         "  --mp4box <パス>     mp4boxへのパス（MP4で字幕処理する場合に必要）[mp4box.exe]\n"
         "  --mkvmerge <パス>   mkvmergeへのパス（--use-mkv-when-sub-exists使用時に必要）[mkvmerge.exe]\n"
+        "  --native-mux        mp4/mkv出力を外部muxerを使わず内部で1回で行う\n"
+        "  --stream-mux        エンコード中の出力を追いかけてmuxする（--native-muxを含む）\n"
         "  --tsreplace-remove-typed  tsreplace実行時に--remove-typedを指定する\n"
         "  --mux-ts-temp        tsreplace時に入力TSの一時コピーを作成してmuxを高速化する\n"
         "  -f|--filter <パス>  フィルタAvisynthスクリプトへのパス[]\n"
         "  -pf|--postfilter <パス>  ポストフィルタAvisynthスクリプトへのパス[]\n"
+        "  --filter-prepass-parallel <数値> フィルタ前処理パスの分割並列数（0で自動）[0]\n"
+        "                      フィルタがAMT_PRE_PROC_PARALLEL = trueを設定した場合のみ有効\n"
         "  --mpeg2decoder <デコーダ>  MPEG2用デコーダ[default]\n"
         "                      使用可能デコーダ: default,QSV,CUVID\n"
         "  --h264decoder <デコーダ>  H264用デコーダ[default]\n"
@@ -88,6 +99,7 @@ static void printHelp(const tchar* bin) {
         "  --nicojk            ニコニコ実況コメントを追加する\n"
         "  --logo <パス>       ロゴファイルを指定（いくつでも指定可能）\n"
         "  --erase-logo <パス> ロゴ消し用追加ロゴファイル。ロゴ消しに適用されます。（いくつでも指定可能）\n"
+        "  --logo-cache-dir <パス> ロゴ評価用データのキャッシュフォルダ（空文字で無効）[../logocache]\n"
         "  --drcs <パス>       DRCSマッピングファイルパス\n"
         "  --ignore-no-drcsmap マッピングにないDRCS外字があっても処理を続行する\n"
         "  --ignore-no-logo    ロゴが見つからなくても処理を続行する\n"
@@ -96,6 +108,7 @@ static void printHelp(const tchar* bin) {
         "  --no-delogo         ロゴ消しをしない（デフォルトはロゴがある場合は消します）\n"
         "  --parallel-logo-analysis auto or <数値> 並列ロゴ解析 (数値は並列数を指定)\n"
         "  --direct-logo-analysis <0|1> AVFrameから直接ロゴ解析[1]\n"
+        "  --logo-prescan <数値> 間引き解析で絞り込んだ上位<数値>個のロゴだけ全フレーム解析（0で無効）[0]\n"
         "  --loose-logo-detection ロゴ検出判定しきい値を低くします\n"
         "  --max-fade-length <数値> ロゴの最大フェードフレーム数[16]\n"
         "  --auto-logo-detect <0|1> ロゴ不一致時に自動ロゴ検出を試行[1]\n"
@@ -107,6 +120,7 @@ static void printHelp(const tchar* bin) {
         "  --auto-logo-detect-margin-x <数値> 自動ロゴ検出のマージンX[6]\n"
         "  --auto-logo-detect-margin-y <数値> 自動ロゴ検出のマージンY[6]\n"
         "  --chapter-exe <パス> chapter_exe.exeへのパス\n"
+        "  --builtin-chapter-exe chapter_exeの代わりに内蔵の無音・シーンチェンジ検出を使う\n"
         "  --jls <パス>         join_logo_scp.exeへのパス\n"
         "  --jls-cmd <パス>    join_logo_scpのコマンドファイルへのパス\n"
         "  --jls-option <オプション>    join_logo_scpのコマンドファイルへのパス\n"
@@ -226,7 +240,10 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
     conf.timelineditorPath = _T("timelineeditor") + exeAppendix;
     conf.mp4boxPath = _T("MP4Box") + exeAppendix;
     conf.mkvmergePath = _T("mkvmerge") + exeAppendix;
+    conf.nativeMux = false;
+    conf.streamMux = false;
     conf.chapterExePath = _T("chapter_exe") + exeAppendix;
+    conf.builtinChapterExe = false;
     conf.joinLogoScpPath = _T("join_logo_scp") + exeAppendix;
     conf.tsreadexPath = _T("tsreadex") + exeAppendix;
     conf.b24tovttPath = _T("b24tovtt") + exeAppendix;
@@ -242,6 +259,7 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
     conf.nicoConvChSidPath = _T("ch_sid.txt");
     conf.drcsOutPath = moduleDir + _T("/../drcs");
     conf.drcsMapPath = conf.drcsOutPath + _T("/drcs_map.txt");
+    conf.logoCacheDir = moduleDir + _T("/../logocache");
     conf.joinLogoScpCmdPath = moduleDir + _T("/../JL/JL_標準.txt");
     conf.mode = _T("ts");
     conf.modeArgs = _T("");
@@ -266,11 +284,17 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
     conf.autoLogoDetectMarginY = 6;
     conf.numEncodeBufferFrames = 16;
     conf.encoderParallel = 1;
+    conf.frameRingSlots = 0;
+    conf.filterPrepassParallel = 0;
     conf.parallelLogoAnalysis = false;
     conf.numParallelLogoAnalysis = 0;
     conf.directLogoAnalysis = true;
+    conf.logoPrescanCandidates = 0;
     conf.tsreplaceRemoveTypeD = false;
     conf.muxTsTemp = false;
+    conf.mmapInput = false;
+    conf.parallelTsAnalyze = false;
+    conf.numTsSplitRanges = 1;
     conf.useMKVWhenSubExist = false;
     conf.outputChapter = false;
     bool nicojk = false;
@@ -324,6 +348,13 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
                 THROWF(ArgumentException, "--enc-parallelには1以上の値を指定してください");
             }
             conf.encoderParallel = parallel;
+        } else if (key == _T("--frame-ring")) {
+            const auto arg = getParam(argc, argv, i++);
+            int slots = std::stoi(arg);
+            if (slots < 0) {
+                THROWF(ArgumentException, "--frame-ringには0以上の値を指定してください");
+            }
+            conf.frameRingSlots = slots;
         } else if (key == _T("--sar")) {
             const auto arg = getParam(argc, argv, i++);
             int ret = sscanfT(arg.c_str(), _T("%d:%d"), &conf.userSAR.first, &conf.userSAR.second);
@@ -388,6 +419,16 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
             conf.tsreplaceRemoveTypeD = true;
         } else if (key == _T("--mux-ts-temp")) {
             conf.muxTsTemp = true;
+        } else if (key == _T("--mmap-input")) {
+            conf.mmapInput = true;
+        } else if (key == _T("--parallel-ts-analyze")) {
+            conf.parallelTsAnalyze = true;
+        } else if (key == _T("--parallel-ts-split")) {
+            const auto arg = getParam(argc, argv, i++);
+            conf.numTsSplitRanges = (arg == _T("auto")) ? 0 : std::stoi(arg);
+            if (conf.numTsSplitRanges < 0) {
+                THROWF(ArgumentException, "--parallel-ts-splitの指定が間違っています: %" PRITSTR "", arg);
+            }
         } else if (key == _T("--use-mkv-when-sub-exists")) {
             conf.useMKVWhenSubExist = true;
         } else if (key == _T("--chapter")) {
@@ -406,6 +447,11 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
             conf.mp4boxPath = pathNormalize(getParam(argc, argv, i++));
         } else if (key == _T("--mkvmerge")) {
             conf.mkvmergePath = pathNormalize(getParam(argc, argv, i++));
+        } else if (key == _T("--native-mux")) {
+            conf.nativeMux = true;
+        } else if (key == _T("--stream-mux")) {
+            conf.nativeMux = true;
+            conf.streamMux = true;
         } else if (key == _T("-j") || key == _T("--json")) {
             conf.outInfoJsonPath = pathNormalize(getParam(argc, argv, i++));
         } else if (key == _T("-f") || key == _T("--filter")) {
@@ -441,6 +487,8 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
             }
         } else if (key == _T("-eb") || key == _T("--encode-buffer")) {
             conf.numEncodeBufferFrames = std::stoi(getParam(argc, argv, i++));
+        } else if (key == _T("--filter-prepass-parallel")) {
+            conf.filterPrepassParallel = std::max(0, std::stoi(getParam(argc, argv, i++)));
         } else if (key == _T("--ignore-no-logo")) {
             conf.ignoreNoLogo = true;
         } else if (key == _T("--ignore-no-drcsmap")) {
@@ -461,6 +509,8 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
             conf.numParallelLogoAnalysis = (arg == _T("auto")) ? 0 : std::stoi(arg);
         } else if (key == _T("--direct-logo-analysis")) {
             conf.directLogoAnalysis = std::stoi(getParam(argc, argv, i++)) != 0;
+        } else if (key == _T("--logo-prescan")) {
+            conf.logoPrescanCandidates = std::max(0, std::stoi(getParam(argc, argv, i++)));
         } else if (key == _T("--auto-logo-detect")) {
             conf.autoLogoDetect = std::stoi(getParam(argc, argv, i++));
         } else if (key == _T("--auto-logo-detect-search-frames")) {
@@ -487,6 +537,9 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
             conf.logoPath.push_back(pathNormalize(getParam(argc, argv, i++)));
         } else if (key == _T("--erase-logo")) {
             conf.eraseLogoPath.push_back(pathNormalize(getParam(argc, argv, i++)));
+        } else if (key == _T("--logo-cache-dir")) {
+            const auto path = getParam(argc, argv, i++);
+            conf.logoCacheDir = path.empty() ? path : pathNormalize(path);
         } else if (key == _T("--drcs")) {
             auto path = pathNormalize(getParam(argc, argv, i++));
             conf.drcsMapPath = path;
@@ -498,6 +551,8 @@ static std::unique_ptr<ConfigWrapper> parseArgs(AMTContext& ctx, int argc, const
             conf.chapterExePath = pathNormalize(getParam(argc, argv, i++));
         } else if (key == _T("--chapter-exe-options")) {
             conf.chapterExeOptions = getParam(argc, argv, i++);
+        } else if (key == _T("--builtin-chapter-exe")) {
+            conf.builtinChapterExe = true;
         } else if (key == _T("--jls")) {
             conf.joinLogoScpPath = pathNormalize(getParam(argc, argv, i++));
         } else if (key == _T("--jls-cmd")) {
@@ -791,6 +846,16 @@ static int amatsukazeTranscodeMain(AMTContext& ctx, const ConfigWrapper& setting
             test::PrintfBug(ctx, setting);
         else if (mode == _T("test_resource"))
             test::ResourceTest(ctx, setting);
+        else if (mode == _T("test_frame_cache"))
+            return test::FrameCacheCapacity(ctx, setting);
+        else if (mode == _T("test_wavestore"))
+            return test::WaveStoreRoundTrip(ctx, setting);
+        else if (mode == _T("test_logo_score"))
+            return test::LogoScoreMultiFade(ctx, setting);
+        else if (mode == _T("test_logo_scan_data"))
+            return test::LogoScanDataRoundTrip(ctx, setting);
+        else if (mode == _T("test_logo_prescan"))
+            return test::LogoPrescanSelection(ctx, setting);
 
         else
             ctx.errorF(_T("--modeの指定が間違っています: %s\n"), mode.c_str());
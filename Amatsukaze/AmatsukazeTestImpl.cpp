@@ -10,6 +10,7 @@
 #include "faad.h"
 #include <thread>
 #include <chrono>
+#include <random>
 
 /* static */ int test::PrintCRCTable(AMTContext& ctx, const ConfigWrapper& setting) {
     CRC32 crc;
@@ -654,3 +655,323 @@ test::TestSplitDualMono::TestSplitDualMono(AMTContext& ctx, const std::vector<ts
     }
     return 0;
 }
+
+/* static */ int test::FrameCacheCapacity(AMTContext& ctx, const ConfigWrapper& setting) {
+    const size_t frameBytes = 1920 * 1080 * 3 / 2;
+    for (int seekDistance = 1; seekDistance <= 40; seekDistance++) {
+        // AMTSource::UpdateCacheBudgetと同じ枚数
+        const int frames = seekDistance * 3 / 2;
+        av::AMTFrameCache cache;
+        cache.setCapacity(frames, frameBytes);
+        for (int n = 0; n < 200; n++) {
+            cache.put(n, PVideoFrame(), frameBytes);
+            // 前方デコードで直近frames枚が全て残っていること
+            for (int i = std::max(0, n - frames + 1); i <= n; i++) {
+                if (!cache.find(i, nullptr)) {
+                    ctx.errorF(_T("フレームキャッシュから直近のフレームが消えています: seekDistance=%d, 最新=%d, 消えたフレーム=%d"), seekDistance, n, i);
+                    return 1;
+                }
+            }
+        }
+        if (cache.find(0, nullptr) || cache.getStats().evictions == 0) {
+            ctx.errorF(_T("フレームキャッシュが容量を超えても破棄していません: seekDistance=%d"), seekDistance);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* static */ int test::WaveStoreRoundTrip(AMTContext& ctx, const ConfigWrapper& setting) {
+    const_cast<ConfigWrapper&>(setting).CreateTempDir();
+    const tstring path = setting.getAudioFilePath();
+    const int blockSize = 128 * 1024; // WAVE_STORE_BLOCK_SIZE
+    std::mt19937 rnd(12345);
+
+    struct TestCase {
+        const tchar* name;
+        std::vector<uint8_t> data;
+        bool compressible;
+    };
+    std::vector<TestCase> testCases;
+    auto makePcm = [&](int numSamples, const std::function<int16_t(int)>& gen) {
+        std::vector<uint8_t> data(numSamples * 2);
+        for (int i = 0; i < numSamples; i++) {
+            const int16_t v = gen(i);
+            memcpy(&data[i * 2], &v, 2);
+        }
+        return data;
+    };
+    // 無音
+    testCases.push_back({ _T("無音"), makePcm(blockSize * 3 / 2, [](int) { return (int16_t)0; }), true });
+    // フルスケールのノイズ（圧縮できないので非圧縮ブロックになる）
+    testCases.push_back({ _T("ノイズ"), makePcm(blockSize * 3 / 2, [&](int) { return (int16_t)(rnd() & 0xFFFF); }), false });
+    // 小さい信号にフルスケールのパルスを混ぜる（エスケープ符号を通る）
+    testCases.push_back({ _T("パルス"), makePcm(blockSize * 3 / 2, [&](int i) {
+        if (i % 997 == 0) {
+            return (int16_t)((i & 2) ? 32767 : -32768);
+        }
+        return (int16_t)((int)(rnd() % 33) - 16);
+    }), true });
+    // 奇数バイトで終わる（ブロックの端数と奇数バイトの末尾）
+    {
+        auto data = makePcm(blockSize + 777, [&](int i) { return (int16_t)(std::sin(i * 0.01) * 8000); });
+        data.push_back(0x5A);
+        testCases.push_back({ _T("奇数長"), std::move(data), true });
+    }
+
+    for (const auto& testCase : testCases) {
+        const auto& data = testCase.data;
+        {
+            // ブロック境界にそろわない大きさで書き込む
+            WaveStoreWriter writer(path);
+            size_t pos = 0;
+            while (pos < data.size()) {
+                const size_t n = std::min<size_t>(data.size() - pos, 1 + rnd() % (blockSize / 2 * 3));
+                writer.write(MemoryChunk((uint8_t*)&data[pos], n));
+                pos += n;
+            }
+            writer.finish();
+        }
+        if (testCase.compressible) {
+            File file(path, _T("rb"));
+            if (file.size() >= (int64_t)data.size()) {
+                ctx.errorF(_T("中間PCMが圧縮されていません: %s"), testCase.name);
+                return 1;
+            }
+        }
+
+        WaveStoreReader reader(path);
+        if (reader.size() != (int64_t)data.size()) {
+            ctx.errorF(_T("中間PCMのサイズが一致しません: %s 期待値=%lld, 実際=%lld"),
+                testCase.name, (long long)data.size(), (long long)reader.size());
+            return 1;
+        }
+        std::vector<uint8_t> buf(std::max<size_t>(data.size(), blockSize * 2) + 16);
+        if (reader.read(MemoryChunk(buf.data(), buf.size())) != data.size() ||
+            memcmp(buf.data(), data.data(), data.size()) != 0) {
+            ctx.errorF(_T("中間PCMの内容が一致しません: %s"), testCase.name);
+            return 1;
+        }
+        // ランダムな位置からの読み込み（ブロックをまたぐものと末尾を越えるものを含む）
+        for (int i = 0; i < 200; i++) {
+            const size_t offset = rnd() % (data.size() + 1);
+            const size_t length = rnd() % (blockSize * 2);
+            const size_t expected = std::min(length, data.size() - offset);
+            reader.seek((int64_t)offset, SEEK_SET);
+            if (reader.read(MemoryChunk(buf.data(), length)) != expected ||
+                memcmp(buf.data(), data.data() + offset, expected) != 0) {
+                ctx.errorF(_T("中間PCMの途中からの読み込みが一致しません: %s offset=%lld, length=%lld"),
+                    testCase.name, (long long)offset, (long long)length);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* static */ int test::LogoScoreMultiFade(AMTContext& ctx, const ConfigWrapper& setting) {
+    struct Kernel {
+        const tchar* name;
+        decltype(CalcLogoScoreMultiFade_AVX2)* func;
+        bool available;
+    };
+    const Kernel kernels[] = {
+        { _T("AVX2"), CalcLogoScoreMultiFade_AVX2, IsAVX2Available() },
+        { _T("AVX512"), CalcLogoScoreMultiFade_AVX512, IsAVX512BWAvailable() },
+    };
+    if (!kernels[0].available) {
+        ctx.info(_T("AVX2が使えないのでスキップします"));
+        return 0;
+    }
+    std::mt19937 rnd(4321);
+    std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+    enum { NUM_FADES = 11 };
+    float fades[NUM_FADES];
+    for (int f = 0; f < NUM_FADES; f++) {
+        fades[f] = (float)f / (NUM_FADES - 1);
+    }
+    // ベクタ幅(8, 16)の倍数でない幅を含める
+    const int widths[] = { 16, 23, 37, 50, 67 };
+    const int heights[] = { 18, 31 };
+    for (const int w : widths) {
+        for (const int h : heights) {
+            // 不透明度と色の違う矩形を重ねたロゴ
+            logo::LogoData data(w, h, 1, 1);
+            for (int plane : { PLANAR_Y, PLANAR_U, PLANAR_V }) {
+                const int size = (plane == PLANAR_Y) ? w * h : (w >> 1) * (h >> 1);
+                std::fill_n(data.GetA(plane), size, 1.0f);
+                std::fill_n(data.GetB(plane), size, 0.0f);
+            }
+            float* aY = data.GetA(PLANAR_Y);
+            float* bY = data.GetB(PLANAR_Y);
+            for (int r = 0; r < 4; r++) {
+                const int x0 = rnd() % (w - 4), y0 = rnd() % (h - 4);
+                const int x1 = x0 + 2 + rnd() % (w - x0 - 2), y1 = y0 + 2 + rnd() % (h - y0 - 2);
+                const float alpha = 0.2f + 0.5f * uni(rnd);
+                const float color = 0.5f + 0.5f * uni(rnd);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        aY[x + y * w] = 1.0f / (1.0f - alpha);
+                        bY[x + y * w] = -alpha * color / (1.0f - alpha);
+                    }
+                }
+            }
+            logo::LogoDataParam param(std::move(data), w, h, 0, 0);
+            param.CreateLogoMask(0.35f);
+            // 1回の相関値のビンのずれで変わりうる量を許容する
+            const float tolerance = 2.0f / std::max(1, param.getMaskPixels());
+
+            // フィールド評価と同じく行の間隔が幅より大きい場合も見る
+            for (const int stride : { w, w * 2 + 3 }) {
+                // カーネルは行末から8要素先まで読むので余裕を持たせる
+                std::vector<float> src(stride * h + 16);
+                for (auto& v : src) {
+                    v = uni(rnd) * 255.0f;
+                }
+                std::vector<float> work(w * h + 16);
+                float expected[NUM_FADES], actual[NUM_FADES];
+                param.SetMultiFadeKernel(nullptr);
+                param.EvaluateLogoMulti(src.data(), 255.0f, fades, NUM_FADES, work.data(), expected, stride);
+                for (const auto& kernel : kernels) {
+                    if (!kernel.available) {
+                        continue;
+                    }
+                    param.SetMultiFadeKernel(kernel.func);
+                    param.EvaluateLogoMulti(src.data(), 255.0f, fades, NUM_FADES, work.data(), actual, stride);
+                    for (int f = 0; f < NUM_FADES; f++) {
+                        if (std::abs(actual[f] - expected[f]) > 1e-3f * std::max(1.0f, std::abs(expected[f])) + tolerance) {
+                            ctx.errorF(_T("ロゴ評価値が一致しません: %s %dx%d stride=%d fade=%.1f 期待値=%f, 実際=%f"),
+                                kernel.name, w, h, stride, fades[f], expected[f], actual[f]);
+                            return 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+/* static */ int test::LogoScanDataRoundTrip(AMTContext& ctx, const ConfigWrapper& setting) {
+    const int width = 61, height = 37; // 奇数サイズ
+    // バッチ(64)の途中で終わる枚数
+    const int numFrames = 64 * 2 + 45;
+    std::mt19937 rnd(777);
+    for (const int pixelBytes : { 1, 2 }) {
+        for (const bool compress : { true, false }) {
+            const size_t frameBytes = (size_t)width * height * pixelBytes;
+            // 少しずつ動くグラデーションにノイズを乗せたフレーム
+            std::vector<std::vector<uint8_t>> src(numFrames, std::vector<uint8_t>(frameBytes));
+            for (int n = 0; n < numFrames; n++) {
+                for (int i = 0; i < width * height; i++) {
+                    const int v = ((i % width) + n) * 3 + (int)(rnd() % 5);
+                    if (pixelBytes == 2) {
+                        const uint16_t v16 = (uint16_t)((v * 4) & 0x3FF);
+                        memcpy(&src[n][i * 2], &v16, 2);
+                    } else {
+                        src[n][i] = (uint8_t)v;
+                    }
+                }
+            }
+            logo::LogoScanDataStore store;
+            store.init(frameBytes, pixelBytes, compress);
+            for (int n = 0; n < numFrames; n++) {
+                store.add(src[n].data());
+                if (n == 100) {
+                    // バッチの途中でflushしても差分がつながること
+                    store.flush();
+                }
+            }
+            store.flush();
+            if (store.numFrames() != numFrames) {
+                ctx.errorF(_T("ロゴスキャンデータのフレーム数が一致しません: 期待値=%d, 実際=%d"), numFrames, store.numFrames());
+                return 1;
+            }
+            if (compress && store.storedBytes() >= (uint64_t)frameBytes * numFrames) {
+                ctx.error(_T("ロゴスキャンデータが圧縮されていません"));
+                return 1;
+            }
+
+            std::vector<uint8_t> buf(frameBytes);
+            int cursor = -1;
+            auto check = [&](int i) {
+                store.getFrame(i, buf.data(), cursor);
+                if (cursor != i || memcmp(buf.data(), src[i].data(), frameBytes) != 0) {
+                    ctx.errorF(_T("ロゴスキャンデータの内容が一致しません: frame=%d pixelBytes=%d compress=%d"),
+                        i, pixelBytes, compress ? 1 : 0);
+                    return false;
+                }
+                return true;
+            };
+            // 先頭から順に
+            for (int i = 0; i < numFrames; i++) {
+                if (!check(i)) return 1;
+            }
+            // バッチの途中とキーフレーム(16枚ごと)をまたぐシーク
+            const int seeks[][2] = {
+                { -1, 37 },  // 何もない状態からバッチの途中へ
+                { 14, 17 },  // キーフレームをまたいで前方へ
+                { 15, 16 },  // 直後のキーフレーム
+                { 63, 65 },  // バッチ境界をまたぐ
+                { 100, 101 }, // 途中でflushした位置をまたぐ
+                { 90, 20 },  // 後方へ
+                { 20, 20 },  // 同じフレーム
+                { -1, numFrames - 1 }, // 最後のフレーム
+            };
+            for (const auto& seek : seeks) {
+                if (seek[0] >= 0) {
+                    if (!check(seek[0])) return 1;
+                } else {
+                    cursor = -1;
+                }
+                if (!check(seek[1])) return 1;
+            }
+            // ランダムアクセス
+            for (int k = 0; k < 300; k++) {
+                if (!check((int)(rnd() % numFrames))) return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// 間引き解析で絞り込んでから全フレーム解析したときに全ロゴを全フレーム解析したときと同じロゴが選ばれるか
+// 入力（--filter-script）とロゴ（--logo 複数）が必要
+/* static */ int test::LogoPrescanSelection(AMTContext& ctx, const ConfigWrapper& setting) {
+    const auto& logoPath = setting.getLogoPath();
+    const int numLogos = (int)logoPath.size();
+    const int topK = (setting.getLogoPrescanCandidates() > 0) ? setting.getLogoPrescanCandidates() : 3;
+    if (numLogos <= topK) {
+        ctx.errorF(_T("ロゴを%d個より多く指定してください"), topK);
+        return 1;
+    }
+    auto env = make_unique_ptr(CreateScriptEnvironment2());
+    PClip clip = env->Invoke("Import", tchar_to_string(setting.getFilterScriptPath()).c_str()).AsClip();
+
+    logo::LogoFrame full(ctx, logoPath, 0.1f);
+    full.scanFrames(clip, {}, 0, 1, env.get());
+    full.selectLogo({}, numLogos);
+
+    // CMAnalyzeと同じ手順
+    logo::LogoFrame pre(ctx, logoPath, 0.1f);
+    std::vector<int> candidates;
+    for (int i = 0; i < numLogos; i++) {
+        candidates.push_back(i);
+    }
+    pre.setScanTargets(candidates);
+    pre.setScanStep(30);
+    pre.scanFrames(clip, {}, 0, 1, env.get());
+    const auto targets = pre.rankLogoCandidates({}, numLogos, topK);
+    pre.setScanTargets(targets);
+    pre.setScanStep(1);
+    pre.scanFrames(clip, {}, 0, 1, env.get());
+    pre.selectLogo({}, numLogos);
+
+    ctx.infoF(_T("全フレーム解析: %s (%f)"), logoPath[full.getBestLogo()].c_str(), full.getLogoRatio());
+    ctx.infoF(_T("絞り込み解析: %s (%f)"), logoPath[pre.getBestLogo()].c_str(), pre.getLogoRatio());
+    if (full.getBestLogo() != pre.getBestLogo()) {
+        ctx.error(_T("絞り込み解析で選ばれたロゴが全フレーム解析と異なります"));
+        return 1;
+    }
+    return 0;
+}
@@ -67,5 +67,15 @@ int PrintfBug(AMTContext& ctx, const ConfigWrapper& setting);
 
 int ResourceTest(AMTContext& ctx, const ConfigWrapper& setting);
 
+int FrameCacheCapacity(AMTContext& ctx, const ConfigWrapper& setting);
+
+int WaveStoreRoundTrip(AMTContext& ctx, const ConfigWrapper& setting);
+
+int LogoScoreMultiFade(AMTContext& ctx, const ConfigWrapper& setting);
+
+int LogoScanDataRoundTrip(AMTContext& ctx, const ConfigWrapper& setting);
+
+int LogoPrescanSelection(AMTContext& ctx, const ConfigWrapper& setting);
+
 } // namespace test
 
@@ -8,6 +8,7 @@
 
 #include "common.h"
 #include "AudioEncoder.h"
+#include "WaveWriter.h"
 
 
 void wave::set4(int8_t dst[4], const char* src) {
@@ -56,7 +57,7 @@ void EncodeAudio(AMTContext& ctx, const tstring& encoder_args,
         }
     }
 
-    File srcFile(audiopath, _T("rb"));
+    WaveStoreReader srcFile(audiopath);
     AutoBuffer buffer;
     int frameWaveLength = audioSamplesPerFrame * bytesPerSample * nchannels;
     MemoryChunk mc = buffer.space(frameWaveLength);
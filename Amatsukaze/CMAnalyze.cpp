@@ -12,6 +12,8 @@
 #include <chrono>
 #include <cmath>
 #include <iomanip>
+#include <map>
+#include <numeric>
 #include <sstream>
 #include <thread>
 #include "CMAnalyze.h"
@@ -62,7 +64,8 @@ CMAnalyze::CMAnalyze(AMTContext& ctx,
     trims(),
     cmzones(),
     sceneChanges(),
-    divs() {}
+    divs(),
+    chapterDetector() {}
 
 void CMAnalyze::analyze(const int serviceId, const int videoFileIndex, const VideoFormat& inputFormat, const int numFrames, const bool analyzeChapterAndCM) {
     Stopwatch sw;
@@ -73,6 +76,14 @@ void CMAnalyze::analyze(const int serviceId, const int videoFileIndex, const Vid
     if (analyzeChapterAndCM) {
         ctx.infoF(_T("チャプター・CM解析開始"));
         const bool noLogoInCM = setting_.isNoLogoInCM() || logoOffInJL(videoFileIndex);
+        if (setting_.isBuiltinChapterExe()) {
+            if (GetLogoAnalysisDecoderType(setting_.getDecoderSetting(), inputFormat.format) != DECODER_DEFAULT) {
+                ctx.info(_T("内蔵の無音・シーンチェンジ検出はCPUデコード専用のため、chapter_exeを使用します"));
+            } else {
+                // ロゴ解析のデコードで映像の特徴も集める
+                chapterDetector.reset(new BuiltinChapterExe(ctx, setting_, videoFileIndex, inputFormat, numFrames));
+            }
+        }
         if (noLogoInCM) {
             ctx.info(_T("チャプター・CM解析にロゴを使用しません。"));
         } else {
@@ -81,6 +92,7 @@ void CMAnalyze::analyze(const int serviceId, const int videoFileIndex, const Vid
         }
         // チャプター・CM解析本体
         analyzeChapterCM(serviceId, videoFileIndex, inputFormat, numFrames, sw, avsChapterExe);
+        chapterDetector = nullptr;
     }
 
     // ロゴ解析 (未実行かつロゴ消しする場合)
@@ -115,7 +127,12 @@ void CMAnalyze::analyzeChapterCM(const int serviceId, const int videoFileIndex,
     // チャプター解析
     ctx.info(_T("[無音・シーンチェンジ解析]"));
     sw.start();
-    chapterExe(videoFileIndex, inputFormat, avspath);
+    if (chapterDetector) {
+        const int decodeThreads = std::max(1, std::min((inputFormat.height > 1080) ? 16 : 8, GetProcessorCount()));
+        chapterDetector->exec(decodeThreads);
+    } else {
+        chapterExe(videoFileIndex, inputFormat, avspath);
+    }
     ctx.infoF(_T("完了: %.2f秒"), sw.getAndReset());
 
     ctx.info(_T("[無音・シーンチェンジ解析結果]"));
@@ -398,7 +415,7 @@ void CMAnalyze::logoFrame(const int videoFileIndex, const VideoFormat& inputForm
 
     std::vector<tstring> allLogoPath = logoPath;
     allLogoPath.insert(allLogoPath.end(), eraseLogoPath.begin(), eraseLogoPath.end());
-    logo::LogoFrame logof(ctx, allLogoPath, 0.35f);
+    logo::LogoFrame logof(ctx, allLogoPath, 0.35f, setting_.getLogoCacheDir());
 
     if (trims.size() > 0 && (trims.size() % 2) == 0) {
         ctx.infoF(_T("解析範囲"));
@@ -407,7 +424,6 @@ void CMAnalyze::logoFrame(const int videoFileIndex, const VideoFormat& inputForm
         }
     }
     int duration = 0;
-    std::atomic<int> startThreads = 0;
     const int processorCount = setting_.getNumParallelLogoAnalysis() > 0 ? setting_.getNumParallelLogoAnalysis() : GetProcessorCount();
     const int preferredThreads = (setting_.isParallelLogoAnalysis()) ? getPreferredThreads(processorCount) : 1;
     const int minFramesPerThread = 600;
@@ -421,72 +437,102 @@ void CMAnalyze::logoFrame(const int videoFileIndex, const VideoFormat& inputForm
     ctx.infoF(_T("ロゴ解析 %d並列 x デコード%dスレッド (%s)"), totalThreads, decodeThreads,
         useDirectLogoAnalysis ? _T("AVFrame直接") : _T("AviSynth"));
 
-    std::vector<std::future<std::pair<int, std::string>>> logoScanThreads;
-    for (int ith = 0; ith < totalThreads; ith++) {
-        logoScanThreads.push_back(std::async(std::launch::async, [&](const int threadID) {
-            try {
-                ScriptEnvironmentPointer env = make_unique_ptr(CreateScriptEnvironment2());
-                if (useDirectLogoAnalysis) {
-                    auto source = av::LoadAMTSourceDirect(ctx, setting_.getTmpAMTSourcePath(videoFileIndex), decodeThreads, env.get());
-                    const auto vi = source->GetVideoInfo();
-                    if (threadID == 0) {
-                        logof.setClipInfo(vi);
-                        duration = (vi.fps_numerator > 0) ? std::max((int)((int64_t)vi.num_frames * (int64_t)vi.fps_denominator / (int64_t)vi.fps_numerator), 1) : 1;
-                    }
-                    startThreads++;
-                    logof.scanFramesDirect(*source, trims, threadID, totalThreads, env.get());
-                } else {
-                    AVSValue result;
-                    env->Invoke("Eval", AVSValue(makePreamble().c_str()));
-                    env->LoadPlugin(tchar_to_string(GetModulePath()).c_str(), true, &result);
-                    const auto amtsourcePath = tchar_to_string(setting_.getTmpAMTSourcePath(videoFileIndex));
-                    AVSValue up_args[4] = { amtsourcePath.c_str(), "", false, decodeThreads };
-                    PClip clip = env->Invoke("AMTSource", AVSValue(up_args, _countof(up_args))).AsClip();
-                    const auto vi = clip->GetVideoInfo();
-                    if (threadID == 0) {
-                        logof.setClipInfo(clip);
-                        duration = (vi.fps_numerator > 0) ? std::max((int)((int64_t)vi.num_frames * (int64_t)vi.fps_denominator / (int64_t)vi.fps_numerator), 1) : 1;
+    // 全スレッドでロゴ解析を1回行う
+    auto scanLogoFrames = [&]() {
+        std::atomic<int> startThreads = 0;
+        std::vector<std::future<std::pair<int, std::string>>> logoScanThreads;
+        for (int ith = 0; ith < totalThreads; ith++) {
+            logoScanThreads.push_back(std::async(std::launch::async, [&](const int threadID) {
+                try {
+                    ScriptEnvironmentPointer env = make_unique_ptr(CreateScriptEnvironment2());
+                    if (useDirectLogoAnalysis) {
+                        auto source = av::LoadAMTSourceDirect(ctx, setting_.getTmpAMTSourcePath(videoFileIndex), decodeThreads, env.get());
+                        const auto vi = source->GetVideoInfo();
+                        if (threadID == 0) {
+                            logof.setClipInfo(vi);
+                            duration = (vi.fps_numerator > 0) ? std::max((int)((int64_t)vi.num_frames * (int64_t)vi.fps_denominator / (int64_t)vi.fps_numerator), 1) : 1;
+                        }
+                        startThreads++;
+                        logof.scanFramesDirect(*source, trims, threadID, totalThreads, env.get());
+                    } else {
+                        AVSValue result;
+                        env->Invoke("Eval", AVSValue(makePreamble().c_str()));
+                        env->LoadPlugin(tchar_to_string(GetModulePath()).c_str(), true, &result);
+                        const auto amtsourcePath = tchar_to_string(setting_.getTmpAMTSourcePath(videoFileIndex));
+                        AVSValue up_args[4] = { amtsourcePath.c_str(), "", false, decodeThreads };
+                        PClip clip = env->Invoke("AMTSource", AVSValue(up_args, _countof(up_args))).AsClip();
+                        const auto vi = clip->GetVideoInfo();
+                        if (threadID == 0) {
+                            logof.setClipInfo(clip);
+                            duration = (vi.fps_numerator > 0) ? std::max((int)((int64_t)vi.num_frames * (int64_t)vi.fps_denominator / (int64_t)vi.fps_numerator), 1) : 1;
+                        }
+                        startThreads++;
+                        logof.scanFrames(clip, trims, threadID, totalThreads, env.get());
                     }
-                    startThreads++;
-                    logof.scanFrames(clip, trims, threadID, totalThreads, env.get());
+                } catch (const AvisynthError& avserror) {
+                    return std::pair<int, std::string>{ 1, avserror.msg };
+                } catch (const Exception& e) {
+                    return std::pair<int, std::string>{ 1, tchar_to_string(e.message()) };
+                } catch (const std::exception& e) {
+                    return std::pair<int, std::string>{ 1, e.what() };
+                } catch (...) {
+                    return std::pair<int, std::string>{ 1, "unknown exception" };
                 }
-            } catch (const AvisynthError& avserror) {
-                return std::pair<int, std::string>{ 1, avserror.msg };
-            } catch (const Exception& e) {
-                return std::pair<int, std::string>{ 1, tchar_to_string(e.message()) };
-            } catch (const std::exception& e) {
-                return std::pair<int, std::string>{ 1, e.what() };
-            } catch (...) {
-                return std::pair<int, std::string>{ 1, "unknown exception" };
-            }
-            return std::pair<int, std::string>{ 0, "" };
-        }, ith));
-        const auto waitStart = std::chrono::steady_clock::now();
-        while (startThreads.load() <= ith) {
-            if (logoScanThreads[ith].wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
-                break;
+                return std::pair<int, std::string>{ 0, "" };
+            }, ith));
+            const auto waitStart = std::chrono::steady_clock::now();
+            while (startThreads.load() <= ith) {
+                if (logoScanThreads[ith].wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+                    break;
+                }
+                if (std::chrono::steady_clock::now() - waitStart > std::chrono::seconds(60)) {
+                    THROWF(AviSynthException, "logo scan #%d: timeout waiting for clip info", ith);
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
-            if (std::chrono::steady_clock::now() - waitStart > std::chrono::seconds(60)) {
-                THROWF(AviSynthException, "logo scan #%d: timeout waiting for clip info", ith);
+            // thread が startThreads を設定せずに終了した場合はここでエラーを回収して中断する
+            if (startThreads.load() <= ith
+                && logoScanThreads[ith].wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+                const auto& result = logoScanThreads[ith].get();
+                if (result.first != 0) {
+                    THROWF(AviSynthException, "logo scan #%d: %s", ith, result.second.c_str());
+                }
+                THROWF(AviSynthException, "logo scan #%d: clip info was not initialized", ith);
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
-        // thread が startThreads を設定せずに終了した場合はここでエラーを回収して中断する
-        if (startThreads.load() <= ith
-            && logoScanThreads[ith].wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+        for (size_t ith = 0; ith < logoScanThreads.size(); ith++) {
             const auto& result = logoScanThreads[ith].get();
             if (result.first != 0) {
                 THROWF(AviSynthException, "logo scan #%d: %s", ith, result.second.c_str());
             }
-            THROWF(AviSynthException, "logo scan #%d: clip info was not initialized", ith);
         }
-    }
-    for (size_t ith = 0; ith < logoScanThreads.size(); ith++) {
-        const auto& result = logoScanThreads[ith].get();
-        if (result.first != 0) {
-            THROWF(AviSynthException, "logo scan #%d: %s", ith, result.second.c_str());
+    };
+
+    const int numPrescanCandidates = setting_.getLogoPrescanCandidates();
+    if (numPrescanCandidates > 0 && (int)logoPath.size() > numPrescanCandidates) {
+        // ロゴが多いときは間引いたフレームで候補を絞ってから、残った候補とロゴ消し用ロゴだけ全フレーム解析する
+        const int prescanStep = 30;
+        ctx.infoF(_T("ロゴ候補絞り込み: %d個のロゴを%dフレームごとに解析"), (int)logoPath.size(), prescanStep);
+        std::vector<int> candidates(logoPath.size());
+        std::iota(candidates.begin(), candidates.end(), 0);
+        logof.setScanTargets(candidates);
+        logof.setScanStep(prescanStep);
+        scanLogoFrames();
+        auto targets = logof.rankLogoCandidates(trims, (int)logoPath.size(), numPrescanCandidates);
+        for (const int i : targets) {
+            ctx.infoF(_T("  候補 logo%d: %s"), i + 1, logoPath[i]);
+        }
+        for (int i = 0; i < (int)eraseLogoPath.size(); i++) {
+            targets.push_back((int)logoPath.size() + i);
         }
+        logof.setScanTargets(targets);
+        logof.setScanStep(1);
     }
+    if (chapterDetector && useDirectLogoAnalysis) {
+        // 全フレームのロゴ解析のデコードで無音・シーンチェンジ検出用の特徴も集める
+        logof.addFrameAnalyzer(chapterDetector.get());
+    }
+    scanLogoFrames();
 
     if (logoPath.size() > 0) {
 #if 0
@@ -725,6 +771,273 @@ void CMAnalyze::chapterExe(int videoFileIndex, const VideoFormat& inputFormat, c
     }
 }
 
+class BuiltinChapterExe::FeatureWorker : public logo::DirectFrameAnalyzer::Worker {
+public:
+    FeatureWorker(BuiltinChapterExe& owner)
+        : owner(owner)
+        , decoded() {}
+
+    virtual void onFrame(int n, const AVFrame* top, const AVFrame* bottom, int srcBitDepth) {
+        calcFeature(top, bottom, srcBitDepth, decoded[n]);
+    }
+
+    virtual void onAlias(int requested, int resolved) {
+        auto it = decoded.find(resolved);
+        if (it == decoded.end()) {
+            return;
+        }
+        owner.features[requested] = it->second;
+        owner.hasFeature[requested] = 1;
+        // もう参照されないデコード済みフレームは捨てる
+        decoded.erase(decoded.begin(), decoded.lower_bound(resolved - KEEP_FRAMES));
+    }
+
+private:
+    enum { KEEP_FRAMES = 300 };
+    BuiltinChapterExe& owner;
+    std::map<int, Feature> decoded;
+};
+
+BuiltinChapterExe::BuiltinChapterExe(AMTContext& ctx, const ConfigWrapper& setting, int videoFileIndex, const VideoFormat& inputFormat, int numFrames)
+    : AMTObject(ctx)
+    , setting_(setting)
+    , videoFileIndex(videoFileIndex)
+    , inputFormat(inputFormat)
+    , numFrames(numFrames)
+    , muteLevel(50)
+    , minMuteFrames(10)
+    , features(numFrames)
+    , hasFeature(numFrames, 0) {
+    // chapter_exeのデフォルトに合わせる（60fpsの場合はMakeChapterExeArgsと同じく-s 20相当）
+    const bool is60fps = (int)(inputFormat.frameRateNum / (double)inputFormat.frameRateDenom + 0.5) >= 60;
+    if (is60fps) {
+        minMuteFrames = 20;
+    }
+    // chapter_exeのオプションで指定されていればそれを使う
+    const std::string options = tchar_to_string(setting_.getChapterExeOptions());
+    std::regex re("(^|\\s)-([ms])\\s+(\\d+)");
+    for (std::sregex_iterator it(options.begin(), options.end(), re), end; it != end; ++it) {
+        const int value = std::stoi((*it)[3].str());
+        if ((*it)[2].str() == "m") {
+            muteLevel = value;
+        } else {
+            minMuteFrames = std::max(1, value);
+        }
+    }
+}
+
+std::unique_ptr<logo::DirectFrameAnalyzer::Worker> BuiltinChapterExe::createWorker() {
+    return std::unique_ptr<Worker>(new FeatureWorker(*this));
+}
+
+/* static */ void BuiltinChapterExe::calcFeature(const AVFrame* top, const AVFrame* bottom, int srcBitDepth, Feature& out) {
+    // トップフィールドの行だけを間引いて読む（フレーム間の比較には十分）
+    enum { STEP = 4 };
+    const int width = top->width;
+    const int height = top->height;
+    const int shift = std::max(0, srcBitDepth - 8);
+    for (int by = 0; by < GRID; by++) {
+        const int y0 = (height * by / GRID) & ~1;
+        const int y1 = height * (by + 1) / GRID;
+        for (int bx = 0; bx < GRID; bx++) {
+            const int x0 = width * bx / GRID;
+            const int x1 = width * (bx + 1) / GRID;
+            int sum = 0;
+            int count = 0;
+            for (int y = y0; y < y1; y += STEP) {
+                const uint8_t* row = top->data[0] + (size_t)y * top->linesize[0];
+                if (srcBitDepth > 8) {
+                    const uint16_t* row16 = reinterpret_cast<const uint16_t*>(row);
+                    for (int x = x0; x < x1; x += STEP, count++) {
+                        sum += row16[x] >> shift;
+                    }
+                } else {
+                    for (int x = x0; x < x1; x += STEP, count++) {
+                        sum += row[x];
+                    }
+                }
+            }
+            out[by * GRID + bx] = (uint8_t)((count > 0) ? sum / count : 0);
+        }
+    }
+}
+
+std::vector<uint8_t> BuiltinChapterExe::detectMuteFrames(av::AMTSource& source, IScriptEnvironment2* env) {
+    enum { BLOCK_FRAMES = 1024 };
+    std::vector<uint8_t> mute(numFrames, 0);
+    const VideoInfo& vi = source.GetVideoInfo();
+    if (!vi.HasAudio()) {
+        ctx.warn(_T("音声がないため無音区間は検出されません"));
+        return mute;
+    }
+    const int channels = vi.AudioChannels();
+    auto frameToSample = [&](int n) {
+        return (int64_t)n * vi.audio_samples_per_second * vi.fps_denominator / vi.fps_numerator;
+    };
+    std::vector<int16_t> buf;
+    for (int start = 0; start < numFrames; start += BLOCK_FRAMES) {
+        const int end = std::min(numFrames, start + (int)BLOCK_FRAMES);
+        const int64_t blockStart = frameToSample(start);
+        buf.resize((size_t)(frameToSample(end) - blockStart) * channels);
+        source.GetAudio(buf.data(), blockStart, frameToSample(end) - blockStart, env);
+        for (int n = start; n < end; n++) {
+            int maxAmp = 0;
+            const int64_t s1 = (frameToSample(n + 1) - blockStart) * channels;
+            for (int64_t s = (frameToSample(n) - blockStart) * channels; s < s1; s++) {
+                maxAmp = std::max(maxAmp, std::abs((int)buf[(size_t)s]));
+            }
+            mute[n] = (maxAmp <= muteLevel) ? 1 : 0;
+        }
+    }
+    return mute;
+}
+
+void BuiltinChapterExe::scanMissingFrames(const std::vector<std::pair<int, int>>& ranges, av::AMTSource& source, IScriptEnvironment2* env) {
+    auto worker = createWorker();
+    const auto onFrame = [&](const int n, const AVFrame* top, const AVFrame* bottom, const int dstBitDepth, const int srcBitDepth) {
+        worker->onFrame(n, top, bottom, srcBitDepth);
+    };
+    const auto onAlias = [&](const int requested, const int resolved) {
+        worker->onAlias(requested, resolved);
+    };
+    int decodedFrames = 0;
+    for (const auto& range : ranges) {
+        for (int n = range.first; n <= range.second; ) {
+            if (hasFeature[n]) {
+                n++;
+                continue;
+            }
+            int end = n;
+            while (end < range.second && !hasFeature[end + 1]) {
+                end++;
+            }
+            source.ScanFramesDirect(n, end, onFrame, onAlias, env);
+            decodedFrames += end - n + 1;
+            n = end + 1;
+        }
+    }
+    if (decodedFrames > 0) {
+        ctx.infoF(_T("無音区間の%dフレームをデコードしました"), decodedFrames);
+    }
+}
+
+int BuiltinChapterExe::frameDiff(int n) const {
+    if (n < 1 || n >= numFrames || !hasFeature[n] || !hasFeature[n - 1]) {
+        return -1;
+    }
+    int sum = 0;
+    for (int i = 0; i < GRID * GRID; i++) {
+        sum += std::abs((int)features[n][i] - (int)features[n - 1][i]);
+    }
+    return sum / (GRID * GRID);
+}
+
+std::vector<int> BuiltinChapterExe::findSceneChanges(int start, int end) const {
+    // 差の大きい順に、無音区間の最小フレーム数以上離れた位置を取る
+    // 一番大きいものはしきい値未満でも取る（chapter_exeも無音区間ごとに必ず1つは出力する）
+    std::vector<std::pair<int, int>> candidates;
+    for (int n = start; n <= end; n++) {
+        const int diff = frameDiff(n);
+        if (diff >= 0) {
+            candidates.push_back(std::make_pair(diff, n));
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+        return a.first > b.first;
+    });
+    std::vector<int> positions;
+    for (const auto& c : candidates) {
+        if (positions.size() > 0 && c.first < SC_THRESHOLD) {
+            break;
+        }
+        const bool separated = std::all_of(positions.begin(), positions.end(), [&](int pos) {
+            return std::abs(pos - c.second) >= minMuteFrames;
+        });
+        if (separated) {
+            positions.push_back(c.second);
+        }
+    }
+    std::sort(positions.begin(), positions.end());
+    return positions;
+}
+
+tstring BuiltinChapterExe::frameToTime(int frame) const {
+    const int64_t ms = (int64_t)frame * 1000 * inputFormat.frameRateDenom / inputFormat.frameRateNum;
+    return StringFormat(_T("%02d:%02d:%02d.%03d"),
+        (int)(ms / 3600000), (int)(ms / 60000 % 60), (int)(ms / 1000 % 60), (int)(ms % 1000));
+}
+
+void BuiltinChapterExe::exec(int decodeThreads) {
+    ctx.infoF(_T("内蔵の無音・シーンチェンジ検出 (無音レベル: %d, 最小無音フレーム数: %d)"), muteLevel, minMuteFrames);
+    std::vector<std::pair<int, int>> muteRanges;
+    std::vector<std::vector<int>> scenePositions;
+    try {
+        ScriptEnvironmentPointer env = make_unique_ptr(CreateScriptEnvironment2());
+        auto source = av::LoadAMTSourceDirect(ctx, setting_.getTmpAMTSourcePath(videoFileIndex), decodeThreads, env.get());
+        numFrames = std::min(numFrames, source->GetVideoInfo().num_frames);
+
+        // 無音区間
+        const auto mute = detectMuteFrames(*source, env.get());
+        for (int n = 0; n < numFrames; ) {
+            if (!mute[n]) {
+                n++;
+                continue;
+            }
+            int end = n;
+            while (end + 1 < numFrames && mute[end + 1]) {
+                end++;
+            }
+            if (end - n + 1 >= minMuteFrames) {
+                muteRanges.push_back(std::make_pair(n, end));
+            }
+            n = end + 1;
+        }
+
+        // 無音区間と前後1フレームの映像の特徴を揃える
+        // ロゴ解析で集まっていない場合はその部分だけデコードする
+        std::vector<std::pair<int, int>> searchRanges;
+        for (const auto& range : muteRanges) {
+            searchRanges.push_back(std::make_pair(std::max(0, range.first - 1), std::min(numFrames - 1, range.second + 1)));
+        }
+        scanMissingFrames(searchRanges, *source, env.get());
+    } catch (const AvisynthError& avserror) {
+        THROWF(AviSynthException, "%s", avserror.msg);
+    }
+
+    for (const auto& range : muteRanges) {
+        scenePositions.push_back(findSceneChanges(range.first, std::min(numFrames - 1, range.second + 1)));
+    }
+    writeResult(muteRanges, scenePositions);
+}
+
+void BuiltinChapterExe::writeResult(const std::vector<std::pair<int, int>>& muteRanges, const std::vector<std::vector<int>>& scenePositions) {
+    // chapter_exeの標準出力（readSceneChangesが読む）とチャプターファイル（join_logo_scpが読む）
+    StringBuilderT out;
+    StringBuilderT chapter;
+    out.append(_T("Amatsukaze built-in chapter_exe\n"));
+    out.append(_T("mute level: %d, min mute frames: %d\n"), muteLevel, minMuteFrames);
+    out.append(_T("--------\n"));
+    int chapterIndex = 0;
+    for (int i = 0; i < (int)muteRanges.size(); i++) {
+        const int start = muteRanges[i].first;
+        const int length = muteRanges[i].second - start + 1;
+        out.append(_T("mute%2d: %d - %dフレーム\n"), i + 1, start, length);
+        for (const int pos : scenePositions[i]) {
+            out.append(_T(" SCPos: %d %d\n"), pos, pos - 1);
+            chapterIndex++;
+            chapter.append(_T("CHAPTER%02d=%s\n"), chapterIndex, frameToTime(start));
+            chapter.append(_T("CHAPTER%02dNAME=%dフレーム SCPos:%d %d\n"), chapterIndex, length, pos, pos - 1);
+        }
+    }
+    auto writeText = [](const tstring& path, const tstring& text) {
+        const std::string str = tchar_to_string(text);
+        File file(path, _T("w"));
+        file.write(MemoryChunk((uint8_t*)str.data(), str.size()));
+    };
+    writeText(setting_.getTmpChapterExeOutPath(videoFileIndex), out.str());
+    writeText(setting_.getTmpChapterExePath(videoFileIndex), chapter.str());
+}
+
 tstring CMAnalyze::MakeJoinLogoScpArgs(int videoFileIndex) {
     StringBuilderT sb;
     sb.append(_T("\"%s\""), setting_.getJoinLogoScpPath());
@@ -14,6 +14,7 @@
 #include <iostream>
 #include <memory>
 #include <regex>
+#include <array>
 
 #include "StreamUtils.h"
 #include "TranscodeSetting.h"
@@ -52,6 +53,57 @@ public:
 #endif
 };
 
+namespace av {
+class AMTSource;
+}
+
+// chapter_exe互換の無音・シーンチェンジ検出
+// 映像はロゴ解析のデコードからフレームごとの輝度の特徴を受け取り（足りない分だけ自分でデコード）、
+// 音声はAMTSourceの音声から無音区間を探して、chapter_exeと同じ形式で出力する
+class BuiltinChapterExe : public AMTObject, public logo::DirectFrameAnalyzer {
+public:
+    BuiltinChapterExe(AMTContext& ctx, const ConfigWrapper& setting, int videoFileIndex, const VideoFormat& inputFormat, int numFrames);
+
+    virtual std::unique_ptr<Worker> createWorker();
+
+    // 無音区間とシーンチェンジを検出して結果を出力
+    void exec(int decodeThreads);
+
+private:
+    enum {
+        GRID = 8, // 特徴は輝度のGRIDxGRIDブロック平均
+        SC_THRESHOLD = 16, // ブロック平均の差の平均がこれ以上ならシーンチェンジの候補
+    };
+    typedef std::array<uint8_t, GRID * GRID> Feature;
+    class FeatureWorker;
+
+    const ConfigWrapper& setting_;
+    int videoFileIndex;
+    VideoFormat inputFormat;
+    int numFrames;
+    int muteLevel;     // 振幅がこれ以下のフレームを無音とする（chapter_exeの-m）
+    int minMuteFrames; // 無音区間の最小フレーム数（chapter_exeの-s）
+    std::vector<Feature> features;
+    std::vector<uint8_t> hasFeature;
+
+    static void calcFeature(const AVFrame* top, const AVFrame* bottom, int srcBitDepth, Feature& out);
+
+    // rangesのうちロゴ解析で特徴が揃わなかったフレームをデコードする
+    void scanMissingFrames(const std::vector<std::pair<int, int>>& ranges, av::AMTSource& source, IScriptEnvironment2* env);
+
+    std::vector<uint8_t> detectMuteFrames(av::AMTSource& source, IScriptEnvironment2* env);
+
+    // 直前のフレームとの差（どちらかの特徴がなければ-1）
+    int frameDiff(int n) const;
+
+    // [start,end]のシーンチェンジ位置
+    std::vector<int> findSceneChanges(int start, int end) const;
+
+    tstring frameToTime(int frame) const;
+
+    void writeResult(const std::vector<std::pair<int, int>>& muteRanges, const std::vector<std::vector<int>>& scenePositions);
+};
+
 class CMAnalyze : public AMTObject {
 public:
     CMAnalyze(AMTContext& ctx,
@@ -63,6 +115,7 @@ public:
     const std::vector<int>& getTrims() const { return trims; }
     const std::vector<EncoderZone>& getZones() const { return cmzones; }
     const std::vector<int>& getDivs() const { return divs; }
+    const std::vector<int>& getSceneChanges() const { return sceneChanges; }
 
     // PMT変更情報からCM追加認識
     void applyPmtCut(
@@ -92,6 +145,8 @@ private:
     std::vector<EncoderZone> cmzones;
     std::vector<int> sceneChanges;
     std::vector<int> divs;
+    // 内蔵の無音・シーンチェンジ検出（チャプター・CM解析中だけ有効）
+    std::unique_ptr<BuiltinChapterExe> chapterDetector;
 
     void analyzeLogo(const int videoFileIndex, const VideoFormat& inputFormat, const int numFrames, Stopwatch& sw, const tstring& avspath);
 
@@ -26,3 +26,25 @@ void BilateralFilter5x5U8RangeLUT_AVX512(uint8_t* dst, const uint8_t* srcBase, i
 bool TryEstimateBgEvalSideContiguousU8_AVX2(const uint8_t* ptr, int len, int threshold, float& avg, uint8_t& minvOut, uint8_t& maxvOut);
 void CalcBgSideStatsBlock32U8_AVX2(const uint8_t* src, int stride, int x, int y, int radius,
     uint16_t* sideSums, uint8_t* sideMins, uint8_t* sideMaxs);
+// ptrからstride間隔のnum個の位置について先頭から連続してsyncByteと一致する個数を返す
+// (各位置から4バイト読み出せること)
+int CountSyncByteRun_AVX2(const uint8_t* ptr, int stride, int num, uint8_t syncByte);
+
+// ロゴ評価の着目点データ（LogoDataParam::CreateLogoMaskで作る）
+struct LogoScoreKernelParam {
+    int w, h;              // ロゴサイズ
+    const float* logoAY;
+    const float* logoBY;
+    int numPixels;         // 着目点の数
+    const int* posX;       // 着目点の座標
+    const int* posY;
+    const float* kernels;  // 着目点ごとに5行x8要素（各行の6要素目以降は0）
+    const float* kernelSums;
+    const float* scale;    // 着目点ごとにclen個（最後に1要素余分にある）
+    const float* scale2;
+    int clen;
+};
+// 複数のfade値でロゴを除去した画像とロゴとの相関スコアを着目点1回の走査で計算する
+// workにはw*hの領域が必要
+void CalcLogoScoreMultiFade_AVX2(const LogoScoreKernelParam& p, const float* src, int srcStride, float maxv, const float* fades, int numFades, float* work, float* results);
+void CalcLogoScoreMultiFade_AVX512(const LogoScoreKernelParam& p, const float* src, int srcStride, float maxv, const float* fades, int numFades, float* work, float* results);
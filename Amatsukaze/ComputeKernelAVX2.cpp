@@ -41,6 +41,62 @@ void removeLogoLineAVX2(float *dst, const float *src, const int srcStride, const
     }
 }
 
+// ロゴ除去後の画像は src + fade * (bg - src) なので、5x5ウィンドウの平均と相関はfadeの一次式になる
+// 着目点ごとにsrcとd = bg - srcの平均・相関を1回だけ求めて、fadeごとの値はそこから計算する
+void CalcLogoScoreMultiFade_AVX2(const LogoScoreKernelParam& p, const float* src, int srcStride, float maxv, const float* fades, int numFades, float* work, float* results) {
+    const __m256 vmaxv = _mm256_set1_ps(maxv);
+    for (int y = 0; y < p.h; y++) {
+        const float* s = src + y * srcStride;
+        const float* a = p.logoAY + y * p.w;
+        const float* b = p.logoBY + y * p.w;
+        float* d = work + y * p.w;
+        int x = 0;
+        for (; x + 8 <= p.w; x += 8) {
+            const __m256 vs = _mm256_loadu_ps(s + x);
+            const __m256 bg = _mm256_fmadd_ps(_mm256_loadu_ps(a + x), vs, _mm256_mul_ps(_mm256_loadu_ps(b + x), vmaxv));
+            _mm256_storeu_ps(d + x, _mm256_sub_ps(bg, vs));
+        }
+        for (; x < p.w; x++) {
+            d[x] = (a[x] * s[x] + b[x] * maxv) - s[x];
+        }
+    }
+
+    const float avgmul = 1.0f / 25.0f;
+    const __m256 vclen = _mm256_set1_ps((float)p.clen);
+    const __m256i vclenmax = _mm256_set1_epi32(p.clen);
+    const __m256 vone = _mm256_set1_ps(1.0f);
+    const __m256 vmone = _mm256_set1_ps(-1.0f);
+    for (int f0 = 0; f0 < numFades; f0 += 8) {
+        const int nf = std::min(8, numFades - f0);
+        alignas(32) float tmp[8] = { 0 };
+        std::copy_n(fades + f0, nf, tmp);
+        const __m256 vfade = _mm256_load_ps(tmp);
+        __m256 vresult = _mm256_setzero_ps();
+        for (int i = 0; i < p.numPixels; i++) {
+            const int x = p.posX[i] - 2;
+            const int y = p.posY[i] - 2;
+            alignas(16) float sums[4];
+            _mm_store_ps(sums, LogoScoreWindowSums(p.kernels + i * 40, src + x + y * srcStride, srcStride, work + x + y * p.w, p.w));
+            // sum(k*(s-avg)) = sum(k*s) - avg*sum(k)
+            const float avgS = sums[0] * avgmul;
+            const float avgD = sums[1] * avgmul;
+            const float corrS = sums[2] - avgS * p.kernelSums[i];
+            const float corrD = sums[3] - avgD * p.kernelSums[i];
+            const __m256 vsum = _mm256_fmadd_ps(vfade, _mm256_set1_ps(corrD), _mm256_set1_ps(corrS));
+            const __m256 vavg = _mm256_fmadd_ps(vfade, _mm256_set1_ps(avgD), _mm256_set1_ps(avgS));
+            // avg単色の場合の相関値が1になるように正規化
+            __m256i vidx = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_mul_ps(vavg, vclen), vmaxv));
+            vidx = _mm256_max_epi32(_mm256_setzero_si256(), _mm256_min_epi32(vclenmax, vidx));
+            const __m256 vscale = _mm256_i32gather_ps(p.scale + i * p.clen, vidx, 4);
+            const __m256 vscale2 = _mm256_i32gather_ps(p.scale2 + i * p.clen, vidx, 4);
+            const __m256 normalized = _mm256_max_ps(vmone, _mm256_min_ps(vone, _mm256_mul_ps(vsum, vscale)));
+            vresult = _mm256_add_ps(vresult, _mm256_mul_ps(normalized, vscale2));
+        }
+        _mm256_store_ps(tmp, vresult);
+        std::copy_n(tmp, nf, results + f0);
+    }
+}
+
 constexpr int kTryEstimateBgHorizontalLoadBytes = 64;
 
 static const uint8_t TryEstimateBgValidMaskFFThen00[kTryEstimateBgHorizontalLoadBytes * 2] = {
@@ -243,3 +299,25 @@ void BilateralFilter5x5U8RangeLUT_AVX2(uint8_t* dst, const uint8_t* srcBase, int
         }
     }
 }
+
+int CountSyncByteRun_AVX2(const uint8_t* ptr, int stride, int num, uint8_t syncByte) {
+    const __m256i vindex = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    const __m256i vmask = _mm256_set1_epi32(0xFF);
+    const __m256i vsync = _mm256_set1_epi32(syncByte);
+    int i = 0;
+    for (; i + 8 <= num; i += 8) {
+        // 8位置分の先頭4バイトを集めて下位バイトだけ比較
+        const __m256i v = _mm256_i32gather_epi32(reinterpret_cast<const int*>(ptr + (size_t)i * stride), vindex, 1);
+        const __m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(v, vmask), vsync);
+        const uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (mask != 0xFF) {
+            return i + (int)_tzcnt_u32(~mask);
+        }
+    }
+    for (; i < num; i++) {
+        if (ptr[(size_t)i * stride] != syncByte) {
+            break;
+        }
+    }
+    return i;
+}
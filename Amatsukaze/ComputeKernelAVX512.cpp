@@ -8,6 +8,7 @@
 
 // このファイルはAVX512でコンパイル
 #include "ComputeKernel.h"
+#include "ComputeKernelSIMD.h"
 #include <algorithm>
 
 namespace {
@@ -34,6 +35,54 @@ inline uint8_t BilateralFilter5x5U8RangeLUTScalarPixel(const uint8_t* srcBase, c
 
 }
 
+// AVX2版と同じ計算を16個のfadeまとめて行う
+void CalcLogoScoreMultiFade_AVX512(const LogoScoreKernelParam& p, const float* src, int srcStride, float maxv, const float* fades, int numFades, float* work, float* results) {
+    const __m512 vmaxv = _mm512_set1_ps(maxv);
+    for (int y = 0; y < p.h; y++) {
+        const float* s = src + y * srcStride;
+        const float* a = p.logoAY + y * p.w;
+        const float* b = p.logoBY + y * p.w;
+        float* d = work + y * p.w;
+        for (int x = 0; x < p.w; x += 16) {
+            const __mmask16 m = (__mmask16)((p.w - x >= 16) ? 0xffff : ((1u << (p.w - x)) - 1));
+            const __m512 vs = _mm512_maskz_loadu_ps(m, s + x);
+            const __m512 bg = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + x), vs, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, b + x), vmaxv));
+            _mm512_mask_storeu_ps(d + x, m, _mm512_sub_ps(bg, vs));
+        }
+    }
+
+    const float avgmul = 1.0f / 25.0f;
+    const __m512 vclen = _mm512_set1_ps((float)p.clen);
+    const __m512i vclenmax = _mm512_set1_epi32(p.clen);
+    const __m512 vone = _mm512_set1_ps(1.0f);
+    const __m512 vmone = _mm512_set1_ps(-1.0f);
+    for (int f0 = 0; f0 < numFades; f0 += 16) {
+        const int nf = std::min(16, numFades - f0);
+        const __mmask16 fmask = (__mmask16)((nf >= 16) ? 0xffff : ((1u << nf) - 1));
+        const __m512 vfade = _mm512_maskz_loadu_ps(fmask, fades + f0);
+        __m512 vresult = _mm512_setzero_ps();
+        for (int i = 0; i < p.numPixels; i++) {
+            const int x = p.posX[i] - 2;
+            const int y = p.posY[i] - 2;
+            alignas(16) float sums[4];
+            _mm_store_ps(sums, LogoScoreWindowSums(p.kernels + i * 40, src + x + y * srcStride, srcStride, work + x + y * p.w, p.w));
+            const float avgS = sums[0] * avgmul;
+            const float avgD = sums[1] * avgmul;
+            const float corrS = sums[2] - avgS * p.kernelSums[i];
+            const float corrD = sums[3] - avgD * p.kernelSums[i];
+            const __m512 vsum = _mm512_fmadd_ps(vfade, _mm512_set1_ps(corrD), _mm512_set1_ps(corrS));
+            const __m512 vavg = _mm512_fmadd_ps(vfade, _mm512_set1_ps(avgD), _mm512_set1_ps(avgS));
+            __m512i vidx = _mm512_cvttps_epi32(_mm512_div_ps(_mm512_mul_ps(vavg, vclen), vmaxv));
+            vidx = _mm512_max_epi32(_mm512_setzero_si512(), _mm512_min_epi32(vclenmax, vidx));
+            const __m512 vscale = _mm512_i32gather_ps(vidx, p.scale + i * p.clen, 4);
+            const __m512 vscale2 = _mm512_i32gather_ps(vidx, p.scale2 + i * p.clen, 4);
+            const __m512 normalized = _mm512_max_ps(vmone, _mm512_min_ps(vone, _mm512_mul_ps(vsum, vscale)));
+            vresult = _mm512_add_ps(vresult, _mm512_mul_ps(normalized, vscale2));
+        }
+        _mm512_mask_storeu_ps(results + f0, fmask, vresult);
+    }
+}
+
 void BilateralFilter5x5U8RangeLUT_AVX512(uint8_t* dst, const uint8_t* srcBase, int srcPitch, int w, int h, const float* spatial, const float* rangeWeight, uint8_t maxv, int y0, int y1) {
     (void)maxv;
     constexpr int radius = 2;
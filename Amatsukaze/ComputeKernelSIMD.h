@@ -64,4 +64,28 @@ RGY_FORCEINLINE float CalcCorrelation5x5_AVX_AVX2(const float* k, const float* Y
 
     if (pavg) *pavg = avg;
     return sum;
+}
+
+// ロゴ評価の着目点1つ分の5x5ウィンドウについて ( sum(s), sum(d), sum(k*s), sum(k*d) ) を返す
+// kは各行8要素で6要素目以降は0であること。s,dは各行5要素だけ読む
+RGY_FORCEINLINE __m128 LogoScoreWindowSums(const float* k, const float* s, int sstride, const float* d, int dstride) {
+    const __m256i mask5 = _mm256_setr_epi32(-1, -1, -1, -1, -1, 0, 0, 0);
+    __m256 ssum = _mm256_setzero_ps();
+    __m256 dsum = _mm256_setzero_ps();
+    __m256 kssum = _mm256_setzero_ps();
+    __m256 kdsum = _mm256_setzero_ps();
+    for (int r = 0; r < 5; r++) {
+        const __m256 vs = _mm256_maskload_ps(s + r * sstride, mask5);
+        const __m256 vd = _mm256_maskload_ps(d + r * dstride, mask5);
+        const __m256 vk = _mm256_loadu_ps(k + r * 8);
+        ssum = _mm256_add_ps(ssum, vs);
+        dsum = _mm256_add_ps(dsum, vd);
+        kssum = _mm256_fmadd_ps(vk, vs, kssum);
+        kdsum = _mm256_fmadd_ps(vk, vd, kdsum);
+    }
+    // 4つの合計をまとめて求める
+    const __m256 t0 = _mm256_hadd_ps(ssum, dsum);
+    const __m256 t1 = _mm256_hadd_ps(kssum, kdsum);
+    const __m256 t2 = _mm256_hadd_ps(t0, t1);
+    return _mm_add_ps(_mm256_castps256_ps128(t2), _mm256_extractf128_ps(t2, 1));
 } 
\ No newline at end of file
@@ -16,8 +16,16 @@
 #include "rgy_pipe.h"
 #include "StringUtils.h"
 #include <cmath>
+#include <numeric>
+#include <climits>
 #include "TranscodeManager.h"
 #include "rgy_filesystem.h"
+#include "FrameRing.h"
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#endif
 
 namespace {
 
@@ -105,6 +113,122 @@ void concatenateChunkOutputs(const tstring& finalPath, const std::vector<tstring
     }
 }
 
+// 分割エンコードのチャンク [startFrame, endFrame)
+struct ChunkRange {
+    int startFrame;
+    int endFrame;
+};
+
+// [lo, hi]にあるカット位置のうちtargetに最も近いものを返す。なければtargetを返す
+int findNearestCut(const std::vector<int>& cuts, int target, int lo, int hi) {
+    int best = target;
+    int bestDiff = INT_MAX;
+    for (auto it = std::lower_bound(cuts.begin(), cuts.end(), lo); it != cuts.end() && *it <= hi; ++it) {
+        const int diff = std::abs(*it - target);
+        if (diff < bestDiff) {
+            best = *it;
+            bestDiff = diff;
+        }
+    }
+    return best;
+}
+
+// シーンチェンジとゾーン境界をカット位置の候補にする
+std::vector<int> makeCutCandidates(int numFrames, const std::vector<int>& sceneChanges, const std::vector<BitrateZone>& zones) {
+    std::vector<int> cuts = sceneChanges;
+    for (const auto& zone : zones) {
+        cuts.push_back(zone.startFrame);
+        cuts.push_back(zone.endFrame);
+    }
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+    cuts.erase(std::remove_if(cuts.begin(), cuts.end(), [numFrames](int f) { return f <= 0 || f >= numFrames; }), cuts.end());
+    return cuts;
+}
+
+// 分割エンコードのチャンクを作る
+// 負荷の偏りを後から埋められるように並列数より多めのチャンクにし、境界はなるべくカット位置に合わせる
+// カット位置の候補がない場合やフレーム数が少ない場合は従来通り並列数で等分する
+std::vector<ChunkRange> makeSceneAlignedChunks(int numFrames, int parallel, const std::vector<int>& sceneChanges, const std::vector<BitrateZone>& zones) {
+    enum {
+        CHUNKS_PER_ENCODER = 4,
+        MIN_CHUNK_FRAMES = 600, // エンコーダの起動とレート制御の立ち上がりに見合う長さ
+    };
+    const auto cuts = makeCutCandidates(numFrames, sceneChanges, zones);
+    std::vector<ChunkRange> chunks;
+    if (cuts.empty() || numFrames < parallel * 2) {
+        for (int p = 0; p < parallel; p++) {
+            chunks.push_back({ numFrames * p / parallel, numFrames * (p + 1) / parallel });
+        }
+        return chunks;
+    }
+    const int target = std::max({ 1,
+        std::min((int)MIN_CHUNK_FRAMES, numFrames / parallel),
+        numFrames / (parallel * CHUNKS_PER_ENCODER) });
+    int start = 0;
+    while (numFrames - start > target * 3 / 2) {
+        // 空のチャンクにならないようにstartより後ろのカット位置だけを使う
+        const int end = findNearestCut(cuts, start + target, std::max(start + 1, start + target / 2), start + target * 3 / 2);
+        chunks.push_back({ start, end });
+        start = end;
+    }
+    chunks.push_back({ start, numFrames });
+    return chunks;
+}
+
+// エンコーダ内部で分割する場合の境界をカット位置に寄せる（チャンク数は変えない）
+std::vector<ChunkRange> alignChunksToCuts(int numFrames, int parallel, const std::vector<int>& sceneChanges, const std::vector<BitrateZone>& zones) {
+    const auto cuts = makeCutCandidates(numFrames, sceneChanges, zones);
+    std::vector<ChunkRange> chunks(parallel);
+    const int window = numFrames / parallel / 4;
+    int start = 0;
+    for (int p = 0; p < parallel; p++) {
+        const int ideal = numFrames * (p + 1) / parallel;
+        const int end = (p == parallel - 1) ? numFrames : findNearestCut(cuts, ideal, std::max(start + 1, ideal - window), ideal + window);
+        chunks[p] = { start, end };
+        start = end;
+    }
+    return chunks;
+}
+
+// 生フレームを送るパイプのバッファサイズ
+// 既定サイズ(Linuxでは64KB)だと1フレーム送る間に何度もエンコーダの読み出し待ちになるので、2フレーム分を目安に拡張する
+uint32_t getFramePipeBufferSize(const VideoInfo& vi) {
+    const uint64_t size = (uint64_t)vi.BMPSize() * 2;
+    return (uint32_t)std::min<uint64_t>(std::max<uint64_t>(size, 1024 * 1024), 32 * 1024 * 1024);
+}
+
+#if !(defined(_WIN32) || defined(_WIN64))
+// iovをすべて書き込む（部分書き込みの場合は続きから再開する）
+// 戻り値: 成功時0、失敗時errno
+int writeAllIov(int fd, std::vector<iovec>& iov, bool useSplice) {
+    size_t idx = 0;
+    while (idx < iov.size()) {
+        const int cnt = (int)std::min<size_t>(iov.size() - idx, IOV_MAX);
+        const ssize_t ret = useSplice ? vmsplice(fd, &iov[idx], cnt, 0) : writev(fd, &iov[idx], cnt);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        if (ret == 0) {
+            return EPIPE;
+        }
+        size_t written = (size_t)ret;
+        while (idx < iov.size() && written >= iov[idx].iov_len) {
+            written -= iov[idx].iov_len;
+            idx++;
+        }
+        if (written > 0) {
+            iov[idx].iov_base = (uint8_t*)iov[idx].iov_base + written;
+            iov[idx].iov_len -= written;
+        }
+    }
+    return 0;
+}
+#endif
+
 } // anonymous namespace
 
 /* static */ const char* Y4MWriter::getPixelFormat(VideoInfo vi) {
@@ -158,22 +282,211 @@ Y4MWriter::Y4MWriter(VideoInfo vi, VideoFormat outfmt, bool sarInContainerOnly)
     nc = vi.IsY() ? 1 : 3;
 }
 void Y4MWriter::inputFrame(const PVideoFrame& frame) {
+    chunks.clear();
     if (n++ == 0) {
-        buffer.add(MemoryChunk((uint8_t*)header.data(), header.size()));
+        chunks.push_back(MemoryChunk((uint8_t*)header.data(), header.size()));
     }
-    buffer.add(MemoryChunk((uint8_t*)frameHeader.data(), frameHeader.size()));
+    chunks.push_back(MemoryChunk((uint8_t*)frameHeader.data(), frameHeader.size()));
+    bool contiguous = true;
     int yuv[] = { PLANAR_Y, PLANAR_U, PLANAR_V };
     for (int c = 0; c < nc; c++) {
         const uint8_t* plane = frame->GetReadPtr(yuv[c]);
         int pitch = frame->GetPitch(yuv[c]);
         int height = frame->GetHeight(yuv[c]);
         int rowsize = frame->GetRowSize(yuv[c]);
-        for (int y = 0; y < height; y++) {
-            buffer.add(MemoryChunk((uint8_t*)plane + y * pitch, rowsize));
+        if (pitch == rowsize) {
+            chunks.push_back(MemoryChunk((uint8_t*)plane, (size_t)rowsize * height));
+        } else {
+            contiguous = false;
+            for (int y = 0; y < height; y++) {
+                chunks.push_back(MemoryChunk((uint8_t*)plane + y * pitch, rowsize));
+            }
+        }
+    }
+    onWriteFrame(frame, chunks, contiguous);
+}
+/* virtual */ void Y4MWriter::onWriteFrame(const PVideoFrame& frame, const std::vector<MemoryChunk>& chunks, bool contiguous) {
+    for (const auto& mc : chunks) {
+        buffer.add(mc);
+    }
+    onWrite(buffer.get());
+    buffer.clear();
+}
+Y4MPipeSender::Y4MPipeSender(PIPE_HANDLE handle, bool allowSplice)
+    : handle_(handle)
+    , useSplice_(false)
+    , pipeSize_(0)
+    , totalBytes_(0) {
+#if !(defined(_WIN32) || defined(_WIN64))
+    if (allowSplice) {
+        const int size = fcntl(handle_, F_GETPIPE_SZ);
+        if (size > 0) {
+            pipeSize_ = (size_t)size;
+            useSplice_ = true;
+        }
+    }
+#endif
+}
+bool Y4MPipeSender::send(const PVideoFrame& frame, const std::vector<MemoryChunk>& chunks, bool contiguous) {
+#if defined(_WIN32) || defined(_WIN64)
+    return false;
+#else
+    std::vector<iovec> iov(chunks.size());
+    size_t frameBytes = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        iov[i].iov_base = chunks[i].data;
+        iov[i].iov_len = chunks[i].length;
+        frameBytes += chunks[i].length;
+    }
+    // 行単位だとページが埋まらずパイプのバッファを無駄に消費するので、vmspliceはプレーンが連続している場合のみ
+    const bool splice = useSplice_ && contiguous;
+    int err = writeAllIov(handle_, iov, splice);
+    if (splice && (err == EINVAL || err == ENOSYS)) {
+        // vmsplice非対応なら以降はwritevのみ（途中まで渡した分があるのでこのフレームは保持する）
+        useSplice_ = false;
+        err = writeAllIov(handle_, iov, false);
+    }
+    if (err != 0) {
+        THROWF(RuntimeException, "failed to write to stdin pipe (errno: %d)", err);
+    }
+    totalBytes_ += frameBytes;
+    if (splice) {
+        heldFrames_.emplace_back(frame, totalBytes_);
+    }
+    // フレームの後にパイプ容量以上書き込めていれば、そのフレームは読み出し済み
+    while (heldFrames_.size() > 0 && totalBytes_ - heldFrames_.front().second >= pipeSize_) {
+        heldFrames_.pop_front();
+    }
+    return true;
+#endif
+}
+void Y4MPipeSender::releaseFrames() {
+    heldFrames_.clear();
+}
+FrameRingSender::FrameRingSender(size_t frameBytes, int numSlots)
+    : memfd_(-1)
+    , ackRead_(-1)
+    , ackWrite_(-1)
+    , control_(0)
+    , numSlots_(numSlots)
+    , slotSize_(0)
+    , base_(nullptr)
+    , freeSlots_() {
+#if defined(_WIN32) || defined(_WIN64)
+    THROW(RuntimeException, "frame ring is not supported on Windows");
+#else
+    const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    slotSize_ = (frameBytes + pageSize - 1) / pageSize * pageSize;
+    try {
+        // memfdとackの書き込み側はエンコーダに継承させるのでCLOEXECを付けない
+        memfd_ = memfd_create("amatsukaze-frame-ring", 0);
+        if (memfd_ < 0) {
+            THROWF(RuntimeException, "failed memfd_create (errno: %d)", errno);
+        }
+        if (ftruncate(memfd_, (off_t)(slotSize_ * numSlots_)) != 0) {
+            THROWF(RuntimeException, "failed to resize frame ring (errno: %d)", errno);
+        }
+        void* base = mmap(nullptr, slotSize_ * numSlots_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+        if (base == MAP_FAILED) {
+            THROWF(RuntimeException, "failed to map frame ring (errno: %d)", errno);
+        }
+        base_ = (uint8_t*)base;
+        int fds[2];
+        if (pipe(fds) != 0) {
+            THROWF(RuntimeException, "failed to create frame ring ack pipe (errno: %d)", errno);
+        }
+        ackRead_ = fds[0];
+        ackWrite_ = fds[1];
+        fcntl(ackRead_, F_SETFD, FD_CLOEXEC);
+    } catch (...) {
+        release();
+        throw;
+    }
+    for (int i = numSlots_ - 1; i >= 0; i--) {
+        freeSlots_.push_back((uint32_t)i);
+    }
+#endif
+}
+FrameRingSender::~FrameRingSender() {
+    release();
+}
+void FrameRingSender::release() {
+#if !(defined(_WIN32) || defined(_WIN64))
+    if (base_ != nullptr) {
+        munmap(base_, slotSize_ * numSlots_);
+        base_ = nullptr;
+    }
+    for (int* fd : { &memfd_, &ackRead_, &ackWrite_ }) {
+        if (*fd >= 0) {
+            ::close(*fd);
+            *fd = -1;
+        }
+    }
+#endif
+}
+void FrameRingSender::start(PIPE_HANDLE control, const std::string& y4mHeader) {
+#if !(defined(_WIN32) || defined(_WIN64))
+    control_ = control;
+    StringBuilder sb;
+    sb.append("AMTFRAMERING %d memfd=%d ack=%d slots=%d slotsize=%llu\n",
+        (int)FRAME_RING_VERSION, memfd_, ackWrite_, numSlots_, (unsigned long long)slotSize_);
+    const std::string line = sb.str();
+    writeControl(line.data(), line.size());
+    writeControl(y4mHeader.data(), y4mHeader.size());
+    // エンコーダに継承済みなので親側は閉じる（エンコーダが終了したらackがEOFになるように）
+    ::close(memfd_);
+    memfd_ = -1;
+    ::close(ackWrite_);
+    ackWrite_ = -1;
+#endif
+}
+void FrameRingSender::send(const std::vector<MemoryChunk>& planes) {
+#if !(defined(_WIN32) || defined(_WIN64))
+    size_t bytes = 0;
+    for (const auto& mc : planes) {
+        bytes += mc.length;
+    }
+    if (bytes > slotSize_) {
+        THROWF(RuntimeException, "frame does not fit in a frame ring slot (%zu > %zu)", bytes, slotSize_);
+    }
+    // 空きスロットがなければエンコーダが返却するのを待つ
+    while (freeSlots_.empty()) {
+        uint32_t slot = 0;
+        const ssize_t ret = ::read(ackRead_, &slot, sizeof(slot));
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret != (ssize_t)sizeof(slot) || slot >= (uint32_t)numSlots_) {
+            THROW(RuntimeException, "エンコーダがフレームリングのスロットを返却しませんでした");
         }
-        onWrite(buffer.get());
-        buffer.clear();
+        freeSlots_.push_back(slot);
     }
+    const uint32_t slot = freeSlots_.back();
+    freeSlots_.pop_back();
+    uint8_t* dst = base_ + slot * slotSize_;
+    for (const auto& mc : planes) {
+        memcpy(dst, mc.data, mc.length);
+        dst += mc.length;
+    }
+    FrameRingRecord record = { slot, (uint32_t)bytes };
+    writeControl(&record, sizeof(record));
+#endif
+}
+void FrameRingSender::writeControl(const void* data, size_t size) {
+#if !(defined(_WIN32) || defined(_WIN64))
+    const uint8_t* ptr = (const uint8_t*)data;
+    while (size > 0) {
+        const ssize_t ret = ::write(control_, ptr, size);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            THROWF(RuntimeException, "failed to write to stdin pipe (errno: %d)", errno);
+        }
+        ptr += ret;
+        size -= (size_t)ret;
+    }
+#endif
 }
 /* static */ const char* Y4MEncodeWriter::getYUV(VideoInfo vi) {
     if (vi.Is420()) return "420";
@@ -181,10 +494,16 @@ void Y4MWriter::inputFrame(const PVideoFrame& frame) {
     if (vi.Is444()) return "424";
     return "Unknown";
 }
-Y4MEncodeWriter::Y4MEncodeWriter(AMTContext& ctx, const tstring& encoder_args, VideoInfo vi, VideoFormat fmt, bool disablePowerThrottoling, bool captureOutputOnly, StdRedirectedSubProcess::LineCallback lineCallback, bool sarInContainerOnly)
+Y4MEncodeWriter::Y4MEncodeWriter(AMTContext& ctx, const tstring& encoder_args, VideoInfo vi, VideoFormat fmt, bool disablePowerThrottoling, bool captureOutputOnly, StdRedirectedSubProcess::LineCallback lineCallback, bool sarInContainerOnly, int frameRingSlots)
     : AMTObject(ctx)
     , y4mWriter_(new MyVideoWriter(this, vi, fmt, sarInContainerOnly))
-    , process_(new StdRedirectedSubProcess(encoder_args, 5, false, disablePowerThrottoling, captureOutputOnly, lineCallback)) {
+    , ring_((frameRingSlots > 0) ? new FrameRingSender((size_t)vi.BMPSize(), frameRingSlots) : nullptr)
+    , process_(new StdRedirectedSubProcess(encoder_args, 5, false, disablePowerThrottoling, captureOutputOnly, lineCallback, ring_ ? 0 : getFramePipeBufferSize(vi)))
+    , sender_(new Y4MPipeSender(process_->stdInHandle(), true)) {
+    if (ring_) {
+        ring_->start(process_->stdInHandle(), y4mWriter_->getHeader());
+        ctx.infoF(_T("フレーム転送: 共有メモリリング (%dスロット)"), frameRingSlots);
+    }
     const int logSarW = sarInContainerOnly ? 1 : fmt.sarWidth;
     const int logSarH = sarInContainerOnly ? 1 : fmt.sarHeight;
     ctx.infoF(_T("y4m format: YUV%sp%d %s %dx%d SAR %d:%d %d/%dfps"),
@@ -205,6 +524,8 @@ void Y4MEncodeWriter::finish() {
     if (y4mWriter_ != NULL) {
         process_->finishWrite();
         int ret = process_->join();
+        // エンコーダが終了したのでvmspliceしたフレームを解放できる
+        sender_->releaseFrames();
         if (ret != 0) {
             ctx.error(_T("↓↓↓↓↓↓エンコーダ最後の出力↓↓↓↓↓↓"));
             for (auto v : process_->getLastLines()) {
@@ -236,6 +557,20 @@ Y4MEncodeWriter::MyVideoWriter::MyVideoWriter(Y4MEncodeWriter* this_, VideoInfo
 /* virtual */ void Y4MEncodeWriter::MyVideoWriter::onWrite(MemoryChunk mc) {
     this_->onVideoWrite(mc);
 }
+/* virtual */ void Y4MEncodeWriter::MyVideoWriter::onWriteFrame(const PVideoFrame& frame, const std::vector<MemoryChunk>& chunks, bool contiguous) {
+    if (this_->ring_) {
+        // ストリームヘッダとFRAME行は制御パイプ側の仕様なので除いてプレーンだけ送る
+        auto it = chunks.begin();
+        while (it != chunks.end() && (it->data == (uint8_t*)header.data() || it->data == (uint8_t*)frameHeader.data())) {
+            ++it;
+        }
+        this_->ring_->send(std::vector<MemoryChunk>(it, chunks.end()));
+        return;
+    }
+    if (!this_->sender_->send(frame, chunks, contiguous)) {
+        Y4MWriter::onWriteFrame(frame, chunks, contiguous);
+    }
+}
 
 void Y4MEncodeWriter::onVideoWrite(MemoryChunk mc) {
     process_->write(mc);
@@ -256,6 +591,7 @@ void AMTFilterVideoEncoder::encodeSWParallel(
     EncoderArgumentGenerator& argGen,
     const std::vector<double>& timeCodes,
     const std::vector<BitrateZone>& bitrateZones,
+    const std::vector<int>& sceneChanges,
     double vfrBitrateScale,
     const tstring& timecodePath,
     int vfrTimingFps,
@@ -271,28 +607,34 @@ void AMTFilterVideoEncoder::encodeSWParallel(
     if (!filterSourceFactory) {
         THROW(RuntimeException, "分割エンコードにはfilterSourceFactoryが必要です");
     }
-    const int mp = actualParallel;
+    const auto ranges = makeSceneAlignedChunks(vi_.num_frames, actualParallel, sceneChanges, bitrateZones);
+    const int numChunks = (int)ranges.size();
+    // エンコーダプロセスはmp個まで同時に起動し、空いたものから次のチャンクを取る
+    const int mp = std::min(actualParallel, numChunks);
     struct ChunkTask {
         int startFrame = 0;
         int endFrame = 0;
         tstring args;
         tstring outputPath;
     };
-    std::vector<ChunkTask> chunks(mp);
+    std::vector<ChunkTask> chunks(numChunks);
     std::vector<tstring> chunkOutputs;
-    chunkOutputs.reserve(mp);
+    chunkOutputs.reserve(numChunks);
+    if (numChunks != actualParallel) {
+        ctx.infoF(_T("シーンチェンジ位置で%dチャンクに分割して%d並列でエンコードします"), numChunks, mp);
+    }
 
-    for (int p = 0; p < mp; p++) {
-        auto& chunk = chunks[p];
-        chunk.startFrame = vi_.num_frames * p / mp;
-        chunk.endFrame = vi_.num_frames * (p + 1) / mp;
+    for (int c = 0; c < numChunks; c++) {
+        auto& chunk = chunks[c];
+        chunk.startFrame = ranges[c].startFrame;
+        chunk.endFrame = ranges[c].endFrame;
         const int chunkFrames = chunk.endFrame - chunk.startFrame;
         auto chunkZones = sliceBitrateZones(bitrateZones, chunk.startFrame, chunk.endFrame);
         tstring chunkTimecodePath;
         if (timecodePath.size() > 0) {
-            chunkTimecodePath = createChunkTimecodeFile(timecodePath, passIndex * mp + p, chunk.startFrame, chunk.endFrame, timeCodes, ctx);
+            chunkTimecodePath = createChunkTimecodeFile(timecodePath, passIndex * numChunks + c, chunk.startFrame, chunk.endFrame, timeCodes, ctx);
         }
-        chunk.outputPath = appendChunkSuffix(baseOutputPath, passIndex * mp + p);
+        chunk.outputPath = appendChunkSuffix(baseOutputPath, passIndex * numChunks + c);
         ctx.registerTmpFile(chunk.outputPath);
         chunk.args = argGen.GenEncoderOptions(
             chunkFrames,
@@ -326,6 +668,11 @@ void AMTFilterVideoEncoder::encodeSWParallel(
             progressThread_ = std::thread([this]() { progressLoop(); });
         }
 
+        void markStarted(int idx) {
+            std::lock_guard<std::mutex> lock(entries_[idx].mtx);
+            entries_[idx].started = true;
+        }
+
         void markFinished(int idx) {
             {
                 std::lock_guard<std::mutex> lock(entries_[idx].mtx);
@@ -361,6 +708,7 @@ void AMTFilterVideoEncoder::encodeSWParallel(
             std::vector<std::string> logs;
             std::string lastProgress;
             bool hasProgress = false;
+            bool started = false;
             bool finished = false;
         };
 
@@ -379,7 +727,7 @@ void AMTFilterVideoEncoder::encodeSWParallel(
                 for (size_t attempt = 0; attempt < entries_.size(); attempt++) {
                     size_t idx = (offset + attempt) % entries_.size();
                     std::unique_lock<std::mutex> lock(entries_[idx].mtx);
-                    if (entries_[idx].finished) {
+                    if (!entries_[idx].started || entries_[idx].finished) {
                         continue;
                     }
                     std::string message = entries_[idx].hasProgress ? entries_[idx].lastProgress : std::string("Running...");
@@ -412,7 +760,7 @@ void AMTFilterVideoEncoder::encodeSWParallel(
         std::thread progressThread_;
     };
 
-    ChunkLogManager logManager(ctx, mp);
+    ChunkLogManager logManager(ctx, numChunks);
     logManager.start();
     bool logStopped = false;
     auto stopLogs = [&]() {
@@ -424,14 +772,14 @@ void AMTFilterVideoEncoder::encodeSWParallel(
     };
 
     ctx.info(_T("[エンコーダ起動]"));
-    for (int p = 0; p < mp; p++) {
-        ctx.infoF(_T("[chunk %d] %s"), p, chunks[p].args.c_str());
+    for (int c = 0; c < numChunks; c++) {
+        ctx.infoF(_T("[chunk %d] %d-%d %s"), c, chunks[c].startFrame, chunks[c].endFrame, chunks[c].args.c_str());
     }
 
-    class ChunkPumpThread : public DataPumpThread<std::unique_ptr<PVideoFrame>, true> {
+    class ChunkPumpThread : public SpscDataPumpThread<std::unique_ptr<PVideoFrame>, true> {
     public:
         ChunkPumpThread(Y4MEncodeWriter* encoder, std::atomic<bool>* anyError)
-            : DataPumpThread(8)
+            : SpscDataPumpThread(8)
             , encoder_(encoder)
             , anyError_(anyError) {}
     protected:
@@ -456,78 +804,86 @@ void AMTFilterVideoEncoder::encodeSWParallel(
 
     bool error = false;
     std::atomic<bool> anyError(false);
-    std::vector<std::unique_ptr<Y4MEncodeWriter>> chunkEncoders(mp);
-    std::vector<std::unique_ptr<ChunkPumpThread>> chunkPumps;
-    chunkPumps.reserve(mp);
+    // エンコーダの終了コードなどのエラーはそのまま呼び出し元に返す
+    std::mutex errorMutex;
+    std::exception_ptr encoderError;
     std::vector<std::thread> workers;
     workers.reserve(mp);
-    std::vector<std::shared_ptr<AMTFilterSource>> chunkFilters(mp);
     double totalEncodeTime = 0.0;
 
-    try {
+    // 長いチャンクから順に空いたワーカーが取っていく
+    std::vector<int> order(numChunks);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return chunks[a].endFrame - chunks[a].startFrame > chunks[b].endFrame - chunks[b].startFrame;
+    });
+    std::atomic<int> nextChunk(0);
+
+    auto encodeChunk = [&](int c, PClip& clip, IScriptEnvironment2* env) {
+        const auto& chunk = chunks[c];
+        logManager.markStarted(c);
+        Y4MEncodeWriter encoder(ctx, chunk.args, vi_, outfmt_, disablePowerThrottoling, true, logManager.makeCallback(c), setting_.getSARInContainerOnly());
+        ChunkPumpThread pump(&encoder, &anyError);
+        pump.start();
         try {
-            for (int p = 0; p < mp; p++) {
-                chunkEncoders[p] = std::unique_ptr<Y4MEncodeWriter>(new Y4MEncodeWriter(
-                    ctx, chunks[p].args, vi_, outfmt_, disablePowerThrottoling, true, logManager.makeCallback(p), setting_.getSARInContainerOnly()));
-                chunkPumps.emplace_back(new ChunkPumpThread(chunkEncoders[p].get(), &anyError));
-                chunkPumps.back()->start();
-            }
-
-            for (int p = 0; p < mp; p++) {
-                workers.emplace_back([&, p]() {
-                    try {
-                        std::shared_ptr<AMTFilterSource> localFilter(filterSourceFactory().release());
-                        chunkFilters[p] = localFilter;
-                        IScriptEnvironment2* localenv = localFilter->getEnv();
-                        PClip localClip = localFilter->getClip();
-                        for (int fi = chunks[p].startFrame; fi < chunks[p].endFrame && !anyError.load(); fi++) {
-                            auto frame = localClip->GetFrame(fi, localenv);
-                            chunkPumps[p]->put(std::unique_ptr<PVideoFrame>(new PVideoFrame(frame)), 1);
-                        }
-                    } catch (const AvisynthError& avserror) {
-                        ctx.errorF(_T("Avisynthフィルタでエラーが発生: %s"), char_to_tstring(avserror.msg));
-                        anyError.store(true);
-                    } catch (Exception&) {
-                        anyError.store(true);
-                    }
-                    chunkPumps[p]->join();
-                    chunkPumps[p]->force_clear();
-                    chunkFilters[p].reset();
-                });
-            }
-
-            for (auto& worker : workers) {
-                worker.join();
+            for (int fi = chunk.startFrame; fi < chunk.endFrame && !anyError.load(); fi++) {
+                auto frame = clip->GetFrame(fi, env);
+                pump.put(std::unique_ptr<PVideoFrame>(new PVideoFrame(frame)), 1);
             }
         } catch (const AvisynthError& avserror) {
             ctx.errorF(_T("Avisynthフィルタでエラーが発生: %s"), char_to_tstring(avserror.msg));
-            error = true;
+            anyError.store(true);
         } catch (Exception&) {
-            error = true;
-        } catch (...) {
-            error = true;
+            anyError.store(true);
         }
-
-        if (anyError.load()) {
-            error = true;
+        pump.join();
+        pump.force_clear();
+        try {
+            encoder.finish();
+        } catch (Exception&) {
+            anyError.store(true);
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!encoderError) {
+                encoderError = std::current_exception();
+            }
         }
+        logManager.markFinished(c);
+    };
 
-        // まず全エンコーダの入力を閉じる。
-        // これをせずに順番に join() してしまうと、ハンドル継承が発生している場合に
-        // stdin のクローズ待ちとハンドル継承によるパイプクローズ待ちでデッドロックする可能性がある。
-        for (int p = 0; p < mp; p++) {
-            if (chunkEncoders[p]) {
-                chunkEncoders[p]->closeInput();
-            }
+    try {
+        for (int w = 0; w < mp; w++) {
+            workers.emplace_back([&]() {
+                try {
+                    std::unique_ptr<AMTFilterSource> localFilter = filterSourceFactory();
+                    IScriptEnvironment2* localenv = localFilter->getEnv();
+                    PClip localClip = localFilter->getClip();
+                    while (!anyError.load()) {
+                        const int next = nextChunk.fetch_add(1);
+                        if (next >= numChunks) {
+                            break;
+                        }
+                        encodeChunk(order[next], localClip, localenv);
+                    }
+                } catch (const AvisynthError& avserror) {
+                    ctx.errorF(_T("Avisynthフィルタでエラーが発生: %s"), char_to_tstring(avserror.msg));
+                    anyError.store(true);
+                } catch (Exception&) {
+                    anyError.store(true);
+                }
+            });
         }
-        for (int p = 0; p < mp; p++) {
-            if (chunkEncoders[p]) {
-                chunkEncoders[p]->finish();
-            }
-            logManager.markFinished(p);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        if (anyError.load()) {
+            error = true;
         }
         stopLogs();
 
+        if (encoderError) {
+            std::rethrow_exception(encoderError);
+        }
         if (error) {
             THROW(RuntimeException, "エンコード中に不明なエラーが発生");
         }
@@ -611,7 +967,6 @@ void AMTFilterVideoEncoder::encodeSWParallel(
         stopLogs();
         throw;
     }
-    chunkFilters.clear();
     // 実効fps, 実効ビットレートを計算して表示
     const double effectiveFps = (totalEncodeTime > 0.0)
         ? (vi_.num_frames / totalEncodeTime)
@@ -635,7 +990,7 @@ void AMTFilterVideoEncoder::encodeSWParallel(
 void AMTFilterVideoEncoder::encode(
     PClip source, VideoFormat outfmt, const std::vector<double>& timeCodes,
     EncoderArgumentGenerator& argGen, const std::vector<int>& passList,
-    const std::vector<BitrateZone>& bitrateZones, double vfrBitrateScale,
+    const std::vector<BitrateZone>& bitrateZones, const std::vector<int>& sceneChanges, double vfrBitrateScale,
     const tstring& timecodePath, int vfrTimingFps, const tstring& baseOutputPath,
     EncodeFileKey key, int serviceId, const EncoderOptionInfo& eoInfo,
     const int pipeParallel, const bool disablePowerThrottoling,
@@ -665,7 +1020,7 @@ void AMTFilterVideoEncoder::encode(
                 THROW(RuntimeException, "分割エンコードは2passと同時に使用できません");
             }
             encodeSWParallel(
-                argGen, timeCodes, bitrateZones, vfrBitrateScale,
+                argGen, timeCodes, bitrateZones, sceneChanges, vfrBitrateScale,
                 timecodePath, vfrTimingFps, baseOutputPath,
                 key, serviceId, eoInfo, currentPass, i,
                 actualParallel, disablePowerThrottoling, filterSourceFactory);
@@ -689,12 +1044,13 @@ void AMTFilterVideoEncoder::encode(
         std::vector<ParallelPipeInfo> pinfo;
         tstring argsWithParallel = args;
         if (useParallel) {
-            // フレーム範囲を分割
+            // フレーム範囲を分割（分割数はエンコーダ側で固定なので境界だけシーンチェンジに寄せる）
             const int mp = actualParallel;
+            const auto ranges = alignChunksToCuts(vi_.num_frames, mp, sceneChanges, bitrateZones);
             pinfo.resize(mp);
             for (int p = 0; p < mp; p++) {
-                pinfo[p].startFrame = vi_.num_frames * p / mp;
-                pinfo[p].endFrame = vi_.num_frames * (p + 1) / mp;
+                pinfo[p].startFrame = ranges[p].startFrame;
+                pinfo[p].endFrame = ranges[p].endFrame;
             }
 
             // 無名パイプ生成 (読み取り側を子プロセスに継承させる)
@@ -702,7 +1058,7 @@ void AMTFilterVideoEncoder::encode(
             chunkSb.append(_T(" --parallel mp=%d,chunk-handles="), mp);
             bool first = true;
             for (int p = 0; p < mp; p++) {
-                if (pinfo[p].pipe.create(true, false, 0) != 0) {
+                if (pinfo[p].pipe.create(true, false, getFramePipeBufferSize(vi_)) != 0) {
                     THROW(RuntimeException, "匿名パイプの生成に失敗");
                 }
                 if (!first) {
@@ -717,8 +1073,21 @@ void AMTFilterVideoEncoder::encode(
         ctx.info(_T("[エンコーダ起動]"));
         ctx.infoF(_T("%s"), argsWithParallel);
 
+        // 共有メモリリングは標準入力1本の経路でのみ使う
+        int frameRingSlots = setting_.getFrameRingSlots();
+#if defined(_WIN32) || defined(_WIN64)
+        if (frameRingSlots > 0) {
+            ctx.warn(_T("フレームリングはWindowsでは使えないのでパイプで転送します"));
+            frameRingSlots = 0;
+        }
+#endif
+        if (frameRingSlots > 0 && useParallel) {
+            ctx.warn(_T("分割並列エンコードではフレームリングを使わずパイプで転送します"));
+            frameRingSlots = 0;
+        }
+
         // 初期化（子プロセス起動）
-        encoder_ = std::unique_ptr<Y4MEncodeWriter>(new Y4MEncodeWriter(ctx, argsWithParallel, vi_, outfmt_, disablePowerThrottoling, false, StdRedirectedSubProcess::LineCallback(), setting_.getSARInContainerOnly()));
+        encoder_ = std::unique_ptr<Y4MEncodeWriter>(new Y4MEncodeWriter(ctx, argsWithParallel, vi_, outfmt_, disablePowerThrottoling, false, StdRedirectedSubProcess::LineCallback(), setting_.getSARInContainerOnly(), frameRingSlots));
         // 親側の読み取りハンドルは不要なので直ちに閉じる（子には継承済み）
         if (useParallel) {
             for (auto& pi : pinfo) {
@@ -759,8 +1128,9 @@ void AMTFilterVideoEncoder::encode(
                 // パイプごとのY4M書き込みスレッド
                 class PipeY4MWriter : public Y4MWriter {
                 public:
+                    // フレームはワーカーのlocalenvと一緒に破棄されるのでvmspliceはせずwritevのみ
                     PipeY4MWriter(RGYAnonymousPipe* pipe, VideoInfo vi, VideoFormat fmt, bool sarInContainerOnly)
-                        : Y4MWriter(vi, fmt, sarInContainerOnly), pipe_(pipe) {}
+                        : Y4MWriter(vi, fmt, sarInContainerOnly), pipe_(pipe), sender_(pipe->writeHandle(), false) {}
                 protected:
                     virtual void onWrite(MemoryChunk mc) override {
                         if (mc.length == 0) return;
@@ -768,14 +1138,20 @@ void AMTFilterVideoEncoder::encode(
                             THROW(RuntimeException, "並列パイプへの書き込みに失敗");
                         }
                     }
+                    virtual void onWriteFrame(const PVideoFrame& frame, const std::vector<MemoryChunk>& chunks, bool contiguous) override {
+                        if (!sender_.send(frame, chunks, contiguous)) {
+                            Y4MWriter::onWriteFrame(frame, chunks, contiguous);
+                        }
+                    }
                 private:
                     RGYAnonymousPipe* pipe_;
+                    Y4MPipeSender sender_;
                 };
 
-                class SegmentPumpThread : public DataPumpThread<std::unique_ptr<PVideoFrame>, true> {
+                class SegmentPumpThread : public SpscDataPumpThread<std::unique_ptr<PVideoFrame>, true> {
                 public:
                     SegmentPumpThread(PipeY4MWriter* writer, std::atomic<bool>* anyError)
-                        : DataPumpThread(8)
+                        : SpscDataPumpThread(8)
                         , writer_(writer)
                         , anyError_(anyError) {}
                     virtual ~SegmentPumpThread() {
@@ -902,7 +1278,7 @@ void AMTFilterVideoEncoder::encode(
     }
 }
 AMTFilterVideoEncoder::SpDataPumpThread::SpDataPumpThread(AMTFilterVideoEncoder* this_, int bufferingFrames)
-    : DataPumpThread(bufferingFrames)
+    : SpscDataPumpThread(bufferingFrames)
     , this_(this_) {}
 /* virtual */ void AMTFilterVideoEncoder::SpDataPumpThread::OnDataReceived(std::unique_ptr<PVideoFrame>&& data) {
     this_->encoder_->inputFrame(*data);
@@ -955,7 +1331,7 @@ AMTSimpleVideoEncoder::SpVideoReader::SpVideoReader(AMTSimpleVideoEncoder* this_
     this_->onAudioPacket(packet);
 }
 AMTSimpleVideoEncoder::SpDataPumpThread::SpDataPumpThread(AMTSimpleVideoEncoder* this_, int bufferingFrames)
-    : DataPumpThread(bufferingFrames)
+    : SpscDataPumpThread(bufferingFrames)
     , this_(this_) {}
 /* virtual */ void AMTSimpleVideoEncoder::SpDataPumpThread::OnDataReceived(std::unique_ptr<av::Frame>&& data) {
     this_->onFrameReceived(std::move(data));
@@ -13,6 +13,7 @@
 #include "TranscodeSetting.h"
 #include "FilteredSource.h"
 #include <functional>
+#include <deque>
 
 class EncoderArgumentGenerator;
 
@@ -21,19 +22,71 @@ class Y4MWriter {
 public:
     Y4MWriter(VideoInfo vi, VideoFormat outfmt, bool sarInContainerOnly = false);
     void inputFrame(const PVideoFrame& frame);
+    // ストリームヘッダ（改行含む）
+    const std::string& getHeader() const { return header; }
 protected:
     virtual void onWrite(MemoryChunk mc) = 0;
+    // 1フレーム分の出力 (chunksはフレームバッファを直接指す)
+    // contiguous: 全プレーンがpitch==rowsizeで、プレーン単位の連続領域になっている
+    // デフォルトはbufferにコピーしてonWriteに渡す
+    virtual void onWriteFrame(const PVideoFrame& frame, const std::vector<MemoryChunk>& chunks, bool contiguous);
     int n;
     int nc;
     std::string header;
     std::string frameHeader;
     AutoBuffer buffer;
+    std::vector<MemoryChunk> chunks;
+};
+
+// フレームバッファからパイプへコピーなしで書き込む
+// Linux: writevで書き込み、プレーンが連続している場合はvmspliceでページごとパイプに渡す
+//   vmspliceしたフレームはパイプから読み出されるまで書き換えられてはいけないので、
+//   その後にパイプ容量以上書き込むまで(=読み出されたことが確実になるまで)参照を保持する
+// Windows: 非対応(sendはfalseを返すので従来のコピー経路を使う)
+class Y4MPipeSender {
+public:
+    Y4MPipeSender(PIPE_HANDLE handle, bool allowSplice);
+    bool send(const PVideoFrame& frame, const std::vector<MemoryChunk>& chunks, bool contiguous);
+    // パイプの読み出し側が終了した後に呼ぶこと
+    void releaseFrames();
+private:
+    PIPE_HANDLE handle_;
+    bool useSplice_;
+    size_t pipeSize_;
+    size_t totalBytes_;
+    std::deque<std::pair<PVideoFrame, size_t>> heldFrames_;
+};
+
+// 共有メモリのフレームリングでフレームを送る（プロトコルはFrameRing.h、Linuxのみ）
+// フレームバッファからスロットへの1回のコピーだけで、パイプを通さずにエンコーダに渡す
+class FrameRingSender : NonCopyable {
+public:
+    // エンコーダの起動前に作ること（memfdとackパイプを子プロセスに継承させるため）
+    FrameRingSender(size_t frameBytes, int numSlots);
+    ~FrameRingSender();
+    // エンコーダ起動後に呼ぶ。子プロセス側のfdを閉じて制御パイプにヘッダを書き込む
+    void start(PIPE_HANDLE control, const std::string& y4mHeader);
+    // 1フレーム分のプレーンを空いたスロットにコピーしてスロット番号を送る
+    void send(const std::vector<MemoryChunk>& planes);
+private:
+    int memfd_;
+    int ackRead_;
+    int ackWrite_;
+    PIPE_HANDLE control_;
+    int numSlots_;
+    size_t slotSize_;
+    uint8_t* base_;
+    std::vector<uint32_t> freeSlots_;
+
+    void release();
+    void writeControl(const void* data, size_t size);
 };
 
 class Y4MEncodeWriter : AMTObject, NonCopyable {
     static const char* getYUV(VideoInfo vi);
 public:
-    Y4MEncodeWriter(AMTContext& ctx, const tstring& encoder_args, VideoInfo vi, VideoFormat fmt, bool disablePowerThrottoling, bool captureOutputOnly = false, StdRedirectedSubProcess::LineCallback lineCallback = StdRedirectedSubProcess::LineCallback(), bool sarInContainerOnly = false);
+    // frameRingSlots: 0より大きければ標準入力の代わりに共有メモリのフレームリングで送る
+    Y4MEncodeWriter(AMTContext& ctx, const tstring& encoder_args, VideoInfo vi, VideoFormat fmt, bool disablePowerThrottoling, bool captureOutputOnly = false, StdRedirectedSubProcess::LineCallback lineCallback = StdRedirectedSubProcess::LineCallback(), bool sarInContainerOnly = false, int frameRingSlots = 0);
     ~Y4MEncodeWriter();
 
     void inputFrame(const PVideoFrame& frame);
@@ -54,12 +107,15 @@ private:
         MyVideoWriter(Y4MEncodeWriter* this_, VideoInfo vi, VideoFormat fmt, bool sarInContainerOnly = false);
     protected:
         virtual void onWrite(MemoryChunk mc);
+        virtual void onWriteFrame(const PVideoFrame& frame, const std::vector<MemoryChunk>& chunks, bool contiguous);
     private:
         Y4MEncodeWriter* this_;
     };
 
     std::unique_ptr<MyVideoWriter> y4mWriter_;
+    std::unique_ptr<FrameRingSender> ring_;
     std::unique_ptr<StdRedirectedSubProcess> process_;
+    std::unique_ptr<Y4MPipeSender> sender_;
 };
 
 class AMTFilterVideoEncoder : public AMTObject {
@@ -70,7 +126,7 @@ public:
     void encode(
         PClip source, VideoFormat outfmt, const std::vector<double>& timeCodes,
         EncoderArgumentGenerator& argGen, const std::vector<int>& passList,
-        const std::vector<BitrateZone>& bitrateZones, double vfrBitrateScale,
+        const std::vector<BitrateZone>& bitrateZones, const std::vector<int>& sceneChanges, double vfrBitrateScale,
         const tstring& timecodePath, int vfrTimingFps, const tstring& baseOutputPath,
         EncodeFileKey key, int serviceId, const EncoderOptionInfo& eoInfo,
         const int pipeParallel, const bool disablePowerThrottoling, IScriptEnvironment* env,
@@ -82,6 +138,7 @@ private:
         EncoderArgumentGenerator& argGen,
         const std::vector<double>& timeCodes,
         const std::vector<BitrateZone>& bitrateZones,
+        const std::vector<int>& sceneChanges,
         double vfrBitrateScale,
         const tstring& timecodePath,
         int vfrTimingFps,
@@ -95,7 +152,7 @@ private:
         bool disablePowerThrottoling,
         const std::function<std::unique_ptr<AMTFilterSource>()>& filterSourceFactory);
 
-    class SpDataPumpThread : public DataPumpThread<std::unique_ptr<PVideoFrame>, true> {
+    class SpDataPumpThread : public SpscDataPumpThread<std::unique_ptr<PVideoFrame>, true> {
     public:
         SpDataPumpThread(AMTFilterVideoEncoder* this_, int bufferingFrames);
     protected:
@@ -139,7 +196,7 @@ private:
         AMTSimpleVideoEncoder * this_;
     };
 
-    class SpDataPumpThread : public DataPumpThread<std::unique_ptr<av::Frame>> {
+    class SpDataPumpThread : public SpscDataPumpThread<std::unique_ptr<av::Frame>> {
     public:
         SpDataPumpThread(AMTSimpleVideoEncoder* this_, int bufferingFrames);
     protected:
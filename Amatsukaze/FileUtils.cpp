@@ -9,6 +9,7 @@
 #include "FileUtils.h"
 #include "rgy_osdep.h"
 #include "rgy_codepage.h"
+#include <algorithm>
 #include <condition_variable>
 #include <deque>
 #include <exception>
@@ -17,12 +18,23 @@
 #include <vector>
 #if defined(_WIN32) || defined(_WIN64)
 #include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif // #if defined(_WIN32) || defined(_WIN64)
 #include "rgy_filesystem.h"
 
 class ReadAheadFile::Impl : NonCopyable {
 public:
-    Impl(const tstring& path, size_t bufferSize, size_t bufferCount)
+    virtual ~Impl() {}
+    virtual MemoryChunk read() = 0;
+    virtual int64_t size() const = 0;
+};
+
+class ReadAheadFile::ThreadImpl : public ReadAheadFile::Impl {
+public:
+    ThreadImpl(const tstring& path, size_t bufferSize, size_t bufferCount)
         : file_(path, _T("rb"))
         , fileSize_(file_.size())
         , buffers_(bufferCount)
@@ -39,7 +51,7 @@ public:
         thread_ = std::thread([this]() { run(); });
     }
 
-    ~Impl() {
+    ~ThreadImpl() {
         {
             std::lock_guard<std::mutex> lock(mutex_);
             stop_ = true;
@@ -51,7 +63,7 @@ public:
         }
     }
 
-    MemoryChunk read() {
+    virtual MemoryChunk read() {
         std::unique_lock<std::mutex> lock(mutex_);
         if (currentBuffer_ != NO_BUFFER) {
             freeBuffers_.push_back(currentBuffer_);
@@ -73,7 +85,7 @@ public:
         return MemoryChunk();
     }
 
-    int64_t size() const {
+    virtual int64_t size() const {
         return fileSize_;
     }
 
@@ -137,8 +149,202 @@ private:
     }
 };
 
-ReadAheadFile::ReadAheadFile(const tstring& path, size_t bufferSize, size_t bufferCount)
-    : impl_(new Impl(path, bufferSize, bufferCount)) {}
+// ファイル全体をメモリマップし、bufferSizeごとに切り出して返す。
+// ページキャッシュを直接参照するのでコピーが発生しない。
+// bufferCount個分先までOSに先読みを依頼し、読み終わった領域は解放を通知する。
+// 書き込まれてもファイルに反映されないようコピーオンライトでマップする。
+class ReadAheadFile::MappedImpl : public ReadAheadFile::Impl {
+public:
+    MappedImpl(const tstring& path, size_t bufferSize, size_t bufferCount)
+        : path_(path)
+        , base_(nullptr)
+        , fileSize_(0)
+        , bufferSize_(bufferSize)
+        , bufferCount_(bufferCount)
+        , pos_(0)
+#if defined(_WIN32) || defined(_WIN64)
+        , hFile_(INVALID_HANDLE_VALUE)
+        , hMap_(NULL)
+#else
+        , fd_(-1)
+#endif
+    {
+        if (bufferSize == 0 || bufferCount < 2) {
+            THROW(ArgumentException, "先読みバッファの指定が不正です");
+        }
+        try {
+            open();
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    ~MappedImpl() {
+        close();
+    }
+
+    virtual MemoryChunk read() {
+        if (pos_ >= fileSize_) {
+            return MemoryChunk();
+        }
+        const size_t length = (size_t)std::min<int64_t>(bufferSize_, fileSize_ - pos_);
+        MemoryChunk chunk(base_ + pos_, length);
+#if !(defined(_WIN32) || defined(_WIN64))
+        // 前回返した領域はもう使われないので解放してよい
+        if (pos_ >= (int64_t)bufferSize_) {
+            advise(pos_ - bufferSize_, bufferSize_, MADV_DONTNEED);
+        }
+        // bufferCount-1個先の領域の先読みを依頼（手前は前回までに依頼済み）
+        const int64_t ahead = pos_ + (int64_t)bufferSize_ * (bufferCount_ - 1);
+        if (ahead < fileSize_) {
+            advise(ahead, bufferSize_, MADV_WILLNEED);
+        }
+#endif
+        pos_ += length;
+        return chunk;
+    }
+
+    virtual int64_t size() const {
+        return fileSize_;
+    }
+
+private:
+    const tstring path_; // エラーメッセージ表示用
+    uint8_t* base_;
+    int64_t fileSize_;
+    size_t bufferSize_;
+    size_t bufferCount_;
+    int64_t pos_;
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE hFile_;
+    HANDLE hMap_;
+
+    void open() {
+        hFile_ = CreateFile(path_.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (hFile_ == INVALID_HANDLE_VALUE) {
+            THROWF(IOException, "ファイルを開けません: %s", GetFullPath(path_));
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(hFile_, &size)) {
+            THROWF(IOException, "ファイルサイズを取得できません: %s", GetFullPath(path_));
+        }
+        fileSize_ = size.QuadPart;
+        if (fileSize_ == 0) {
+            return;
+        }
+        hMap_ = CreateFileMapping(hFile_, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if (hMap_ == NULL) {
+            THROWF(IOException, "ファイルをメモリマップできません: %s", GetFullPath(path_));
+        }
+        base_ = (uint8_t*)MapViewOfFile(hMap_, FILE_MAP_COPY, 0, 0, 0);
+        if (base_ == nullptr) {
+            THROWF(IOException, "ファイルをメモリマップできません: %s", GetFullPath(path_));
+        }
+    }
+
+    void close() {
+        if (base_ != nullptr) {
+            UnmapViewOfFile(base_);
+            base_ = nullptr;
+        }
+        if (hMap_ != NULL) {
+            CloseHandle(hMap_);
+            hMap_ = NULL;
+        }
+        if (hFile_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile_);
+            hFile_ = INVALID_HANDLE_VALUE;
+        }
+    }
+#else
+    int fd_;
+
+    void open() {
+        fd_ = ::open(path_.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            THROWF(IOException, "ファイルを開けません: %s", GetFullPath(path_));
+        }
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            THROWF(IOException, "ファイルサイズを取得できません: %s", GetFullPath(path_));
+        }
+        fileSize_ = st.st_size;
+        if (fileSize_ == 0) {
+            return;
+        }
+        void* ptr = mmap(nullptr, (size_t)fileSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd_, 0);
+        if (ptr == MAP_FAILED) {
+            THROWF(IOException, "ファイルをメモリマップできません: %s", GetFullPath(path_));
+        }
+        base_ = (uint8_t*)ptr;
+        madvise(base_, (size_t)fileSize_, MADV_SEQUENTIAL);
+        // 最初のbufferCount-1個分の先読みを依頼
+        advise(0, bufferSize_ * (bufferCount_ - 1), MADV_WILLNEED);
+    }
+
+    void close() {
+        if (base_ != nullptr) {
+            munmap(base_, (size_t)fileSize_);
+            base_ = nullptr;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    // [offset, offset+length)を含むページ範囲にmadviseする（ヒントなので失敗は無視）
+    void advise(int64_t offset, size_t length, int advice) {
+        static const int64_t pageSize = sysconf(_SC_PAGESIZE);
+        const int64_t start = offset / pageSize * pageSize;
+        const int64_t end = std::min<int64_t>(offset + (int64_t)length, fileSize_);
+        if (end > start) {
+            madvise(base_ + start, (size_t)(end - start), advice);
+        }
+    }
+#endif
+};
+
+void File::appendFrom(const tstring& srcpath) const {
+    File src(srcpath, _T("rb"));
+    const int64_t srcSize = src.size();
+    seek(0, SEEK_END);
+    int64_t copied = 0;
+#if !(defined(_WIN32) || defined(_WIN64))
+    // カーネル内でコピーする（対応するファイルシステムではデータを共有するのでコピーが発生しない）
+    // 使えない場合は残りを通常の読み書きでコピーする
+    flush();
+    const int dstfd = fileno(fp_);
+    const int srcfd = fileno(src.fp_);
+    while (copied < srcSize) {
+        const ssize_t ret = copy_file_range(srcfd, nullptr, dstfd, nullptr, (size_t)(srcSize - copied), 0);
+        if (ret <= 0) {
+            break;
+        }
+        copied += ret;
+    }
+    // ファイルディスクリプタを直接操作したのでストリームの位置を合わせ直す
+    seek(0, SEEK_END);
+    src.seek(copied, SEEK_SET);
+#endif // #if !(defined(_WIN32) || defined(_WIN64))
+    enum { BUF_SIZE = 4 * 1024 * 1024 };
+    std::vector<uint8_t> buf(BUF_SIZE);
+    while (copied < srcSize) {
+        const size_t readBytes = src.read(MemoryChunk(buf.data(), (size_t)std::min<int64_t>(BUF_SIZE, srcSize - copied)));
+        if (readBytes == 0) {
+            THROWF(IOException, "failed to read from file: %s", GetFullPath(srcpath));
+        }
+        write(MemoryChunk(buf.data(), readBytes));
+        copied += readBytes;
+    }
+}
+
+ReadAheadFile::ReadAheadFile(const tstring& path, size_t bufferSize, size_t bufferCount, bool memoryMap)
+    : impl_(memoryMap
+        ? static_cast<Impl*>(new MappedImpl(path, bufferSize, bufferCount))
+        : static_cast<Impl*>(new ThreadImpl(path, bufferSize, bufferCount))) {}
 
 ReadAheadFile::~ReadAheadFile() = default;
 
@@ -177,6 +177,8 @@ public:
     static void copy(const tstring& srcpath, const tstring& dstpath) {
         rgy_file_copy(srcpath, dstpath, true);
     }
+    // srcpathのファイルの内容をこのファイルの末尾に追加する
+    void appendFrom(const tstring& srcpath) const;
 private:
     const tstring path_; // エラーメッセージ表示用
     FILE* fp_;
@@ -185,9 +187,11 @@ private:
 // 逐次読み込みを別スレッドで先行させ、利用側の処理とファイルI/Oを並行実行する。
 // read() は単一スレッドから呼び、返された領域は次の read() 呼び出しまで有効。
 // 終了時に同期read中の場合、そのreadがOSから戻るまでデストラクタは待機する。
+// memoryMap=trueの場合はスレッドを使わずファイルをメモリマップして同じ単位で返す。
+// この場合、読み込めるのは開いた時点のファイルサイズまで。
 class ReadAheadFile : NonCopyable {
 public:
-    ReadAheadFile(const tstring& path, size_t bufferSize, size_t bufferCount);
+    ReadAheadFile(const tstring& path, size_t bufferSize, size_t bufferCount, bool memoryMap = false);
     ~ReadAheadFile();
 
     MemoryChunk read();
@@ -195,6 +199,8 @@ public:
 
 private:
     class Impl;
+    class ThreadImpl;
+    class MappedImpl;
     std::unique_ptr<Impl> impl_;
 };
 
@@ -7,8 +7,13 @@
 */
 
 #include "FilteredSource.h"
+#include "zlib.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <future>
+#include <set>
 #include <string>
 
 namespace {
@@ -152,6 +157,51 @@ static bool detectActualDrop(const StreamReformInfo& reformInfo, EncodeFileKey k
     return false;
 }
 
+static std::vector<uint8_t> readFileBytes(const tstring& path) {
+    File file(path, _T("rb"));
+    std::vector<uint8_t> buf((size_t)file.size());
+    if (buf.size() > 0 && file.read(MemoryChunk(buf.data(), buf.size())) != buf.size()) {
+        THROWF(IOException, "failed to read file: %s", path);
+    }
+    return buf;
+}
+
+// 前処理パスの分割並列でシャードごとに使うAMT_SHARD_TMP
+static tstring getShardTmpPath(const tstring& tmppath, int shard) {
+    return tmppath + StringFormat(_T(".shard%d"), shard);
+}
+
+// 各シャードが出力した <AMT_TMP>.shard<i><suffix> をシャード順に連結して <AMT_TMP><suffix> にする
+// フレーム順に追記される解析結果ファイルを想定（ヘッダはシャード0だけが書くこと）
+static void mergeShardFiles(AMTContext& ctx, const tstring& tmppath, int numShards) {
+    const auto dir = pathGetDirectory(tmppath);
+    const auto base = tmppath.substr(dir.size() + 1);
+    std::set<tstring> suffixes;
+    for (int i = 0; i < numShards; i++) {
+        const auto prefix = base + StringFormat(_T(".shard%d"), i);
+        for (const auto& name : GetDirectoryFiles(dir, prefix + _T("*"))) {
+            const auto suffix = name.substr(prefix.size());
+            // .shard1 に対して .shard10 などが引っかかるので除外
+            if (suffix.empty() || suffix[0] == _T('.')) {
+                suffixes.insert(suffix);
+            }
+        }
+    }
+    for (const auto& suffix : suffixes) {
+        File dst(tmppath + suffix, _T("wb"));
+        for (int i = 0; i < numShards; i++) {
+            const auto srcpath = getShardTmpPath(tmppath, i) + suffix;
+            if (!File::exists(srcpath)) {
+                continue;
+            }
+            auto buf = readFileBytes(srcpath);
+            dst.write(MemoryChunk(buf.data(), buf.size()));
+            removeT(srcpath.c_str());
+        }
+        ctx.debugF(_T("フィルタ前処理結果を結合: %s"), tmppath + suffix);
+    }
+}
+
 } // namespace
 
 void RFFExtractor::clear() {
@@ -333,6 +383,7 @@ AMTFilterSource::AMTFilterSource(AMTContext&ctx,
     const ConfigWrapper& setting,
     const StreamReformInfo& reformInfo,
     const std::vector<EncoderZone>& zones,
+    const std::vector<int>& sceneChanges,
     const tstring& logopath,
     EncodeFileKey key,
     const ResourceManger& rm)
@@ -344,12 +395,27 @@ AMTFilterSource::AMTFilterSource(AMTContext&ctx,
         // フィルタ前処理用リソース確保
         auto res = rm.wait(HOST_CMD_Filter);
 
+        // 入力が同じなら前回の前処理結果を再利用する
+        const auto prepassCachePath = MakePrepassCachePath(key, reformInfo, zones, logopath);
         int pass = 0;
-        for (; pass < 4; pass++) {
-            if (!FilterPass(pass, res.gpuIndex, key, reformInfo, logopath)) {
-                break;
+        if (LoadPrepassCache(prepassCachePath, key, pass)) {
+            ctx.infoF(_T("[一時ファイル再利用] フィルタ前処理結果を再利用します(%dパス): %s"), pass, prepassCachePath);
+        } else {
+            for (; pass < 4; pass++) {
+                if (!FilterPass(pass, res.gpuIndex, key, reformInfo, logopath)) {
+                    break;
+                }
+                // 分割並列に対応したフィルタはフレーム範囲を分けて並列に読む
+                if (env_->GetVarDef("AMT_PRE_PROC_PARALLEL", false).AsBool()) {
+                    ReadAllFramesParallel(pass, res.gpuIndex, key, reformInfo, logopath);
+                } else {
+                    ReadAllFrames(pass);
+                }
+            }
+            // 前処理があった場合だけ保存
+            if (pass > 0) {
+                SavePrepassCache(prepassCachePath, key, pass);
             }
-            ReadAllFrames(pass);
         }
 
         // エンコード用リソース確保
@@ -398,6 +464,7 @@ AMTFilterSource::AMTFilterSource(AMTContext&ctx,
         writeScriptFile(key);
 
         MakeZones(key, zones, reformInfo);
+        MakeSceneChanges(key, sceneChanges, reformInfo);
 
         MakeOutFormat(reformInfo.getFormat(key).videoFormat);
 
@@ -502,6 +569,7 @@ AMTFilterSource::AMTFilterSource(AMTContext& ctx, const AMTFilterSource& source)
     // メタデータをコピー（スレッドごとに環境は別）
     outfmt_ = source.outfmt_;
     outZones_ = source.outZones_;
+    outSceneChanges_ = source.outSceneChanges_;
     timeCodes_ = source.timeCodes_;
 }
 
@@ -522,6 +590,10 @@ const std::vector<EncoderZone> AMTFilterSource::getZones() const {
     return outZones_;
 }
 
+const std::vector<int>& AMTFilterSource::getSceneChanges() const {
+    return outSceneChanges_;
+}
+
 // 各フレームの時間ms(最後のフレームの表示時間を定義するため要素数はフレーム数+1)
 const std::vector<double>& AMTFilterSource::getTimeCodes() const {
     return timeCodes_;
@@ -583,7 +655,10 @@ std::vector<tstring> AMTFilterSource::GetSuitablePlugins(const tstring& basepath
 void AMTFilterSource::InitEnv() {
     env_ = nullptr;
     env_ = make_unique_ptr(CreateScriptEnvironment2());
+    InitScript();
+}
 
+void AMTFilterSource::InitScript() {
     script_.Clear();
     auto& sb = script_.Get();
     if (setting_.isDumpFilter()) {
@@ -632,6 +707,77 @@ void AMTFilterSource::ReadAllFrames(int pass) {
     ctx.infoF(_T("フィルタパス%d 完了: %.2f秒"), pass + 1, sw.getTotal());
 }
 
+void AMTFilterSource::ReadAllFramesParallel(int pass, int gpuIndex,
+    EncodeFileKey key,
+    const StreamReformInfo& reformInfo,
+    const tstring& logopath) {
+    const int numFrames = env_->GetVar("last").AsClip()->GetVideoInfo().num_frames;
+    const int maxShards = (setting_.getFilterPrepassParallel() > 0)
+        ? setting_.getFilterPrepassParallel()
+        : std::min(8, std::max(1, GetProcessorCount() / 2));
+    // 短いとスクリプト環境を作るコストの方が大きいので、1シャードあたり最低1000フレームにする
+    const int minFramesPerShard = 1000;
+    const int numShards = std::max(1, std::min(maxShards, numFrames / minFramesPerShard));
+    if (numShards <= 1) {
+        // 分割なしのときはAMT_SHARD_TMP == AMT_TMPなので結合は不要
+        ReadAllFrames(pass);
+        return;
+    }
+    // 分割なしで作ったフィルタグラフは使わないので先に解放する
+    env_ = nullptr;
+
+    struct Shard {
+        ScriptEnvironmentPointer env;
+        PClip clip; // envより先に解放すること
+        int start, end;
+    };
+    std::vector<Shard> shards;
+    for (int i = 0; i < numShards; i++) {
+        FilterPass(pass, gpuIndex, key, reformInfo, logopath, i, numShards);
+        Shard shard = { std::move(env_), nullptr,
+            (int)((int64_t)numFrames * i / numShards), (int)((int64_t)numFrames * (i + 1) / numShards) };
+        shard.clip = shard.env->GetVar("last").AsClip();
+        shards.push_back(std::move(shard));
+    }
+
+    ctx.infoF(_T("フィルタパス%d 予定フレーム数: %d (%d分割並列)"), pass + 1, numFrames, numShards);
+    Stopwatch sw;
+    sw.start();
+    std::atomic<int> finished(0);
+    std::vector<std::future<void>> threads;
+    for (auto& shard : shards) {
+        threads.push_back(std::async(std::launch::async, [&finished](Shard* s) {
+            try {
+                for (int i = s->start; i < s->end; i++) {
+                    PVideoFrame frame = s->clip->GetFrame(i, s->env.get());
+                    finished++;
+                }
+            } catch (const AvisynthError& avserror) {
+                // AvisynthErrorは環境に依存しているのでここで変換する
+                THROWF(AviSynthException, "%s", avserror.msg);
+            }
+        }, &shard));
+    }
+    int prevFrames = 0;
+    for (auto& th : threads) {
+        while (th.wait_for(std::chrono::seconds(1)) != std::future_status::ready) {
+            const int current = finished.load();
+            double elapsed = sw.current();
+            ctx.progressF(_T("%dフレーム完了 %.2ffps"), current, (current - prevFrames) / elapsed);
+            prevFrames = current;
+            sw.stop();
+        }
+    }
+    for (auto& th : threads) {
+        th.get();
+    }
+    // フィルタの終了処理で解析結果が書き出されるので、環境を解放してから結合する
+    shards.clear();
+    mergeShardFiles(ctx, setting_.getAvsTmpPath(key), numShards);
+
+    ctx.infoF(_T("フィルタパス%d 完了: %.2f秒"), pass + 1, sw.getTotal());
+}
+
 void AMTFilterSource::defineMakeSource(
     EncodeFileKey key,
     const StreamReformInfo& reformInfo,
@@ -646,8 +792,8 @@ void AMTFilterSource::defineMakeSource(
     auto eraseLogo = [&](const tstring& logopath, const tstring& logoFramePath, bool forceEnable) {
         if (forceEnable || File::exists(logoFramePath)) {
             sb.append("\tlogo = \"%s\"\n", logopath);
-            sb.append("\tAMTEraseLogo(AMTAnalyzeLogo(logo), logo, \"%s\", maxfade=%d)\n",
-                logoFramePath, setting_.getMaxFadeLength());
+            sb.append("\tAMTEraseLogo(AMTAnalyzeLogo(logo, cachedir=\"%s\"), logo, \"%s\", maxfade=%d)\n",
+                setting_.getLogoCacheDir(), logoFramePath, setting_.getMaxFadeLength());
             ++numEraseLogo;
         }
         };
@@ -710,9 +856,19 @@ void AMTFilterSource::trimInput(EncodeFileKey key,
 bool AMTFilterSource::FilterPass(int pass, int gpuIndex,
     EncodeFileKey key,
     const StreamReformInfo& reformInfo,
-    const tstring& logopath) {
+    const tstring& logopath,
+    int shard, int numShards) {
     InitEnv();
+    MakePassScript(pass, gpuIndex, key, reformInfo, logopath, shard, numShards);
+    script_.Apply(env_.get());
+    return env_->GetVarDef("AMT_PRE_PROC", false).AsBool();
+}
 
+void AMTFilterSource::MakePassScript(int pass, int gpuIndex,
+    EncodeFileKey key,
+    const StreamReformInfo& reformInfo,
+    const tstring& logopath,
+    int shard, int numShards) {
     auto tmppath = setting_.getAvsTmpPath(key);
 
     defineMakeSource(key, reformInfo, logopath);
@@ -722,15 +878,112 @@ bool AMTFilterSource::FilterPass(int pass, int gpuIndex,
     sb.append("AMT_TMP = \"%s\"\n", pathToOS(tmppath));
     sb.append("AMT_PASS = %d\n", pass);
     sb.append("AMT_DEV = %d\n", gpuIndex);
+    // 前処理パスの分割並列用
+    // AMT_PRE_PROC_PARALLEL = true を設定したフィルタは、解析結果を AMT_SHARD_TMP + ".xxx" に
+    // フレーム順で出力すること（シャード順に連結して AMT_TMP + ".xxx" になる）
+    sb.append("AMT_SHARD = %d\n", shard);
+    sb.append("AMT_NUM_SHARDS = %d\n", numShards);
+    if (numShards > 1) {
+        sb.append("AMT_SHARD_TMP = \"%s\"\n", pathToOS(getShardTmpPath(tmppath, shard)));
+    } else {
+        sb.append("AMT_SHARD_TMP = AMT_TMP\n");
+    }
     sb.append("AMT_SOURCE\n");
 
     tstring mainpath = setting_.getFilterScriptPath();
     if (mainpath.size()) {
         sb.append("Import(\"%s\")\n", mainpath);
     }
+}
 
-    script_.Apply(env_.get());
-    return env_->GetVarDef("AMT_PRE_PROC", false).AsBool();
+tstring AMTFilterSource::MakePrepassCachePath(
+    EncodeFileKey key,
+    const StreamReformInfo& reformInfo,
+    const std::vector<EncoderZone>& zones,
+    const tstring& logopath) {
+    uint32_t crc = 0;
+    uint32_t adler = 1;
+    auto add = [&](const void* data, size_t size) {
+        crc = (uint32_t)crc32(crc, (const Bytef*)data, (uInt)size);
+        adler = (uint32_t)adler32(adler, (const Bytef*)data, (uInt)size);
+    };
+    auto addFile = [&](const tstring& path) {
+        if (path.size() > 0 && File::exists(path)) {
+            const auto data = readFileBytes(path);
+            const int64_t size = (int64_t)data.size();
+            add(&size, sizeof(size));
+            add(data.data(), data.size());
+        } else {
+            const int64_t size = -1;
+            add(&size, sizeof(size));
+        }
+    };
+
+    // パス番号以外は全パス同じなのでパス0のスクリプトで代表させる
+    // GPUは実行ごとに変わるので含めない
+    InitScript();
+    MakePassScript(0, 0, key, reformInfo, logopath, 0, 1);
+    const auto script = script_.Get().str();
+    script_.Clear();
+    add(script.data(), script.size());
+    // Importされるフィルタスクリプトの中身
+    addFile(setting_.getFilterScriptPath());
+    addFile(setting_.getTmpAMTSourcePath(key.video));
+    // ロゴ消しに使うlogoframe
+    addFile(setting_.getTmpLogoFramePath(key.video));
+    for (int i = 0; i < (int)setting_.getEraseLogoPath().size(); i++) {
+        addFile(setting_.getTmpLogoFramePath(key.video, i));
+    }
+    for (const auto& zone : zones) {
+        add(&zone, sizeof(zone));
+    }
+    return setting_.getTmpPrepassCachePath(StringFormat(_T("%08x%08x"), crc, adler));
+}
+
+bool AMTFilterSource::LoadPrepassCache(const tstring& cachepath, EncodeFileKey key, int& numPasses) {
+    if (!File::exists(cachepath)) {
+        return false;
+    }
+    try {
+        const auto tmppath = setting_.getAvsTmpPath(key);
+        File file(cachepath, _T("rb"));
+        const int cachedPasses = file.readValue<int>();
+        const int numFiles = file.readValue<int>();
+        if (cachedPasses <= 0 || numFiles < 0) {
+            THROW(FormatException, "フィルタ前処理キャッシュが不正です");
+        }
+        for (int i = 0; i < numFiles; i++) {
+            const auto suffix = file.readString();
+            const auto data = file.readArray<uint8_t>();
+            File dst(tmppath + char_to_tstring(suffix), _T("wb"));
+            dst.write(MemoryChunk(const_cast<uint8_t*>(data.data()), data.size()));
+        }
+        numPasses = cachedPasses;
+        return true;
+    } catch (const Exception& e) {
+        ctx.warnF(_T("[一時ファイル再利用] フィルタ前処理キャッシュの読み込みに失敗しました: %s"), e.message());
+    }
+    return false;
+}
+
+void AMTFilterSource::SavePrepassCache(const tstring& cachepath, EncodeFileKey key, int numPasses) {
+    try {
+        // 前処理パスで作られた AMT_TMP + ".xxx" をすべて保存する
+        const auto tmppath = setting_.getAvsTmpPath(key);
+        const auto dir = pathGetDirectory(tmppath);
+        const auto base = tmppath.substr(dir.size() + 1);
+        const auto names = GetDirectoryFiles(dir, base + _T("*"));
+        File file(cachepath, _T("wb"));
+        file.writeValue(numPasses);
+        file.writeValue((int)names.size());
+        for (const auto& name : names) {
+            file.writeString(tchar_to_string(name.substr(base.size())));
+            file.writeArray(readFileBytes(dir + _T("/") + name));
+        }
+    } catch (const Exception& e) {
+        ctx.warnF(_T("[一時ファイル再利用] フィルタ前処理キャッシュの保存に失敗しました: %s"), e.message());
+        removeT(cachepath.c_str());
+    }
 }
 
 void AMTFilterSource::MakeZones(
@@ -802,6 +1055,33 @@ void AMTFilterSource::MakeZones(
     }
 }
 
+void AMTFilterSource::MakeSceneChanges(
+    EncodeFileKey key,
+    const std::vector<int>& sceneChanges,
+    const StreamReformInfo& reformInfo) {
+    const auto& outFrames = reformInfo.getEncodeFile(key).videoFrames;
+    const int numSrcFrames = (int)outFrames.size();
+    const int numOutFrames = filter_->GetVideoInfo().num_frames;
+    const VideoFormat& infmt = reformInfo.getFormat(key).videoFormat;
+    const double tick = (double)infmt.frameRateDenom / infmt.frameRateNum;
+    const double scale = (double)numOutFrames / numSrcFrames;
+
+    // ゾーンと同じ方法で出力フレーム番号に変換する
+    outSceneChanges_.clear();
+    for (int sc : sceneChanges) {
+        int frame = (int)(std::lower_bound(outFrames.begin(), outFrames.end(), sc) - outFrames.begin());
+        if (timeCodes_.size()) {
+            frame = (int)(std::lower_bound(timeCodes_.begin(), timeCodes_.end(), frame * tick * 1000) - timeCodes_.begin());
+        } else if (numSrcFrames != numOutFrames) {
+            frame = (int)std::round(frame * scale);
+        }
+        if (frame > 0 && frame < numOutFrames &&
+            (outSceneChanges_.empty() || outSceneChanges_.back() < frame)) {
+            outSceneChanges_.push_back(frame);
+        }
+    }
+}
+
 void AMTFilterSource::MakeOutFormat(const VideoFormat& infmt) {
     auto vi = filter_->GetVideoInfo();
     // vi_からエンコーダ入力用VideoFormatを生成する
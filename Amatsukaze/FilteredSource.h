@@ -61,6 +61,7 @@ public:
         const ConfigWrapper& setting,
         const StreamReformInfo& reformInfo,
         const std::vector<EncoderZone>& zones,
+        const std::vector<int>& sceneChanges,
         const tstring& logopath,
         EncodeFileKey key,
         const ResourceManger& rm);
@@ -79,6 +80,9 @@ public:
     // 入力ゾーンのtrim後のゾーンを返す
     const std::vector<EncoderZone> getZones() const;
 
+    // 入力のシーンチェンジ位置を出力フレーム番号に変換したもの（昇順）
+    const std::vector<int>& getSceneChanges() const;
+
     // 各フレームの時間ms(最後のフレームの表示時間を定義するため要素数はフレーム数+1)
     const std::vector<double>& getTimeCodes() const;
 
@@ -93,6 +97,7 @@ private:
     PClip filter_;
     VideoFormat outfmt_;
     std::vector<EncoderZone> outZones_;
+    std::vector<int> outSceneChanges_;
     std::vector<double> timeCodes_;
     int vfrTimingFps_;
 
@@ -102,8 +107,17 @@ private:
 
     void InitEnv();
 
+    void InitScript();
+
     void ReadAllFrames(int pass);
 
+    // フレーム範囲を分割して別々のスクリプト環境で並列に読み込む
+    // 各シャードの解析結果ファイルは読み込み後に連結する
+    void ReadAllFramesParallel(int pass, int gpuIndex,
+        EncodeFileKey key,
+        const StreamReformInfo& reformInfo,
+        const tstring& logopath);
+
     void defineMakeSource(
         EncodeFileKey key,
         const StreamReformInfo& reformInfo,
@@ -113,16 +127,43 @@ private:
         const StreamReformInfo& reformInfo);
 
     // 戻り値: 前処理？
+    // shard/numShardsは前処理パスの分割並列時のシャード番号/シャード数
     bool FilterPass(int pass, int gpuIndex,
         EncodeFileKey key,
         const StreamReformInfo& reformInfo,
+        const tstring& logopath,
+        int shard = 0, int numShards = 1);
+
+    // FilterPassで評価するスクリプトを作る（InitScriptの後に呼ぶ）
+    void MakePassScript(int pass, int gpuIndex,
+        EncodeFileKey key,
+        const StreamReformInfo& reformInfo,
+        const tstring& logopath,
+        int shard, int numShards);
+
+    // 前処理の入力（スクリプト、フィルタ、AMTSource、ロゴ解析結果、ゾーン）から
+    // 前処理結果のキャッシュファイルパスを作る
+    tstring MakePrepassCachePath(
+        EncodeFileKey key,
+        const StreamReformInfo& reformInfo,
+        const std::vector<EncoderZone>& zones,
         const tstring& logopath);
 
+    // キャッシュから前処理の出力ファイルを復元する。成功したらnumPassesに前処理パス数を入れる
+    bool LoadPrepassCache(const tstring& cachepath, EncodeFileKey key, int& numPasses);
+
+    void SavePrepassCache(const tstring& cachepath, EncodeFileKey key, int numPasses);
+
     void MakeZones(
         EncodeFileKey key,
         const std::vector<EncoderZone>& zones,
         const StreamReformInfo& reformInfo);
 
+    void MakeSceneChanges(
+        EncodeFileKey key,
+        const std::vector<int>& sceneChanges,
+        const StreamReformInfo& reformInfo);
+
     void MakeOutFormat(const VideoFormat& infmt);
 };
 
@@ -0,0 +1,175 @@
+﻿#pragma once
+
+/**
+* Shared memory frame ring for encoder wrappers
+* Copyright (c) 2017-2019 Nekopanda
+*
+* This software is released under the MIT License.
+* http://opensource.org/licenses/mit-license.php
+*/
+#pragma once
+
+// 共有メモリのフレームリングでエンコーダ（ラッパー）にフレームを渡すプロトコル（Linuxのみ）
+//
+// エンコーダの標準入力を制御パイプとして使い、フレームデータはmemfdのスロットに置く
+//   1. テキスト1行 "AMTFRAMERING <バージョン> memfd=<fd> ack=<fd> slots=<スロット数> slotsize=<バイト数>"
+//   2. 通常のY4Mストリームヘッダ1行（フレームのフォーマットはこれで判断する）
+//   3. 以降1フレームごとにFrameRingRecord（スロット番号とバイト数）
+//   標準入力のEOFがストリームの終わり
+// スロットslotのデータはmemfdのslot*slotsizeの位置にあり、Y4Mの1フレーム分（FRAME行を除いたプレーン）が入っている
+// 読み出し側は使い終わったスロットの番号(uint32_t)をackに書き込んで返却する
+// 返却されるまで送信側はそのスロットを書き換えないので、読み出し側はコピーせずに参照できる
+// memfdとackは子プロセスにfd番号そのままで継承される
+//
+// FrameRingReaderは読み出し側の参照実装で、Amatsukazeの他のコードに依存しないのでラッパーにそのまま組み込める
+
+#include <cstdint>
+#include <cstddef>
+
+enum {
+    FRAME_RING_VERSION = 1,
+};
+
+struct FrameRingRecord {
+    uint32_t slot;
+    uint32_t bytes;
+};
+
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <string>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/mman.h>
+
+class FrameRingReader {
+public:
+    // controlFdは制御パイプ（通常は標準入力）
+    explicit FrameRingReader(int controlFd = STDIN_FILENO)
+        : controlFd_(controlFd)
+        , memfd_(-1)
+        , ackFd_(-1)
+        , numSlots_(0)
+        , slotSize_(0)
+        , base_(nullptr) {}
+
+    ~FrameRingReader() {
+        if (base_ != nullptr) {
+            munmap((void*)base_, (size_t)numSlots_ * slotSize_);
+        }
+        if (memfd_ >= 0) {
+            ::close(memfd_);
+        }
+        if (ackFd_ >= 0) {
+            ::close(ackFd_);
+        }
+    }
+
+    FrameRingReader(const FrameRingReader&) = delete;
+    FrameRingReader& operator=(const FrameRingReader&) = delete;
+
+    // プロトコルヘッダとY4Mストリームヘッダを読んでリングをマップする
+    bool open() {
+        std::string line;
+        if (!readLine(line)) {
+            return false;
+        }
+        int version = 0;
+        unsigned long long slotSize = 0;
+        if (sscanf(line.c_str(), "AMTFRAMERING %d memfd=%d ack=%d slots=%d slotsize=%llu",
+            &version, &memfd_, &ackFd_, &numSlots_, &slotSize) != 5 ||
+            version != FRAME_RING_VERSION || numSlots_ <= 0 || slotSize == 0) {
+            return false;
+        }
+        slotSize_ = (size_t)slotSize;
+        void* base = mmap(nullptr, (size_t)numSlots_ * slotSize_, PROT_READ, MAP_SHARED, memfd_, 0);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        base_ = (const uint8_t*)base;
+        return readLine(y4mHeader_);
+    }
+
+    // Y4Mストリームヘッダ（改行を除く）
+    const std::string& y4mHeader() const { return y4mHeader_; }
+
+    int numSlots() const { return numSlots_; }
+
+    // 次のフレームを取得する。ストリームの終わりかエラーならfalse（正常な終わりならerrnoは0）
+    // dataはrelease(slot)するまで有効
+    bool next(const uint8_t*& data, size_t& bytes, uint32_t& slot) {
+        FrameRingRecord record;
+        errno = 0;
+        if (!readAll(&record, sizeof(record))) {
+            return false;
+        }
+        if (record.slot >= (uint32_t)numSlots_ || record.bytes > slotSize_) {
+            errno = EPROTO;
+            return false;
+        }
+        data = base_ + (size_t)record.slot * slotSize_;
+        bytes = record.bytes;
+        slot = record.slot;
+        return true;
+    }
+
+    // 使い終わったスロットを返却する
+    bool release(uint32_t slot) {
+        const uint8_t* ptr = (const uint8_t*)&slot;
+        size_t remain = sizeof(slot);
+        while (remain > 0) {
+            const ssize_t ret = ::write(ackFd_, ptr, remain);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            ptr += ret;
+            remain -= (size_t)ret;
+        }
+        return true;
+    }
+
+private:
+    int controlFd_;
+    int memfd_;
+    int ackFd_;
+    int numSlots_;
+    size_t slotSize_;
+    const uint8_t* base_;
+    std::string y4mHeader_;
+
+    bool readAll(void* buf, size_t size) {
+        uint8_t* ptr = (uint8_t*)buf;
+        while (size > 0) {
+            const ssize_t ret = ::read(controlFd_, ptr, size);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            if (ret == 0) {
+                return false;
+            }
+            ptr += ret;
+            size -= (size_t)ret;
+        }
+        return true;
+    }
+
+    // ヘッダ行は短いので1バイトずつ読む（後続のレコードを読みすぎないように）
+    bool readLine(std::string& line) {
+        line.clear();
+        char c;
+        while (readAll(&c, 1)) {
+            if (c == '\n') {
+                return true;
+            }
+            line.push_back(c);
+        }
+        return false;
+    }
+};
+#endif
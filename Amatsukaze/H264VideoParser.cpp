@@ -457,6 +457,9 @@ void H264SuplementaryEnhancementInformation::recovery_point(BitReader& reader_or
 
 H264VideoParser::H264VideoParser(AMTContext& ctx)
     : AMTObject(ctx)
+    , buffer()
+    , nalUnits()
+    , parseNalUnit(get_parse_nal_unit_h264_func())
     , beffering_period_DTS()
     , sps()
     , pps()
@@ -692,7 +695,7 @@ void H264VideoParser::frameType(uint8_t primary_pic_type, FRAME_TYPE& type) {
 }
 
 void H264VideoParser::pushNalUnit(int unitStart, int lastNonZero) {
-    if (lastNonZero > 0) {
+    if (lastNonZero > unitStart) {
         NalUnit nal;
         nal.offset = unitStart;
         // rbsp_stop_one_bitを取り除く
@@ -711,33 +714,50 @@ void H264VideoParser::pushNalUnit(int unitStart, int lastNonZero) {
 void H264VideoParser::storeBuffer(MemoryChunk frame) {
     buffer.clear();
     nalUnits.clear();
-    buffer.add(MemoryChunk(frame.data, 2));
-    int32_t n3bytes = (frame.data[0] << 8) | frame.data[1];
-    int unitStart = 0;
-    int lastNonZero = 0;
-    int unitStartOrig = 0;
-    int lastNonZeroOrig = 0;
-    for (int i = 2; i < (int)frame.length; i++) {
-        uint8_t inByte = frame.data[i];
-        n3bytes = ((n3bytes & 0xFFFF) << 8) | inByte;
-        if (n3bytes == 0x03) {
-            // skip one byte
-            //PRINTF("Skip one byte (H264 NAL)\n");
-        } else {
-            buffer.add(inByte);
-            int k = (int)buffer.size();
-
-            if (n3bytes == 0x01) {
-                // start code prefix
-                pushNalUnit(unitStart, lastNonZero);
-                unitStart = k;
-                unitStartOrig = i;
-            }
-            if (inByte) {
-                lastNonZero = k;
-                lastNonZeroOrig = i;
+    // スタートコードの検索はSIMD版を使う
+    for (const auto& nalInfo : parseNalUnit(frame.data, frame.length)) {
+        const uint8_t* ptr = nalInfo.ptr;
+        const uint8_t* end = nalInfo.ptr + nalInfo.size;
+        // スタートコードを飛ばす
+        while (ptr < end && *ptr == 0) {
+            ++ptr;
+        }
+        if (ptr < end && *ptr == 1) {
+            ++ptr;
+        }
+        // 末尾のゼロ(trailing_zero_8bitsや次のスタートコードの先頭)を除く
+        while (end > ptr && end[-1] == 0) {
+            --end;
+        }
+        if (ptr == end) {
+            continue;
+        }
+        const int unitStart = (int)buffer.size();
+        const uint8_t nal_unit_type = bsm(ptr[0], 0, 5);
+        if (nal_unit_type == 6 || nal_unit_type == 7 || nal_unit_type == 8 || nal_unit_type == 9) {
+            // 中身を読むNALだけエミュレーション防止バイトを取り除く
+            int32_t n3bytes = -1;
+            int lastNonZero = unitStart;
+            for (const uint8_t* p = ptr; p < end; p++) {
+                const uint8_t inByte = *p;
+                n3bytes = ((n3bytes & 0xFFFF) << 8) | inByte;
+                if (n3bytes == 0x03) {
+                    // skip one byte
+                    continue;
+                }
+                buffer.add(inByte);
+                if (inByte) {
+                    lastNonZero = (int)buffer.size();
+                }
             }
+            pushNalUnit(unitStart, lastNonZero);
+        } else {
+            // スライスなどはNALヘッダしか見ないので、ヘッダだけ入れて長さは符号化されたままの長さで数える
+            buffer.add(ptr[0]);
+            NalUnit nal;
+            nal.offset = unitStart;
+            nal.length = (int)(end - ptr) - ((end[-1] == 0x80) ? 1 : 0);
+            nalUnits.push_back(nal);
         }
     }
-    pushNalUnit(unitStart, lastNonZero);
 }
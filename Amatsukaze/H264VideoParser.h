@@ -10,6 +10,7 @@
 #pragma once
 
 #include "StreamUtils.h"
+#include "rgy_bitstream.h"
 
 struct H264HRDBitRate {
     uint32_t bit_rate_vlaue_minus1;
@@ -212,7 +213,7 @@ public:
 
 class H264VideoParser : public AMTObject, public IVideoParser {
     struct NalUnit {
-        int offset;
+        int offset; // bufferでの位置
         int length; // rbsp_trailing_bitsを除いた長さ
     };
 public:
@@ -224,8 +225,10 @@ public:
     virtual bool inputFrame(MemoryChunk frame, std::vector<VideoFrameInfo>& info, int64_t PTS, int64_t DTS);
 
 private:
+    // 中身を解析するNALはエミュレーション防止バイトを除いたもの、それ以外はNALヘッダのみ
     AutoBuffer buffer;
     std::vector<NalUnit> nalUnits;
+    decltype(parse_nal_unit_h264_c)* parseNalUnit;
 
     // 直前の beffering period の DTS;
     int64_t beffering_period_DTS;
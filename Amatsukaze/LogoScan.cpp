@@ -10,6 +10,7 @@
 #include "AMTSource.h"
 #include "FileUtils.h"
 #include "StringUtils.h"
+#include "ComputeKernel.h"
 #include <cstdlib>
 #include <regex>
 #include <array>
@@ -218,6 +219,59 @@ bool HasAVX2AvailableCached() {
     return available;
 }
 
+uint64_t GetAvailableSystemMemoryBytes() {
+#if defined(_WIN32) || defined(_WIN64)
+    MEMORYSTATUSEX msex = { 0 };
+    msex.dwLength = sizeof(msex);
+    if (GlobalMemoryStatusEx(&msex)) {
+        return msex.ullAvailPhys;
+    }
+    return 0;
+#else
+    FILE* fp = fopen("/proc/meminfo", "r");
+    if (fp != nullptr) {
+        char line[256];
+        while (fgets(line, sizeof(line), fp) != nullptr) {
+            uint64_t kb = 0;
+            if (sscanf(line, "MemAvailable: %" PRIu64 " kB", &kb) == 1) {
+                fclose(fp);
+                return kb * 1024;
+            }
+        }
+        fclose(fp);
+    }
+    struct sysinfo info;
+    if (sysinfo(&info) == 0) {
+        return (uint64_t)info.freeram * info.mem_unit;
+    }
+    return 0;
+#endif
+}
+
+// ロゴ評価用データのキャッシュファイルパス
+// ロゴファイルの内容のハッシュ、画像サイズ、マスク比率で区別する。使えない場合は空
+tstring MakeLogoMaskCachePath(const tstring& cacheDir, const tstring& logoPath, const logo::LogoHeader& header, float maskratio, const tchar* variant) {
+    if (cacheDir.empty()) {
+        return tstring();
+    }
+    try {
+        File file(logoPath, _T("rb"));
+        std::vector<uint8_t> data((size_t)file.size());
+        if (data.size() == 0 || file.read(MemoryChunk(data.data(), data.size())) != data.size()) {
+            return tstring();
+        }
+        const uint32_t crc = (uint32_t)crc32(0, data.data(), (uInt)data.size());
+        const uint32_t adler = (uint32_t)adler32(1, data.data(), (uInt)data.size());
+        if (!File::exists(cacheDir) && mkdirT(cacheDir.c_str()) != 0) {
+            return tstring();
+        }
+        return StringFormat(_T("%s/%08x%08x_%dx%d_%dx%d_m%d_%s.amtlmc"), cacheDir, crc, adler,
+            header.w, header.h, header.imgw, header.imgh, (int)std::lround(maskratio * 1000), variant);
+    } catch (const IOException&) {
+        return tstring();
+    }
+}
+
 }
 
 void removeLogoLine(float *dst, const float *src, const int srcStride, const float *logoAY, const float *logoBY, const int logowidth, const float maxv, const float fade) {
@@ -269,7 +323,8 @@ logo::LogoDataParam::LogoDataParam() :
     maskpixels(0),
     blackScore(0.0f),
     pCalcCorrelation5x5(nullptr),
-    pRemoveLogoLine(nullptr) {}
+    pRemoveLogoLine(nullptr),
+    pCalcLogoScoreMultiFade(nullptr) {}
 
 logo::LogoDataParam::LogoDataParam(LogoData&& logo, const LogoHeader* header) :
     LogoData(std::move(logo)),
@@ -284,7 +339,8 @@ logo::LogoDataParam::LogoDataParam(LogoData&& logo, const LogoHeader* header) :
     maskpixels(0),
     blackScore(0.0f),
     pCalcCorrelation5x5(nullptr),
-    pRemoveLogoLine(nullptr) {}
+    pRemoveLogoLine(nullptr),
+    pCalcLogoScoreMultiFade(nullptr) {}
 
 logo::LogoDataParam::LogoDataParam(LogoData&& logo, int imgw, int imgh, int imgx, int imgy) :
     LogoData(std::move(logo)),
@@ -299,7 +355,8 @@ logo::LogoDataParam::LogoDataParam(LogoData&& logo, int imgw, int imgh, int imgx
     maskpixels(0),
     blackScore(0.0f),
     pCalcCorrelation5x5(nullptr),
-    pRemoveLogoLine(nullptr) {}
+    pRemoveLogoLine(nullptr),
+    pCalcLogoScoreMultiFade(nullptr) {}
 
 int logo::LogoDataParam::getImgWidth() const { return imgw; }
 int logo::LogoDataParam::getImgHeight() const { return imgh; }
@@ -323,7 +380,6 @@ void logo::LogoDataParam::CreateLogoMask(float maskratio) {
     const float corrLowerLimit = 0.2f;
 
     pCalcCorrelation5x5 = IsAVX2Available() ? CalcCorrelation5x5_AVX2 : (IsAVXAvailable() ? CalcCorrelation5x5_AVX : CalcCorrelation5x5);
-    pRemoveLogoLine = IsAVX2Available() ? removeLogoLineAVX2 : removeLogoLine;
 
     int YSize = w * h;
     auto memWork = std::unique_ptr<float[]>(new float[YSize * CLEN + 8]);
@@ -425,11 +481,144 @@ void logo::LogoDataParam::CreateLogoMask(float maskratio) {
     }
 #endif
 
+    SetupEvaluation();
+
     // 黒背景の評価値（これがはっきり出たときの基準）
     float *slice = &memWork[(16 >> CSHIFT) * YSize];
     blackScore = CorrelationScore(slice, 255);
 }
 
+void logo::LogoDataParam::SetupEvaluation() {
+    pCalcCorrelation5x5 = IsAVX2Available() ? CalcCorrelation5x5_AVX2 : (IsAVXAvailable() ? CalcCorrelation5x5_AVX : CalcCorrelation5x5);
+    pRemoveLogoLine = IsAVX2Available() ? removeLogoLineAVX2 : removeLogoLine;
+    pCalcLogoScoreMultiFade = IsAVX512BWAvailable() ? CalcLogoScoreMultiFade_AVX512 : (IsAVX2Available() ? CalcLogoScoreMultiFade_AVX2 : nullptr);
+
+    // 複数fade一括評価用に着目点ごとのデータを並べ直す
+    // scaleはidx=CLENのとき次の着目点の先頭を読むのでCorrelationScoreに合わせて1要素余分に確保
+    maskPosX.clear();
+    maskPosY.clear();
+    for (int y = 2; y < h - 2; y++) {
+        for (int x = 2; x < w - 2; x++) {
+            if (mask[x + y * w]) {
+                maskPosX.push_back(x);
+                maskPosY.push_back(y);
+            }
+        }
+    }
+    const int count = (int)maskPosX.size();
+    simdKernels.assign(count * KSIZE * 8, 0.0f);
+    kernelSums.assign(count, 0.0f);
+    scaleSoA.assign(count * CLEN + 1, 0.0f);
+    scale2SoA.assign(count * CLEN + 1, 0.0f);
+    for (int i = 0; i < count; i++) {
+        const float* k = &kernels[i * KLEN];
+        for (int ky = 0; ky < KSIZE; ky++) {
+            std::copy_n(k + ky * KSIZE, KSIZE, &simdKernels[(i * KSIZE + ky) * 8]);
+        }
+        kernelSums[i] = std::accumulate(k, k + KLEN, 0.0f);
+        for (int c = 0; c < CLEN; c++) {
+            scaleSoA[i * CLEN + c] = scales[i * CLEN + c].scale;
+            scale2SoA[i * CLEN + c] = scales[i * CLEN + c].scale2;
+        }
+    }
+}
+
+// キャッシュファイル形式
+//   magic(8) w h maskpixels count thresh blackScore
+//   mask[w*h] kernels[count*KLEN] scales[count*CLEN]
+static const char LOGO_MASK_CACHE_MAGIC[8] = { 'A', 'M', 'T', 'L', 'G', 'M', 'C', '1' };
+
+bool logo::LogoDataParam::LoadMaskCache(const tstring& path) {
+    if (!File::exists(path)) {
+        return false;
+    }
+    try {
+        File file(path, _T("rb"));
+        char magic[8];
+        if (file.read(MemoryChunk((uint8_t*)magic, sizeof(magic))) != sizeof(magic) ||
+            memcmp(magic, LOGO_MASK_CACHE_MAGIC, sizeof(magic)) != 0) {
+            return false;
+        }
+        const int cw = file.readValue<int32_t>();
+        const int ch = file.readValue<int32_t>();
+        const int cmaskpixels = file.readValue<int32_t>();
+        const int count = file.readValue<int32_t>();
+        const float cthresh = file.readValue<float>();
+        const float cblackScore = file.readValue<float>();
+        if (cw != w || ch != h || cmaskpixels < 0 || cmaskpixels > w * h || count < 0 || count > cmaskpixels) {
+            return false;
+        }
+        auto cmask = std::unique_ptr<uint8_t[]>(new uint8_t[w * h]);
+        auto ckernels = std::unique_ptr<float[]>(new float[cmaskpixels * KLEN + 8]());
+        auto cscales = std::unique_ptr<ScaleLimit[]>(new ScaleLimit[cmaskpixels * CLEN]());
+        const size_t kernelBytes = sizeof(float) * count * KLEN;
+        const size_t scaleBytes = sizeof(ScaleLimit) * count * CLEN;
+        if (file.read(MemoryChunk(cmask.get(), w * h)) != (size_t)(w * h) ||
+            (kernelBytes > 0 && file.read(MemoryChunk((uint8_t*)ckernels.get(), kernelBytes)) != kernelBytes) ||
+            (scaleBytes > 0 && file.read(MemoryChunk((uint8_t*)cscales.get(), scaleBytes)) != scaleBytes)) {
+            return false;
+        }
+        // 着目点の数がカーネルの数と合っているか
+        int maskCount = 0;
+        for (int y = 2; y < h - 2; y++) {
+            for (int x = 2; x < w - 2; x++) {
+                maskCount += cmask[x + y * w] ? 1 : 0;
+            }
+        }
+        if (maskCount != count) {
+            return false;
+        }
+        mask = std::move(cmask);
+        kernels = std::move(ckernels);
+        scales = std::move(cscales);
+        maskpixels = cmaskpixels;
+        thresh = cthresh;
+        blackScore = cblackScore;
+    } catch (const IOException&) {
+        return false;
+    }
+    SetupEvaluation();
+    return true;
+}
+
+void logo::LogoDataParam::SaveMaskCache(const tstring& path) const {
+    // 他のプロセスが読んでいる途中のファイルを壊さないように一時ファイルに書いてから置き換える
+    const tstring tmppath = StringFormat(_T("%s.%u.%u.tmp"), path, (uint32_t)GetCurrentProcessId(),
+        (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        File file(tmppath, _T("wb"));
+        file.write(MemoryChunk((uint8_t*)LOGO_MASK_CACHE_MAGIC, sizeof(LOGO_MASK_CACHE_MAGIC)));
+        const int count = (int)maskPosX.size();
+        file.writeValue((int32_t)w);
+        file.writeValue((int32_t)h);
+        file.writeValue((int32_t)maskpixels);
+        file.writeValue((int32_t)count);
+        file.writeValue(thresh);
+        file.writeValue(blackScore);
+        file.write(MemoryChunk(mask.get(), w * h));
+        file.write(MemoryChunk((uint8_t*)kernels.get(), sizeof(float) * count * KLEN));
+        file.write(MemoryChunk((uint8_t*)scales.get(), sizeof(ScaleLimit) * count * CLEN));
+    }
+    if (_trename(tmppath.c_str(), path.c_str()) != 0) {
+        // 他のプロセスが先に作った場合など
+        removeT(tmppath.c_str());
+    }
+}
+
+void logo::LogoDataParam::CreateLogoMaskCached(float maskratio, const tstring& cachePath) {
+    if (cachePath.size() > 0 && LoadMaskCache(cachePath)) {
+        return;
+    }
+    CreateLogoMask(maskratio);
+    if (cachePath.size() > 0) {
+        try {
+            SaveMaskCache(cachePath);
+        } catch (const IOException&) {
+            // キャッシュが書けなくても処理は続ける
+        }
+    }
+}
+
 float logo::LogoDataParam::EvaluateLogo(const float *src, float maxv, float fade, float* work, int stride) {
     // ロゴを評価 //
     const float *logoAY = GetA(PLANAR_Y);
@@ -448,6 +637,40 @@ float logo::LogoDataParam::EvaluateLogo(const float *src, float maxv, float fade
     return CorrelationScore(work, maxv) / blackScore;
 }
 
+void logo::LogoDataParam::EvaluateLogoMulti(const float *src, float maxv, const float* fades, int numFades, float* work, float* results, int stride) {
+    if (stride == -1) {
+        stride = w;
+    }
+    if (pCalcLogoScoreMultiFade == nullptr) {
+        for (int i = 0; i < numFades; i++) {
+            results[i] = EvaluateLogo(src, maxv, fades[i], work, stride);
+        }
+        return;
+    }
+    LogoScoreKernelParam p;
+    p.w = w;
+    p.h = h;
+    p.logoAY = GetA(PLANAR_Y);
+    p.logoBY = GetB(PLANAR_Y);
+    p.numPixels = (int)maskPosX.size();
+    p.posX = maskPosX.data();
+    p.posY = maskPosY.data();
+    p.kernels = simdKernels.data();
+    p.kernelSums = kernelSums.data();
+    p.scale = scaleSoA.data();
+    p.scale2 = scale2SoA.data();
+    p.clen = CLEN;
+    pCalcLogoScoreMultiFade(p, src, stride, maxv, fades, numFades, work, results);
+    // 正規化
+    for (int i = 0; i < numFades; i++) {
+        results[i] /= blackScore;
+    }
+}
+
+void logo::LogoDataParam::SetMultiFadeKernel(decltype(CalcLogoScoreMultiFade_AVX2)* kernel) {
+    pCalcLogoScoreMultiFade = kernel;
+}
+
 std::unique_ptr<logo::LogoDataParam> logo::LogoDataParam::MakeFieldLogo(bool bottom) {
     auto logo = std::unique_ptr<logo::LogoDataParam>(
         new logo::LogoDataParam(LogoData(w, h / 2, logUVx, logUVy), imgw, imgh / 2, imgx, imgy / 2));
@@ -538,6 +761,14 @@ void logo::LogoColor::Add(double f, double b) {
     sumFB += f * b;
 }
 
+void logo::LogoColor::Merge(const LogoColor& other) {
+    sumF += other.sumF;
+    sumB += other.sumB;
+    sumF2 += other.sumF2;
+    sumB2 += other.sumB2;
+    sumFB += other.sumFB;
+}
+
 /*====================================================================
 * 	GetAB_?()
 * 		回帰直線の傾きと切片を返す X軸:前景 Y軸:背景
@@ -714,6 +945,19 @@ logo::LogoScan::LogoScan(int scanw, int scanh, int logUVx, int logUVy, int thy)
     logoU(new LogoColor[scanw * scanh >> (logUVx + logUVy)]),
     logoV(new LogoColor[scanw * scanh >> (logUVx + logUVy)]) {}
 
+void logo::LogoScan::Merge(const LogoScan& other) {
+    const int YSize = scanw * scanh;
+    const int UVSize = scanw * scanh >> (logUVx + logUVy);
+    for (int i = 0; i < YSize; i++) {
+        logoY[i].Merge(other.logoY[i]);
+    }
+    for (int i = 0; i < UVSize; i++) {
+        logoU[i].Merge(other.logoU[i]);
+        logoV[i].Merge(other.logoV[i]);
+    }
+    nframes += other.nframes;
+}
+
 namespace {
     double QuantileCopy(std::vector<double> values, const double q) {
         if (values.empty()) {
@@ -1242,23 +1486,174 @@ void logo::SimpleVideoReader::readAll(const tstring& src, int serviceid, const F
     }
 }
 
-logo::LogoScanDataCompressed::LogoScanDataCompressed() : compressed_data(), original_size(0) {};
+struct logo::LogoScanDataStore::Workers {
+    LogoScanWorkerPool pool;
+    explicit Workers(int threadCount) : pool(threadCount) {}
+};
+
+logo::LogoScanDataStore::LogoScanDataStore() :
+    frameBytes(0),
+    pixelBytes(1),
+    compressed(true),
+    frames(),
+    batch(),
+    batchFrames(0),
+    workers() {}
+
+logo::LogoScanDataStore::~LogoScanDataStore() {}
+
+void logo::LogoScanDataStore::init(size_t frameBytes_, int pixelBytes_, bool compress) {
+    frameBytes = frameBytes_;
+    pixelBytes = pixelBytes_;
+    compressed = compress;
+    frames.clear();
+    batch.clear();
+    batchFrames = 0;
+    if (compressed) {
+        batch.resize(frameBytes * (BATCH_FRAMES + 1));
+    }
+}
+
+void logo::LogoScanDataStore::add(const void *ptr) {
+    if (!compressed) {
+        const uint8_t* src = (const uint8_t*)ptr;
+        frames.emplace_back(src, src + frameBytes);
+        return;
+    }
+    memcpy(batch.data() + frameBytes * (batchFrames + 1), ptr, frameBytes);
+    if (++batchFrames == BATCH_FRAMES) {
+        flush();
+    }
+}
+
+void logo::LogoScanDataStore::flush() {
+    if (!compressed || batchFrames == 0) {
+        return;
+    }
+    if (!workers) {
+        workers.reset(new Workers(ResolveAutoDetectThreadCount(0)));
+    }
+    const int base = (int)frames.size();
+    const int num = batchFrames;
+    frames.resize(base + num);
+    // batchの先頭には直前のフレームが入っているので、各フレームの差分元は1つ前
+    workers->pool.run(num, [&](int start, int end) {
+        for (int i = start; i < end; i++) {
+            const uint8_t* cur = batch.data() + frameBytes * (i + 1);
+            encodeFrame(frames[base + i], cur, cur - frameBytes, ((base + i) % KEY_INTERVAL) == 0);
+        }
+    });
+    // 最後のフレームを次のバッチの差分元にする
+    memmove(batch.data(), batch.data() + frameBytes * num, frameBytes);
+    batchFrames = 0;
+}
 
-logo::LogoScanDataCompressed::~LogoScanDataCompressed() {};
+uint64_t logo::LogoScanDataStore::storedBytes() const {
+    uint64_t total = 0;
+    for (const auto& f : frames) {
+        total += f.size();
+    }
+    return total;
+}
 
-void logo::LogoScanDataCompressed::compress(const void *ptr, size_t datasize) {
-    original_size = (unsigned long)datasize;
-    std::vector<uint8_t> tmp(datasize * 3 / 2);
-    unsigned long compressed_size = (unsigned long)tmp.size();
-    compress2(tmp.data(), &compressed_size, (BYTE *)ptr, (unsigned long)datasize, Z_DEFAULT_COMPRESSION);
+// 圧縮データ: 1バイト目 bit0=キーフレーム bit1=zlib圧縮
+// 差分は画素単位で取り、16bitの場合は下位バイトと上位バイトを分けて並べる
+void logo::LogoScanDataStore::encodeFrame(std::vector<uint8_t>& dst, const uint8_t* cur, const uint8_t* prev, bool key) const {
+    std::vector<uint8_t> residual(frameBytes);
+    if (pixelBytes == 2) {
+        const int n = (int)(frameBytes / 2);
+        const uint16_t* c = (const uint16_t*)cur;
+        const uint16_t* p = key ? c - 1 : (const uint16_t*)prev;
+        for (int i = 0; i < n; i++) {
+            const uint16_t d = (uint16_t)(c[i] - ((key && i == 0) ? 0 : p[i]));
+            residual[i] = (uint8_t)d;
+            residual[n + i] = (uint8_t)(d >> 8);
+        }
+    } else {
+        const uint8_t* p = key ? cur - 1 : prev;
+        for (size_t i = 0; i < frameBytes; i++) {
+            residual[i] = (uint8_t)(cur[i] - ((key && i == 0) ? 0 : p[i]));
+        }
+    }
+
+    dst.resize(1 + compressBound((uLong)frameBytes));
+    z_stream zs = {};
+    if (deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15, 8, Z_RLE) != Z_OK) {
+        THROW(RuntimeException, "deflateInit2 failed");
+    }
+    zs.next_in = residual.data();
+    zs.avail_in = (uInt)frameBytes;
+    zs.next_out = dst.data() + 1;
+    zs.avail_out = (uInt)(dst.size() - 1);
+    const int ret = deflate(&zs, Z_FINISH);
+    const size_t outBytes = zs.total_out;
+    deflateEnd(&zs);
+    if (ret == Z_STREAM_END && outBytes < frameBytes) {
+        dst[0] = (uint8_t)((key ? 1 : 0) | 2);
+        dst.resize(1 + outBytes);
+    } else {
+        // 縮まない場合は差分をそのまま持つ
+        dst[0] = (uint8_t)(key ? 1 : 0);
+        dst.resize(1 + frameBytes);
+        memcpy(dst.data() + 1, residual.data(), frameBytes);
+    }
+    dst.shrink_to_fit();
+}
 
-    compressed_data.resize(compressed_size);
-    memcpy(compressed_data.data(), tmp.data(), compressed_size);
+void logo::LogoScanDataStore::decodeFrame(uint8_t* dst, const std::vector<uint8_t>& src, std::vector<uint8_t>& work) const {
+    const bool key = (src[0] & 1) != 0;
+    const uint8_t* residual = src.data() + 1;
+    if (src[0] & 2) {
+        work.resize(frameBytes);
+        uLongf destLen = (uLongf)frameBytes;
+        if (uncompress(work.data(), &destLen, src.data() + 1, (uLong)(src.size() - 1)) != Z_OK || destLen != frameBytes) {
+            THROW(FormatException, "logo scan data is corrupted");
+        }
+        residual = work.data();
+    }
+    if (pixelBytes == 2) {
+        const int n = (int)(frameBytes / 2);
+        uint16_t* d = (uint16_t*)dst;
+        if (key) {
+            uint16_t prev = 0;
+            for (int i = 0; i < n; i++) {
+                d[i] = prev = (uint16_t)(prev + (residual[i] | (residual[n + i] << 8)));
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                d[i] = (uint16_t)(d[i] + (residual[i] | (residual[n + i] << 8)));
+            }
+        }
+    } else {
+        if (key) {
+            uint8_t prev = 0;
+            for (size_t i = 0; i < frameBytes; i++) {
+                dst[i] = prev = (uint8_t)(prev + residual[i]);
+            }
+        } else {
+            for (size_t i = 0; i < frameBytes; i++) {
+                dst[i] = (uint8_t)(dst[i] + residual[i]);
+            }
+        }
+    }
 }
 
-void logo::LogoScanDataCompressed::decompress(void *ptr) {
-    unsigned long buf_size = original_size;
-    uncompress((BYTE *)ptr, &buf_size, (BYTE *)compressed_data.data(), (unsigned long)compressed_data.size());
+void logo::LogoScanDataStore::getFrame(int i, void *ptr, int& cursor) const {
+    if (!compressed) {
+        memcpy(ptr, frames[i].data(), frameBytes);
+        cursor = i;
+        return;
+    }
+    // 直前のフレームが入っていなければ直近のキーフレームから復元する
+    int start = i - (i % KEY_INTERVAL);
+    if (cursor >= start && cursor < i) {
+        start = cursor + 1;
+    }
+    std::vector<uint8_t> work;
+    for (int n = start; n <= i; n++) {
+        decodeFrame((uint8_t*)ptr, frames[n], work);
+    }
+    cursor = i;
 }
 
 logo::LogoAnalyzer::InitialLogoCreator::InitialLogoCreator(LogoAnalyzer* pThis) :
@@ -1275,6 +1670,12 @@ void logo::LogoAnalyzer::InitialLogoCreator::readAll(const tstring& src, int ser
     { File file(src, _T("rb")); filesize = file.size(); }
 
     SimpleVideoReader::readAll(src, serviceid);
+    scanData.flush();
+    if (scanData.isCompressed() && scanData.numFrames() > 0) {
+        const uint64_t rawBytes = (uint64_t)scanData.frameSize() * scanData.numFrames();
+        pThis->ctx.infoF(_T("[GenLogo] scan data: %d frames %.1fMB -> %.1fMB"), scanData.numFrames(),
+            rawBytes / (1024.0 * 1024.0), scanData.storedBytes() / (1024.0 * 1024.0));
+    }
 
     pThis->logodata = logoscan->GetLogo(false);
     if (pThis->logodata == nullptr) {
@@ -1294,6 +1695,17 @@ void logo::LogoAnalyzer::InitialLogoCreator::readAll(const tstring& src, int ser
     logoscan = std::unique_ptr<LogoScan>(
         new LogoScan(pThis->scanw, pThis->scanh, pThis->logUVx, pThis->logUVy, pThis->GetAdjustedBackgroundThreshold()));
 
+    // 全フレーム無圧縮で持っても十分メモリに余裕があれば圧縮しない
+    const int pixelBytes = isHighBitDepth() ? 2 : 1;
+    const uint64_t rawBytes = (uint64_t)scanDataSize * pixelBytes * std::max(0, pThis->numMaxFrames);
+    const uint64_t memoryGuard = 2ull * 1024ull * 1024ull * 1024ull;
+    const uint64_t availBytes = GetAvailableSystemMemoryBytes();
+    const bool compress = !(availBytes > 0 && rawBytes + memoryGuard < availBytes / 2);
+    scanData.init(scanDataSize * pixelBytes, pixelBytes, compress);
+    pThis->ctx.infoF(_T("[GenLogo] scan data: %s (max %.1fMB, avail %.1fMB)"),
+        compress ? _T("compressed") : _T("uncompressed"),
+        rawBytes / (1024.0 * 1024.0), availBytes / (1024.0 * 1024.0));
+
     pThis->ctx.infoF(_T("[GenLogo] source=%dx%d thresholdAdjusted=%d(base=%d) resolutionScale=%.3f eligibleFadeMin=%d"),
         pThis->imgw, pThis->imgh,
         pThis->GetAdjustedBackgroundThreshold(), pThis->thy,
@@ -1413,6 +1825,204 @@ void logo::LogoAnalyzer::ValidateLogoQuality() const {
     }
 }
 
+template <typename pixel_t>
+void logo::LogoAnalyzer::ReMakeLogo() {
+
+    // ロゴを評価用にインタレ解除
+    LogoDataParam deintLogo(LogoData(scanw, scanh, logUVx, logUVy), scanw, scanh, scanx, scany);
+    DeintLogo(deintLogo, *logodata, scanw, scanh);
+    deintLogo.CreateLogoMask(0.1f);
+
+    const int numFrames = creator->numFrames();
+
+    const size_t scanDataSize = scanw * scanh * 3 / 2;
+    const size_t YSize = scanw * scanh;
+
+    // フレームをスレッド数の連続区間に分けて、区間ごとに先頭から少しずつ進める
+    // （区間内は順に読むので差分の復元が1フレーム分で済む）
+    const int threadN = ResolveAutoDetectThreadCount(0);
+    const int numShards = std::max(1, std::min(threadN, numFrames));
+    const int shardStep = 256;
+    struct ShardWork {
+        int start, end;
+        int cursor;
+        std::vector<pixel_t> scanData;
+        std::vector<float> deint;
+        std::vector<float> work;
+    };
+    std::vector<ShardWork> shards(numShards);
+    for (int s = 0; s < numShards; s++) {
+        auto& shard = shards[s];
+        shard.start = (int)((int64_t)numFrames * s / numShards);
+        shard.end = (int)((int64_t)numFrames * (s + 1) / numShards);
+        shard.cursor = -1;
+        shard.scanData.resize(scanDataSize);
+    }
+    const int maxShardFrames = (numFrames + numShards - 1) / numShards;
+    LogoScanWorkerPool pool(numShards);
+    // fn(shard, frame)を全フレームについて呼ぶ。shardStepごとにprogress(処理済みフレーム数)を呼ぶ
+    auto forEachFrame = [&](auto&& fn, auto&& progress) {
+        for (int pos = 0; pos < maxShardFrames; pos += shardStep) {
+            pool.run(numShards, [&](const int s0, const int s1) {
+                for (int s = s0; s < s1; s++) {
+                    auto& shard = shards[s];
+                    const int end = std::min(shard.end, shard.start + pos + shardStep);
+                    for (int i = shard.start + pos; i < end; i++) {
+                        fn(s, i);
+                    }
+                }
+            }, 1);
+            int done = 0;
+            for (const auto& shard : shards) {
+                done += std::min(shard.end - shard.start, pos + shardStep);
+            }
+            progress(done);
+        }
+    };
+    auto readFrame = [&](ShardWork& shard, const int i) {
+        creator->getFrame(i, shard.scanData.data(), shard.cursor);
+        return shard.scanData.data();
+    };
+
+    const int numFade = 20;
+    auto minFades = std::unique_ptr<int[]>(new int[numFrames]);
+    {
+        float fades[numFade];
+        for (int fi = 0; fi < numFade; fi++) {
+            fades[fi] = 0.1f * fi;
+        }
+        for (auto& shard : shards) {
+            shard.deint.resize(YSize + 8);
+            shard.work.resize(YSize + 8);
+        }
+        const float maxv = (float)((1 << creator->bitdepth()) - 1);
+
+        // 全フレームループ
+        forEachFrame([&](const int s, const int i) {
+            auto& shard = shards[s];
+            // フレームをインタレ解除
+            DeintY(shard.deint.data(), readFrame(shard, i), scanw, scanw, scanh);
+            // 全fade値でロゴを評価
+            float results[numFade];
+            deintLogo.EvaluateLogoMulti(shard.deint.data(), maxv, fades, numFade, shard.work.data(), results);
+            float minResult = std::numeric_limits<float>::max();
+            int minFadeIndex = 0;
+            for (int fi = 0; fi < numFade; fi++) {
+                float result = std::abs(results[fi]);
+                if (result < minResult) {
+                    minResult = result;
+                    minFadeIndex = fi;
+                }
+            }
+            minFades[i] = minFadeIndex;
+        }, [&](const int done) {
+            float progress = (float)done / numFrames * 25 + progressbase;
+            if (cb(progress, done, numFrames, numFrames) == false) {
+                THROW(RuntimeException, "Cancel requested");
+            }
+        });
+        for (auto& shard : shards) {
+            shard.deint = std::vector<float>();
+            shard.work = std::vector<float>();
+        }
+    }
+
+    // 評価値を集約
+    // とりあえず出してみる
+    std::vector<int> numMinFades(numFade);
+    for (int i = 0; i < numFrames; i++) {
+        numMinFades[minFades[i]]++;
+    }
+    int maxi = (int)(std::max_element(numMinFades.begin(), numMinFades.end()) - numMinFades.begin());
+    const int eligibleFadeMin = GetEligibleFadeMinIndex();
+    ctx.infoF(_T("[GenLogo] dominant fade: index=%d rate=%.1f%% eligibleFadeMin=%d"),
+        maxi, numMinFades[maxi] / (float)numFrames * 100.0f, eligibleFadeMin);
+
+    int usedEligibleFadeMin = eligibleFadeMin;
+    int eligibleFrames = 0;
+    auto remakeLogoWithFadeMin = [&](const int fadeMin, int& outEligibleFrames) {
+        int scanUVw = scanw >> logUVx;
+        int scanUVh = scanh >> logUVy;
+        int offU = scanw * scanh;
+        int offV = offU + scanUVw * scanUVh;
+
+        // 区間ごとに集計して、最後に区間順に足す
+        std::vector<std::unique_ptr<LogoScan>> shardScans(numShards);
+        std::vector<int> shardEligible(numShards);
+        for (int s = 0; s < numShards; s++) {
+            shardScans[s] = std::make_unique<LogoScan>(scanw, scanh, logUVx, logUVy, GetAdjustedBackgroundThreshold());
+        }
+
+        // 全フレームループ
+        int nextLog = 2000;
+        forEachFrame([&](const int s, const int i) {
+            // ロゴのあるフレームだけAddFrame
+            if (minFades[i] >= fadeMin) {
+                shardEligible[s]++;
+                const auto ptr = readFrame(shards[s], i);
+                shardScans[s]->AddFrame(ptr, ptr + offU, ptr + offV, scanw, scanUVw, creator->bitdepth());
+            }
+        }, [&](const int done) {
+            if (done >= nextLog || done == numFrames) {
+                ctx.infoF(_T("[GenLogo] eligible frame collect: %d/%d fadeMin=%d eligible=%d"),
+                    done, numFrames, fadeMin, std::accumulate(shardEligible.begin(), shardEligible.end(), 0));
+                nextLog = (done / 2000 + 1) * 2000;
+            }
+        });
+
+        LogoScan& logoscan = *shardScans[0];
+        for (int s = 1; s < numShards; s++) {
+            logoscan.Merge(*shardScans[s]);
+        }
+        outEligibleFrames = std::accumulate(shardEligible.begin(), shardEligible.end(), 0);
+        auto candidate = logoscan.GetLogo(true);
+        if (candidate != nullptr) {
+            logoQuality = logoscan.CalcQualityMetrics(*candidate);
+        }
+        return candidate;
+    };
+
+    // ロゴ作成
+    logodata = remakeLogoWithFadeMin(eligibleFadeMin, eligibleFrames);
+    if (logodata == nullptr && validateQuality) {
+        std::vector<int> retryFadeMins;
+        auto addRetryFadeMin = [&](const int value) {
+            const int fadeMin = std::max(0, std::min(numFade - 1, value));
+            if (fadeMin < eligibleFadeMin &&
+                std::find(retryFadeMins.begin(), retryFadeMins.end(), fadeMin) == retryFadeMins.end()) {
+                retryFadeMins.push_back(fadeMin);
+            }
+        };
+        addRetryFadeMin(eligibleFadeMin - 2);
+        addRetryFadeMin(5);
+        addRetryFadeMin(3);
+        addRetryFadeMin(1);
+        addRetryFadeMin(0);
+        for (const int retryFadeMin : retryFadeMins) {
+            int retryEligibleFrames = 0;
+            ctx.infoF(_T("[GenLogo] retry logo remake with relaxed fadeMin=%d (strict=%d)"),
+                retryFadeMin, eligibleFadeMin);
+            auto retryLogo = remakeLogoWithFadeMin(retryFadeMin, retryEligibleFrames);
+            if (retryLogo != nullptr) {
+                logodata = std::move(retryLogo);
+                usedEligibleFadeMin = retryFadeMin;
+                eligibleFrames = retryEligibleFrames;
+                ctx.infoF(_T("[GenLogo] relaxed fadeMin succeeded: fadeMin=%d eligible=%d/%d"),
+                    usedEligibleFadeMin, eligibleFrames, numFrames);
+                break;
+            }
+        }
+    }
+    if (logodata != nullptr) {
+        LogLogoQuality(_T("remake"));
+    }
+
+    if (logodata == nullptr) {
+        THROWF(RuntimeException, "Insufficient logo frames (eligible=%d, total=%d, eligibleFadeMin=%d, dominantFade=%d, dominantFadeRate=%.1f%%)",
+            eligibleFrames, numFrames, usedEligibleFadeMin, maxi, numMinFades[maxi] / (float)numFrames * 100.0f);
+    }
+}
+
 void logo::LogoAnalyzer::ScanLogo() {
     ctx.infoF(_T("[GenLogo] start: input=%s serviceId=%d rect=(%d,%d,%d,%d) threshold=%d maxFrames=%d debug=%s"),
         srcpath.c_str(), serviceid, scanx, scany, scanw, scanh, thy, numMaxFrames,
@@ -1447,7 +2057,7 @@ void logo::LogoAnalyzer::ScanLogo() {
     logodata->Save(dstpath, &header);
     ctx.infoF(_T("[GenLogo] completed: output=%s"), dstpath.c_str());
 }
-logo::AMTAnalyzeLogo::AMTAnalyzeLogo(PClip clip, const tstring& logoPath, float maskratio, IScriptEnvironment* env)
+logo::AMTAnalyzeLogo::AMTAnalyzeLogo(PClip clip, const tstring& logoPath, float maskratio, const tstring& cacheDir, IScriptEnvironment* env)
     : GenericVideoFilter(clip)
     , srcvi(vi)
     , maskratio(maskratio) {
@@ -1461,12 +2071,12 @@ logo::AMTAnalyzeLogo::AMTAnalyzeLogo(PClip clip, const tstring& logoPath, float
     deintLogo = std::unique_ptr<LogoDataParam>(
         new LogoDataParam(LogoData(header.w, header.h, header.logUVx, header.logUVy), &header));
     DeintLogo(*deintLogo, *logo, header.w, header.h);
-    deintLogo->CreateLogoMask(maskratio);
+    deintLogo->CreateLogoMaskCached(maskratio, MakeLogoMaskCachePath(cacheDir, logoPath, header, maskratio, _T("deint")));
 
     fieldLogoT = logo->MakeFieldLogo(false);
-    fieldLogoT->CreateLogoMask(maskratio);
+    fieldLogoT->CreateLogoMaskCached(maskratio, MakeLogoMaskCachePath(cacheDir, logoPath, header, maskratio, _T("fieldT")));
     fieldLogoB = logo->MakeFieldLogo(true);
-    fieldLogoB->CreateLogoMask(maskratio);
+    fieldLogoB->CreateLogoMaskCached(maskratio, MakeLogoMaskCachePath(cacheDir, logoPath, header, maskratio, _T("fieldB")));
 
     // for debug
     //LogoHeader hT = header;
@@ -1512,6 +2122,7 @@ int __stdcall logo::AMTAnalyzeLogo::SetCacheHints(int cachehints, int frame_rang
         args[0].AsClip(),       // source
         char_to_tstring(args[1].AsString()),			// logopath
         (float)args[2].AsFloat(35) / 100.0f, // maskratio
+        char_to_tstring(args[3].AsString("")), // cachedir
         env
     );
 }
@@ -1682,7 +2293,7 @@ int __stdcall logo::AMTEraseLogo::SetCacheHints(int cachehints, int frame_range)
 }
 
 // 絶対値<0.2fは不明とみなす
-logo::LogoFrame::LogoFrame(AMTContext& ctx, const std::vector<tstring>& logofiles, float maskratio) :
+logo::LogoFrame::LogoFrame(AMTContext& ctx, const std::vector<tstring>& logofiles, float maskratio, const tstring& cacheDir) :
     AMTObject(ctx),
     numLogos((int)logofiles.size()),
     logoArr(logofiles.size()),
@@ -1692,6 +2303,11 @@ logo::LogoFrame::LogoFrame(AMTContext& ctx, const std::vector<tstring>& logofile
     framesPerSec(0),
     vi(),
     evalResults(),
+    logoGroups(),
+    maxGroupYSize(0),
+    scanTargets(logofiles.size(), 1),
+    scanStep(1),
+    frameAnalyzers(),
     bestLogo(-1),
     logoRatio(0.0) {
     vi.num_frames = 0;
@@ -1701,7 +2317,7 @@ logo::LogoFrame::LogoFrame(AMTContext& ctx, const std::vector<tstring>& logofile
             logoArr[i] = LogoDataParam(LogoData::Load(logofiles[i], &header), &header);
             deintArr[i] = LogoDataParam(LogoData(header.w, header.h, header.logUVx, header.logUVy), &header);
             DeintLogo(deintArr[i], logoArr[i], header.w, header.h);
-            deintArr[i].CreateLogoMask(maskratio);
+            deintArr[i].CreateLogoMaskCached(maskratio, MakeLogoMaskCachePath(cacheDir, logofiles[i], header, maskratio, _T("deint")));
 
             int YSize = header.w * header.h;
             maxYSize = std::max(maxYSize, YSize);
@@ -1721,6 +2337,45 @@ void logo::LogoFrame::setClipInfo(const VideoInfo& info) {
     evalResults.resize(vi.num_frames * numLogos, EvalResult{ 0, -1 });
     numFrames = vi.num_frames;
     framesPerSec = (int)std::round((float)vi.fps_numerator / vi.fps_denominator);
+    MakeLogoGroups();
+}
+
+void logo::LogoFrame::MakeLogoGroups() {
+    logoGroups.clear();
+    maxGroupYSize = 0;
+    for (int i = 0; i < numLogos; i++) {
+        const LogoDataParam& logo = deintArr[i];
+        if (!scanTargets[i] || !logo.isValid() || logo.getImgWidth() != vi.width || logo.getImgHeight() != vi.height) {
+            continue;
+        }
+        LogoGroup group = { logo.getImgX(), logo.getImgY(), logo.getWidth(), logo.getHeight(), { i } };
+        // 重なるグループがなくなるまで統合する
+        for (bool merged = true; merged; ) {
+            merged = false;
+            for (auto it = logoGroups.begin(); it != logoGroups.end(); ++it) {
+                if (it->x < group.x + group.w && group.x < it->x + it->w &&
+                    it->y < group.y + group.h && group.y < it->y + it->h) {
+                    const int x0 = std::min(it->x, group.x);
+                    const int y0 = std::min(it->y, group.y);
+                    const int x1 = std::max(it->x + it->w, group.x + group.w);
+                    const int y1 = std::max(it->y + it->h, group.y + group.h);
+                    group.logos.insert(group.logos.end(), it->logos.begin(), it->logos.end());
+                    group = LogoGroup{ x0, y0, x1 - x0, y1 - y0, std::move(group.logos) };
+                    logoGroups.erase(it);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+        std::sort(group.logos.begin(), group.logos.end());
+        logoGroups.push_back(std::move(group));
+    }
+    for (const auto& group : logoGroups) {
+        maxGroupYSize = std::max(maxGroupYSize, group.w * group.h);
+    }
+    if (numLogos > 1) {
+        ctx.debugF(_T("logo scan: %d logos in %d groups"), numLogos, (int)logoGroups.size());
+    }
 }
 
 void logo::LogoFrame::ScanFrameDirect(const AVFrame* top, const AVFrame* bottom,
@@ -1738,17 +2393,14 @@ void logo::LogoFrame::ScanFrameDirect(const AVFrame* top, const AVFrame* bottom,
         return (shift < 0) ? (value << -shift) : value;
     };
 
-    for (int i = 0; i < numLogos; i++) {
-        LogoDataParam& logo = deintArr[i];
-        if (!logo.isValid() || logo.getImgWidth() != vi.width || logo.getImgHeight() != vi.height) {
-            outResult[i] = EvalResult{ 0, -1 };
-            continue;
-        }
+    // 評価対象外のロゴ
+    std::fill_n(outResult, numLogos, EvalResult{ 0, -1 });
 
-        const int width = logo.getWidth();
-        const int height = logo.getHeight();
-        const int srcX = logo.getImgX();
-        const int srcY = logo.getImgY();
+    for (const auto& group : logoGroups) {
+        const int width = group.w;
+        const int height = group.h;
+        const int srcX = group.x;
+        const int srcY = group.y;
         if (srcBitDepth > 8) {
             const int topPitch = top->linesize[0] / (int)sizeof(uint16_t);
             const int bottomPitch = bottom->linesize[0] / (int)sizeof(uint16_t);
@@ -1777,9 +2429,7 @@ void logo::LogoFrame::ScanFrameDirect(const AVFrame* top, const AVFrame* bottom,
             }
         }
 
-        DeintY(memDeint, memY, width, width, height);
-        outResult[i].corr0 = logo.EvaluateLogo(memDeint, maxv, 0, memWork);
-        outResult[i].corr1 = logo.EvaluateLogo(memDeint, maxv, 1, memWork);
+        EvaluateLogoGroup(group, memY, width, memDeint, memWork, maxv, outResult);
     }
 }
 
@@ -1802,8 +2452,8 @@ void logo::LogoFrame::scanFramesDirect(av::AMTSource& source, const std::vector<
         setClipInfo(source.GetVideoInfo());
     }
 
-    std::vector<uint16_t> memY(maxYSize + 8);
-    std::vector<float> memDeint(maxYSize + 8, 0.0f);
+    std::vector<uint16_t> memY(maxGroupYSize + 8);
+    std::vector<float> memDeint(maxGroupYSize + 8, 0.0f);
     std::vector<float> memWork(maxYSize + 8, 0.0f);
     std::vector<EvalResult> decodedResults((size_t)vi.num_frames * numLogos, EvalResult{ 0, -1 });
     std::vector<uint8_t> decodedValid(vi.num_frames, 0);
@@ -1812,29 +2462,91 @@ void logo::LogoFrame::scanFramesDirect(av::AMTSource& source, const std::vector<
     for (const auto& r : range) {
         ctx.infoF(_T("  logo scan #%d: %6d-%6d"), threadId, r.first, r.second);
     }
-    const int threadTotalFrames = getTotalFrames(range);
+    const int threadTotalFrames = getTotalScanFrames(range);
+    // 間引き評価では他の解析器に渡すフレームが揃わないので全フレーム評価のときだけ渡す
+    std::vector<std::unique_ptr<DirectFrameAnalyzer::Worker>> analyzerWorkers;
+    if (scanStep <= 1) {
+        for (auto analyzer : frameAnalyzers) {
+            analyzerWorkers.push_back(analyzer->createWorker());
+        }
+    }
     int finished = 0;
+    const auto onFrame = [&](const int n, const AVFrame* top, const AVFrame* bottom, const int dstBitDepth, const int srcBitDepth) {
+        // 間引き評価ではシーク先まで途中のフレームもデコードされてくるので対象フレームだけ評価する
+        if (n % scanStep != 0) {
+            return;
+        }
+        ScanFrameDirect(top, bottom, dstBitDepth, srcBitDepth, memY.data(), memDeint.data(), memWork.data(),
+            &decodedResults[(size_t)n * numLogos]);
+        decodedValid[n] = 1;
+        for (auto& worker : analyzerWorkers) {
+            worker->onFrame(n, top, bottom, srcBitDepth);
+        }
+    };
+    const auto onAlias = [&](const int requested, const int resolved) {
+        if (scanStep > 1 && resolved >= 0 && resolved < vi.num_frames && !decodedValid[resolved]) {
+            // 評価しなかったフレームに解決された場合は評価しなかったフレームと同じ扱い
+            finished++;
+            return;
+        }
+        if (resolved < 0 || resolved >= vi.num_frames || !decodedValid[resolved]) {
+            THROWF(RuntimeException, "direct logo scan frame %d resolved to unavailable frame %d", requested, resolved);
+        }
+        std::copy_n(&decodedResults[(size_t)resolved * numLogos], numLogos,
+            &evalResults[(size_t)requested * numLogos]);
+        for (auto& worker : analyzerWorkers) {
+            worker->onAlias(requested, resolved);
+        }
+        if ((finished % 5000) == 0) {
+            ctx.infoF(_T("  logo scan #%d: Finished %6d/%d frames"), threadId, finished, threadTotalFrames);
+        }
+        finished++;
+    };
     for (const auto& r : range) {
-        source.ScanFramesDirect(r.first, r.second,
-            [&](const int n, const AVFrame* top, const AVFrame* bottom, const int dstBitDepth, const int srcBitDepth) {
-                ScanFrameDirect(top, bottom, dstBitDepth, srcBitDepth, memY.data(), memDeint.data(), memWork.data(),
-                    &decodedResults[(size_t)n * numLogos]);
-                decodedValid[n] = 1;
-            },
-            [&](const int requested, const int resolved) {
-                if (resolved < 0 || resolved >= vi.num_frames || !decodedValid[resolved]) {
-                    THROWF(RuntimeException, "direct logo scan frame %d resolved to unavailable frame %d", requested, resolved);
-                }
-                std::copy_n(&decodedResults[(size_t)resolved * numLogos], numLogos,
-                    &evalResults[(size_t)requested * numLogos]);
-                if ((finished % 5000) == 0) {
-                    ctx.infoF(_T("  logo scan #%d: Finished %6d/%d frames"), threadId, finished, threadTotalFrames);
-                }
-                finished++;
-            }, env);
+        if (scanStep <= 1) {
+            source.ScanFramesDirect(r.first, r.second, onFrame, onAlias, env);
+        } else {
+            // 間引き評価は対象フレームだけシークしてデコードする
+            for (int n = getFirstScanFrame(r.first); n <= r.second; n += scanStep) {
+                source.ScanFramesDirect(n, n, onFrame, onAlias, env);
+            }
+        }
+    }
+}
+
+void logo::LogoFrame::setScanStep(int step) {
+    scanStep = std::max(1, step);
+}
+
+void logo::LogoFrame::addFrameAnalyzer(DirectFrameAnalyzer* analyzer) {
+    frameAnalyzers.push_back(analyzer);
+}
+
+void logo::LogoFrame::setScanTargets(const std::vector<int>& logos) {
+    std::fill(scanTargets.begin(), scanTargets.end(), (uint8_t)(logos.empty() ? 1 : 0));
+    for (const int i : logos) {
+        if (i >= 0 && i < numLogos) {
+            scanTargets[i] = 1;
+        }
     }
 }
 
+std::vector<int> logo::LogoFrame::rankLogoCandidates(const std::vector<int>& trims, int numCandidates, int topK) const {
+    if (numCandidates < 0) {
+        numCandidates = numLogos;
+    }
+    // 評価していないフレームはどのロゴでも検出なしになるので、
+    // 全フレームを対象にしたスコアでも順位は間引いたフレームだけで計算したものと変わらない
+    const auto logoScore = calcLogoScore(trimAllTargets(trims), numCandidates);
+    std::vector<int> order(numCandidates);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return logoScore[a].score < logoScore[b].score;
+    });
+    order.resize(std::min(numCandidates, std::max(topK, 0)));
+    return order;
+}
+
 void logo::LogoFrame::dumpResult(const tstring& basepath) {
     for (int i = 0; i < numLogos; i++) {
         StringBuilder sb;
@@ -4071,35 +4783,6 @@ namespace {
             return isStoredRoiReplayActive() ? 8 : bitDepth;
         }
 
-        static uint64_t getAvailableSystemMemoryBytes() {
-#if defined(_WIN32) || defined(_WIN64)
-            MEMORYSTATUSEX msex = { 0 };
-            msex.dwLength = sizeof(msex);
-            if (GlobalMemoryStatusEx(&msex)) {
-                return msex.ullAvailPhys;
-            }
-            return 0;
-#else
-            FILE* fp = fopen("/proc/meminfo", "r");
-            if (fp != nullptr) {
-                char line[256];
-                while (fgets(line, sizeof(line), fp) != nullptr) {
-                    uint64_t kb = 0;
-                    if (sscanf(line, "MemAvailable: %" PRIu64 " kB", &kb) == 1) {
-                        fclose(fp);
-                        return kb * 1024;
-                    }
-                }
-                fclose(fp);
-            }
-            struct sysinfo info;
-            if (sysinfo(&info) == 0) {
-                return (uint64_t)info.freeram * info.mem_unit;
-            }
-            return 0;
-#endif
-        }
-
         tstring getRoiCacheBaseDir() const {
             static const char* kEnvNames[] = {
                 "AMT_LOGO_AUTODETECT_TMPDIR",
@@ -4166,7 +4849,7 @@ namespace {
             const uint64_t frameBytes = (uint64_t)scanw * scanh;
             const uint64_t estimatedBytes = frameBytes * (uint64_t)searchFrames;
             const uint64_t memoryGuard = 2ull * 1024ull * 1024ull * 1024ull;
-            const uint64_t availBytes = getAvailableSystemMemoryBytes();
+            const uint64_t availBytes = GetAvailableSystemMemoryBytes();
             const bool preferTempFile = (availBytes > 0 && availBytes < estimatedBytes + memoryGuard);
             roiCacheFrameBytes = (int)frameBytes;
             roiReplayFrame.resize(roiCacheFrameBytes);
@@ -6508,10 +7191,11 @@ namespace {
             logo::DeintY(pass2.evalDeint.data(), srcY + off, pitchY, w, h);
             // alpha=0/1 の相関を評価し、後段のロゴ有無推定用に保存する。
             const float maxvf = (float)maxv;
-            const float corr0 = pass2.deintLogo->EvaluateLogo(pass2.evalDeint.data(), maxvf, 0.0f, pass2.evalWork.data());
-            const float corr1 = pass2.deintLogo->EvaluateLogo(pass2.evalDeint.data(), maxvf, 1.0f, pass2.evalWork.data());
-            pass2.corr0.push_back(corr0);
-            pass2.corr1.push_back(corr1);
+            const float fades[2] = { 0.0f, 1.0f };
+            float corr[2];
+            pass2.deintLogo->EvaluateLogoMulti(pass2.evalDeint.data(), maxvf, fades, 2, pass2.evalWork.data(), corr);
+            pass2.corr0.push_back(corr[0]);
+            pass2.corr1.push_back(corr[1]);
             return 0;
         }
 
@@ -18,6 +18,7 @@
 #include "TsInfo.h"
 #include "TextOut.h"
 #include "ReaderWriterFFmpeg.h"
+#include "ComputeKernel.h"
 
 #include <cmath>
 #include <functional>
@@ -102,6 +103,13 @@ class LogoDataParam : public LogoData {
 
     decltype(CalcCorrelation5x5)* pCalcCorrelation5x5;
     decltype(removeLogoLine)* pRemoveLogoLine;
+
+    // 複数fade一括評価用（着目点ごとに並べ直したもの）
+    std::vector<int> maskPosX, maskPosY;
+    std::vector<float> simdKernels; // 着目点ごとに5行x8要素
+    std::vector<float> kernelSums;
+    std::vector<float> scaleSoA, scale2SoA;
+    decltype(CalcLogoScoreMultiFade_AVX2)* pCalcLogoScoreMultiFade;
 public:
     LogoDataParam();
 
@@ -122,8 +130,22 @@ public:
     // 評価準備
     void CreateLogoMask(float maskratio);
 
+    // CreateLogoMaskの結果をキャッシュファイルに読み書きする
+    // 読めなかった場合や内容が合わない場合はfalse
+    bool LoadMaskCache(const tstring& path);
+    void SaveMaskCache(const tstring& path) const;
+
+    // cachePathが空でなければキャッシュがあれば読み、なければ作って保存する
+    void CreateLogoMaskCached(float maskratio, const tstring& cachePath);
+
     float EvaluateLogo(const float *src, float maxv, float fade, float* work, int stride = -1);
 
+    // 複数のfade値でEvaluateLogoした結果をresultsに返す
+    void EvaluateLogoMulti(const float *src, float maxv, const float* fades, int numFades, float* work, float* results, int stride = -1);
+
+    // EvaluateLogoMultiで使うカーネルを差し替える（テスト用。nullptrならfadeごとにEvaluateLogoする）
+    void SetMultiFadeKernel(decltype(CalcLogoScoreMultiFade_AVX2)* kernel);
+
     std::unique_ptr<LogoDataParam> MakeFieldLogo(bool bottom);
 
 private:
@@ -131,6 +153,9 @@ private:
     // 画素ごとにロゴとの相関を計算
     float CorrelationScore(const float *work, float maxv);
 
+    // mask, kernels, scalesから評価用の関数と並べ直したデータを用意
+    void SetupEvaluation();
+
     void AddLogo(float* Y, int maxv);
 };
 
@@ -144,6 +169,9 @@ public:
     // ピクセルの色を追加 f:前景 b:背景 (0-1の値を入れること)
     void Add(double f, double b);
 
+    // 別に集計した結果を足す
+    void Merge(const LogoColor& other);
+
     /*====================================================================
     * 	GetAB_?()
     * 		回帰直線の傾きと切片を返す X軸:前景 Y軸:背景
@@ -185,6 +213,9 @@ public:
     // AddFrame で受理されたフレーム数を返す
     int getNumFrames() const { return nframes; }
 
+    // 同じサイズのLogoScanで集計した結果を足す
+    void Merge(const LogoScan& other);
+
     void Normalize(int mavx);
 
     std::unique_ptr<LogoData> GetLogo(bool clean, LogoColorMode colorMode = LogoColorMode::NormalYUV) const;
@@ -397,18 +428,44 @@ typedef bool(*LOGO_ANALYZE_CB)(float progress, int nread, int total, int ngather
 //   大きめの処理区間にまとめて通知する。
 typedef bool(*LOGO_AUTODETECT_CB)(int stage, float stageProgress, float progress, int nread, int total);
 
-class LogoScanDataCompressed {
+// ロゴ生成用の有効フレームの保存
+// フレーム間差分(KEY_INTERVALごとにフレーム内差分)を高速設定のzlibで圧縮する
+// 圧縮はBATCH_FRAMESごとに複数スレッドでまとめて行う（スレッドは最初のバッチで作って使い回す）
+class LogoScanDataStore {
 public:
-    LogoScanDataCompressed();
-    ~LogoScanDataCompressed();
-
-    void compress(const void *ptr, size_t datasize);
-    void decompress(void *ptr);
-    int originalSize() const { return original_size; }
-protected:
-    std::vector<char> compressed_data;
-    
-    unsigned long original_size;
+    LogoScanDataStore();
+    ~LogoScanDataStore();
+
+    // frameBytes: 1フレームのバイト数 pixelBytes: 1画素のバイト数
+    // compress=falseのときは無圧縮で保持する
+    void init(size_t frameBytes, int pixelBytes, bool compress);
+    void add(const void *ptr);
+    // 圧縮待ちのフレームを処理する（読み出す前に呼ぶこと）
+    void flush();
+
+    int numFrames() const { return (int)frames.size(); }
+    size_t frameSize() const { return frameBytes; }
+    bool isCompressed() const { return compressed; }
+    uint64_t storedBytes() const;
+    // cursorはptrに入っているフレーム番号（なければ-1）
+    // 前のフレームに続けて読む場合は差分を適用するだけで済む
+    void getFrame(int i, void *ptr, int& cursor) const;
+private:
+    enum {
+        KEY_INTERVAL = 16,
+        BATCH_FRAMES = 64,
+    };
+    size_t frameBytes;
+    int pixelBytes;
+    bool compressed;
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<uint8_t> batch;     // 圧縮待ちのフレーム（先頭は直前のフレーム）
+    int batchFrames;
+    struct Workers;
+    std::unique_ptr<Workers> workers;
+
+    void encodeFrame(std::vector<uint8_t>& dst, const uint8_t* cur, const uint8_t* prev, bool key) const;
+    void decodeFrame(uint8_t* dst, const std::vector<uint8_t>& src, std::vector<uint8_t>& work) const;
 };
 
 class LogoAnalyzer : AMTObject {
@@ -421,15 +478,15 @@ class LogoAnalyzer : AMTObject {
         int64_t filesize;
         std::vector<uint8_t> memScanData;
         std::unique_ptr<LogoScan> logoscan;
-        std::vector<std::unique_ptr<LogoScanDataCompressed>> scanData;
+        LogoScanDataStore scanData;
     public:
         InitialLogoCreator(LogoAnalyzer* pThis);
         void readAll(const tstring& src, int serviceid);
         int bitdepth() const { return bitDepth; }
         bool isHighBitDepth() const { return bitDepth > 8; }
-        int numFrames() const { return (int)scanData.size(); }
-        int getFrameSize(const int i) const { return (int)scanData[i]->originalSize(); }
-        void getFrame(const int i, void *ptr) { return scanData[i]->decompress(ptr); }
+        int numFrames() const { return scanData.numFrames(); }
+        int getFrameSize(const int i) const { return (int)scanData.frameSize(); }
+        void getFrame(const int i, void *ptr, int& cursor) const { scanData.getFrame(i, ptr, cursor); }
     protected:
         virtual void onFirstFrame(AVStream *videoStream, AVFrame* frame);;
         virtual bool onFrame(AVFrame* frame);
@@ -453,9 +510,7 @@ class LogoAnalyzer : AMTObject {
                 // 有効なフレームは保存しておく
                 CopyYV12((pixel_t *)memScanData.data(), scanY, scanU, scanV, pitchY, pitchUV, pThis->scanw, pThis->scanh);
                 //ここでメモリにためる
-                auto scanDataCompressed = std::make_unique<LogoScanDataCompressed>();
-                scanDataCompressed->compress(memScanData.data(), scanDataSize * sizeof(pixel_t));
-                scanData.push_back(std::move(scanDataCompressed));
+                scanData.add(memScanData.data());
             }
         }
     };
@@ -514,141 +569,10 @@ class LogoAnalyzer : AMTObject {
         return std::max(5, std::min(9, (int)std::lround(9.0 * fadeScale)));
     }
 
+    // 保存したフレームでfadeを推定して、ロゴのあるフレームだけでロゴを作り直す
+    // フレームはスレッドごとに連続区間で分担する
     template <typename pixel_t>
-    void ReMakeLogo()  {
-
-        // ロゴを評価用にインタレ解除
-        LogoDataParam deintLogo(LogoData(scanw, scanh, logUVx, logUVy), scanw, scanh, scanx, scany);
-        DeintLogo(deintLogo, *logodata, scanw, scanh);
-        deintLogo.CreateLogoMask(0.1f);
-
-        const int numFrames = creator->numFrames();
-
-        const size_t scanDataSize = scanw * scanh * 3 / 2;
-        const size_t YSize = scanw * scanh;
-        std::vector<pixel_t> memScanData;
-
-        auto memDeint = std::unique_ptr<float[]>(new float[YSize + 8]);
-        auto memWork = std::unique_ptr<float[]>(new float[YSize + 8]);
-
-        const int numFade = 20;
-        auto minFades = std::unique_ptr<int[]>(new int[numFrames]);
-        {
-
-            // 全フレームループ
-            for (int i = 0; i < numFrames; i++) {
-                memScanData.resize(creator->getFrameSize(i));
-                creator->getFrame(i, memScanData.data());
-                const float maxv = (float)((1 << creator->bitdepth()) - 1);
-                // フレームをインタレ解除
-                DeintY(memDeint.get(), memScanData.data(), scanw, scanw, scanh);
-                // fade値ループ
-                float minResult = std::numeric_limits<float>::max();
-                int minFadeIndex = 0;
-                for (int fi = 0; fi < numFade; fi++) {
-                    float fade = 0.1f * fi;
-                    // ロゴを評価
-                    float result = std::abs(deintLogo.EvaluateLogo(memDeint.get(), maxv, fade, memWork.get()));
-                    if (result < minResult) {
-                        minResult = result;
-                        minFadeIndex = fi;
-                    }
-                }
-                minFades[i] = minFadeIndex;
-
-                if ((i % 100) == 0) {
-                    float progress = (float)i / numFrames * 25 + progressbase;
-                    if (cb(progress, i, numFrames, numFrames) == false) {
-                        THROW(RuntimeException, "Cancel requested");
-                    }
-                }
-            }
-        }
-
-        // 評価値を集約
-        // とりあえず出してみる
-        std::vector<int> numMinFades(numFade);
-        for (int i = 0; i < numFrames; i++) {
-            numMinFades[minFades[i]]++;
-        }
-        int maxi = (int)(std::max_element(numMinFades.begin(), numMinFades.end()) - numMinFades.begin());
-        const int eligibleFadeMin = GetEligibleFadeMinIndex();
-        ctx.infoF(_T("[GenLogo] dominant fade: index=%d rate=%.1f%% eligibleFadeMin=%d"),
-            maxi, numMinFades[maxi] / (float)numFrames * 100.0f, eligibleFadeMin);
-
-        int usedEligibleFadeMin = eligibleFadeMin;
-        int eligibleFrames = 0;
-        auto remakeLogoWithFadeMin = [&](const int fadeMin, int& outEligibleFrames) {
-            LogoScan logoscan(scanw, scanh, logUVx, logUVy, GetAdjustedBackgroundThreshold());
-            outEligibleFrames = 0;
-            int scanUVw = scanw >> logUVx;
-            int scanUVh = scanh >> logUVy;
-            int offU = scanw * scanh;
-            int offV = offU + scanUVw * scanUVh;
-
-            // 全フレームループ
-            for (int i = 0; i < numFrames; i++) {
-                memScanData.resize(creator->getFrameSize(i));
-                creator->getFrame(i, memScanData.data());
-                // ロゴのあるフレームだけAddFrame
-                if (minFades[i] >= fadeMin) {
-                    outEligibleFrames++;
-                    const auto ptr = memScanData.data();
-                    logoscan.AddFrame(ptr, ptr + offU, ptr + offV, scanw, scanUVw, creator->bitdepth());
-                }
-
-                if (((i + 1) % 2000) == 0 || (i + 1) == numFrames) {
-                    ctx.infoF(_T("[GenLogo] eligible frame collect: %d/%d fadeMin=%d eligible=%d"),
-                        i + 1, numFrames, fadeMin, outEligibleFrames);
-                }
-            }
-            auto candidate = logoscan.GetLogo(true);
-            if (candidate != nullptr) {
-                logoQuality = logoscan.CalcQualityMetrics(*candidate);
-            }
-            return candidate;
-        };
-
-        // ロゴ作成
-        logodata = remakeLogoWithFadeMin(eligibleFadeMin, eligibleFrames);
-        if (logodata == nullptr && validateQuality) {
-            std::vector<int> retryFadeMins;
-            auto addRetryFadeMin = [&](const int value) {
-                const int fadeMin = std::max(0, std::min(numFade - 1, value));
-                if (fadeMin < eligibleFadeMin &&
-                    std::find(retryFadeMins.begin(), retryFadeMins.end(), fadeMin) == retryFadeMins.end()) {
-                    retryFadeMins.push_back(fadeMin);
-                }
-            };
-            addRetryFadeMin(eligibleFadeMin - 2);
-            addRetryFadeMin(5);
-            addRetryFadeMin(3);
-            addRetryFadeMin(1);
-            addRetryFadeMin(0);
-            for (const int retryFadeMin : retryFadeMins) {
-                int retryEligibleFrames = 0;
-                ctx.infoF(_T("[GenLogo] retry logo remake with relaxed fadeMin=%d (strict=%d)"),
-                    retryFadeMin, eligibleFadeMin);
-                auto retryLogo = remakeLogoWithFadeMin(retryFadeMin, retryEligibleFrames);
-                if (retryLogo != nullptr) {
-                    logodata = std::move(retryLogo);
-                    usedEligibleFadeMin = retryFadeMin;
-                    eligibleFrames = retryEligibleFrames;
-                    ctx.infoF(_T("[GenLogo] relaxed fadeMin succeeded: fadeMin=%d eligible=%d/%d"),
-                        usedEligibleFadeMin, eligibleFrames, numFrames);
-                    break;
-                }
-            }
-        }
-        if (logodata != nullptr) {
-            LogLogoQuality(_T("remake"));
-        }
-
-        if (logodata == nullptr) {
-            THROWF(RuntimeException, "Insufficient logo frames (eligible=%d, total=%d, eligibleFadeMin=%d, dominantFade=%d, dominantFadeRate=%.1f%%)",
-                eligibleFrames, numFrames, usedEligibleFadeMin, maxi, numMinFades[maxi] / (float)numFrames * 100.0f);
-        }
-    }
+    void ReMakeLogo();
 
 public:
     LogoAnalyzer(AMTContext& ctx, const tchar* srcpath, int serviceid, const tchar* workfile, const tchar* dstpath,
@@ -706,10 +630,17 @@ class AMTAnalyzeLogo : public GenericVideoFilter {
             DeintY(memDeint.get(), srcY + off, pitchY, header.w, header.h);
 
             LogoAnalyzeFrame info;
+            float fades[11];
+            for (int f = 0; f <= 10; f++) {
+                fades[f] = (float)f / 10.0f;
+            }
+            deintLogo->EvaluateLogoMulti(memDeint.get(), maxv, fades, 11, memWork.get(), info.p);
+            fieldLogoT->EvaluateLogoMulti(memCopy.get(), maxv, fades, 11, memWork.get(), info.t, header.w * 2);
+            fieldLogoB->EvaluateLogoMulti(memCopy.get() + header.w, maxv, fades, 11, memWork.get(), info.b, header.w * 2);
             for (int f = 0; f <= 10; f++) {
-                info.p[f] = std::abs(deintLogo->EvaluateLogo(memDeint.get(), maxv, (float)f / 10.0f, memWork.get()));
-                info.t[f] = std::abs(fieldLogoT->EvaluateLogo(memCopy.get(), maxv, (float)f / 10.0f, memWork.get(), header.w * 2));
-                info.b[f] = std::abs(fieldLogoB->EvaluateLogo(memCopy.get() + header.w, maxv, (float)f / 10.0f, memWork.get(), header.w * 2));
+                info.p[f] = std::abs(info.p[f]);
+                info.t[f] = std::abs(info.t[f]);
+                info.b[f] = std::abs(info.b[f]);
             }
 
             pDst[i] = info;
@@ -719,7 +650,7 @@ class AMTAnalyzeLogo : public GenericVideoFilter {
     }
 
 public:
-    AMTAnalyzeLogo(PClip clip, const tstring& logoPath, float maskratio, IScriptEnvironment* env);
+    AMTAnalyzeLogo(PClip clip, const tstring& logoPath, float maskratio, const tstring& cacheDir, IScriptEnvironment* env);
 
     PVideoFrame __stdcall GetFrame(int n, IScriptEnvironment* env_);
 
@@ -842,6 +773,26 @@ public:
     static AVSValue __cdecl Create(AVSValue args, void* user_data, IScriptEnvironment* env);
 };
 
+// scanFramesDirectでデコードしたフレームをロゴ評価と一緒に受け取る解析器
+// 同じデコードでロゴ以外の解析も行うために使う
+class DirectFrameAnalyzer {
+public:
+    virtual ~DirectFrameAnalyzer() {}
+
+    // 解析スレッドごとの処理（スレッドごとにcreateWorkerで作る）
+    class Worker {
+    public:
+        virtual ~Worker() {}
+        // デコードしたフレームn（AVFrameはコールバック内でのみ有効）
+        virtual void onFrame(int n, const AVFrame* top, const AVFrame* bottom, int srcBitDepth) = 0;
+        // 出力フレームrequestedの内容はデコードしたフレームresolved
+        // requestedはスレッド間で重複しない
+        virtual void onAlias(int requested, int resolved) = 0;
+    };
+
+    virtual std::unique_ptr<Worker> createWorker() = 0;
+};
+
 class LogoFrame : AMTObject {
     int numLogos;
     std::vector<LogoDataParam> logoArr;
@@ -857,34 +808,83 @@ class LogoFrame : AMTObject {
     };
     std::vector<EvalResult> evalResults;
 
+    // 領域が重なるロゴのグループ（インタレ解除はグループ単位で1回だけ行う）
+    struct LogoGroup {
+        int x, y, w, h;          // 全ロゴを含む領域
+        std::vector<int> logos;  // deintArrのインデックス
+    };
+    std::vector<LogoGroup> logoGroups;
+    int maxGroupYSize;
+
+    // 評価対象のロゴ（0のロゴはグループに入れず評価しない）
+    std::vector<uint8_t> scanTargets;
+    // 評価するフレームの間隔（1なら全フレーム）
+    int scanStep;
+    // scanFramesDirectでデコードしたフレームを渡す解析器
+    std::vector<DirectFrameAnalyzer*> frameAnalyzers;
+
     // 絶対値<0.2fは不明とみなす
     const float THRESH = 0.2f;
 
     int bestLogo;
     float logoRatio;
 
+    // 有効なロゴを領域の重なりでグループ化
+    void MakeLogoGroups();
+
+    // グループ領域をまとめてインタレ解除して、グループ内の全ロゴを続けて評価する
+    // srcはグループ領域の左上
+    template <typename pixel_t>
+    void EvaluateLogoGroup(const LogoGroup& group, const pixel_t* src, int srcPitch, float* memDeint, float* memWork, const float maxv, EvalResult* outResult) {
+        DeintY(memDeint, src, srcPitch, group.w, group.h);
+
+        // DeintYは上下端の行をそのままコピーするので、
+        // ロゴ単体でインタレ解除した場合と同じになるようロゴの上下端の行を差し替える
+        auto setRow = [&](int y, int x0, int w, bool raw) {
+            const pixel_t* s = src + x0 + y * srcPitch;
+            float* d = memDeint + x0 + y * group.w;
+            if (raw || y == 0 || y == group.h - 1) {
+                for (int x = 0; x < w; x++) {
+                    d[x] = s[x];
+                }
+            } else {
+                for (int x = 0; x < w; x++) {
+                    d[x] = (s[x - srcPitch] + 2 * s[x] + s[x + srcPitch] + 2) * 0.25f;
+                }
+            }
+        };
+
+        for (int i : group.logos) {
+            LogoDataParam& logo = deintArr[i];
+            const int lx = logo.getImgX() - group.x;
+            const int ly = logo.getImgY() - group.y;
+            const int lw = logo.getWidth();
+            const int lh = logo.getHeight();
+            setRow(ly, lx, lw, true);
+            setRow(ly + lh - 1, lx, lw, true);
+
+            // ロゴ評価
+            const float fades[2] = { 0.0f, 1.0f };
+            float corr[2];
+            logo.EvaluateLogoMulti(memDeint + lx + ly * group.w, maxv, fades, 2, memWork, corr, group.w);
+            outResult[i].corr0 = corr[0];
+            outResult[i].corr1 = corr[1];
+
+            setRow(ly, lx, lw, false);
+            setRow(ly + lh - 1, lx, lw, false);
+        }
+    }
+
     template <typename pixel_t>
     void ScanFrame(PVideoFrame& frame, float* memDeint, float* memWork, const float maxv, EvalResult *outResult) {
         const pixel_t* srcY = reinterpret_cast<const pixel_t*>(frame->GetReadPtr(PLANAR_Y));
         const int pitchY = frame->GetPitch(PLANAR_Y) / sizeof(pixel_t);
 
-        for (int i = 0; i < numLogos; i++) {
-            LogoDataParam& logo = deintArr[i];
-            if (logo.isValid() == false ||
-                logo.getImgWidth() != vi.width ||
-                logo.getImgHeight() != vi.height) {
-                outResult[i].corr0 = 0;
-                outResult[i].corr1 = -1;
-                continue;
-            }
+        // 評価対象外のロゴ
+        std::fill_n(outResult, numLogos, EvalResult{ 0, -1 });
 
-            // フレームをインタレ解除
-            const int off = logo.getImgX() + logo.getImgY() * pitchY;
-            DeintY(memDeint, srcY + off, pitchY, logo.getWidth(), logo.getHeight());
-
-            // ロゴ評価
-            outResult[i].corr0 = logo.EvaluateLogo(memDeint, maxv, 0, memWork);
-            outResult[i].corr1 = logo.EvaluateLogo(memDeint, maxv, 1, memWork);
+        for (const auto& group : logoGroups) {
+            EvaluateLogoGroup(group, srcY + group.x + group.y * pitchY, pitchY, memDeint, memWork, maxv, outResult);
         }
     }
 
@@ -936,6 +936,23 @@ class LogoFrame : AMTObject {
         return std::accumulate(range.begin(), range.end(), 0, [](int sum, const std::pair<int, int>& r) { return sum + r.second - r.first + 1; });
     }
 
+    // n以降で最初の評価対象フレーム
+    int getFirstScanFrame(const int n) const {
+        return (n + scanStep - 1) / scanStep * scanStep;
+    }
+
+    // rangeのうち評価対象のフレーム数
+    int getTotalScanFrames(const std::vector<std::pair<int, int>>& range) const {
+        int sum = 0;
+        for (const auto& r : range) {
+            const int first = getFirstScanFrame(r.first);
+            if (first <= r.second) {
+                sum += (r.second - first) / scanStep + 1;
+            }
+        }
+        return sum;
+    }
+
     bool inTrimRange(const int n, const std::vector<int>& trims) const {
         // trimsの長さが0の場合は、すべてのフレームを対象とする
         if (trims.size() == 0 || (trims.size() % 2) != 0) {
@@ -947,7 +964,7 @@ class LogoFrame : AMTObject {
 
     template <typename pixel_t>
     void IterateFrames(PClip clip, const std::vector<int>& trims, const int threadId, const int totalThreads, IScriptEnvironment2* env) {
-        std::vector<float> memDeint(maxYSize + 8, 0.0f);
+        std::vector<float> memDeint(maxGroupYSize + 8, 0.0f);
         std::vector<float> memWork(maxYSize + 8, 0.0f);
         const float maxv = (float)((1 << vi.BitsPerComponent()) - 1);
 
@@ -955,11 +972,11 @@ class LogoFrame : AMTObject {
         for (const auto& r : range) {
             ctx.infoF(_T("  logo scan #%d: %6d-%6d"), threadId, r.first, r.second);
         }
-        const int threadTotalFrames = getTotalFrames(range);
+        const int threadTotalFrames = getTotalScanFrames(range);
 
         int finished = 0;
         for (const auto& r : range) {
-            for (int n = r.first; n <= r.second; n++, finished++) {
+            for (int n = getFirstScanFrame(r.first); n <= r.second; n += scanStep, finished++) {
                 PVideoFrame frame = clip->GetFrame(n, env);
                 ScanFrame<pixel_t>(frame, memDeint.data(), memWork.data(), maxv, &evalResults[n * numLogos]);
 
@@ -983,7 +1000,8 @@ class LogoFrame : AMTObject {
     std::vector<LogoScore> calcLogoScore(const std::vector<std::pair<int, int>>& range, int numCandidates) const;
 
 public:
-    LogoFrame(AMTContext& ctx, const std::vector<tstring>& logofiles, float maskratio);
+    // cacheDirが空でなければロゴ評価用データのキャッシュを使う
+    LogoFrame(AMTContext& ctx, const std::vector<tstring>& logofiles, float maskratio, const tstring& cacheDir = tstring());
 
     void setClipInfo(PClip clip);
 
@@ -996,6 +1014,22 @@ public:
 
     void dumpResult(const tstring& basepath);
 
+    // 以降のscanFrames/scanFramesDirectでstepフレームごとに1フレームだけ評価する（1なら全フレーム）
+    // 評価しなかったフレームはロゴなし扱い（corr0=0）になる
+    void setScanStep(int step);
+
+    // 以降のscanFrames/scanFramesDirectで評価するロゴを指定
+    // 評価するロゴのグループはsetClipInfoで作るので、呼んだ後にsetClipInfoし直すこと
+    // （scanLogoFramesはsetClipInfoを呼ぶので、その前に呼べばよい）。空なら全ロゴを評価する
+    void setScanTargets(const std::vector<int>& logos);
+
+    // 以降のscanFramesDirectでデコードしたフレームをanalyzerにも渡す（全フレーム評価のときだけ）
+    void addFrameAnalyzer(DirectFrameAnalyzer* analyzer);
+
+    // 0番目～numCandidatesまでのロゴを現在の評価結果でスコアの良い順に並べて上位topK個を返す
+    // 間引き評価の結果から全フレーム評価するロゴを絞り込むのに使う
+    std::vector<int> rankLogoCandidates(const std::vector<int>& trims, int numCandidates, int topK) const;
+
     // 0番目～numCandidatesまでのロゴから最も合っているロゴ(bestLogo)を選択
     // numCandidatesの指定がない場合(-1)は、すべてのロゴから検索
     void selectLogo(const std::vector<int>& trims, int numCandidates = -1);
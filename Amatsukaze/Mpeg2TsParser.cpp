@@ -7,6 +7,8 @@
 */
 
 #include "Mpeg2TsParser.h"
+#include "ComputeKernel.h"
+#include <algorithm>
 
 AdapdationField::AdapdationField(uint8_t* data, int length) : MemoryChunk(data, length) {}
 
@@ -238,12 +240,20 @@ void PESPacket::writeTimeStamp(uint8_t* ptr, int64_t TS) {
 }
 TsPacketParser::TsPacketParser(AMTContext& ctx)
     : AMTObject(ctx)
-    , syncOK(false) {}
+    , syncOK(false)
+    , resetCount(0) {}
 
 /** @brief TSデータを入力 */
 void TsPacketParser::inputTS(MemoryChunk data) {
 
-    buffer.add(data);
+    if (syncOK && buffer.size() < 2 * TS_PACKET_LENGTH) {
+        // 同期が取れている間は入力データをコピーせずに処理する
+        if (!inputDirect(data)) {
+            return;
+        }
+    } else {
+        buffer.add(data);
+    }
 
     if (syncOK) {
         outPackets();
@@ -278,6 +288,18 @@ void TsPacketParser::flush() {
 void TsPacketParser::reset() {
     buffer.clear();
     syncOK = false;
+    resetCount++;
+}
+
+// 同期バイト確認済みの連続したnumPackets個のTSパケットを1つずつ出力
+/* virtual */ void TsPacketParser::onTsPackets(uint8_t* ptr, int numPackets) {
+    const int generation = resetCount;
+    for (int i = 0; i < numPackets; i++) {
+        checkAndOutPacket(MemoryChunk(ptr + (size_t)i * TS_PACKET_LENGTH, TS_PACKET_LENGTH));
+        if (isResetRequested(generation)) {
+            return;
+        }
+    }
 }
 
 // numPacket個分のパケットの同期バイトが合っているかチェック
@@ -290,6 +312,77 @@ bool TsPacketParser::checkSyncByte(uint8_t* ptr, int numPacket) {
     return true;
 }
 
+// ptrからstride 188で先頭から連続して同期バイトが合っている位置の数
+int TsPacketParser::countSyncRun(const uint8_t* ptr, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    // 同期バイトがデータ内にある位置の数
+    const int numPos = (int)((length - 1) / TS_PACKET_LENGTH + 1);
+    // 4バイト読み出しがデータ内に収まる位置の数
+    const int numSimd = (length >= 4) ? (int)((length - 4) / TS_PACKET_LENGTH + 1) : 0;
+    static const bool avx2 = IsAVX2Available();
+    int i = 0;
+    if (avx2) {
+        i = CountSyncByteRun_AVX2(ptr, TS_PACKET_LENGTH, numSimd, TS_SYNC_BYTE);
+        if (i < numSimd) {
+            return i;
+        }
+    }
+    for (; i < numPos; i++) {
+        if (ptr[(size_t)i * TS_PACKET_LENGTH] != TS_SYNC_BYTE) {
+            break;
+        }
+    }
+    return i;
+}
+
+// 同期済みのとき呼び出し元のバッファ上で直接パケットを切り出す
+// 処理しなかった残りを内部バッファに繰り越した場合は内部バッファでの処理が必要かを返す
+bool TsPacketParser::inputDirect(MemoryChunk data) {
+    const int generation = resetCount;
+
+    // 繰り越した端数をパケット境界まで埋めて出力する
+    size_t offset = (TS_PACKET_LENGTH - buffer.size() % TS_PACKET_LENGTH) % TS_PACKET_LENGTH;
+    if (data.length <= offset) {
+        // 次の同期バイトまで届かない
+        buffer.add(data);
+        return buffer.size() >= 2 * TS_PACKET_LENGTH;
+    }
+    buffer.add(MemoryChunk(data.data, offset));
+    while (buffer.size() > 0) {
+        const uint8_t nextSync = (buffer.size() > TS_PACKET_LENGTH)
+            ? buffer.ptr()[TS_PACKET_LENGTH] : data.data[offset];
+        if (buffer.ptr()[0] != TS_SYNC_BYTE || nextSync != TS_SYNC_BYTE) {
+            // 同期が崩れたので内部バッファで処理
+            buffer.add(MemoryChunk(data.data + offset, data.length - offset));
+            return true;
+        }
+        checkAndOutPacket(MemoryChunk(buffer.ptr(), TS_PACKET_LENGTH));
+        if (isResetRequested(generation)) {
+            // resetされたら残りは捨てる（バッファ経由の場合と同じ）
+            return false;
+        }
+        buffer.trimHead(TS_PACKET_LENGTH);
+    }
+
+    // 次のパケットの同期バイトまで合っているパケットをまとめて出力
+    uint8_t* ptr = data.data + offset;
+    size_t length = data.length - offset;
+    const int numPackets = std::max(0, countSyncRun(ptr, length) - 1);
+    if (numPackets > 0) {
+        onTsPackets(ptr, numPackets);
+        if (isResetRequested(generation)) {
+            return false;
+        }
+    }
+
+    // 残りを繰り越す
+    const size_t consumed = (size_t)numPackets * TS_PACKET_LENGTH;
+    buffer.add(MemoryChunk(ptr + consumed, length - consumed));
+    return buffer.size() >= 2 * TS_PACKET_LENGTH;
+}
+
 // 「先頭と次のパケットの同期バイトを見て合っていれば出力」を繰り返す
 void TsPacketParser::outPackets() {
     while (buffer.size() >= 2 * TS_PACKET_LENGTH &&
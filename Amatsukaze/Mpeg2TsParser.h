@@ -151,13 +151,29 @@ protected:
     /** @brief 切りだされたTSパケットを処理 */
     virtual void onTsPacket(TsPacket packet) = 0;
 
+    /** @brief 同期バイト確認済みの連続したnumPackets個のTSパケットをまとめて処理
+    * デフォルトは1つずつチェックしてonTsPacketに渡す（途中でreset()が呼ばれたら残りは処理しない）
+    */
+    virtual void onTsPackets(uint8_t* ptr, int numPackets);
+
 private:
     AutoBuffer buffer;
     bool syncOK;
+    int resetCount;
+
+    // onTsPacketの中でreset()が呼ばれたか
+    bool isResetRequested(int generation) const { return resetCount != generation; }
 
     // numPacket個分のパケットの同期バイトが合っているかチェック
     bool checkSyncByte(uint8_t* ptr, int numPacket);
 
+    // ptrからstride 188で先頭から連続して同期バイトが合っている位置の数
+    int countSyncRun(const uint8_t* ptr, size_t length);
+
+    // 同期済みのとき呼び出し元のバッファ上で直接パケットを切り出す
+    // 処理しなかった残りを内部バッファに繰り越した場合は内部バッファでの処理が必要かを返す
+    bool inputDirect(MemoryChunk data);
+
     // 「先頭と次のパケットの同期バイトを見て合っていれば出力」を繰り返す
     void outPackets();
 
@@ -7,7 +7,14 @@
 */
 
 #include "Muxer.h"
+#include "ReaderWriterFFmpeg.h"
 #include <cmath>
+#include <deque>
+#include <functional>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <regex>
 
 /* static */ ENUM_FORMAT getActualOutputFormat(EncodeFileKey key, const StreamReformInfo& reformInfo, const ConfigWrapper& setting) {
     if (!setting.getUseMKVWhenSubExist() || setting.getFormat() == FORMAT_MKV) {
@@ -39,33 +46,30 @@ AMTMuxder::AMTMuxder(
     , setting_(setting)
     , reformInfo_(reformInfo) {}
 
-void AMTMuxder::mux(EncodeFileKey key,
+AMTMuxder::~AMTMuxder() {
+    if (streaming_) {
+        // 例外で抜けた場合もスレッドを残さない
+        streaming_->video->finish(false);
+        streaming_->thread.join();
+    }
+}
+
+AMTMuxder::MuxInput AMTMuxder::makeMuxInput(EncodeFileKey key,
     const EncoderOptionInfo& eoInfo, // エンコーダオプション情報
     bool nicoOK,
     EncodeFileOutput& fileOut) // 出力情報
 {
     const auto& fileIn = reformInfo_.getEncodeFile(key);
     auto fmt = reformInfo_.getFormat(key);
-    auto muxFormat = getActualOutputFormat(key, reformInfo_, setting_);
-    auto vfmt = fileOut.vfmt;
-
-    bool tsreplaceEdgeTrim = false;
-    int64_t tsreplaceDelay = 0;
-    if (muxFormat == FORMAT_TSREPLACE && key.cm == CMTYPE_EDGE_TRIM) {
-        if (!fileIn.videoFrames.empty()) {
-            const auto& filterFrames = reformInfo_.getFilterSourceFrames(key.video);
-            int firstIndex = fileIn.videoFrames.front();
-            if (firstIndex >= 0 && firstIndex < (int)filterFrames.size()) {
-                double firstPts = filterFrames[firstIndex].pts;
-                double basePts = reformInfo_.getFirstDataPTS();
-                tsreplaceDelay = (int64_t)std::llround(firstPts - basePts);
-                if (tsreplaceDelay < 0) {
-                    tsreplaceDelay = 0;
-                }
-                tsreplaceEdgeTrim = true;
-            }
-        }
-    }
+    MuxInput in;
+    in.muxFormat = getActualOutputFormat(key, reformInfo_, setting_);
+    in.vfmt = fileOut.vfmt;
+    const auto muxFormat = in.muxFormat;
+    auto& vfmt = in.vfmt;
+    auto& audioFiles = in.audioFiles;
+    auto& chapterFile = in.chapterFile;
+    auto& subsFiles = in.subsFiles;
+    auto& subsTitles = in.subsTitles;
 
     if (eoInfo.selectEvery > 1) {
         // エンコーダで間引く場合があるので、それを反映する
@@ -100,7 +104,6 @@ void AMTMuxder::mux(EncodeFileKey key,
     }
 
     // 音声ファイルを作成
-    std::vector<tstring> audioFiles;
     if (setting_.isEncodeAudio()) {
         audioFiles.push_back(setting_.getIntAudioFilePath(key, 0, setting_.getAudioEncoder()));
     } else if (setting_.getFormat() != FORMAT_TSREPLACE
@@ -123,12 +126,9 @@ void AMTMuxder::mux(EncodeFileKey key,
     }
 
     // 映像ファイル
-    tstring encVideoFile = setting_.getEncVideoFilePath(key);
-    uint64_t encVideoFileSize = 0;
-    rgy_get_filesize(encVideoFile.c_str(), &encVideoFileSize);
+    in.encVideoFile = setting_.getEncVideoFilePath(key);
 
     // チャプターファイル
-    tstring chapterFile;
     if (setting_.isChapterEnabled()) {
         auto path = setting_.getTmpChapterPath(key);
         if (File::exists(path)) {
@@ -142,8 +142,6 @@ void AMTMuxder::mux(EncodeFileKey key,
     }
 
     // 字幕ファイル
-    std::vector<tstring> subsFiles;
-    std::vector<tstring> subsTitles;
     if (nicoOK) {
         for (NicoJKType jktype : setting_.getNicoJKTypes()) {
             auto srcsub = setting_.getTmpNicoJKASSPath(key, jktype);
@@ -204,6 +202,66 @@ void AMTMuxder::mux(EncodeFileKey key,
             }
         }
     }
+    // タイムコード用
+    in.timebase = std::make_pair(vfmt.frameRateNum * (fileOut.vfrTimingFps / 30), vfmt.frameRateDenom);
+
+    in.outPath = setting_.getOutFilePath(fileIn.outKey, fileIn.keyMax, muxFormat, eoInfo.format);
+    if (muxFormat != setting_.getFormat()) { // 初期のフォーマットから変わっているとき
+        if (muxFormat == FORMAT_MKV) { // useMKVWhenSubExistの場合
+            ctx.infoF(_T("字幕が存在するため、mkv出力に切り替えます。"));
+        } else {
+            THROWF(RuntimeException, "Unexpected error, muxFormat != setting_.getFormat()");
+        }
+    }
+    return in;
+}
+
+bool AMTMuxder::makeNativeMuxParam(const MuxInput& in,
+    const EncoderOptionInfo& eoInfo,
+    const EncodeFileOutput& fileOut,
+    NativeMuxParam& param)
+{
+    if (!setting_.isNativeMux()) {
+        return false;
+    }
+    const auto& vfmt = in.vfmt;
+    const bool inContainer = encoderOutputInContainer(setting_.getEncoder(), in.muxFormat);
+    const auto userSAR = setting_.getUserSAR();
+    const bool userSARValid = userSAR.first > 0 && userSAR.second > 0;
+    param.format = in.muxFormat;
+    param.videoFormat = eoInfo.format;
+    param.videoInContainer = inContainer;
+    param.videoPath = in.encVideoFile;
+    param.vfmt = vfmt;
+    param.sar = std::make_pair(0, 0);
+    // 外部muxerと同じ条件でSARをコンテナに記録
+    if ((!inContainer || setting_.getSARInContainerOnly())
+        && (setting_.getEncoder() == ENCODER_SVTAV1 || setting_.getSARInContainerOnly())
+        && (!vfmt.isSARUnspecified() || userSARValid)) {
+        param.sar = userSARValid ? userSAR : std::make_pair(vfmt.sarWidth, vfmt.sarHeight);
+    }
+    param.audioPaths = in.audioFiles;
+    param.subsPaths = in.subsFiles;
+    param.subsTitles = in.subsTitles;
+    param.chapterPath = in.chapterFile;
+    param.timecodePath = fileOut.timecode;
+    param.timebase = in.timebase;
+    param.outPath = in.outPath;
+    tstring reason;
+    if (setting_.getMuxerAddEncoderCmd()) {
+        reason = _T("--muxer-add-encoder-cmd指定");
+    } else {
+        AMTNativeMuxer::isSupported(param, reason);
+    }
+    if (reason.size() > 0) {
+        ctx.infoF(_T("内部muxerを使用できないため外部muxerを使用します（%s）"), reason);
+        return false;
+    }
+    return true;
+}
+
+void AMTMuxder::copyPscFile(EncodeFileKey key, const EncoderOptionInfo& eoInfo, ENUM_FORMAT muxFormat) {
+    const auto& fileIn = reformInfo_.getEncodeFile(key);
     // pscファイルは別ファイルとしてコピー
     auto srcpsc = setting_.getTmpPSCFilePath(key);
     if (File::exists(srcpsc)) {
@@ -211,6 +269,53 @@ void AMTMuxder::mux(EncodeFileKey key,
         File::copy(srcpsc, dstpsc);
     }
 
+}
+
+void AMTMuxder::mux(EncodeFileKey key,
+    const EncoderOptionInfo& eoInfo, // エンコーダオプション情報
+    bool nicoOK,
+    EncodeFileOutput& fileOut) // 出力情報
+{
+    if (fileOut.streamMuxed) {
+        // エンコードと並行してmux済み（pscはpsisiarcの完了後でないとコピーできない）
+        copyPscFile(key, eoInfo, getActualOutputFormat(key, reformInfo_, setting_));
+        return;
+    }
+    const auto& fileIn = reformInfo_.getEncodeFile(key);
+    const MuxInput in = makeMuxInput(key, eoInfo, nicoOK, fileOut);
+    const auto muxFormat = in.muxFormat;
+    const auto& vfmt = in.vfmt;
+    const auto& audioFiles = in.audioFiles;
+    const auto& encVideoFile = in.encVideoFile;
+    const auto& chapterFile = in.chapterFile;
+    const auto& subsFiles = in.subsFiles;
+    const auto& subsTitles = in.subsTitles;
+    const auto& timebase = in.timebase;
+    const auto& outPath = in.outPath;
+
+    bool tsreplaceEdgeTrim = false;
+    int64_t tsreplaceDelay = 0;
+    if (muxFormat == FORMAT_TSREPLACE && key.cm == CMTYPE_EDGE_TRIM) {
+        if (!fileIn.videoFrames.empty()) {
+            const auto& filterFrames = reformInfo_.getFilterSourceFrames(key.video);
+            int firstIndex = fileIn.videoFrames.front();
+            if (firstIndex >= 0 && firstIndex < (int)filterFrames.size()) {
+                double firstPts = filterFrames[firstIndex].pts;
+                double basePts = reformInfo_.getFirstDataPTS();
+                tsreplaceDelay = (int64_t)std::llround(firstPts - basePts);
+                if (tsreplaceDelay < 0) {
+                    tsreplaceDelay = 0;
+                }
+                tsreplaceEdgeTrim = true;
+            }
+        }
+    }
+
+    uint64_t encVideoFileSize = 0;
+    rgy_get_filesize(encVideoFile.c_str(), &encVideoFileSize);
+
+    copyPscFile(key, eoInfo, muxFormat);
+
     const tstring tmpOut1Path = setting_.getVfrTmpFile1Path(key, (muxFormat == FORMAT_TSREPLACE) ? FORMAT_MP4 : muxFormat);
     const tstring tmpOut2Path = setting_.getVfrTmpFile2Path(key, (muxFormat == FORMAT_TSREPLACE) ? FORMAT_MP4 : muxFormat);
 
@@ -247,56 +352,872 @@ void AMTMuxder::mux(EncodeFileKey key,
         file.write(sb.getMC());
     }
 
-    // タイムコード用
-    auto timebase = std::make_pair(vfmt.frameRateNum * (fileOut.vfrTimingFps / 30), vfmt.frameRateDenom);
+    NativeMuxParam nativeParam;
+    if (makeNativeMuxParam(in, eoInfo, fileOut, nativeParam)) {
+        ctx.infoF(_T("内部muxerで出力: %s"), outPath);
+        AMTNativeMuxer nativeMuxer(ctx);
+        nativeMuxer.mux(nativeParam);
+        for (const auto& warning : nativeMuxer.getWarnings()) {
+            ctx.warn(warning);
+        }
+    } else {
+        auto muxerPath = (muxFormat != setting_.getFormat()) ? setting_.getMkvMergePath() : setting_.getMuxerPath();
+        auto args = makeMuxerArgs(
+            setting_.getEncoder(), setting_.getUserSAR(), muxFormat, muxerPath,
+            setting_.getTimelineEditorPath(), setting_.getMp4BoxPath(),
+            (File::exists(setting_.getTmpRawTSPath()) ? setting_.getTmpRawTSPath() : setting_.getSrcFilePath()),
+            encVideoFile, encoderOutputInContainer(setting_.getEncoder(), muxFormat),
+            vfmt, audioFiles, setting_.getTmpDir(),
+            outPath, tmpOut1Path, tmpOut2Path, chapterFile,
+            fileOut.timecode, timebase, subsFiles, subsTitles, metaFile,
+            setting_.getTsreplaceRemoveTypeD(), tsreplaceEdgeTrim, tsreplaceDelay,
+            setting_.getMuxerAddEncoderCmd(), setting_.getSARInContainerOnly(),
+            encoderToString(setting_.getEncoder()),
+            setting_.getEncoderOptions());
 
-    auto outPath = setting_.getOutFilePath(fileIn.outKey, fileIn.keyMax, muxFormat, eoInfo.format);
-    auto muxerPath = setting_.getMuxerPath();
-    if (muxFormat != setting_.getFormat()) { // 初期のフォーマットから変わっているとき
-        if (muxFormat == FORMAT_MKV) { // useMKVWhenSubExistの場合
-            muxerPath = setting_.getMkvMergePath();
-            ctx.infoF(_T("字幕が存在するため、mkv出力に切り替えます。"));
+        for (int i = 0; i < (int)args.size(); i++) {
+            ctx.infoF(_T("%s"), args[i].first);
+            StdRedirectedSubProcess muxer(args[i].first, 0, args[i].second);
+            int ret = muxer.join();
+            if (ret != 0) {
+                // mkvmerge使用時、戻り値"1"は警告扱いにしたいが、
+                // 実際にmux結果ファイルが正常に出力されていることを確認してから成功扱いにする。
+                if (muxFormat == FORMAT_MKV && ret == 1) {
+                    uint64_t outSize = 0;
+                    if (encVideoFileSize > 0 && rgy_get_filesize(outPath.c_str(), &outSize) && outSize >= encVideoFileSize) {
+                        ctx.warnF(_T("mkvmergeから警告コード 1 が返されましたが、出力ファイルは正常に作成されました。(output: %lld bytes, input video: %lld bytes)"),
+                                    (long long)outSize, (long long)encVideoFileSize);
+                        continue;
+                    }
+                }
+                THROWF(RuntimeException, "mux failed (exit code: %d)", ret);
+            }
+            // mp4boxがコンソール出力のコードページを変えてしまうので戻す
+            ctx.setDefaultCP();
+        }
+    }
+
+    File outfile(outPath, _T("rb"));
+    fileOut.fileSize = outfile.size();
+}
+
+bool AMTMuxder::startStreamingMux(EncodeFileKey key,
+    const EncoderOptionInfo& eoInfo,
+    bool nicoOK,
+    EncodeFileOutput& fileOut)
+{
+    if (!setting_.isStreamMux() || streaming_) {
+        return false;
+    }
+    const size_t numOutSubs = fileOut.outSubs.size();
+    const MuxInput in = makeMuxInput(key, eoInfo, nicoOK, fileOut);
+    NativeMuxParam param;
+    bool ok = makeNativeMuxParam(in, eoInfo, fileOut, param);
+    if (ok && param.videoInContainer) {
+        // コンテナは最後に書き込まれる情報が必要なので追いかけて読めない
+        ctx.info(_T("エンコーダがコンテナで出力するためストリーミングmuxは使用しません"));
+        ok = false;
+    }
+    if (ok && param.format == FORMAT_MKV && param.chapterPath.size() > 0 && param.timecodePath.empty()) {
+        // mkvはヘッダでチャプターを書き込むので、映像の長さが分からないと最後のチャプターの終了時刻が決まらない
+        ctx.info(_T("mkvのチャプターの終了時刻を決められないためストリーミングmuxは使用しません"));
+        ok = false;
+    }
+    if (!ok) {
+        // 後で通常のmuxをするときに再度追加されるので戻しておく
+        fileOut.outSubs.resize(numOutSubs);
+        return false;
+    }
+    // 前回の出力が残っていると読んでしまうので消しておく
+    if (rgy_file_exists(in.encVideoFile)) {
+        rgy_file_remove(in.encVideoFile.c_str());
+    }
+    ctx.infoF(_T("[ストリーミングMux開始] %s"), in.outPath);
+    streaming_ = std::unique_ptr<StreamingMux>(new StreamingMux());
+    streaming_->video = std::make_shared<GrowingFileReader>(in.encVideoFile);
+    streaming_->muxer = std::unique_ptr<AMTNativeMuxer>(new AMTNativeMuxer(ctx));
+    streaming_->outPath = in.outPath;
+    streaming_->numOutSubs = numOutSubs;
+    param.videoStream = streaming_->video;
+    StreamingMux* job = streaming_.get();
+    job->thread = std::thread([job, param]() {
+        try {
+            job->muxer->mux(param);
+        } catch (...) {
+            job->error = std::current_exception();
+        }
+    });
+    return true;
+}
+
+void AMTMuxder::finishStreamingMux(bool success, EncodeFileOutput& fileOut) {
+    if (!streaming_) {
+        return;
+    }
+    auto job = std::move(streaming_);
+    job->video->finish(success);
+    job->thread.join();
+    if (!success) {
+        // 途中まで書き込まれた出力を残さない
+        if (rgy_file_exists(job->outPath)) {
+            rgy_file_remove(job->outPath.c_str());
+        }
+        return;
+    }
+    if (job->error) {
+        // エンコードは成功しているので通常のmuxでやり直す
+        tstring message = _T("unknown exception");
+        try {
+            std::rethrow_exception(job->error);
+        } catch (const Exception& e) {
+            message = e.message();
+        } catch (const std::exception& e) {
+            message = char_to_tstring(e.what());
+        } catch (...) {
+        }
+        ctx.warnF(_T("ストリーミングmuxに失敗したため通常のmuxを行います: %s"), message);
+        if (rgy_file_exists(job->outPath)) {
+            rgy_file_remove(job->outPath.c_str());
+        }
+        // 後で通常のmuxをするときに再度追加されるので戻しておく
+        fileOut.outSubs.resize(job->numOutSubs);
+        return;
+    }
+    for (const auto& warning : job->muxer->getWarnings()) {
+        ctx.warn(warning);
+    }
+    File outfile(job->outPath, _T("rb"));
+    fileOut.fileSize = outfile.size();
+    fileOut.streamMuxed = true;
+    ctx.info(_T("[ストリーミングMux完了]"));
+}
+
+namespace {
+
+struct PacketDeleter {
+    void operator()(AVPacket* pkt) const { av_packet_free(&pkt); }
+};
+using PacketPtr = std::unique_ptr<AVPacket, PacketDeleter>;
+
+struct OutputFormatDeleter {
+    void operator()(AVFormatContext* s) const {
+        if (s->pb != nullptr) {
+            avio_closep(&s->pb);
+        }
+        avformat_free_context(s);
+    }
+};
+
+struct ParserDeleter {
+    void operator()(AVCodecParserContext* p) const { av_parser_close(p); }
+};
+
+// 出力トラック
+struct NativeMuxTrack {
+    AVStream* st;
+    AVRational tb;                        // readが返すパケットのタイムベース
+    std::function<bool(AVPacket*)> read;  // 次のパケットを読む（終端ならfalse）
+    PacketPtr next;
+    bool hasNext;
+};
+
+struct OgmChapter {
+    int64_t ms;
+    std::string name;
+};
+
+PacketPtr allocPacket() {
+    PacketPtr pkt(av_packet_alloc());
+    if (!pkt) {
+        THROW(RuntimeException, "failed av_packet_alloc");
+    }
+    return pkt;
+}
+
+void findStreamInfo(AVFormatContext* s) {
+    if (avformat_find_stream_info(s, nullptr) < 0) {
+        THROW(FormatException, "failed avformat_find_stream_info");
+    }
+}
+
+AVStream* findStream(AVFormatContext* s, AVMediaType type) {
+    for (int i = 0; i < (int)s->nb_streams; i++) {
+        if (s->streams[i]->codecpar->codec_type == type) {
+            return s->streams[i];
+        }
+    }
+    return nullptr;
+}
+
+AVStream* newOutputStream(AVFormatContext* s) {
+    AVStream* st = avformat_new_stream(s, nullptr);
+    if (st == nullptr) {
+        THROW(RuntimeException, "failed avformat_new_stream");
+    }
+    return st;
+}
+
+// 生ストリームの入力フォーマット（nullptrなら自動判別）
+const char* rawVideoInputFormat(const NativeMuxParam& param) {
+    if (param.videoInContainer) {
+        return nullptr;
+    }
+    switch (param.videoFormat) {
+    case VS_H264: return "h264";
+    case VS_H265: return "hevc";
+    default: return nullptr;
+    }
+}
+
+std::vector<double> readTimecodeV2(const tstring& path) {
+    File file(path, _T("r"));
+    std::vector<double> ret;
+    std::string str;
+    while (file.getline(str)) {
+        if (str.size() && str[0] != '#') {
+            ret.push_back(std::atof(str.c_str()));
+        }
+    }
+    return ret;
+}
+
+std::vector<OgmChapter> readOgmChapters(const tstring& path) {
+    File file(path, _T("r"));
+    std::regex reTime("CHAPTER(\\d+)=(\\d+):(\\d+):(\\d+)\\.(\\d+)");
+    std::regex reName("CHAPTER(\\d+)NAME=(.*)");
+    std::map<int, OgmChapter> chapters;
+    std::string str;
+    while (file.getline(str)) {
+        if (str.size() >= 3 && (uint8_t)str[0] == 0xEF && (uint8_t)str[1] == 0xBB && (uint8_t)str[2] == 0xBF) {
+            str = str.substr(3);
+        }
+        std::smatch m;
+        if (std::regex_match(str, m, reTime)) {
+            chapters[std::stoi(m[1].str())].ms =
+                ((std::stoll(m[2].str()) * 60 + std::stoll(m[3].str())) * 60 + std::stoll(m[4].str())) * 1000 + std::stoll(m[5].str());
+        } else if (std::regex_match(str, m, reName)) {
+            chapters[std::stoi(m[1].str())].name = m[2].str();
+        }
+    }
+    std::vector<OgmChapter> ret;
+    for (const auto& c : chapters) {
+        ret.push_back(c.second);
+    }
+    return ret;
+}
+
+int readGrowingFile(void* opaque, uint8_t* buf, int size) {
+    return static_cast<GrowingFileReader*>(opaque)->read(buf, size);
+}
+
+// 映像入力を開く（videoStreamがあれば書き込み中のファイルを追いかけて読む）
+std::shared_ptr<AVFormatContext> openVideoInput(const NativeMuxParam& param) {
+    const char* format = rawVideoInputFormat(param);
+    if (!param.videoStream) {
+        auto in = std::make_shared<av::InputContext>(param.videoPath, format);
+        findStreamInfo((*in)());
+        return std::shared_ptr<AVFormatContext>(in, (*in)());
+    }
+    auto inputFormat = (format != nullptr) ? av_find_input_format(format) : nullptr;
+    enum { BUF_SIZE = 64 * 1024 };
+    uint8_t* buffer = (uint8_t*)av_malloc(BUF_SIZE);
+    if (buffer == nullptr) {
+        THROW(RuntimeException, "failed av_malloc");
+    }
+    AVIOContext* pb = avio_alloc_context(buffer, BUF_SIZE, 0, param.videoStream.get(), readGrowingFile, nullptr, nullptr);
+    if (pb == nullptr) {
+        av_free(buffer);
+        THROW(RuntimeException, "failed avio_alloc_context");
+    }
+    AVFormatContext* s = avformat_alloc_context();
+    if (s == nullptr) {
+        av_freep(&pb->buffer);
+        avio_context_free(&pb);
+        THROW(RuntimeException, "failed avformat_alloc_context");
+    }
+    s->pb = pb;
+    s->flags |= AVFMT_FLAG_CUSTOM_IO;
+    if (avformat_open_input(&s, nullptr, inputFormat, nullptr) != 0) {
+        // 失敗したらsは解放されている
+        av_freep(&pb->buffer);
+        avio_context_free(&pb);
+        THROW(IOException, "failed avformat_open_input");
+    }
+    auto stream = param.videoStream;
+    std::shared_ptr<AVFormatContext> ret(s, [pb, stream](AVFormatContext* s) mutable {
+        avformat_close_input(&s);
+        av_freep(&pb->buffer);
+        avio_context_free(&pb);
+    });
+    findStreamInfo(ret.get());
+    return ret;
+}
+
+} // namespace
+
+GrowingFileReader::GrowingFileReader(const tstring& path)
+    : path_(path)
+    , fp_(nullptr)
+    , finished_(false)
+    , success_(false) {}
+
+GrowingFileReader::~GrowingFileReader() {
+    if (fp_ != nullptr) {
+        fclose(fp_);
+    }
+}
+
+void GrowingFileReader::finish(bool success) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    finished_ = true;
+    success_ = success;
+    cond_.notify_all();
+}
+
+int GrowingFileReader::read(uint8_t* buf, int size) {
+    while (true) {
+        bool finished, success;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            finished = finished_;
+            success = success_;
+        }
+        if (finished && !success) {
+            return AVERROR_EXIT;
+        }
+        if (fp_ == nullptr) {
+            // エンコーダがまだファイルを作っていないことがある
+            fp_ = fsopenT(path_.c_str(), _T("rb"), _SH_DENYNO);
+        }
+        if (fp_ != nullptr) {
+            const size_t ret = fread(buf, 1, size, fp_);
+            if (ret > 0) {
+                return (int)ret;
+            }
+            if (ferror(fp_)) {
+                return AVERROR(EIO);
+            }
+            // 追記されたデータを読めるようにEOFを解除
+            clearerr(fp_);
+        }
+        if (finished) {
+            // 終了通知後に読んで何もなければ終端
+            return AVERROR_EOF;
+        }
+        std::unique_lock<std::mutex> lock(mtx_);
+        cond_.wait_for(lock, std::chrono::milliseconds(100), [this] { return finished_; });
+    }
+}
+
+AMTNativeMuxer::AMTNativeMuxer(AMTContext& ctx)
+    : AMTObject(ctx) {}
+
+/* static */ bool AMTNativeMuxer::isSupported(const NativeMuxParam& param, tstring& reason) {
+    if (param.format != FORMAT_MP4 && param.format != FORMAT_MKV) {
+        reason = _T("出力フォーマットがmp4/mkvでない");
+        return false;
+    }
+    if (!param.vfmt.progressive) {
+        // フィールド単位のパケットになるので外部muxerに任せる
+        reason = _T("インタレース出力");
+        return false;
+    }
+    if (!param.videoInContainer) {
+        if (param.videoFormat != VS_H264 && param.videoFormat != VS_H265 && param.videoFormat != VS_AV1) {
+            reason = _T("映像フォーマットが非対応");
+            return false;
+        }
+        if (param.timecodePath.empty() && !param.vfmt.fixedFrameRate) {
+            reason = _T("フレームレートが固定でない");
+            return false;
+        }
+    }
+    return true;
+}
+
+const std::vector<tstring>& AMTNativeMuxer::getWarnings() const {
+    return warnings_;
+}
+
+void AMTNativeMuxer::mux(const NativeMuxParam& param) {
+    const bool isMKV = (param.format == FORMAT_MKV);
+    // POCから表示順を求める（生ストリームはタイムスタンプを持たないため）
+    const bool usePOC = !param.videoInContainer && (param.videoFormat == VS_H264 || param.videoFormat == VS_H265);
+    // 生ストリームかタイムコードがある場合はタイムスタンプを付け直す
+    const bool retime = !param.videoInContainer || !param.timecodePath.empty();
+
+    std::vector<double> timecode;
+    if (param.timecodePath.size() > 0) {
+        timecode = readTimecodeV2(param.timecodePath);
+        if (timecode.empty()) {
+            THROW(FormatException, "empty timecode file");
+        }
+    }
+    const VideoFormat& vfmt = param.vfmt;
+    const double frameMs = 1000.0 * vfmt.frameRateDenom / vfmt.frameRateNum;
+    const AVRational videoTb = (timecode.size() > 0)
+        ? AVRational{ param.timebase.second, param.timebase.first }
+        : AVRational{ vfmt.frameRateDenom, vfmt.frameRateNum };
+    // 表示順n番目のフレームの時刻（範囲外は外挿する）
+    auto frameTime = [&](int n) -> int64_t {
+        if (timecode.empty()) {
+            return n;
+        }
+        double ms;
+        if (n < 0) {
+            ms = timecode.front() + n * frameMs;
+        } else if (n < (int)timecode.size()) {
+            ms = timecode[n];
         } else {
-            THROWF(RuntimeException, "Unexpected error, muxFormat != setting_.getFormat()");
+            ms = timecode.back() + (n - (int)timecode.size() + 1) * frameMs;
         }
+        return std::llround(ms * videoTb.den / (1000.0 * videoTb.num));
+    };
+
+    // 出力
+    AVFormatContext* octxRaw = nullptr;
+    if (avformat_alloc_output_context2(&octxRaw, nullptr, isMKV ? "matroska" : "mp4", nullptr) < 0 || octxRaw == nullptr) {
+        THROW(FormatException, "failed avformat_alloc_output_context2");
     }
-    auto args = makeMuxerArgs(
-        setting_.getEncoder(), setting_.getUserSAR(), muxFormat, muxerPath,
-        setting_.getTimelineEditorPath(), setting_.getMp4BoxPath(),
-        (File::exists(setting_.getTmpRawTSPath()) ? setting_.getTmpRawTSPath() : setting_.getSrcFilePath()),
-        encVideoFile, encoderOutputInContainer(setting_.getEncoder(), muxFormat),
-        vfmt, audioFiles, setting_.getTmpDir(),
-        outPath, tmpOut1Path, tmpOut2Path, chapterFile,
-        fileOut.timecode, timebase, subsFiles, subsTitles, metaFile,
-        setting_.getTsreplaceRemoveTypeD(), tsreplaceEdgeTrim, tsreplaceDelay,
-        setting_.getMuxerAddEncoderCmd(), setting_.getSARInContainerOnly(),
-        encoderToString(setting_.getEncoder()),
-        setting_.getEncoderOptions());
+    std::unique_ptr<AVFormatContext, OutputFormatDeleter> octx(octxRaw);
+    // mp4のopusはexperimental扱い
+    octx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
 
-    for (int i = 0; i < (int)args.size(); i++) {
-        ctx.infoF(_T("%s"), args[i].first);
-        StdRedirectedSubProcess muxer(args[i].first, 0, args[i].second);
-        int ret = muxer.join();
-        if (ret != 0) {
-            // mkvmerge使用時、戻り値"1"は警告扱いにしたいが、
-            // 実際にmux結果ファイルが正常に出力されていることを確認してから成功扱いにする。
-            if (muxFormat == FORMAT_MKV && ret == 1) {
-                uint64_t outSize = 0;
-                if (encVideoFileSize > 0 && rgy_get_filesize(outPath.c_str(), &outSize) && outSize >= encVideoFileSize) {
-                    ctx.warnF(_T("mkvmergeから警告コード 1 が返されましたが、出力ファイルは正常に作成されました。(output: %lld bytes, input video: %lld bytes)"),
-                                (long long)outSize, (long long)encVideoFileSize);
-                    continue;
+    std::vector<NativeMuxTrack> tracks;
+    auto addTrack = [&](AVStream* st, AVRational tb, std::function<bool(AVPacket*)> read) {
+        st->time_base = tb;
+        NativeMuxTrack track;
+        track.st = st;
+        track.tb = tb;
+        track.read = read;
+        track.next = allocPacket();
+        track.hasNext = false;
+        tracks.push_back(std::move(track));
+    };
+
+    // 映像
+    // 書き込み中のファイルはデコード順に読みながらREORDER_WINDOWフレーム先読みして表示順を確定させる
+    // 完成したファイルは1パス目で全フレームの表示順を求めておく
+    enum { REORDER_WINDOW = 32 };
+    struct VideoFrame {
+        PacketPtr pkt;
+        int64_t key;   // 表示順のキー
+        int outIndex;  // 表示順（未確定なら-1）
+    };
+    std::shared_ptr<AVFormatContext> vin = openVideoInput(param);
+    AVStream* vs = av::GetVideoStream(vin.get());
+    if (vs == nullptr) {
+        THROW(FormatException, "video stream not found");
+    }
+    auto initParser = [&](AVStream* st, std::unique_ptr<AVCodecParserContext, ParserDeleter>& p, av::CodecContext& pctx) {
+        p.reset(av_parser_init(st->codecpar->codec_id));
+        if (!p) {
+            THROW(RuntimeException, "failed av_parser_init");
+        }
+        p->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+        pctx.Set(avcodec_find_decoder(st->codecpar->codec_id));
+        if (avcodec_parameters_to_context(pctx(), st->codecpar) < 0) {
+            THROW(RuntimeException, "failed avcodec_parameters_to_context");
+        }
+    };
+    // デコード順index番目のパケットの表示順のキー
+    auto orderKey = [&](AVPacket* pkt, int index, AVCodecParserContext* p, AVCodecContext* pctx, int64_t& epoch) -> int64_t {
+        if (usePOC) {
+            uint8_t* outbuf = nullptr;
+            int outsize = 0;
+            av_parser_parse2(p, pctx, &outbuf, &outsize,
+                pkt->data, pkt->size, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0);
+            const int poc = p->output_picture_number;
+            // IDRでPOCが0に戻るので区間を進める
+            if ((pkt->flags & AV_PKT_FLAG_KEY) && poc == 0 && index > 0) {
+                epoch++;
+            }
+            return (epoch << 32) + poc;
+        }
+        if (param.videoInContainer && pkt->pts != AV_NOPTS_VALUE) {
+            return pkt->pts;
+        }
+        return index;
+    };
+    // 1パス目: 完成したファイルなら全フレームの表示順を求める（デコード順 -> 表示順）
+    const bool exactOrder = retime && !param.videoStream;
+    std::unique_ptr<AVCodecParserContext, ParserDeleter> parser;
+    av::CodecContext parserCtx;
+    if (usePOC && !exactOrder) {
+        initParser(vs, parser, parserCtx);
+    }
+    std::vector<int> outIndexOf;
+    int exactDelay = 0;
+    if (exactOrder) {
+        std::shared_ptr<AVFormatContext> in = openVideoInput(param);
+        AVStream* st = av::GetVideoStream(in.get());
+        if (st == nullptr) {
+            THROW(FormatException, "video stream not found");
+        }
+        std::unique_ptr<AVCodecParserContext, ParserDeleter> p;
+        av::CodecContext pctx;
+        if (usePOC) {
+            initParser(st, p, pctx);
+        }
+        std::vector<int64_t> keys;
+        int64_t keyEpoch = 0;
+        PacketPtr pkt = allocPacket();
+        while (av_read_frame(in.get(), pkt.get()) >= 0) {
+            if (pkt->stream_index == st->index) {
+                keys.push_back(orderKey(pkt.get(), (int)keys.size(), p.get(), pctx(), keyEpoch));
+            }
+            av_packet_unref(pkt.get());
+        }
+        std::vector<int> decodeOrder(keys.size());
+        std::iota(decodeOrder.begin(), decodeOrder.end(), 0);
+        std::stable_sort(decodeOrder.begin(), decodeOrder.end(), [&](int a, int b) {
+            return keys[a] < keys[b];
+        });
+        outIndexOf.resize(keys.size());
+        for (int i = 0; i < (int)keys.size(); i++) {
+            outIndexOf[decodeOrder[i]] = i;
+        }
+        for (int i = 0; i < (int)keys.size(); i++) {
+            exactDelay = std::max(exactDelay, i - outIndexOf[i]);
+        }
+    }
+    std::deque<VideoFrame> pending; // デコード順
+    std::priority_queue<std::pair<int64_t, int>,
+        std::vector<std::pair<int64_t, int>>,
+        std::greater<std::pair<int64_t, int>>> unordered; // (キー, デコード順)
+    int numRead = 0;     // 読んだフレーム数
+    int numOrdered = 0;  // 表示順が確定したフレーム数
+    int numEmitted = 0;  // 出力したフレーム数
+    int delay = exactOrder ? exactDelay : -1; // B-frameによる表示の遅延フレーム数（先読みの場合は最初に表示順を確定させるときに決める）
+    int64_t epoch = 0;
+    int64_t lastOrderedKey = INT64_MIN;
+    int64_t videoEnd = 0;
+    bool videoEof = false;
+    auto readVideoFrame = [&]() {
+        PacketPtr pkt = allocPacket();
+        while (av_read_frame(vin.get(), pkt.get()) >= 0) {
+            if (pkt->stream_index == vs->index) {
+                if (exactOrder) {
+                    if (numRead >= (int)outIndexOf.size()) {
+                        THROW(FormatException, "video frame count mismatch");
+                    }
+                    const int outIndex = outIndexOf[numRead++];
+                    numOrdered++;
+                    VideoFrame frame = { std::move(pkt), outIndex, outIndex };
+                    pending.push_back(std::move(frame));
+                    return true;
+                }
+                const int64_t key = orderKey(pkt.get(), numRead, parser.get(), parserCtx(), epoch);
+                if (numOrdered > 0 && key < lastOrderedKey) {
+                    THROW(FormatException, "video reordering is deeper than the lookahead window");
+                }
+                unordered.emplace(key, numRead++);
+                VideoFrame frame = { std::move(pkt), key, -1 };
+                pending.push_back(std::move(frame));
+                return true;
+            }
+            av_packet_unref(pkt.get());
+        }
+        return false;
+    };
+    // 先読みしたフレームの並べ替えから遅延フレーム数を決める
+    auto decideDelay = [&]() {
+        std::vector<int> order(pending.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            return pending[a].key < pending[b].key;
+        });
+        // 末尾付近は後続フレームで順位が変わりうるので前半だけ見る
+        const int limit = videoEof ? (int)order.size() : (int)order.size() / 2;
+        int d = std::max(0, vs->codecpar->video_delay);
+        for (int r = 0; r < (int)order.size(); r++) {
+            if (order[r] < limit) {
+                d = std::max(d, order[r] - r);
+            }
+        }
+        return d;
+    };
+    auto orderVideoFrame = [&]() {
+        if (delay < 0) {
+            delay = decideDelay();
+        }
+        auto top = unordered.top();
+        unordered.pop();
+        lastOrderedKey = top.first;
+        pending[top.second - numEmitted].outIndex = numOrdered++;
+    };
+    {
+        AVStream* st = newOutputStream(octx.get());
+        if (avcodec_parameters_copy(st->codecpar, vs->codecpar) < 0) {
+            THROW(RuntimeException, "failed avcodec_parameters_copy");
+        }
+        st->codecpar->codec_tag = 0;
+        if (param.sar.first > 0 && param.sar.second > 0) {
+            st->sample_aspect_ratio = st->codecpar->sample_aspect_ratio = AVRational{ param.sar.first, param.sar.second };
+        }
+        if (timecode.empty()) {
+            st->avg_frame_rate = AVRational{ vfmt.frameRateNum, vfmt.frameRateDenom };
+        }
+        if (!isMKV) {
+            av_dict_set(&st->metadata, "handler_name", "Video", 0);
+        }
+        addTrack(st, retime ? videoTb : vs->time_base, [&](AVPacket* pkt) {
+            if (!retime) {
+                while (av_read_frame(vin.get(), pkt) >= 0) {
+                    if (pkt->stream_index == vs->index) {
+                        if (pkt->dts == AV_NOPTS_VALUE) {
+                            pkt->dts = pkt->pts;
+                        }
+                        numEmitted++;
+                        videoEnd = std::max(videoEnd, pkt->pts + pkt->duration);
+                        return true;
+                    }
+                    av_packet_unref(pkt);
+                }
+                return false;
+            }
+            while (true) {
+                if (pending.size() > 0 && pending.front().outIndex >= 0) {
+                    VideoFrame frame = std::move(pending.front());
+                    pending.pop_front();
+                    const int i = numEmitted++;
+                    av_packet_move_ref(pkt, frame.pkt.get());
+                    pkt->pts = frameTime(frame.outIndex);
+                    pkt->dts = frameTime(i - delay);
+                    if (pkt->dts > pkt->pts) {
+                        THROW(FormatException, "video reordering is deeper than the estimated delay");
+                    }
+                    pkt->duration = frameTime(frame.outIndex + 1) - pkt->pts;
+                    videoEnd = std::max(videoEnd, pkt->pts + pkt->duration);
+                    return true;
+                }
+                if (videoEof) {
+                    if (unordered.empty()) {
+                        return false;
+                    }
+                    orderVideoFrame();
+                } else if (!readVideoFrame()) {
+                    videoEof = true;
+                } else if ((int)unordered.size() > REORDER_WINDOW) {
+                    orderVideoFrame();
                 }
             }
-            THROWF(RuntimeException, "mux failed (exit code: %d)", ret);
+        });
+    }
+    const AVRational videoTrackTb = tracks.back().tb;
+
+    // 音声
+    for (int i = 0; i < (int)param.audioPaths.size(); i++) {
+        auto in = std::make_shared<av::InputContext>(param.audioPaths[i]);
+        findStreamInfo((*in)());
+        AVStream* as = findStream((*in)(), AVMEDIA_TYPE_AUDIO);
+        if (as == nullptr) {
+            THROW(FormatException, "audio stream not found");
+        }
+        AVStream* st = newOutputStream(octx.get());
+        if (avcodec_parameters_copy(st->codecpar, as->codecpar) < 0) {
+            THROW(RuntimeException, "failed avcodec_parameters_copy");
         }
-        // mp4boxがコンソール出力のコードページを変えてしまうので戻す
-        ctx.setDefaultCP();
+        st->codecpar->codec_tag = 0;
+        if (!isMKV) {
+            av_dict_set(&st->metadata, "handler_name", StringFormat("Audio%d", i).c_str(), 0);
+        }
+        const int index = as->index;
+        auto nextPts = std::make_shared<int64_t>(0);
+        addTrack(st, as->time_base, [in, index, nextPts](AVPacket* pkt) {
+            while (av_read_frame((*in)(), pkt) >= 0) {
+                if (pkt->stream_index == index) {
+                    if (pkt->pts == AV_NOPTS_VALUE) {
+                        pkt->pts = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : *nextPts;
+                    }
+                    if (pkt->dts == AV_NOPTS_VALUE) {
+                        pkt->dts = pkt->pts;
+                    }
+                    *nextPts = pkt->pts + pkt->duration;
+                    return true;
+                }
+                av_packet_unref(pkt);
+            }
+            return false;
+        });
     }
 
-    File outfile(outPath, _T("rb"));
-    fileOut.fileSize = outfile.size();
+    // 字幕（小さいので全て読んでおく）
+    for (int i = 0; i < (int)param.subsPaths.size(); i++) {
+        if (!isMKV && param.subsTitles[i] != _T("SRT")) { // mp4はSRTのみ
+            continue;
+        }
+        av::InputContext in(param.subsPaths[i]);
+        findStreamInfo(in());
+        AVStream* ss = findStream(in(), AVMEDIA_TYPE_SUBTITLE);
+        if (ss == nullptr) {
+            THROW(FormatException, "subtitle stream not found");
+        }
+        AVStream* st = newOutputStream(octx.get());
+        auto packets = std::make_shared<std::deque<PacketPtr>>();
+        PacketPtr pkt = allocPacket();
+        if (isMKV) {
+            if (avcodec_parameters_copy(st->codecpar, ss->codecpar) < 0) {
+                THROW(RuntimeException, "failed avcodec_parameters_copy");
+            }
+            st->codecpar->codec_tag = 0;
+            av_dict_set(&st->metadata, "title", tchar_to_string(param.subsTitles[i], CP_UTF8).c_str(), 0);
+            while (av_read_frame(in(), pkt.get()) >= 0) {
+                if (pkt->stream_index == ss->index) {
+                    PacketPtr p = allocPacket();
+                    av_packet_move_ref(p.get(), pkt.get());
+                    packets->push_back(std::move(p));
+                }
+                av_packet_unref(pkt.get());
+            }
+        } else {
+            // mp4はmov_textに変換する
+            av::CodecContext dec(avcodec_find_decoder(ss->codecpar->codec_id));
+            if (avcodec_parameters_to_context(dec(), ss->codecpar) < 0) {
+                THROW(RuntimeException, "failed avcodec_parameters_to_context");
+            }
+            dec()->pkt_timebase = ss->time_base;
+            if (avcodec_open2(dec(), dec()->codec, nullptr) < 0) {
+                THROW(RuntimeException, "failed avcodec_open2 (subtitle decoder)");
+            }
+            av::CodecContext enc(avcodec_find_encoder(AV_CODEC_ID_MOV_TEXT));
+            enc()->time_base = ss->time_base;
+            if (dec()->subtitle_header_size > 0) {
+                enc()->subtitle_header = (uint8_t*)av_mallocz(dec()->subtitle_header_size + 1);
+                memcpy(enc()->subtitle_header, dec()->subtitle_header, dec()->subtitle_header_size);
+                enc()->subtitle_header_size = dec()->subtitle_header_size;
+            }
+            if (avcodec_open2(enc(), enc()->codec, nullptr) < 0) {
+                THROW(RuntimeException, "failed avcodec_open2 (mov_text encoder)");
+            }
+            if (avcodec_parameters_from_context(st->codecpar, enc()) < 0) {
+                THROW(RuntimeException, "failed avcodec_parameters_from_context");
+            }
+            av_dict_set(&st->metadata, "handler_name", tchar_to_string(param.subsTitles[i], CP_UTF8).c_str(), 0);
+            std::vector<uint8_t> buf(1024 * 1024);
+            while (av_read_frame(in(), pkt.get()) >= 0) {
+                if (pkt->stream_index == ss->index) {
+                    AVSubtitle sub = AVSubtitle();
+                    int gotSub = 0;
+                    if (avcodec_decode_subtitle2(dec(), &sub, &gotSub, pkt.get()) >= 0 && gotSub) {
+                        const int size = avcodec_encode_subtitle(enc(), buf.data(), (int)buf.size(), &sub);
+                        avsubtitle_free(&sub);
+                        if (size < 0) {
+                            THROW(RuntimeException, "failed avcodec_encode_subtitle");
+                        }
+                        PacketPtr p = allocPacket();
+                        if (av_new_packet(p.get(), size) < 0) {
+                            THROW(RuntimeException, "failed av_new_packet");
+                        }
+                        memcpy(p->data, buf.data(), size);
+                        p->pts = pkt->pts;
+                        p->duration = pkt->duration;
+                        packets->push_back(std::move(p));
+                    }
+                }
+                av_packet_unref(pkt.get());
+            }
+        }
+        for (auto& p : *packets) {
+            if (p->dts == AV_NOPTS_VALUE) {
+                p->dts = p->pts;
+            }
+        }
+        addTrack(st, ss->time_base, [packets](AVPacket* pkt) {
+            if (packets->empty()) {
+                return false;
+            }
+            av_packet_move_ref(pkt, packets->front().get());
+            packets->pop_front();
+            return true;
+        });
+    }
+
+    // チャプター
+    // mkvはヘッダでチャプターを書き込むので最後のチャプターの終了時刻はここで求めておく（mp4は最後に更新する）
+    // 1パス目でフレーム数が分かっていればそこから、なければタイムコードか入力コンテナの長さから求める
+    int64_t knownDurationMs = 0;
+    if (exactOrder) {
+        knownDurationMs = av_rescale_q(frameTime((int)outIndexOf.size()), videoTb, AVRational{ 1, 1000 });
+    } else if (timecode.size() > 0) {
+        knownDurationMs = av_rescale_q(frameTime((int)timecode.size()), videoTb, AVRational{ 1, 1000 });
+    } else if (!param.videoStream && vs->duration != AV_NOPTS_VALUE) {
+        knownDurationMs = av_rescale_q(vs->duration, vs->time_base, AVRational{ 1, 1000 });
+    }
+    if (param.chapterPath.size() > 0) {
+        auto chapters = readOgmChapters(param.chapterPath);
+        if (chapters.size() > 0) {
+            octx->chapters = (AVChapter**)av_calloc(chapters.size(), sizeof(AVChapter*));
+            if (octx->chapters == nullptr) {
+                THROW(RuntimeException, "failed av_calloc");
+            }
+            for (int i = 0; i < (int)chapters.size(); i++) {
+                AVChapter* ch = (AVChapter*)av_mallocz(sizeof(AVChapter));
+                if (ch == nullptr) {
+                    THROW(RuntimeException, "failed av_mallocz");
+                }
+                octx->chapters[octx->nb_chapters++] = ch;
+                ch->id = i + 1;
+                ch->time_base = AVRational{ 1, 1000 };
+                ch->start = chapters[i].ms;
+                ch->end = (i + 1 < (int)chapters.size()) ? chapters[i + 1].ms : std::max(chapters[i].ms, knownDurationMs);
+                av_dict_set(&ch->metadata, "title", chapters[i].name.c_str(), 0);
+            }
+        }
+    }
+
+    if (avio_open(&octx->pb, tchar_to_string(param.outPath, CP_UTF8).c_str(), AVIO_FLAG_WRITE) < 0) {
+        THROW(IOException, "failed avio_open");
+    }
+    AVDictionary* opts = nullptr;
+    if (!isMKV) {
+        av_dict_set(&opts, "brand", "mp42", 0);
+    }
+    const int headerRet = avformat_write_header(octx.get(), &opts);
+    av_dict_free(&opts);
+    if (headerRet < 0) {
+        THROWF(FormatException, "failed avformat_write_header (%d)", headerRet);
+    }
+
+    // dts順に各トラックのパケットを書き込む
+    for (auto& track : tracks) {
+        track.hasNext = track.read(track.next.get());
+    }
+    while (true) {
+        NativeMuxTrack* best = nullptr;
+        for (auto& track : tracks) {
+            if (track.hasNext && (best == nullptr ||
+                av_compare_ts(track.next->dts, track.tb, best->next->dts, best->tb) < 0)) {
+                best = &track;
+            }
+        }
+        if (best == nullptr) {
+            break;
+        }
+        AVPacket* pkt = best->next.get();
+        av_packet_rescale_ts(pkt, best->tb, best->st->time_base);
+        pkt->stream_index = best->st->index;
+        pkt->pos = -1;
+        const int ret = av_interleaved_write_frame(octx.get(), pkt);
+        if (ret < 0) {
+            THROWF(IOException, "failed av_interleaved_write_frame (%d)", ret);
+        }
+        best->hasNext = best->read(pkt);
+    }
+    if (octx->nb_chapters > 0) {
+        AVChapter* last = octx->chapters[octx->nb_chapters - 1];
+        last->end = std::max(last->start, av_rescale_q(videoEnd, videoTrackTb, last->time_base));
+    }
+    const int trailerRet = av_write_trailer(octx.get());
+    if (trailerRet < 0) {
+        THROWF(IOException, "failed av_write_trailer (%d)", trailerRet);
+    }
+    if (timecode.size() > 0 && (int)timecode.size() != numEmitted) {
+        warnings_.push_back(StringFormat(_T("タイムコードのフレーム数(%d)と映像のフレーム数(%d)が一致しません"),
+            (int)timecode.size(), numEmitted));
+    }
 }
+
 SpDualMonoSplitter::SpDualMonoSplitter(AMTContext& ctx) : DualMonoSplitter(ctx) {}
 void SpDualMonoSplitter::open(int index, const tstring& filename) {
     file[index] = std::unique_ptr<File>(new File(filename, _T("wb")));
@@ -15,6 +15,7 @@
 #include "EncoderOptionParser.h"
 #include "AdtsParser.h"
 #include "ProcessThread.h"
+#include <exception>
 
 struct EncodeFileOutput {
     VideoFormat vfmt;
@@ -24,6 +25,7 @@ struct EncodeFileOutput {
     double targetBitrate;
     int vfrTimingFps;
     tstring timecode;
+    bool streamMuxed; // エンコードと並行してmux済み
 };
 
 ENUM_FORMAT getActualOutputFormat(EncodeFileKey key, const StreamReformInfo& reformInfo, const ConfigWrapper& setting);
@@ -36,6 +38,62 @@ public:
     virtual void OnOutFrame(int index, MemoryChunk mc);
 };
 
+// エンコーダが書き込み中のファイルを追いかけて読む
+class GrowingFileReader : NonCopyable {
+public:
+    GrowingFileReader(const tstring& path);
+    ~GrowingFileReader();
+
+    // 書き込み終了を通知する（successがfalseなら読み込みを中断させる）
+    void finish(bool success);
+
+    // データが書き込まれるまで待って読む
+    // 終端ならAVERROR_EOF、中断ならAVERROR_EXITを返す
+    int read(uint8_t* buf, int size);
+
+private:
+    tstring path_;
+    FILE* fp_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    bool finished_;
+    bool success_;
+};
+
+struct NativeMuxParam {
+    ENUM_FORMAT format;             // FORMAT_MP4かFORMAT_MKV
+    VIDEO_STREAM_FORMAT videoFormat;
+    bool videoInContainer;          // エンコーダがコンテナで出力している
+    tstring videoPath;
+    VideoFormat vfmt;
+    std::pair<int, int> sar;        // コンテナに記録するSAR（0:0なら記録しない）
+    std::vector<tstring> audioPaths;
+    std::vector<tstring> subsPaths;
+    std::vector<tstring> subsTitles;
+    tstring chapterPath;            // OGM形式
+    tstring timecodePath;           // timecode v2（空ならフレームレート固定）
+    std::pair<int, int> timebase;   // timecode用のタイムスケール, タイムベース
+    tstring outPath;
+    std::shared_ptr<GrowingFileReader> videoStream; // あればvideoPathの代わりにこれから読む
+};
+
+// 外部muxerを使わずlibavformatで映像・音声・字幕・チャプターを1回でmp4/mkvに書き出す
+class AMTNativeMuxer : public AMTObject {
+public:
+    AMTNativeMuxer(AMTContext& ctx);
+
+    // 対応していなければ理由を返してfalse（外部muxerを使う）
+    static bool isSupported(const NativeMuxParam& param, tstring& reason);
+
+    // ログは出さない（別スレッドから呼ばれるため）ので警告はgetWarningsで取得する
+    void mux(const NativeMuxParam& param);
+
+    const std::vector<tstring>& getWarnings() const;
+
+private:
+    std::vector<tstring> warnings_;
+};
+
 class AMTMuxder : public AMTObject {
 public:
     AMTMuxder(
@@ -48,9 +106,56 @@ public:
         bool nicoOK,
         EncodeFileOutput& fileOut); // 出力情報
 
+    // エンコーダの出力を追いかけてmuxを開始する（内部muxerで扱えなければfalse）
+    bool startStreamingMux(EncodeFileKey key,
+        const EncoderOptionInfo& eoInfo,
+        bool nicoOK,
+        EncodeFileOutput& fileOut);
+
+    // エンコード終了を通知してmuxの完了を待つ（successがfalseなら中断）
+    void finishStreamingMux(bool success, EncodeFileOutput& fileOut);
+
+    ~AMTMuxder();
+
 private:
+    struct MuxInput {
+        ENUM_FORMAT muxFormat;
+        VideoFormat vfmt;
+        std::vector<tstring> audioFiles;
+        tstring encVideoFile;
+        tstring chapterFile;
+        std::vector<tstring> subsFiles;
+        std::vector<tstring> subsTitles;
+        std::pair<int, int> timebase; // タイムコード用
+        tstring outPath;
+    };
+
+    struct StreamingMux {
+        std::shared_ptr<GrowingFileReader> video;
+        std::unique_ptr<AMTNativeMuxer> muxer;
+        std::thread thread;
+        std::exception_ptr error;
+        tstring outPath;
+        size_t numOutSubs; // 開始前のfileOut.outSubsの数（通常のmuxに戻すときに使う）
+    };
+
     const ConfigWrapper& setting_;
     const StreamReformInfo& reformInfo_;
+    std::unique_ptr<StreamingMux> streaming_;
+
+    // mux入力を集める（外部ファイルとして出力する字幕等のコピーも行う）
+    MuxInput makeMuxInput(EncodeFileKey key,
+        const EncoderOptionInfo& eoInfo,
+        bool nicoOK,
+        EncodeFileOutput& fileOut);
+
+    // 内部muxerを使う場合はparamを作ってtrue
+    bool makeNativeMuxParam(const MuxInput& in,
+        const EncoderOptionInfo& eoInfo,
+        const EncodeFileOutput& fileOut,
+        NativeMuxParam& param);
+
+    void copyPscFile(EncodeFileKey key, const EncoderOptionInfo& eoInfo, ENUM_FORMAT muxFormat);
 };
 
 class AMTSimpleMuxder : public AMTObject {
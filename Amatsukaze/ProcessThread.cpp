@@ -10,7 +10,7 @@
 #include "rgy_thread_affinity.h"
 #include "cpu_info.h"
 
-SubProcess::SubProcess(const tstring& args, const bool disablePowerThrottoling) :
+SubProcess::SubProcess(const tstring& args, const bool disablePowerThrottoling, const uint32_t stdInBufferSize) :
     process_(createRGYPipeProcess()),
     bufferStdOut(),
     bufferStdErr(),
@@ -18,6 +18,7 @@ SubProcess::SubProcess(const tstring& args, const bool disablePowerThrottoling)
     thSetPowerThrottling() {
     // RGYPipeProcessの初期化（標準入出力のモード設定）
     process_->init(PIPE_MODE_ENABLE, PIPE_MODE_ENABLE, PIPE_MODE_ENABLE);
+    process_->setStdInBufferSize(stdInBufferSize);
     process_->setStdOutBufferSize(4 * 1024);
     process_->setStdErrBufferSize(4 * 1024);
     
@@ -45,6 +46,10 @@ void SubProcess::write(MemoryChunk mc) {
     }
 }
 
+PIPE_HANDLE SubProcess::stdInHandle() const {
+    return process_->stdInHandle();
+}
+
 size_t SubProcess::readErr(MemoryChunk mc) {
     if (bufferStdErr.size() > 0) {
         const size_t bytesToCopy = std::min(bufferStdErr.size(), (size_t)mc.length);
@@ -123,8 +128,8 @@ int SubProcess::join() {
     return exitCode_;
 }
 
-EventBaseSubProcess::EventBaseSubProcess(const tstring& args, const bool disablePowerThrottoling)
-    : SubProcess(args, disablePowerThrottoling)
+EventBaseSubProcess::EventBaseSubProcess(const tstring& args, const bool disablePowerThrottoling, const uint32_t stdInBufferSize)
+    : SubProcess(args, disablePowerThrottoling, stdInBufferSize)
     , drainOut(this, false)
     , drainErr(this, true) {
     drainOut.start();
@@ -181,8 +186,8 @@ void EventBaseSubProcess::drain_thread(bool isErr) {
     }
 }
 
-StdRedirectedSubProcess::StdRedirectedSubProcess(const tstring& args, const int bufferLines, const bool isUtf8, const bool disablePowerThrottoling, bool captureOnly, LineCallback lineCallback) :
-    EventBaseSubProcess(args, disablePowerThrottoling),
+StdRedirectedSubProcess::StdRedirectedSubProcess(const tstring& args, const int bufferLines, const bool isUtf8, const bool disablePowerThrottoling, bool captureOnly, LineCallback lineCallback, const uint32_t stdInBufferSize) :
+    EventBaseSubProcess(args, disablePowerThrottoling, stdInBufferSize),
     isUtf8(isUtf8),
     bufferLines(bufferLines),
     captureOnly(captureOnly),
@@ -15,6 +15,8 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <vector>
 
 #include "StreamUtils.h"
 #include "PerformanceUtil.h"
@@ -182,11 +184,187 @@ private:
     }
 };
 
+// DataPumpThreadと同じ使い方の単一プロデューサ・単一コンシューマ版
+// put()は1つのスレッドからだけ呼ぶこと。force_clear()はjoin()後に呼ぶこと
+// 固定長のリングバッファでロックを取らずに受け渡し、待つときは少しスピンしてから条件変数で寝る
+// 相手を起こすのは相手が寝ているときだけで、プロデューサは半分空くまでまとめて待たせる
+template <typename T, bool PERF = false>
+class SpscDataPumpThread : private ThreadBase {
+    enum { SPIN_COUNT = 256 };
+public:
+    SpscDataPumpThread(size_t maximum)
+        : maximum_(maximum)
+        , lowWater_(maximum / 2)
+        , slots_(std::max<size_t>(maximum, 1))
+        , head_(0)
+        , tail_(0)
+        , current_(0)
+        , finished_(false)
+        , error_(false)
+        , producerWaiting_(false)
+        , consumerWaiting_(false) {}
+
+    virtual ~SpscDataPumpThread() {
+        if (isRunning()) {
+            THROW(InvalidOperationException, "call join() before destroy object ...");
+        }
+    }
+
+    void put(T&& data, size_t amount) {
+        if (error_.load()) {
+            THROW(RuntimeException, "DataPumpThread error");
+        }
+        if (finished_.load()) {
+            THROW(InvalidOperationException, "DataPumpThread is already finished");
+        }
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        auto canPut = [&]() {
+            return error_.load() || finished_.load() ||
+                (current_.load() < maximum_ && tail - head_.load(std::memory_order_acquire) < slots_.size());
+        };
+        if (!canPut()) {
+            if (PERF) producer.start();
+            waitFor(canPut, producerWaiting_);
+            if (PERF) producer.stop();
+            if (error_.load()) {
+                THROW(RuntimeException, "DataPumpThread error");
+            }
+            if (finished_.load()) {
+                THROW(InvalidOperationException, "DataPumpThread is already finished");
+            }
+        }
+        auto& slot = slots_[tail % slots_.size()];
+        slot.first = amount;
+        slot.second = std::move(data);
+        current_.fetch_add(amount);
+        tail_.store(tail + 1, std::memory_order_release);
+        // tail_の書き込みとconsumerWaiting_の読み出しを入れ替えられると起床を見落とすので分ける
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (consumerWaiting_.load()) {
+            wake();
+        }
+    }
+
+    void force_clear() {
+        for (auto& slot : slots_) {
+            slot.second = T();
+        }
+        head_.store(tail_.load());
+        current_.store(0);
+    }
+
+    void start() {
+        finished_.store(false);
+        producer.reset();
+        consumer.reset();
+        ThreadBase::start();
+    }
+
+    void join() {
+        finished_.store(true);
+        wake();
+        ThreadBase::join();
+    }
+
+    bool isRunning() { return ThreadBase::isRunning(); }
+
+    void getTotalWait(double& prod, double& cons) {
+        prod = producer.getTotal();
+        cons = consumer.getTotal();
+    }
+
+protected:
+    virtual void OnDataReceived(T&& data) = 0;
+
+private:
+    std::mutex critical_section_;
+    std::condition_variable cond_;
+
+    size_t maximum_;
+    size_t lowWater_;
+    std::vector<std::pair<size_t, T>> slots_;
+    std::atomic<size_t> head_; // コンシューマが次に読む位置
+    std::atomic<size_t> tail_; // プロデューサが次に書く位置
+    std::atomic<size_t> current_;
+
+    std::atomic<bool> finished_;
+    std::atomic<bool> error_;
+    std::atomic<bool> producerWaiting_;
+    std::atomic<bool> consumerWaiting_;
+
+    Stopwatch producer;
+    Stopwatch consumer;
+
+    template <typename Pred>
+    void waitFor(Pred pred, std::atomic<bool>& waiting) {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+            if (pred()) return;
+            if (i >= SPIN_COUNT / 2) std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(critical_section_);
+        // フラグを立ててから条件を確認するので、相手が条件を満たした後にフラグを見落とすことはない
+        // （相手側も条件を満たす書き込みとフラグの読み出しの間にフェンスを置いている）
+        waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!pred()) {
+            cond_.wait(lock);
+        }
+        waiting.store(false);
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(critical_section_);
+        cond_.notify_all();
+    }
+
+    virtual void run() {
+        const size_t numSlots = slots_.size();
+        while (true) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            auto hasData = [&]() {
+                return tail_.load(std::memory_order_acquire) != head || finished_.load() || error_.load();
+            };
+            if (!hasData()) {
+                if (PERF) consumer.start();
+                waitFor(hasData, consumerWaiting_);
+                if (PERF) consumer.stop();
+            }
+            const size_t tail = tail_.load(std::memory_order_acquire);
+            if (tail == head) {
+                // データがなくてfinished_かerror_なら終了
+                return;
+            }
+            auto& slot = slots_[head % numSlots];
+            const size_t amount = slot.first;
+            T data = std::move(slot.second);
+            head_.store(head + 1, std::memory_order_release);
+            const size_t newsize = current_.fetch_sub(amount) - amount;
+            // head_の書き込みとproducerWaiting_の読み出しを入れ替えられると起床を見落とすので分ける
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (producerWaiting_.load() && (newsize <= lowWater_ || tail - head == numSlots)) {
+                wake();
+            }
+            if (error_.load() == false) {
+                try {
+                    OnDataReceived(std::move(data));
+                } catch (Exception&) {
+                    error_.store(true);
+                    // put() が待機している場合に解除する
+                    wake();
+                }
+            }
+        }
+    }
+};
+
 class SubProcess {
 public:
-    SubProcess(const tstring& args, const bool disablePowerThrottoling = false);
+    // stdInBufferSize: 標準入力パイプのバッファサイズ (0で既定値)
+    SubProcess(const tstring& args, const bool disablePowerThrottoling = false, const uint32_t stdInBufferSize = 0);
     ~SubProcess();
     void write(MemoryChunk mc);
+    // 標準入力パイプのハンドル（finishWrite後は無効）
+    PIPE_HANDLE stdInHandle() const;
     size_t readErr(MemoryChunk mc);
     size_t readOut(MemoryChunk mc);
     void finishWrite();
@@ -203,7 +381,7 @@ private:
 
 class EventBaseSubProcess : public SubProcess {
 public:
-    EventBaseSubProcess(const tstring& args, const bool disablePowerThrottoling = false);
+    EventBaseSubProcess(const tstring& args, const bool disablePowerThrottoling = false, const uint32_t stdInBufferSize = 0);
     ~EventBaseSubProcess();
     int join();
     bool isRunning();
@@ -230,7 +408,7 @@ class StdRedirectedSubProcess : public EventBaseSubProcess {
 public:
     using LineCallback = std::function<void(bool isErr, const std::vector<char>& line, bool isProgress)>;
 
-    StdRedirectedSubProcess(const tstring& args, const int bufferLines = 0, const bool isUtf8 = false, const bool disablePowerThrottoling = false, bool captureOnly = false, LineCallback lineCallback = LineCallback());
+    StdRedirectedSubProcess(const tstring& args, const int bufferLines = 0, const bool isUtf8 = false, const bool disablePowerThrottoling = false, bool captureOnly = false, LineCallback lineCallback = LineCallback(), const uint32_t stdInBufferSize = 0);
 
     virtual ~StdRedirectedSubProcess();
 
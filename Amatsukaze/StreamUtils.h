@@ -10,6 +10,8 @@
 #include <algorithm>
 #include <vector>
 #include <array>
+#include <atomic>
+#include <mutex>
 #include <map>
 #include <set>
 #include <fstream>
@@ -415,14 +417,17 @@ public:
     }
 
     void registerTmpFile(const tstring& path) {
+        std::lock_guard<std::mutex> lock(tmpFilesMutex);
         tmpFiles.insert(path);
     }
 
     void unregisterTmpFile(const tstring& path) {
+        std::lock_guard<std::mutex> lock(tmpFilesMutex);
         tmpFiles.erase(path);
     }
 
     void clearTmpFiles() {
+        std::lock_guard<std::mutex> lock(tmpFilesMutex);
         for (auto& path : tmpFiles) {
             if (path.find(_T('*')) != tstring::npos) {
                 auto dir = pathGetDirectory(path);
@@ -438,9 +443,18 @@ public:
     }
 
     void incrementCounter(AMT_ERROR_COUNTER err) {
+        if (threadQuiet) {
+            return;
+        }
         errCounter[err]++;
     }
 
+    // 呼び出したスレッドからのログ出力（エラー以外）とエラーカウントを抑制する
+    // 範囲分割解析で手前の範囲と重複して読む区間を解析するときに使う
+    void setThreadQuiet(bool quiet) {
+        threadQuiet = quiet;
+    }
+
     int getErrorCount(AMT_ERROR_COUNTER err) const {
         return errCounter[err];
     }
@@ -499,6 +513,8 @@ public:
     // コンソール出力をデフォルトコードページに設定
     void setDefaultCP() {
 #if defined(_WIN32) || defined(_WIN64)
+        // 並列ステージのスレッドからも呼ばれるので出力と排他する
+        std::lock_guard<std::mutex> lock(printMutex);
         SetConsoleCP(acp);
         SetConsoleOutputCP(acp);
 #endif
@@ -556,7 +572,9 @@ private:
     int acp;
 
     std::set<tstring> tmpFiles;
-    std::array<int, AMT_ERR_MAX> errCounter;
+    std::mutex tmpFilesMutex;
+    // ES解析スレッドからも加算される
+    std::array<std::atomic<int>, AMT_ERR_MAX> errCounter;
     tstring errMessage;
 #if defined(_WIN32) || defined(_WIN64)
     mutable std::string errMessageUtf8;
@@ -564,7 +582,12 @@ private:
 
     std::map<std::string, std::wstring> drcsMap;
 
+    static inline thread_local bool threadQuiet = false;
+    // ログは並列ステージのスレッドからも出力される
+    mutable std::mutex printMutex;
+
     void writeT(const tchar* str) const {
+        std::lock_guard<std::mutex> lock(printMutex);
 #if defined(_WIN32) || defined(_WIN64)
         const auto text = tchar_to_string(str, (uint32_t)acp);
         fwrite(text.data(), 1, text.size(), stderr);
@@ -595,14 +618,22 @@ private:
         char buffer[80];
 
         time(&rawtime);
-        tm * timeinfo = localtime(&rawtime);
+        tm timeinfo;
+#if defined(_WIN32) || defined(_WIN64)
+        localtime_s(&timeinfo, &rawtime);
+#else
+        localtime_r(&rawtime, &timeinfo);
+#endif
 
-        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
+        strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
         const auto time = char_to_tstring(buffer);
         writeT(StringFormat(_T("%s %s%s"), time.c_str(), str, endchar).c_str());
     }
 
     void print(const tchar* str, AMT_LOG_LEVEL level) const {
+        if (threadQuiet && level != AMT_LOG_ERROR) {
+            return;
+        }
         if (timePrefix) {
             printWithTimePrefix(str);
         } else {
@@ -612,6 +643,9 @@ private:
     }
 
     void printProgress(const tchar* str) const {
+        if (threadQuiet) {
+            return;
+        }
         if (timePrefix) {
             printWithTimePrefix(str, _T("\r"));
         } else {
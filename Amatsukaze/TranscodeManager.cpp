@@ -17,6 +17,12 @@
 #include "Subtitle.h"
 #include "WaveWriter.h"
 #include <filesystem>
+#include <future>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
 
 namespace {
 
@@ -559,7 +565,7 @@ static tstring createWhisperWaveInput(AMTContext& ctx,
 
     writeWaveHeader(fp.get(), destChannels, sampleRate, bytesPerSample * 8, totalSamples);
 
-    File sourceWave(setting.getWaveFilePath(), _T("rb"));
+    WaveStoreReader sourceWave(setting.getWaveFilePath());
     std::vector<uint8_t> srcBuffer;
     std::vector<uint8_t> dstBuffer;
 
@@ -672,6 +678,180 @@ private:
     bool joined_ = false;
 };
 
+// 出力キーごとの処理段階（音声エンコード、字幕生成、mux等）を依存関係に従って並行実行する。
+// フィルタ・エンコードはAviSynth環境とResourceMangerを使うので呼び出しスレッドで実行し、
+// addExternalで登録した段階の完了をdoneで通知する。
+// 依存先が失敗した段階は実行せず、同じ例外で失敗扱いにする。
+class StageScheduler {
+public:
+    StageScheduler(int numWorkers)
+        : abort_(false) {
+        for (int i = 0; i < numWorkers; i++) {
+            workers_.emplace_back([this]() { workerMain(); });
+        }
+    }
+
+    ~StageScheduler() {
+        {
+            // 未実行の段階は捨てて、実行中の段階の完了だけ待つ
+            std::lock_guard<std::mutex> lock(mtx_);
+            abort_ = true;
+            ready_.clear();
+            cond_.notify_all();
+        }
+        for (auto& th : workers_) {
+            th.join();
+        }
+    }
+
+    // depsがすべて完了したらワーカーでfuncを実行する
+    int add(std::function<void()> func, const std::vector<int>& deps) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        const int id = (int)stages_.size();
+        stages_.emplace_back();
+        Stage& stage = stages_.back();
+        stage.func = std::move(func);
+        for (int dep : deps) {
+            if (dep < 0) {
+                continue;
+            }
+            Stage& depStage = stages_[dep];
+            if (depStage.state == STAGE_FAILED) {
+                stage.state = STAGE_FAILED;
+                stage.error = depStage.error;
+            } else if (depStage.state != STAGE_DONE) {
+                depStage.dependents.push_back(id);
+                stage.remaining++;
+            }
+        }
+        if (stage.state != STAGE_FAILED && stage.remaining == 0) {
+            stage.state = STAGE_READY;
+            ready_.push_back(id);
+            cond_.notify_all();
+        }
+        return id;
+    }
+
+    // 呼び出しスレッドで実行する段階
+    int addExternal() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stages_.emplace_back();
+        stages_.back().state = STAGE_RUNNING;
+        return (int)stages_.size() - 1;
+    }
+
+    void done(int id) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (stages_[id].state == STAGE_RUNNING) {
+            finish(id, nullptr);
+        }
+    }
+
+    // 完了を待つ（失敗していたら例外を再送出する）
+    void wait(int id) {
+        if (id < 0) {
+            return;
+        }
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            cond_.wait(lock, [&]() {
+                return stages_[id].state == STAGE_DONE || stages_[id].state == STAGE_FAILED;
+            });
+            error = stages_[id].error;
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // 既に失敗した段階があれば例外を再送出する
+    void throwIfFailed() {
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (const auto& stage : stages_) {
+                if (stage.state == STAGE_FAILED) {
+                    error = stage.error;
+                    break;
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    enum StageState {
+        STAGE_WAITING,
+        STAGE_READY,
+        STAGE_RUNNING,
+        STAGE_DONE,
+        STAGE_FAILED,
+    };
+    struct Stage {
+        std::function<void()> func;
+        std::vector<int> dependents;
+        int remaining = 0;
+        StageState state = STAGE_WAITING;
+        std::exception_ptr error;
+    };
+
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::deque<Stage> stages_; // 追加しても要素の参照が無効にならないようにdeque
+    std::deque<int> ready_;
+    std::vector<std::thread> workers_;
+    bool abort_;
+
+    // mtx_を取得した状態で呼ぶ
+    void finish(int id, std::exception_ptr error) {
+        Stage& stage = stages_[id];
+        stage.state = error ? STAGE_FAILED : STAGE_DONE;
+        stage.error = error;
+        for (int next : stage.dependents) {
+            Stage& nextStage = stages_[next];
+            if (nextStage.state != STAGE_WAITING) {
+                continue;
+            }
+            if (error) {
+                finish(next, error);
+            } else if (--nextStage.remaining == 0) {
+                nextStage.state = STAGE_READY;
+                ready_.push_back(next);
+            }
+        }
+        cond_.notify_all();
+    }
+
+    void workerMain() {
+        while (true) {
+            int id;
+            std::function<void()> func;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                cond_.wait(lock, [&]() { return abort_ || ready_.size() > 0; });
+                if (abort_) {
+                    return;
+                }
+                id = ready_.front();
+                ready_.pop_front();
+                stages_[id].state = STAGE_RUNNING;
+                func = std::move(stages_[id].func);
+            }
+            std::exception_ptr error;
+            try {
+                func();
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mtx_);
+            finish(id, error);
+        }
+    }
+};
+
 } // namespace
 
 AMTSplitter::AMTSplitter(AMTContext& ctx, const ConfigWrapper& setting)
@@ -680,19 +860,56 @@ AMTSplitter::AMTSplitter(AMTContext& ctx, const ConfigWrapper& setting)
     , psWriter(ctx)
     , writeHandler(*this)
     , audioFile_(setting.getAudioFilePath(), _T("wb"))
-    , waveFile_(setting.getWaveFilePath(), _T("wb"))
+    , waveFile_(setting.getWaveFilePath())
     , curVideoFormat_()
     , videoFileCount_(0)
     , videoStreamType_(-1)
     , audioStreamType_(-1)
     , audioFileSize_(0)
     , waveFileSize_(0)
-    , srcFileSize_(0) {
+    , srcFileSize_(0)
+    , rangeIndex_(-1)
+    , warmup_(false)
+    , rangeStartFormat_()
+    , rangeFirstFileFrames_(-1)
+    , rangeStartPackets_(0)
+    , rangeStartScramblePackets_(0)
+    , stitchedIntVideoSize_(-1) {
+    psWriter.setHandler(&writeHandler);
+    setParallelEsParse(setting.isParallelTsAnalyze());
+    // 音声が複数あるときはAACデコードが解析時間の大半になるので指定がなくても並列にする
+    setAutoParallelEsParse(2);
+}
+
+// 字幕は範囲分割しないので常に無効
+// 範囲の境界でイベントを切り替えるためES並列解析も使わない
+AMTSplitter::AMTSplitter(AMTContext& ctx, const ConfigWrapper& setting, int rangeIndex)
+    : TsSplitter(ctx, true, true, false)
+    , setting_(setting)
+    , psWriter(ctx)
+    , writeHandler(*this)
+    , audioFile_(setting.getSplitRangeAudioFilePath(rangeIndex), _T("wb"))
+    , waveFile_(setting.getSplitRangeWaveFilePath(rangeIndex))
+    , curVideoFormat_()
+    , videoFileCount_(0)
+    , videoStreamType_(-1)
+    , audioStreamType_(-1)
+    , audioFileSize_(0)
+    , waveFileSize_(0)
+    , srcFileSize_(0)
+    , rangeIndex_(rangeIndex)
+    , warmup_(false)
+    , rangeStartFormat_()
+    , rangeFirstFileFrames_(-1)
+    , rangeStartPackets_(0)
+    , rangeStartScramblePackets_(0)
+    , stitchedIntVideoSize_(-1) {
     psWriter.setHandler(&writeHandler);
 }
 
 StreamReformInfo AMTSplitter::split() {
     readAll();
+    waveFile_.finish();
 
     // for debug
     printInteraceCount();
@@ -706,7 +923,7 @@ int64_t AMTSplitter::getSrcFileSize() const {
 }
 
 int64_t AMTSplitter::getTotalIntVideoSize() const {
-    return writeHandler.getTotalSize();
+    return (stitchedIntVideoSize_ >= 0) ? stitchedIntVideoSize_ : writeHandler.getTotalSize();
 }
 AMTSplitter::StreamFileWriteHandler::StreamFileWriteHandler(TsSplitter& this_)
     : this_(this_), totalIntVideoSize_() {}
@@ -728,24 +945,52 @@ int64_t AMTSplitter::StreamFileWriteHandler::getTotalSize() const {
 }
 
 void AMTSplitter::readAll() {
+    const auto bounds = getSplitRangeBounds();
+    if (bounds.size() > 2) {
+        if (readAllParallel(bounds)) {
+            return;
+        }
+        // tsreadexと一時TSへの出力は済んでいる
+        ctx.warn(_T("範囲分割でのTS解析に失敗したため、通常のTS解析をやり直します"));
+        readSequential(true, false);
+        return;
+    }
+    readSequential(true, true);
+}
+
+void AMTSplitter::readSequential(bool parseTs, bool writeSideOutputs) {
     enum {
         BUFSIZE = 4 * 1024 * 1024,
         BUFFER_COUNT = 4
     };
-    ReadAheadFile srcfile(setting_.getSrcFilePath(), BUFSIZE, BUFFER_COUNT);
+    const bool memoryMap = setting_.isMmapInputEnabled();
+    ReadAheadFile srcfile(setting_.getSrcFilePath(), BUFSIZE, BUFFER_COUNT, memoryMap);
     // tsreplaceで一時TSを使う場合だけ、入力TSのコピーを作成する。
-    const bool needCopyTS = setting_.getFormat() == FORMAT_TSREPLACE
+    const bool needCopyTS = writeSideOutputs
+        && setting_.getFormat() == FORMAT_TSREPLACE
         && setting_.isMuxTsTempEnabled();
     std::unique_ptr<File> rawts;
+    std::future<bool> rawtsCopy;
     if (needCopyTS) {
-        rawts.reset(new File(setting_.getTmpRawTSPath(), _T("wb")));
+        if (memoryMap) {
+            // メモリマップ時はページキャッシュ上のデータをOSにファイルコピーさせる
+            // (Linuxではcopy_file_range等でカーネル内で完結する)
+            const tstring srcPath = setting_.getSrcFilePath();
+            const tstring dstPath = setting_.getTmpRawTSPath();
+            rawtsCopy = std::async(std::launch::async, [srcPath, dstPath]() {
+                return rgy_file_copy(srcPath, dstPath, true);
+            });
+        } else {
+            rawts.reset(new File(setting_.getTmpRawTSPath(), _T("wb")));
+        }
     }
     std::unique_ptr<TsReadExPipe> tsreadex;
-    if (isTsReadExAvailable(setting_)) {
+    if (writeSideOutputs && isTsReadExAvailable(setting_)) {
         tsreadex.reset(new TsReadExPipe(ctx, setting_));
     }
     srcFileSize_ = srcfile.size();
-    while (true) {
+    // 入力を読むのは解析するか、tsreadexか一時TSに渡す場合だけ
+    while (parseTs || rawts || tsreadex) {
         const MemoryChunk chunk = srcfile.read();
         if (chunk.length == 0) break;
         if (rawts) {
@@ -754,7 +999,12 @@ void AMTSplitter::readAll() {
         if (tsreadex) {
             tsreadex->write(chunk);
         }
-        inputTsData(chunk);
+        if (parseTs) {
+            inputTsData(chunk);
+        }
+    }
+    if (rawtsCopy.valid() && !rawtsCopy.get()) {
+        THROWF(IOException, "入力TSのコピーに失敗しました: %s", setting_.getTmpRawTSPath());
     }
     if (tsreadex) {
         const int exitCode = tsreadex->join();
@@ -764,6 +1014,249 @@ void AMTSplitter::readAll() {
     }
 }
 
+std::vector<int64_t> AMTSplitter::getSplitRangeBounds() const {
+    enum {
+        MIN_RANGE_SIZE = 256 * 1024 * 1024,
+        MAX_AUTO_RANGES = 8,
+    };
+    std::vector<int64_t> bounds;
+    int numRanges = setting_.getNumTsSplitRanges();
+    if (numRanges == 1) {
+        return bounds;
+    }
+    if (enableCaption) {
+        // 字幕パーサはスレッドセーフでないので分割できない
+        ctx.info(_T("字幕処理が有効なため、TS解析の範囲分割は行いません"));
+        return bounds;
+    }
+    if (numRanges == 0) {
+        const int logical = (int)std::thread::hardware_concurrency();
+        numRanges = std::max(1, std::min(logical, (int)MAX_AUTO_RANGES));
+    }
+    File srcfile(setting_.getSrcFilePath(), _T("rb"));
+    const int64_t fileSize = srcfile.size();
+    numRanges = (int)std::min<int64_t>(numRanges, fileSize / MIN_RANGE_SIZE);
+    if (numRanges <= 1) {
+        return bounds;
+    }
+    // 境界をTSパケットの先頭に合わせるため最初の同期位置を探す
+    std::vector<uint8_t> head(TS_PACKET_LENGTH * 8);
+    const int headSize = (int)srcfile.read(MemoryChunk(head.data(), head.size()));
+    int syncPos = -1;
+    for (int i = 0; i < TS_PACKET_LENGTH && i + TS_PACKET_LENGTH * 2 < headSize; i++) {
+        if (head[i] == TS_SYNC_BYTE &&
+            head[i + TS_PACKET_LENGTH] == TS_SYNC_BYTE &&
+            head[i + TS_PACKET_LENGTH * 2] == TS_SYNC_BYTE) {
+            syncPos = i;
+            break;
+        }
+    }
+    if (syncPos < 0) {
+        return bounds;
+    }
+    const int64_t numPackets = (fileSize - syncPos) / TS_PACKET_LENGTH;
+    bounds.push_back(0);
+    for (int i = 1; i < numRanges; i++) {
+        bounds.push_back(syncPos + numPackets * i / numRanges * TS_PACKET_LENGTH);
+    }
+    bounds.push_back(fileSize);
+    return bounds;
+}
+
+bool AMTSplitter::readAllParallel(const std::vector<int64_t>& bounds) {
+    const int numRanges = (int)bounds.size() - 1;
+    ctx.infoF(_T("TS解析を%d個の範囲に分割して並列に行います"), numRanges);
+
+    std::vector<std::unique_ptr<AMTSplitter>> ranges;
+    std::vector<std::future<void>> results;
+    for (int i = 0; i < numRanges; i++) {
+        ranges.emplace_back(new AMTSplitter(ctx, setting_, i));
+        ranges.back()->setServiceId(preferedServiceId);
+    }
+    for (int i = 0; i < numRanges; i++) {
+        AMTSplitter* range = ranges[i].get();
+        const int64_t start = bounds[i];
+        const int64_t end = bounds[i + 1];
+        const bool isLast = (i == numRanges - 1);
+        results.push_back(std::async(std::launch::async, [range, start, end, isLast]() {
+            range->readRange(start, end, isLast);
+        }));
+    }
+
+    // 解析と並行して入力を先頭から読み、tsreadexと一時TSに渡す
+    std::exception_ptr sideOutputError;
+    try {
+        readSequential(false, true);
+    } catch (...) {
+        sideOutputError = std::current_exception();
+    }
+
+    bool succeeded = true;
+    for (int i = 0; i < numRanges; i++) {
+        try {
+            results[i].get();
+        } catch (const Exception& e) {
+            ctx.warnF(_T("範囲%dのTS解析に失敗しました: %s"), i, e.message());
+            succeeded = false;
+        }
+    }
+    if (sideOutputError) {
+        std::rethrow_exception(sideOutputError);
+    }
+    if (!succeeded || !checkSplitRanges(ranges)) {
+        return false;
+    }
+    stitchRanges(ranges);
+    ranges.clear();
+
+    // 結合済みの範囲ごとの音声ファイルは不要
+    for (int i = 0; i < numRanges; i++) {
+        removeT(setting_.getSplitRangeAudioFilePath(i).c_str());
+        removeT(setting_.getSplitRangeWaveFilePath(i).c_str());
+    }
+    return true;
+}
+
+void AMTSplitter::readRange(int64_t start, int64_t end, bool isLast) {
+    enum {
+        BUFSIZE = 4 * 1024 * 1024,
+        // パーサの状態を作るために範囲の手前から読む量（PAT,PMT,PCRとシーケンスヘッダが揃うのに十分な量）
+        WARMUP_PACKETS = 32 * 1024 * 1024 / TS_PACKET_LENGTH,
+    };
+    const int64_t readStart = std::max<int64_t>(0, start - (int64_t)WARMUP_PACKETS * TS_PACKET_LENGTH);
+    File srcfile(setting_.getSrcFilePath(), _T("rb"));
+    srcfile.seek(readStart, SEEK_SET);
+    std::vector<uint8_t> buf(BUFSIZE);
+
+    // 先頭の範囲は通常の解析と同じ
+    warmup_ = (readStart < start);
+    // 手前の区間は前の範囲でも解析するので、ログとエラーカウントが重複しないようにする
+    struct QuietGuard {
+        AMTContext& ctx;
+        ~QuietGuard() { ctx.setThreadQuiet(false); }
+    } quietGuard{ ctx };
+    ctx.setThreadQuiet(warmup_);
+    int64_t pos = readStart;
+    while (pos < end) {
+        // 手前の区間と範囲の境界ではちょうどで区切って入力する
+        const int64_t limit = warmup_ ? start : end;
+        const size_t readBytes = srcfile.read(MemoryChunk(buf.data(), (size_t)std::min<int64_t>(BUFSIZE, limit - pos)));
+        if (readBytes == 0) break;
+        inputTsData(MemoryChunk(buf.data(), readBytes));
+        pos += readBytes;
+        if (warmup_ && pos >= start) {
+            warmup_ = false;
+            ctx.setThreadQuiet(false);
+            beginRange();
+        }
+    }
+    // 範囲の最後で途中のPESは次の範囲が出力するので最後の範囲だけflushする
+    if (isLast) {
+        flush();
+    }
+    writeHandler.close();
+    audioFile_.flush();
+    // 結合時に読むのでインデックスまで書いておく
+    waveFile_.finish();
+}
+
+void AMTSplitter::beginRange() {
+    if (initPhase != INIT_FINISHED || curVideoFormat_.isEmpty()) {
+        THROWF(FormatException, "範囲%dの開始位置までに映像フォーマットを取得できませんでした", rangeIndex_);
+    }
+    // 前の範囲の最後の中間映像ファイルの続きとして出力する
+    rangeStartFormat_ = curVideoFormat_;
+    writeHandler.open(getIntVideoFilePath(videoFileCount_++));
+    psWriter.outHeader(videoStreamType_, audioStreamType_);
+    rangeStartPackets_ = numTotalPackets;
+    rangeStartScramblePackets_ = numScramblePackets;
+}
+
+bool AMTSplitter::checkSplitRanges(const std::vector<std::unique_ptr<AMTSplitter>>& ranges) const {
+    if (ranges[0]->videoFileCount_ == 0) {
+        ctx.warn(_T("範囲0で映像が見つかりませんでした"));
+        return false;
+    }
+    for (int i = 1; i < (int)ranges.size(); i++) {
+        const AMTSplitter& prev = *ranges[i - 1];
+        const AMTSplitter& range = *ranges[i];
+        // 範囲の最初の中間映像ファイルを前の範囲のファイルに繋げられること
+        if (!range.rangeStartFormat_.isBasicEquals(prev.curVideoFormat_) ||
+            range.videoStreamType_ != prev.videoStreamType_ ||
+            range.audioStreamType_ != prev.audioStreamType_) {
+            ctx.warnF(_T("範囲%dの開始位置で映像フォーマットが前の範囲と一致しません"), i);
+            return false;
+        }
+    }
+    return true;
+}
+
+void AMTSplitter::stitchRanges(const std::vector<std::unique_ptr<AMTSplitter>>& ranges) {
+    for (int r = 0; r < (int)ranges.size(); r++) {
+        const AMTSplitter& range = *ranges[r];
+        const int videoBase = (int)videoFrameList_.size();
+        const int audioBase = (int)audioFrameList_.size();
+        const bool continued = (r > 0);
+        const int fileBase = continued ? (videoFileCount_ - 1) : videoFileCount_;
+
+        // 中間映像ファイル
+        int64_t firstFileOffset = 0;
+        for (int i = 0; i < range.videoFileCount_; i++) {
+            const tstring srcpath = setting_.getSplitRangeIntVideoFilePath(r, i);
+            const tstring dstpath = setting_.getIntVideoFilePath(fileBase + i);
+            if (i == 0 && continued) {
+                File dst(dstpath, _T("ab"));
+                firstFileOffset = dst.size();
+                dst.appendFrom(srcpath);
+                removeT(srcpath.c_str());
+            } else if (_trename(srcpath.c_str(), dstpath.c_str()) != 0) {
+                THROWF(IOException, "ファイルを移動できません: %s", GetFullPath(srcpath));
+            }
+        }
+        stitchedIntVideoSize_ = range.writeHandler.getTotalSize() +
+            ((continued && range.videoFileCount_ == 1) ? firstFileOffset : 0);
+        videoFileCount_ = fileBase + range.videoFileCount_;
+
+        for (int i = 0; i < (int)range.videoFrameList_.size(); i++) {
+            videoFrameList_.push_back(range.videoFrameList_[i]);
+            if (continued && (range.rangeFirstFileFrames_ < 0 || i < range.rangeFirstFileFrames_)) {
+                videoFrameList_.back().fileOffset += firstFileOffset;
+            }
+        }
+
+        // 音声
+        for (const FileAudioFrameInfo& frame : range.audioFrameList_) {
+            audioFrameList_.push_back(frame);
+            audioFrameList_.back().fileOffset += audioFileSize_;
+            audioFrameList_.back().waveOffset += waveFileSize_;
+        }
+        audioFile_.appendFrom(setting_.getSplitRangeAudioFilePath(r));
+        waveFile_.appendFrom(setting_.getSplitRangeWaveFilePath(r));
+        audioFileSize_ += range.audioFileSize_;
+        waveFileSize_ += range.waveFileSize_;
+
+        for (StreamEvent ev : range.streamEventList_) {
+            ev.frameIdx += (ev.type == AUDIO_FORMAT_CHANGED) ? audioBase : videoBase;
+            streamEventList_.push_back(ev);
+        }
+        timeList_.insert(timeList_.end(), range.timeList_.begin(), range.timeList_.end());
+
+        numTotalPackets += range.numTotalPackets - range.rangeStartPackets_;
+        numScramblePackets += range.numScramblePackets - range.rangeStartScramblePackets_;
+    }
+    const AMTSplitter& last = *ranges.back();
+    curVideoFormat_ = last.curVideoFormat_;
+    videoStreamType_ = last.videoStreamType_;
+    audioStreamType_ = last.audioStreamType_;
+    selectedServiceId = ranges[0]->selectedServiceId;
+}
+
+tstring AMTSplitter::getIntVideoFilePath(int index) const {
+    return (rangeIndex_ >= 0)
+        ? setting_.getSplitRangeIntVideoFilePath(rangeIndex_, index)
+        : setting_.getIntVideoFilePath(index);
+}
+
 /* static */ bool AMTSplitter::CheckPullDown(PICTURE_TYPE p0, PICTURE_TYPE p1) {
     switch (p0) {
     case PIC_TFF:
@@ -864,6 +1357,9 @@ void AMTSplitter::printInteraceCount() {
     int64_t clock,
     const std::vector<VideoFrameInfo>& frames,
     PESPacket packet) {
+    if (warmup_) {
+        return;
+    }
     for (const VideoFrameInfo& frame : frames) {
         videoFrameList_.push_back(frame);
         videoFrameList_.back().fileOffset = writeHandler.getTotalSize();
@@ -872,6 +1368,11 @@ void AMTSplitter::printInteraceCount() {
 }
 
 /* virtual */ void AMTSplitter::onVideoFormatChanged(VideoFormat fmt) {
+    if (warmup_) {
+        // 範囲の開始時のフォーマットとして覚えておくだけ
+        curVideoFormat_ = fmt;
+        return;
+    }
     ctx.info(_T("[映像フォーマット変更]"));
 
     StringBuilder sb;
@@ -892,7 +1393,10 @@ void AMTSplitter::printInteraceCount() {
     if (!curVideoFormat_.isBasicEquals(fmt)) {
         // アスペクト比以外も変更されていたらファイルを分ける
         //（StreamReformと条件を合わせなければならないことに注意）
-        writeHandler.open(setting_.getIntVideoFilePath(videoFileCount_++));
+        if (videoFileCount_ == 1) {
+            rangeFirstFileFrames_ = (int)videoFrameList_.size();
+        }
+        writeHandler.open(getIntVideoFilePath(videoFileCount_++));
         psWriter.outHeader(videoStreamType_, audioStreamType_);
     }
     curVideoFormat_ = fmt;
@@ -908,6 +1412,9 @@ void AMTSplitter::printInteraceCount() {
     int64_t clock,
     const std::vector<AudioFrameData>& frames,
     PESPacket packet) {
+    if (warmup_) {
+        return;
+    }
     for (const AudioFrameData& frame : frames) {
         FileAudioFrameInfo info = frame;
         info.audioIdx = audioIdx;
@@ -929,6 +1436,9 @@ void AMTSplitter::printInteraceCount() {
 }
 
 /* virtual */ void AMTSplitter::onAudioFormatChanged(int audioIdx, AudioFormat fmt) {
+    if (warmup_) {
+        return;
+    }
     ctx.infoF(_T("[音声%dフォーマット変更]"), audioIdx);
     ctx.infoF(_T("チャンネル: %s サンプルレート: %d"),
         getAudioChannelString(fmt.channels), fmt.sampleRate);
@@ -965,6 +1475,9 @@ void AMTSplitter::printInteraceCount() {
     ASSERT(audio.size() > 0);
     videoStreamType_ = video.stype;
     audioStreamType_ = audio[0].stype;
+    if (warmup_) {
+        return;
+    }
 
     StreamEvent ev = StreamEvent();
     ev.type = PID_TABLE_CHANGED;
@@ -974,6 +1487,9 @@ void AMTSplitter::printInteraceCount() {
 }
 
 /* virtual */ void AMTSplitter::onTime(int64_t clock, JSTTime time) {
+    if (warmup_) {
+        return;
+    }
     timeList_.push_back(std::make_pair(clock, time));
 }
 
@@ -1490,9 +2006,19 @@ void DoBadThing() {
         tstring vttPath;
         std::unique_ptr<StdRedirectedSubProcess> process;
         int exitCode = -1; // join()の結果 (-1: 未実行)
+        tstring errorMessage;
     };
     std::vector<WhisperTask> whisperTasks;
     std::vector<int> whisperLocalIndex(keys.size(), 0);
+    std::vector<PsisiarcTask> psisiarcTasks;
+    std::vector<int> psisiarcKeyIndex; // psisiarcTasksの出力キー番号
+    // --stream-mux時はエンコードと並行してmuxするので先に作っておく
+    auto muxer = std::unique_ptr<AMTMuxder>(new AMTMuxder(ctx, setting, reformInfo));
+    // 音声エンコード・字幕生成・muxは依存関係に従って映像エンコードと並行して実行する
+    // （段階から参照する変数より後に宣言して、先に破棄されるようにする）
+    StageScheduler scheduler(4);
+    std::vector<int> audioStages(keys.size(), -1);
+    const bool whisperEnabled = (setting.getSubtitleMode() == SUBMODE_WHISPER_ALWAYS || setting.getSubtitleMode() == SUBMODE_WHISPER_FALLBACK);
     if (setting.isEncodeAudio()) {
         ctx.info(_T("[音声エンコード]"));
         for (int i = 0; i < (int)keys.size(); i++) {
@@ -1506,9 +2032,18 @@ void DoBadThing() {
                 outpath);
             auto format = reformInfo.getFormat(key);
             auto audioFrames = reformInfo.getWaveInput(reformInfo.getEncodeFile(key).audioFrames[0]);
-            EncodeAudio(ctx, args, setting.getWaveFilePath(), format.audioFormat[0], audioFrames);
+            // 音声エンコーダは1つずつ順番に動かす
+            audioStages[i] = scheduler.add([&ctx, &setting, args, format, audioFrames]() {
+                EncodeAudio(ctx, args, setting.getWaveFilePath(), format.audioFormat[0], audioFrames);
+            }, { (i > 0) ? audioStages[i - 1] : -1 });
             whisperAudioEntries.push_back({ i, key, 0, outpath, 0, -1 });
         }
+        if (whisperEnabled) {
+            // Whisperはエンコードした音声を入力にするので、ここで揃える
+            for (int id : audioStages) {
+                scheduler.wait(id);
+            }
+        }
     } else if (setting.getFormat() != FORMAT_TSREPLACE
         || (setting.getSubtitleMode() == SUBMODE_WHISPER_ALWAYS || setting.getSubtitleMode() == SUBMODE_WHISPER_FALLBACK)) { // tsreplaceの場合は音声ファイルを作らない
         ctx.info(_T("[音声出力]"));
@@ -1556,7 +2091,6 @@ void DoBadThing() {
         }
     }
 
-    std::vector<PsisiarcTask> psisiarcTasks;
     ctx.info(_T("[字幕ファイル生成]"));
     for (int i = 0; i < (int)keys.size(); i++) {
         auto key = keys[i];
@@ -1593,10 +2127,11 @@ void DoBadThing() {
         } catch (const Exception& e) {
             ctx.warnF(_T("WebVTT生成に失敗: %s"), e.message());
         }
+        psisiarcKeyIndex.resize(psisiarcTasks.size(), i);
 
         // Whisperによる字幕生成 (モード制御 + 複数音声)
         try {
-            if (setting.getSubtitleMode() == SUBMODE_WHISPER_ALWAYS || setting.getSubtitleMode() == SUBMODE_WHISPER_FALLBACK) {
+            if (whisperEnabled) {
                 SubtitleGenerator whisperGen(ctx);
                 const auto wdir    = setting.getTmpWhisperDir();
                 const auto whisper = setting.getWhisperPath();
@@ -1642,7 +2177,7 @@ void DoBadThing() {
                         const auto vttPath = setting.getTmpWhisperVttPath(entry.key, entry.localIndex);
 
                         if (setting.isWhisperParallelEnabled()) {
-                            // エンコードと並列実行: ここではタスクだけ登録し、別スレッドで直列実行する
+                            // エンコードと並列実行: ここではタスクだけ登録し、後で段階として直列実行する
                             WhisperTask task;
                             task.keyIndex = i;
                             task.key = entry.key;
@@ -1691,55 +2226,96 @@ void DoBadThing() {
 
     auto argGen = std::unique_ptr<EncoderArgumentGenerator>(new EncoderArgumentGenerator(setting, reformInfo));
 
-    // Whisper並列実行時は、別スレッドでwhisperTasksを直列実行する
-    std::unique_ptr<std::thread> whisperThread;
-    if (setting.isWhisperParallelEnabled() && !whisperTasks.empty()) {
-        whisperThread = std::make_unique<std::thread>([&ctx, &whisperTasks]() {
-            SubtitleGenerator whisperGen(ctx);
-            for (auto& task : whisperTasks) {
-                task.process = whisperGen.startWhisperProcess(task.param);
-                task.exitCode = task.process->join();
-            }
-        });
-    }
-
-    // psisiarcは専用スレッドでタスクを直列実行し、映像エンコードと並行させる。
-    std::unique_ptr<std::thread> psisiarcThread;
-    if (!psisiarcTasks.empty()) {
-        psisiarcThread = std::make_unique<std::thread>([&psisiarcTasks]() {
-            for (auto& task : psisiarcTasks) {
-                // 例外がスレッド外へ漏れるとterminateするため、タスク単位で捕捉して継続する。
-                // ログはスレッドセーフでないため出さず、同期時にまとめて報告する。
+    // Whisper並列実行時は、映像エンコードと並行してwhisperTasksを直列実行する
+    std::vector<int> whisperStages(whisperTasks.size(), -1);
+    if (setting.isWhisperParallelEnabled()) {
+        for (int t = 0; t < (int)whisperTasks.size(); t++) {
+            auto& task = whisperTasks[t];
+            whisperStages[t] = scheduler.add([&ctx, &task]() {
+                // 失敗してもmuxは続けるため、タスク単位で捕捉して同期時にまとめて報告する。
                 try {
-                    task.process = std::make_unique<StdRedirectedSubProcess>(
-                        task.cmd, 0, false, false, true);
+                    SubtitleGenerator whisperGen(ctx);
+                    task.process = whisperGen.startWhisperProcess(task.param);
                     task.exitCode = task.process->join();
                 } catch (const Exception& e) {
                     task.errorMessage = e.message();
-                } catch (...) {
-                    task.errorMessage = _T("不明なエラー");
+                    return;
+                }
+                if (task.exitCode == 0) {
+                    // muxが読む前に空SRT/VTTファイルの削除を行う
+                    uint64_t filesize = 0;
+                    if (rgy_file_exists(task.srtPath) && rgy_get_filesize(task.srtPath.c_str(), &filesize) && filesize == 0) {
+                        rgy_file_remove(task.srtPath.c_str());
+                    }
+                    if (rgy_file_exists(task.vttPath) && rgy_get_filesize(task.vttPath.c_str(), &filesize) && filesize == 0) {
+                        rgy_file_remove(task.vttPath.c_str());
+                    }
                 }
+            }, { (t > 0) ? whisperStages[t - 1] : -1 });
+        }
+    }
+
+    // psisiarcはタスクを直列実行し、映像エンコードと並行させる。
+    std::vector<int> psisiarcStages(psisiarcTasks.size(), -1);
+    for (int t = 0; t < (int)psisiarcTasks.size(); t++) {
+        auto& task = psisiarcTasks[t];
+        psisiarcStages[t] = scheduler.add([&task]() {
+            // 失敗してもmuxは続けるため、タスク単位で捕捉する。
+            // ログはスレッドセーフでないため出さず、同期時にまとめて報告する。
+            try {
+                task.process = std::make_unique<StdRedirectedSubProcess>(
+                    task.cmd, 0, false, false, true);
+                task.exitCode = task.process->join();
+            } catch (const Exception& e) {
+                task.errorMessage = e.message();
+            } catch (...) {
+                task.errorMessage = _T("不明なエラー");
             }
-        });
+        }, { (t > 0) ? psisiarcStages[t - 1] : -1 });
     }
-    // エンコード中の例外でunwindする場合もjoinを保証し、joinable時のterminateを防ぐ。
-    struct PsisiarcThreadJoiner {
-        std::unique_ptr<std::thread>& thread;
-        ~PsisiarcThreadJoiner() {
-            if (thread && thread->joinable()) {
-                thread->join();
+
+    // muxは出力キーごとに、映像・音声・字幕が揃ったら順番に行う。
+    // ResourceMangerのmuxフェーズを待つ必要があるときは、エンコードがすべて終わってからになる。
+    const int muxPhaseStage = scheduler.addExternal();
+    if (!rm.isValid()) {
+        scheduler.done(muxPhaseStage);
+    }
+    std::vector<int> encodeStages(keys.size(), -1);
+    std::vector<int> muxStages(keys.size(), -1);
+    for (int i = 0; i < (int)keys.size(); i++) {
+        encodeStages[i] = scheduler.addExternal();
+        std::vector<int> deps = { muxPhaseStage, encodeStages[i], audioStages[i], (i > 0) ? muxStages[i - 1] : -1 };
+        for (int t = 0; t < (int)whisperTasks.size(); t++) {
+            if (whisperTasks[t].keyIndex == i) {
+                deps.push_back(whisperStages[t]);
+            }
+        }
+        for (int t = 0; t < (int)psisiarcTasks.size(); t++) {
+            if (psisiarcKeyIndex[t] == i) {
+                deps.push_back(psisiarcStages[t]);
             }
         }
-    } psisiarcThreadJoiner{ psisiarcThread };
+        muxStages[i] = scheduler.add([&, i]() {
+            ctx.infoF(_T("[Mux開始] %d/%d %s"), i + 1, (int)keys.size(), CMTypeToString(keys[i].cm));
+            muxer->mux(keys[i], eoInfo, nicoOK, outFileInfo[i]);
+        }, deps);
+    }
+
+    // 字幕を並行して生成している場合はmux時に揃っていないのでストリーミングmuxはしない
+    const bool streamMuxAvailable = setting.isStreamMux() && !setting.isTwoPass() && encoderParallel <= 1
+        && !eoInfo.afsTimecode && !(setting.isWhisperParallelEnabled() && !whisperTasks.empty());
 
     sw.start();
     for (int i = 0; i < (int)keys.size(); i++) {
+        // 並行して実行している段階が失敗していたら、エンコードを続けずに中断する
+        scheduler.throwIfFailed();
+
         auto key = keys[i];
         auto& fileOut = outFileInfo[i];
         const CMAnalyze* cma = cmanalyze[key.video].get();
 
         AMTFilterSource filterSource(ctx, setting, reformInfo,
-            cma->getZones(), cma->getLogoPath(), key, rm);
+            cma->getZones(), cma->getSceneChanges(), cma->getLogoPath(), key, rm);
 
         if (!setting.getPreEncBatchFile().empty()) {
             ctx.infoF(_T("[エンコード前バッチファイル] %d/%d"), i + 1, (int)keys.size());
@@ -1812,27 +2388,46 @@ void DoBadThing() {
                 return std::unique_ptr<AMTFilterSource>(new AMTFilterSource(ctx, filterSource));
             };
 
-            encoder.encode(filterClip, outfmt,
-                timeCodes, *argGen, passList, bitrateZones, vfrBitrateScale,
-                baseTimecodePath, fileOut.vfrTimingFps, baseOutputPath,
-                key, serviceId, eoInfo, encoderParallel, disablePowerThrottoling,
-                env, filterFactory, setting.getEncoder());
+            // 音声を揃えてから、エンコーダの出力を追いかけてmuxする（psisiarcの出力はmuxに入らないので待たない）
+            if (streamMuxAvailable) {
+                scheduler.wait(audioStages[i]);
+            }
+            const bool streamMux = streamMuxAvailable && muxer->startStreamingMux(key, eoInfo, nicoOK, fileOut);
+            try {
+                encoder.encode(filterClip, outfmt,
+                    timeCodes, *argGen, passList, bitrateZones, filterSource.getSceneChanges(), vfrBitrateScale,
+                    baseTimecodePath, fileOut.vfrTimingFps, baseOutputPath,
+                    key, serviceId, eoInfo, encoderParallel, disablePowerThrottoling,
+                    env, filterFactory, setting.getEncoder());
+            } catch (...) {
+                if (streamMux) {
+                    muxer->finishStreamingMux(false, fileOut);
+                }
+                throw;
+            }
+            if (streamMux) {
+                muxer->finishStreamingMux(true, fileOut);
+            }
         } catch (const AvisynthError& avserror) {
             THROWF(AviSynthException, "%s", avserror.msg);
         }
+        scheduler.done(encodeStages[i]);
     }
     ctx.infoF(_T("エンコード完了: %.2f秒"), sw.getAndReset());
 
     argGen = nullptr;
 
-    // Whisper並列実行時はここでバックグラウンドスレッドの完了待ち＆ログ出力を行う
+    // Whisper並列実行時はここで完了待ち＆ログ出力を行う
     if (setting.isWhisperParallelEnabled() && !whisperTasks.empty()) {
-        if (whisperThread && whisperThread->joinable()) {
-            ctx.info(_T("[Whisper字幕生成: バックグラウンド処理の完了待ち]"));
-            whisperThread->join();
-            whisperThread.reset();
+        ctx.info(_T("[Whisper字幕生成: バックグラウンド処理の完了待ち]"));
+        for (int id : whisperStages) {
+            scheduler.wait(id);
         }
         for (auto& task : whisperTasks) {
+            if (!task.errorMessage.empty()) {
+                ctx.warnF(_T("Whisper字幕生成に失敗: %s"), task.errorMessage.c_str());
+                continue;
+            }
             if (!task.process) {
                 continue;
             }
@@ -1853,26 +2448,15 @@ void DoBadThing() {
 
             if (ret != 0) {
                 ctx.warnF(_T("Whisper字幕生成に失敗 (終了コード: 0x%x)"), ret);
-                continue;
-            }
-
-            // 正常終了時のみ、空SRT/VTTファイルの削除を行う
-            uint64_t filesize = 0;
-            if (rgy_file_exists(task.srtPath) && rgy_get_filesize(task.srtPath.c_str(), &filesize) && filesize == 0) {
-                rgy_file_remove(task.srtPath.c_str());
-            }
-            if (rgy_file_exists(task.vttPath) && rgy_get_filesize(task.vttPath.c_str(), &filesize) && filesize == 0) {
-                rgy_file_remove(task.vttPath.c_str());
             }
         }
     }
 
-    // muxがpscを読む前にpsisiarcの完了を待ち、捕捉した出力をまとめて記録する。
+    // psisiarcの完了を待ち、捕捉した出力をまとめて記録する。
     if (!psisiarcTasks.empty()) {
-        if (psisiarcThread && psisiarcThread->joinable()) {
-            ctx.info(_T("[psisiarc: バックグラウンド処理の完了待ち]"));
-            psisiarcThread->join();
-            psisiarcThread.reset();
+        ctx.info(_T("[psisiarc: バックグラウンド処理の完了待ち]"));
+        for (int id : psisiarcStages) {
+            scheduler.wait(id);
         }
         for (auto& task : psisiarcTasks) {
             if (!task.errorMessage.empty()) {
@@ -1901,15 +2485,12 @@ void DoBadThing() {
     }
 
     rm.wait(HOST_CMD_Mux);
+    scheduler.done(muxPhaseStage);
     sw.start();
     int64_t totalOutSize = 0;
-    auto muxer = std::unique_ptr<AMTMuxder>(new AMTMuxder(ctx, setting, reformInfo));
     for (int i = 0; i < (int)keys.size(); i++) {
-        auto key = keys[i];
-
-        ctx.infoF(_T("[Mux開始] %d/%d %s"), i + 1, (int)keys.size(), CMTypeToString(key.cm));
-        muxer->mux(key, eoInfo, nicoOK, outFileInfo[i]);
-
+        // エンコード中に終わっていなかった分のmuxを待つ
+        scheduler.wait(muxStages[i]);
         totalOutSize += outFileInfo[i].fileSize;
     }
     ctx.infoF(_T("Mux完了: %.2f秒"), sw.getAndReset());
@@ -38,6 +38,9 @@ public:
     int64_t getTotalIntVideoSize() const;
 
 protected:
+    // 範囲分割並列解析で1つの範囲を解析するインスタンス
+    AMTSplitter(AMTContext& ctx, const ConfigWrapper& setting, int rangeIndex);
+
     class StreamFileWriteHandler : public PsStreamWriter::EventHandler {
         TsSplitter& this_;
         std::unique_ptr<File> file_;
@@ -54,7 +57,7 @@ protected:
     PsStreamWriter psWriter;
     StreamFileWriteHandler writeHandler;
     File audioFile_;
-    File waveFile_;
+    WaveStoreWriter waveFile_;
     VideoFormat curVideoFormat_;
 
     int videoFileCount_;
@@ -71,8 +74,36 @@ protected:
     std::vector<CaptionItem> captionTextList_;
     std::vector<std::pair<int64_t, JSTTime>> timeList_;
 
+    // 範囲分割並列解析
+    int rangeIndex_; // 範囲を解析するインスタンスの範囲番号（それ以外は-1）
+    bool warmup_; // 範囲の手前からパーサの状態を作るために読んでいる間はtrue
+    VideoFormat rangeStartFormat_;
+    int rangeFirstFileFrames_; // 範囲の最初の中間映像ファイルのフレーム数（-1:ファイルが1つだけ）
+    int64_t rangeStartPackets_;
+    int64_t rangeStartScramblePackets_;
+    int64_t stitchedIntVideoSize_; // 範囲を結合したときの最後の中間映像ファイルサイズ（-1:結合していない）
+
     void readAll();
 
+    // parseTs=falseのときはtsreadexと一時TSへの出力だけを行う
+    void readSequential(bool parseTs, bool writeSideOutputs);
+
+    // 範囲の境界位置（分割しない場合は空）
+    std::vector<int64_t> getSplitRangeBounds() const;
+
+    // 失敗した場合はfalse（このインスタンスの解析状態は変更しない）
+    bool readAllParallel(const std::vector<int64_t>& bounds);
+
+    void readRange(int64_t start, int64_t end, bool isLast);
+
+    void beginRange();
+
+    bool checkSplitRanges(const std::vector<std::unique_ptr<AMTSplitter>>& ranges) const;
+
+    void stitchRanges(const std::vector<std::unique_ptr<AMTSplitter>>& ranges);
+
+    tstring getIntVideoFilePath(int index) const;
+
     static bool CheckPullDown(PICTURE_TYPE p0, PICTURE_TYPE p1);
 
     void printInteraceCount();
@@ -816,6 +816,18 @@ bool ConfigWrapper::isMuxTsTempEnabled() const {
     return conf.muxTsTemp;
 }
 
+bool ConfigWrapper::isMmapInputEnabled() const {
+    return conf.mmapInput;
+}
+
+bool ConfigWrapper::isParallelTsAnalyze() const {
+    return conf.parallelTsAnalyze;
+}
+
+int ConfigWrapper::getNumTsSplitRanges() const {
+    return conf.numTsSplitRanges;
+}
+
 bool ConfigWrapper::getUseMKVWhenSubExist() const {
     return conf.useMKVWhenSubExist;
 }
@@ -840,6 +852,14 @@ tstring ConfigWrapper::getMkvMergePath() const {
     return conf.mkvmergePath;
 }
 
+bool ConfigWrapper::isNativeMux() const {
+    return conf.nativeMux;
+}
+
+bool ConfigWrapper::isStreamMux() const {
+    return conf.streamMux;
+}
+
 tstring ConfigWrapper::getWhisperPath() const {
     return conf.whisperPath;
 }
@@ -944,6 +964,14 @@ int ConfigWrapper::getEncoderParallel() const {
     return conf.encoderParallel;
 }
 
+int ConfigWrapper::getFrameRingSlots() const {
+    return conf.frameRingSlots;
+}
+
+int ConfigWrapper::getFilterPrepassParallel() const {
+    return conf.filterPrepassParallel;
+}
+
 const std::vector<tstring>& ConfigWrapper::getLogoPath() const {
     return conf.logoPath;
 }
@@ -952,6 +980,10 @@ const std::vector<tstring>& ConfigWrapper::getEraseLogoPath() const {
     return conf.eraseLogoPath;
 }
 
+const tstring& ConfigWrapper::getLogoCacheDir() const {
+    return conf.logoCacheDir;
+}
+
 bool ConfigWrapper::isIgnoreNoLogo() const {
     return conf.ignoreNoLogo;
 }
@@ -994,6 +1026,9 @@ int ConfigWrapper::getNumParallelLogoAnalysis() const {
 bool ConfigWrapper::isDirectLogoAnalysis() const {
     return conf.directLogoAnalysis;
 }
+int ConfigWrapper::getLogoPrescanCandidates() const {
+    return conf.logoPrescanCandidates;
+}
 int ConfigWrapper::getMaxFadeLength() const {
     return conf.maxFadeLength;
 }
@@ -1033,6 +1068,10 @@ tstring ConfigWrapper::getChapterExeOptions() const {
     return conf.chapterExeOptions;
 }
 
+bool ConfigWrapper::isBuiltinChapterExe() const {
+    return conf.builtinChapterExe;
+}
+
 tstring ConfigWrapper::getJoinLogoScpPath() const {
     return conf.joinLogoScpPath;
 }
@@ -1133,6 +1172,18 @@ tstring ConfigWrapper::getIntVideoFilePath(int index) const {
     return regtmp(StringFormat(_T("%s/i%d.mpg"), tmpDir.path(), index));
 }
 
+tstring ConfigWrapper::getSplitRangeAudioFilePath(int range) const {
+    return regtmp(StringFormat(_T("%s/r%d-audio.dat"), tmpDir.path(), range));
+}
+
+tstring ConfigWrapper::getSplitRangeWaveFilePath(int range) const {
+    return regtmp(StringFormat(_T("%s/r%d-audio.wav"), tmpDir.path(), range));
+}
+
+tstring ConfigWrapper::getSplitRangeIntVideoFilePath(int range, int index) const {
+    return regtmp(StringFormat(_T("%s/r%d-i%d.mpg"), tmpDir.path(), range, index));
+}
+
 tstring ConfigWrapper::getStreamInfoPath() const {
     return conf.outVideoPath + _T("-streaminfo.dat");
 }
@@ -1177,6 +1228,10 @@ tstring ConfigWrapper::getAvsTimecodePath(EncodeFileKey key) const {
         tmpDir.path(), key.video, key.format, key.div, GetCMSuffix(key.cm)) + _T(".timecode.txt"));
 }
 
+tstring ConfigWrapper::getTmpPrepassCachePath(const tstring& hash) const {
+    return regtmp(StringFormat(_T("%s/prepass-%s.dat"), tmpDir.path(), hash));
+}
+
 tstring ConfigWrapper::getFilterAvsPath(EncodeFileKey key) const {
     auto str = StringFormat(_T("%s/vfilter%d-%d-%d%s.avs"),
         tmpDir.path(), key.video, key.format, key.div, GetCMSuffix(key.cm));
@@ -1627,11 +1682,23 @@ void ConfigWrapper::dump() const {
     if (conf.srcFilePath != conf.srcFilePathOrg) {
         ctx.infoF(_T("入力 (オリジナル): %s"), conf.srcFilePathOrg);
     }
+    if (conf.mmapInput) {
+        ctx.info(_T("入力読み込み: メモリマップ"));
+    }
+    if (conf.parallelTsAnalyze) {
+        ctx.info(_T("TS解析: ストリーム並列"));
+    }
+    if (conf.numTsSplitRanges != 1) {
+        ctx.infoF(_T("TS解析の範囲分割: %s"), (conf.numTsSplitRanges > 0) ? StringFormat(_T("%d"), conf.numTsSplitRanges) : tstring(_T("自動")));
+    }
     ctx.infoF(_T("出力: %s"), conf.outVideoPath);
     ctx.infoF(_T("一時フォルダ: %s"), tmpDir.path());
     ctx.infoF(_T("出力フォーマット: %s%s"),
         formatToString(conf.format),
         (conf.useMKVWhenSubExist) ? _T(" (字幕ありではMKV)") : _T(""));
+    if (conf.nativeMux) {
+        ctx.infoF(_T("mux: 内部muxer (mp4/mkv)%s"), conf.streamMux ? _T(" エンコードと並行") : _T(""));
+    }
     ctx.infoF(_T("エンコーダ: %s (%s)"), conf.encoderPath, encoderToString(conf.encoder));
     ctx.infoF(_T("エンコーダオプション: %s"), conf.encoderOptions);
     if (conf.userSAR.first > 0 && conf.userSAR.second > 0) {
@@ -1647,10 +1714,14 @@ void ConfigWrapper::dump() const {
         conf.twoPass ? _T("2パス") : _T("1パス"),
         cmOutMaskToString(conf.cmoutmask).c_str());
     ctx.infoF(_T("エンコード分割並列: %d"), conf.encoderParallel);
+    ctx.infoF(_T("フィルタ前処理分割並列: %s"), (conf.filterPrepassParallel > 0) ? StringFormat(_T("%d"), conf.filterPrepassParallel) : tstring(_T("自動")));
     const bool logoRequiredForChapter = conf.chapter && (!conf.noLogoInCM || !conf.noDelogo);
     ctx.infoF(_T("チャプター解析: %s%s"),
         conf.chapter ? _T("有効") : _T("無効"),
         (logoRequiredForChapter && !conf.ignoreNoLogo) ? _T("（ロゴ必須）") : _T(""));
+    if (conf.chapter) {
+        ctx.infoF(_T("無音・シーンチェンジ解析: %s"), conf.builtinChapterExe ? _T("内蔵") : _T("chapter_exe"));
+    }
     if (conf.chapter) {
         for (int i = 0; i < (int)conf.logoPath.size(); i++) {
             ctx.infoF(_T("logo%d: %s"), (i + 1), conf.logoPath[i]);
@@ -1660,6 +1731,7 @@ void ConfigWrapper::dump() const {
     ctx.infoF(_T("ロゴ消し: %s"), conf.noDelogo ? _T("しない") : _T("する"));
     ctx.infoF(_T("並列ロゴ解析: %s"), conf.parallelLogoAnalysis ? (conf.numParallelLogoAnalysis > 0 ? StringFormat(_T("%d並列"), conf.numParallelLogoAnalysis) : _T("オン")) : _T("オフ"));
     ctx.infoF(_T("AVFrame直接ロゴ解析: %s"), conf.directLogoAnalysis ? _T("オン") : _T("オフ"));
+    ctx.infoF(_T("ロゴ候補の間引き絞り込み: %s"), (conf.logoPrescanCandidates > 0) ? StringFormat(_T("上位%d個"), conf.logoPrescanCandidates) : tstring(_T("オフ")));
     if (conf.audioEncoder != AUDIO_ENCODER_NONE) {
         ctx.infoF(_T("音声: %s (%s)"), conf.audioEncoderPath, audioEncoderToString(conf.audioEncoder));
         if (conf.audioBitrateInKbps > 0) {
@@ -216,6 +216,10 @@ struct Config {
     tstring timelineditorPath;
     tstring mp4boxPath;
     tstring mkvmergePath;
+    // 外部muxerを使わずlibavformatでmp4/mkvを出力する
+    bool nativeMux;
+    // エンコードと並行して内部muxerでmuxする
+    bool streamMux;
     // Whisper 実行ファイルのパス
     tstring whisperPath;
     // Whisper モデル名
@@ -233,6 +237,9 @@ struct Config {
     ENUM_FORMAT format;
     bool tsreplaceRemoveTypeD;
     bool muxTsTemp;
+    bool mmapInput;
+    bool parallelTsAnalyze;
+    int numTsSplitRanges; // 0:自動
     bool useMKVWhenSubExist;
     bool splitSub;
     bool twoPass;
@@ -252,9 +259,15 @@ struct Config {
     int audioBitrateInKbps;
     int numEncodeBufferFrames;
     int encoderParallel;
+    // エンコーダへのフレーム転送に使う共有メモリリングのスロット数（0ならパイプ、Linuxのみ）
+    int frameRingSlots;
+    // フィルタ前処理パスの分割並列数（0なら自動）
+    int filterPrepassParallel;
     // CM解析用設定
     std::vector<tstring> logoPath;
     std::vector<tstring> eraseLogoPath;
+    // ロゴ評価用データのキャッシュディレクトリ（空なら使わない）
+    tstring logoCacheDir;
     bool ignoreNoLogo;
     bool ignoreNoDrcsMap;
     bool ignoreNicoJKError;
@@ -265,6 +278,9 @@ struct Config {
     bool parallelLogoAnalysis;
     int numParallelLogoAnalysis;
     bool directLogoAnalysis;
+    // 間引き解析後に全フレーム解析するロゴ候補数（0なら全ロゴを全フレーム解析）
+    // 間引き解析で最適なロゴが候補から漏れると選択結果が変わるのでデフォルトは無効
+    int logoPrescanCandidates;
     int maxFadeLength;
     // 自動ロゴ検出設定
     int autoLogoDetect;              // 0:無効, 1:有効
@@ -277,6 +293,8 @@ struct Config {
     int autoLogoDetectMarginY;
     tstring chapterExePath;
     tstring chapterExeOptions;
+    // chapter_exeを使わず、ロゴ解析と同じデコードで無音・シーンチェンジを検出する
+    bool builtinChapterExe;
     tstring joinLogoScpPath;
     tstring joinLogoScpCmdPath;
     tstring joinLogoScpOptions;
@@ -357,6 +375,12 @@ public:
 
     bool isMuxTsTempEnabled() const;
 
+    bool isMmapInputEnabled() const;
+
+    bool isParallelTsAnalyze() const;
+
+    int getNumTsSplitRanges() const;
+
     bool getUseMKVWhenSubExist() const;
 
     bool isFormatVFRSupported() const;
@@ -368,6 +392,10 @@ public:
     tstring getMp4BoxPath() const;
 
     tstring getMkvMergePath() const;
+
+    bool isNativeMux() const;
+
+    bool isStreamMux() const;
     tstring getWhisperPath() const;
     tstring getWhisperModel() const;
     tstring getWhisperOption() const;
@@ -416,10 +444,16 @@ public:
 
     int getEncoderParallel() const;
 
+    int getFrameRingSlots() const;
+
+    int getFilterPrepassParallel() const;
+
     const std::vector<tstring>& getLogoPath() const;
 
     const std::vector<tstring>& getEraseLogoPath() const;
 
+    const tstring& getLogoCacheDir() const;
+
     bool isIgnoreNoLogo() const;
 
     bool isIgnoreNoDrcsMap() const;
@@ -442,6 +476,8 @@ public:
 
     bool isDirectLogoAnalysis() const;
 
+    int getLogoPrescanCandidates() const;
+
     int getMaxFadeLength() const;
 
     bool isAutoLogoDetectEnabled() const;
@@ -458,6 +494,8 @@ public:
 
     tstring getChapterExeOptions() const;
 
+    bool isBuiltinChapterExe() const;
+
     tstring getJoinLogoScpPath() const;
 
     tstring getJoinLogoScpCmdPath() const;
@@ -516,6 +554,13 @@ public:
 
     tstring getIntVideoFilePath(int index) const;
 
+    // 分割並列TS解析で各範囲が出力する中間ファイル
+    tstring getSplitRangeAudioFilePath(int range) const;
+
+    tstring getSplitRangeWaveFilePath(int range) const;
+
+    tstring getSplitRangeIntVideoFilePath(int range, int index) const;
+
     tstring getStreamInfoPath() const;
 
     tstring getTmpStreamInfoPath() const;
@@ -534,6 +579,9 @@ public:
 
     tstring getAvsTimecodePath(EncodeFileKey key) const;
 
+    // フィルタ前処理結果のキャッシュ（hashは前処理の入力から作ったキー）
+    tstring getTmpPrepassCachePath(const tstring& hash) const;
+
     tstring getFilterAvsPath(EncodeFileKey key) const;
 
     tstring getEncStatsFilePath(EncodeFileKey key) const;
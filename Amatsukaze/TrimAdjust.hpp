@@ -292,7 +292,7 @@ public:
         const int sampleBytes = 4; // 16bitステレオ: int16_t L + int16_t R
         std::vector<int16_t> monoSamples(sampleCount, 0);
         {
-            File waveFile(audioFilePath, _T("rb"));
+            WaveStoreReader waveFile(audioFilePath);
             const int afIdxStart = sampleStart / audioSamplesPerFrame;
             const int afIdxEnd = std::min((sampleEnd - 1) / audioSamplesPerFrame + 1,
                                           (int)audioFrames.size());
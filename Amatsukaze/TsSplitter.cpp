@@ -229,6 +229,162 @@ void TsPacketBuffer::backAndInput() {
         handler->onTsPacket(-1, packet);
     }
 }
+
+/* virtual */ void TsPacketBuffer::onTsPackets(uint8_t* ptr, int numPackets) {
+    if (buffering) {
+        // 初期化中はハンドラの中で読み直し(backAndInput)が起きるので1パケットずつ処理する
+        TsPacketParser::onTsPackets(ptr, numPackets);
+        return;
+    }
+    // 初期化後はハンドラに直接渡す
+    for (int i = 0; i < numPackets; i++) {
+        TsPacket packet(ptr + (size_t)i * TS_PACKET_LENGTH);
+        if (handler != NULL && packet.parse() && packet.check()) {
+            handler->onTsPacket(-1, packet);
+        }
+    }
+}
+EsParserWorker::EsParserWorker(PesParser* parser, int firstRound)
+    : parser(parser)
+    , firstRound(firstRound)
+    , curSeq(-1)
+    , curEvents(nullptr)
+    , finished(false) {
+    thread = std::thread([this]() { run(); });
+}
+
+EsParserWorker::~EsParserWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        finished = true;
+        inputCond.notify_all();
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+int EsParserWorker::getFirstRound() const {
+    return firstRound;
+}
+
+void EsParserWorker::addPacket(int64_t seq, int64_t clock, TsPacket packet) {
+    current.emplace_back();
+    Input& input = current.back();
+    input.seq = seq;
+    input.clock = clock;
+    memcpy(input.data, packet.data, TS_PACKET_LENGTH);
+}
+
+void EsParserWorker::submit() {
+    std::unique_lock<std::mutex> lock(mtx);
+    outputCond.wait(lock, [this]() { return inputQueue.size() < MAX_QUEUED_ROUNDS || error; });
+    inputQueue.emplace_back(std::move(current));
+    current.clear();
+    inputCond.notify_one();
+}
+
+EsParserWorker::EventList EsParserWorker::receive() {
+    std::unique_lock<std::mutex> lock(mtx);
+    outputCond.wait(lock, [this]() { return !outputQueue.empty() || error; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    EventList events = std::move(outputQueue.front());
+    outputQueue.pop_front();
+    return events;
+}
+
+void EsParserWorker::run() {
+    try {
+        while (true) {
+            std::vector<Input> inputs;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                inputCond.wait(lock, [this]() { return finished || !inputQueue.empty(); });
+                if (finished) return;
+                inputs = std::move(inputQueue.front());
+            }
+            EventList events;
+            curEvents = &events;
+            for (Input& input : inputs) {
+                TsPacket packet(input.data);
+                packet.parse();
+                curSeq = input.seq;
+                parser->onTsPacket(input.clock, packet);
+            }
+            curEvents = nullptr;
+
+            std::lock_guard<std::mutex> lock(mtx);
+            // 処理が終わるまでキューに残しておくことで投入数を制限する
+            inputQueue.pop_front();
+            outputQueue.emplace_back(std::move(events));
+            outputCond.notify_all();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mtx);
+        error = std::current_exception();
+        outputCond.notify_all();
+    }
+}
+
+void EsParserWorker::onVideoFormatChanged(VideoFormat fmt) {
+    curEvents->emplace_back();
+    Event& ev = curEvents->back();
+    ev.type = Event::VIDEO_FORMAT_CHANGED;
+    ev.seq = curSeq;
+    ev.clock = -1;
+    ev.videoFormat = fmt;
+}
+
+void EsParserWorker::onVideoPesPacket(int64_t clock, const std::vector<VideoFrameInfo>& frames, PESPacket packet) {
+    curEvents->emplace_back();
+    Event& ev = curEvents->back();
+    ev.type = Event::VIDEO_PES;
+    ev.seq = curSeq;
+    ev.clock = clock;
+    ev.videoFrames = frames;
+    ev.pes.assign(packet.data, packet.data + packet.length);
+}
+
+void EsParserWorker::onAudioFormatChanged(AudioFormat fmt) {
+    curEvents->emplace_back();
+    Event& ev = curEvents->back();
+    ev.type = Event::AUDIO_FORMAT_CHANGED;
+    ev.seq = curSeq;
+    ev.clock = -1;
+    ev.audioFormat = fmt;
+}
+
+void EsParserWorker::onAudioPesPacket(int64_t clock, const std::vector<AudioFrameData>& frames, PESPacket packet) {
+    curEvents->emplace_back();
+    Event& ev = curEvents->back();
+    ev.type = Event::AUDIO_PES;
+    ev.seq = curSeq;
+    ev.clock = clock;
+    ev.pes.assign(packet.data, packet.data + packet.length);
+    // フレームデータはパーサ内のバッファを指しているのでコピーする
+    size_t totalSize = 0;
+    for (const AudioFrameData& frame : frames) {
+        totalSize += frame.codedDataSize + frame.decodedDataSize;
+    }
+    ev.audioData.resize(totalSize);
+    ev.audioFrames = frames;
+    uint8_t* ptr = ev.audioData.data();
+    for (AudioFrameData& frame : ev.audioFrames) {
+        if (frame.codedDataSize > 0) {
+            memcpy(ptr, frame.codedData, frame.codedDataSize);
+        }
+        frame.codedData = ptr;
+        ptr += frame.codedDataSize;
+        if (frame.decodedDataSize > 0) {
+            memcpy(ptr, frame.decodedData, frame.decodedDataSize);
+            frame.decodedData = (uint16_t*)ptr;
+            ptr += frame.decodedDataSize;
+        }
+    }
+}
+
 TsSystemClock::TsSystemClock(AMTContext& ctx)
     : AMTObject(ctx)
     , PcrPid(-1)
@@ -317,13 +473,51 @@ TsSplitter::TsSplitter(AMTContext& ctx, bool enableVideo, bool enableAudio, bool
     , enableCaption(enableCaption)
     , warnedInvalidAudioIndex(false)
     , numTotalPackets(0)
-    , numScramblePackets(0) {
+    , numScramblePackets(0)
+    , parallelEsParse(false)
+    , autoParallelMinAudios(0)
+    , numSubmittedRounds(0)
+    , numMergedRounds(0) {
     tsPacketParser.setHandler(&tsPacketHandler);
     tsPacketParser.setNumBufferingPackets(50 * 1024); // 9.6MB
     tsPacketSelector.setHandler(this);
     reset();
 }
 
+TsSplitter::~TsSplitter() {
+    // パーサより先にワーカースレッドを止める
+    videoWorker = nullptr;
+    audioWorkers.clear();
+}
+
+void TsSplitter::setParallelEsParse(bool enable) {
+    if (parallelEsParse == enable) {
+        return;
+    }
+    parallelEsParse = enable;
+    if (enable) {
+        videoWorker = std::unique_ptr<EsParserWorker>(new EsParserWorker(&videoParser, numSubmittedRounds));
+        videoParser.worker = videoWorker.get();
+        for (int i = 0; i < (int)audioParsers.size(); i++) {
+            audioWorkers.emplace_back(new EsParserWorker(audioParsers[i], numSubmittedRounds));
+            audioParsers[i]->worker = audioWorkers.back().get();
+        }
+    } else {
+        submitEsRound();
+        mergeEsRounds(0);
+        videoParser.worker = nullptr;
+        for (auto parser : audioParsers) {
+            parser->worker = nullptr;
+        }
+        videoWorker = nullptr;
+        audioWorkers.clear();
+    }
+}
+
+void TsSplitter::setAutoParallelEsParse(int minAudios) {
+    autoParallelMinAudios = minAudios;
+}
+
 void TsSplitter::reset() {
     initPhase = PMT_WAITING;
     preferedServiceId = -1;
@@ -343,9 +537,92 @@ int TsSplitter::getActualServiceId() {
 
 void TsSplitter::inputTsData(MemoryChunk data) {
     tsPacketParser.inputTS(data);
+    if (parallelEsParse) {
+        // 1ラウンドだけ解析中のまま残して次の入力と並行させる
+        submitEsRound();
+        mergeEsRounds(1);
+    }
 }
 void TsSplitter::flush() {
     tsPacketParser.flush();
+    if (parallelEsParse) {
+        submitEsRound();
+        mergeEsRounds(0);
+    }
+}
+
+void TsSplitter::submitEsRound() {
+    videoWorker->submit();
+    for (auto& worker : audioWorkers) {
+        worker->submit();
+    }
+    captionRounds.emplace_back(std::move(captionInputs));
+    captionInputs.clear();
+    ++numSubmittedRounds;
+}
+
+void TsSplitter::mergeEsRounds(int numInFlight) {
+    while (numSubmittedRounds - numMergedRounds > numInFlight) {
+        const int round = numMergedRounds;
+        // [0]が映像、[1..]が音声
+        std::vector<EsParserWorker::EventList> lists;
+        lists.emplace_back(videoWorker->receive());
+        for (auto& worker : audioWorkers) {
+            lists.emplace_back((worker->getFirstRound() <= round)
+                ? worker->receive() : EsParserWorker::EventList());
+        }
+        std::vector<CaptionInput> captions = std::move(captionRounds.front());
+        captionRounds.pop_front();
+
+        // 各リストは通し番号順なので先頭同士を比べて小さい方から出力する
+        std::vector<size_t> pos(lists.size());
+        size_t captionPos = 0;
+        while (true) {
+            int minList = -1;
+            int64_t minSeq = INT64_MAX;
+            for (int i = 0; i < (int)lists.size(); i++) {
+                if (pos[i] < lists[i].size() && lists[i][pos[i]].seq < minSeq) {
+                    minSeq = lists[i][pos[i]].seq;
+                    minList = i;
+                }
+            }
+            if (captionPos < captions.size() && captions[captionPos].seq < minSeq) {
+                CaptionInput& input = captions[captionPos++];
+                TsPacket packet(input.data);
+                packet.parse();
+                captionParser.onTsPacket(input.clock, packet);
+                continue;
+            }
+            if (minList < 0) {
+                break;
+            }
+            emitEsEvent(lists[minList][pos[minList]++], minList - 1);
+        }
+        ++numMergedRounds;
+    }
+}
+
+void TsSplitter::emitEsEvent(EsParserWorker::Event& ev, int audioIdx) {
+    switch (ev.type) {
+    case EsParserWorker::Event::VIDEO_FORMAT_CHANGED:
+        onVideoFormatChanged(ev.videoFormat);
+        break;
+    case EsParserWorker::Event::VIDEO_PES: {
+        PESPacket packet(MemoryChunk(ev.pes.data(), ev.pes.size()));
+        packet.parse();
+        onVideoPesPacket(ev.clock, ev.videoFrames, packet);
+        break;
+    }
+    case EsParserWorker::Event::AUDIO_FORMAT_CHANGED:
+        onAudioFormatChanged(audioIdx, ev.audioFormat);
+        break;
+    case EsParserWorker::Event::AUDIO_PES: {
+        PESPacket packet(MemoryChunk(ev.pes.data(), ev.pes.size()));
+        packet.parse();
+        onAudioPesPacket(audioIdx, ev.clock, ev.audioFrames, packet);
+        break;
+    }
+    }
 }
 
 int64_t TsSplitter::getNumTotalPackets() const {
@@ -387,26 +664,42 @@ TsSplitter::PcrDetectionHandler::PcrDetectionHandler(TsSplitter& this_)
     }
 }
 TsSplitter::SpVideoFrameParser::SpVideoFrameParser(AMTContext&ctx, TsSplitter& this_)
-    : VideoFrameParser(ctx), this_(this_) {}
+    : VideoFrameParser(ctx), this_(this_), worker(nullptr) {}
 /* virtual */ void TsSplitter::SpVideoFrameParser::onVideoPesPacket(int64_t clock, const std::vector<VideoFrameInfo>& frames, PESPacket packet) {
     if (clock == -1) {
         ctx.error(_T("Video PES Packet にクロック情報がありません"));
         return;
     }
-    this_.onVideoPesPacket(clock, frames, packet);
+    if (worker) {
+        worker->onVideoPesPacket(clock, frames, packet);
+    } else {
+        this_.onVideoPesPacket(clock, frames, packet);
+    }
 }
 
 /* virtual */ void TsSplitter::SpVideoFrameParser::onVideoFormatChanged(VideoFormat fmt) {
-    this_.onVideoFormatChanged(fmt);
+    if (worker) {
+        worker->onVideoFormatChanged(fmt);
+    } else {
+        this_.onVideoFormatChanged(fmt);
+    }
 }
 TsSplitter::SpAudioFrameParser::SpAudioFrameParser(AMTContext&ctx, TsSplitter& this_, int audioIdx)
-    : AudioFrameParser(ctx), this_(this_), audioIdx(audioIdx) {}
+    : AudioFrameParser(ctx), this_(this_), audioIdx(audioIdx), worker(nullptr) {}
 /* virtual */ void TsSplitter::SpAudioFrameParser::onAudioPesPacket(int64_t clock, const std::vector<AudioFrameData>& frames, PESPacket packet) {
-    this_.onAudioPesPacket(audioIdx, clock, frames, packet);
+    if (worker) {
+        worker->onAudioPesPacket(clock, frames, packet);
+    } else {
+        this_.onAudioPesPacket(audioIdx, clock, frames, packet);
+    }
 }
 
 /* virtual */ void TsSplitter::SpAudioFrameParser::onAudioFormatChanged(AudioFormat fmt) {
-    this_.onAudioFormatChanged(audioIdx, fmt);
+    if (worker) {
+        worker->onAudioFormatChanged(fmt);
+    } else {
+        this_.onAudioFormatChanged(audioIdx, fmt);
+    }
 }
 TsSplitter::SpCaptionParser::SpCaptionParser(AMTContext&ctx, TsSplitter& this_)
     : CaptionParser(ctx), this_(this_) {}
@@ -460,6 +753,12 @@ TsSplitter::SpCaptionParser::SpCaptionParser(AMTContext&ctx, TsSplitter& this_)
 
 // TsPacketSelectorでPID Tableが変更された時変更後の情報が送られる
 /* virtual */ void TsSplitter::onPidTableChanged(const PMTESInfo video, const std::vector<PMTESInfo>& audio, const PMTESInfo caption) {
+    if (parallelEsParse) {
+        // 派生クラスはここまでのフレーム数を参照するので解析中の結果を全て出力しておく
+        // パーサの設定もワーカーが止まっている間に変更する
+        submitEsRound();
+        mergeEsRounds(0);
+    }
     if (enableVideo || enableAudio) {
         // 映像ストリーム形式をセット
         switch (video.stype) {
@@ -479,9 +778,18 @@ TsSplitter::SpCaptionParser::SpCaptionParser(AMTContext&ctx, TsSplitter& this_)
         while (audioParsers.size() < numAudios) {
             int audioIdx = int(audioParsers.size());
             audioParsers.push_back(new SpAudioFrameParser(ctx, *this, audioIdx));
+            if (parallelEsParse) {
+                audioWorkers.emplace_back(new EsParserWorker(audioParsers.back(), numSubmittedRounds));
+                audioParsers.back()->worker = audioWorkers.back().get();
+            }
             ctx.infoF(_T("音声パーサ %d を追加"), audioIdx);
         }
     }
+    if (!parallelEsParse && enableAudio && autoParallelMinAudios > 0 && (int)audio.size() >= autoParallelMinAudios) {
+        // ここまでの解析結果は全て出力済みなので途中からでも切り替えられる
+        ctx.infoF(_T("音声が%dストリームあるのでES解析を並列で行います"), (int)audio.size());
+        setParallelEsParse(true);
+    }
 }
 
 bool TsSplitter::checkScramble(TsPacket packet) {
@@ -494,7 +802,13 @@ bool TsSplitter::checkScramble(TsPacket packet) {
 }
 
 /* virtual */ void TsSplitter::onVideoPacket(int64_t clock, TsPacket packet) {
-    if (enableVideo && checkScramble(packet)) videoParser.onTsPacket(clock, packet);
+    if (enableVideo && checkScramble(packet)) {
+        if (parallelEsParse) {
+            videoWorker->addPacket(numTotalPackets, clock, packet);
+        } else {
+            videoParser.onTsPacket(clock, packet);
+        }
+    }
 }
 
 /* virtual */ void TsSplitter::onAudioPacket(int64_t clock, TsPacket packet, int audioIdx) {
@@ -507,10 +821,24 @@ bool TsSplitter::checkScramble(TsPacket packet) {
             }
             return;
         }
-        audioParsers[audioIdx]->onTsPacket(clock, packet);
+        if (parallelEsParse) {
+            audioWorkers[audioIdx]->addPacket(numTotalPackets, clock, packet);
+        } else {
+            audioParsers[audioIdx]->onTsPacket(clock, packet);
+        }
     }
 }
 
 /* virtual */ void TsSplitter::onCaptionPacket(int64_t clock, TsPacket packet) {
-    if (enableCaption && checkScramble(packet)) captionParser.onTsPacket(clock, packet);
+    if (enableCaption && checkScramble(packet)) {
+        if (parallelEsParse) {
+            captionInputs.emplace_back();
+            CaptionInput& input = captionInputs.back();
+            input.seq = numTotalPackets;
+            input.clock = clock;
+            memcpy(input.data, packet.data, TS_PACKET_LENGTH);
+        } else {
+            captionParser.onTsPacket(clock, packet);
+        }
+    }
 }
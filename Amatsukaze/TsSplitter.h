@@ -15,6 +15,12 @@
 #include <vector>
 #include <map>
 #include <array>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
 
 #include "StreamUtils.h"
 #include "Mpeg2TsParser.h"
@@ -119,6 +125,8 @@ public:
 
     virtual void onTsPacket(TsPacket packet);
 
+    virtual void onTsPackets(uint8_t* ptr, int numPackets);
+
 private:
     TsPacketHandler* handler;
     AutoBuffer buffer;
@@ -127,6 +135,78 @@ private:
     bool buffering;
 };
 
+// 映像・音声のES解析を別スレッドで行うワーカー
+// TSパケットは通し番号付きでまとめて(ラウンド単位で)投入し、
+// 解析結果もラウンド単位で通し番号付きのイベントとして受け取る
+class EsParserWorker : NonCopyable {
+public:
+    struct Event {
+        enum TYPE {
+            VIDEO_FORMAT_CHANGED,
+            VIDEO_PES,
+            AUDIO_FORMAT_CHANGED,
+            AUDIO_PES,
+        };
+        TYPE type;
+        int64_t seq; // 元になったTSパケットの通し番号
+        int64_t clock;
+        VideoFormat videoFormat;
+        AudioFormat audioFormat;
+        std::vector<VideoFrameInfo> videoFrames;
+        std::vector<AudioFrameData> audioFrames; // データはaudioDataを指す
+        std::vector<uint8_t> pes;
+        std::vector<uint8_t> audioData;
+    };
+    typedef std::vector<Event> EventList;
+
+    // firstRound: このワーカーが最初に受け取るラウンド番号
+    EsParserWorker(PesParser* parser, int firstRound);
+    ~EsParserWorker();
+
+    int getFirstRound() const;
+
+    // 以下は投入側スレッドから呼ぶ
+    void addPacket(int64_t seq, int64_t clock, TsPacket packet);
+    // 現在のラウンドを投入（キューが一杯なら待つ）
+    void submit();
+    // 最も古いラウンドの結果を受け取る（終わっていなければ待つ）
+    EventList receive();
+
+    // 以下はワーカースレッドでパーサから呼ばれる
+    void onVideoFormatChanged(VideoFormat fmt);
+    void onVideoPesPacket(int64_t clock, const std::vector<VideoFrameInfo>& frames, PESPacket packet);
+    void onAudioFormatChanged(AudioFormat fmt);
+    void onAudioPesPacket(int64_t clock, const std::vector<AudioFrameData>& frames, PESPacket packet);
+
+private:
+    enum {
+        // 投入済み未処理ラウンドの上限
+        MAX_QUEUED_ROUNDS = 2,
+    };
+    struct Input {
+        int64_t seq;
+        int64_t clock;
+        uint8_t data[TS_PACKET_LENGTH];
+    };
+
+    PesParser* parser;
+    int firstRound;
+    std::vector<Input> current;
+    std::deque<std::vector<Input>> inputQueue;
+    std::deque<EventList> outputQueue;
+    // ワーカースレッドで処理中のパケット
+    int64_t curSeq;
+    EventList* curEvents;
+    bool finished;
+    std::exception_ptr error;
+    std::mutex mtx;
+    std::condition_variable inputCond;
+    std::condition_variable outputCond;
+    std::thread thread;
+
+    void run();
+};
+
 class TsSystemClock : public AMTObject {
 public:
     TsSystemClock(AMTContext& ctx);
@@ -162,9 +242,18 @@ private:
 class TsSplitter : public AMTObject, protected TsPacketSelectorHandler {
 public:
     TsSplitter(AMTContext& ctx, bool enableVideo, bool enableAudio, bool enableCaption);
+    virtual ~TsSplitter();
 
     void reset();
 
+    // 映像と音声のES解析をPIDごとのスレッドで行う（入力開始前に設定すること）
+    // 結果はTSパケット順に並べ直してから仮想関数を呼ぶので出力は変わらない
+    void setParallelEsParse(bool enable);
+
+    // PMTの音声ストリームがminAudios個以上になったら自動でES並列解析を有効にする
+    // 音声のデコードをPIDごとのスレッドで行うため（0以下で無効）
+    void setAutoParallelEsParse(int minAudios);
+
     // 0以下で指定無効
     void setServiceId(int sid);
 
@@ -203,6 +292,9 @@ protected:
     public:
         SpVideoFrameParser(AMTContext&ctx, TsSplitter& this_);
 
+        // 設定されている場合は結果をワーカーに返す
+        EsParserWorker* worker;
+
     protected:
         virtual void onVideoPesPacket(int64_t clock, const std::vector<VideoFrameInfo>& frames, PESPacket packet);
 
@@ -214,6 +306,9 @@ protected:
     public:
         SpAudioFrameParser(AMTContext&ctx, TsSplitter& this_, int audioIdx);
 
+        // 設定されている場合は結果をワーカーに返す
+        EsParserWorker* worker;
+
     protected:
         virtual void onAudioPesPacket(int64_t clock, const std::vector<AudioFrameData>& frames, PESPacket packet);
 
@@ -252,6 +347,28 @@ protected:
     int64_t numTotalPackets;
     int64_t numScramblePackets;
 
+    // ES並列解析
+    struct CaptionInput {
+        int64_t seq;
+        int64_t clock;
+        uint8_t data[TS_PACKET_LENGTH];
+    };
+    bool parallelEsParse;
+    int autoParallelMinAudios;
+    std::unique_ptr<EsParserWorker> videoWorker;
+    std::vector<std::unique_ptr<EsParserWorker>> audioWorkers;
+    // 字幕はDRCS出力で派生クラスの状態を参照するのでマージ時にこのスレッドで解析する
+    std::vector<CaptionInput> captionInputs;
+    std::deque<std::vector<CaptionInput>> captionRounds;
+    int numSubmittedRounds;
+    int numMergedRounds;
+
+    // 現在のラウンドを各ワーカーに投入
+    void submitEsRound();
+    // 投入済みのラウンドが numInFlight 個になるまで結果をマージして仮想関数を呼ぶ
+    void mergeEsRounds(int numInFlight);
+    void emitEsEvent(EsParserWorker::Event& ev, int audioIdx);
+
     virtual void onVideoPesPacket(
         int64_t clock,
         const std::vector<VideoFrameInfo>& frames,
@@ -8,6 +8,9 @@
 
 #include "WaveWriter.h"
 
+#include <algorithm>
+#include <cstring>
+
 uint32_t toBigEndian(uint32_t a) {
     return (a >> 24) | ((a & 0xFF0000) >> 8) | ((a & 0xFF00) << 8) | (a << 24);
 }
@@ -58,3 +61,493 @@ void writeWaveHeader(FILE* fp, int channels, int samplerate, int bitswidth, int6
     }
 }
 
+
+namespace {
+
+// ファイル先頭と末尾の識別子
+const char WAVE_STORE_MAGIC[8] = { 'A', 'M', 'T', 'W', 'A', 'V', 'Z', '1' };
+
+enum {
+    WAVE_STORE_HEADER_SIZE = 16,
+    WAVE_STORE_TRAILER_SIZE = 24,
+    WAVE_STORE_BLOCK_SIZE = 128 * 1024, // 非圧縮でのブロックサイズ
+    WAVE_STORE_GROUP = 256, // Riceパラメータを共有するサンプル数
+    WAVE_STORE_ESCAPE = 24, // 商がこれ以上のときは16bitそのまま書く
+    WAVE_STORE_BLOCK_HEADER = 4,
+};
+
+enum {
+    WAVE_BLOCK_RAW = 0,
+    WAVE_BLOCK_RICE = 1,
+};
+
+inline int countLeadingZeros64(uint64_t v) {
+#if defined(_WIN64)
+    unsigned long index;
+    _BitScanReverse64(&index, v);
+    return 63 - (int)index;
+#elif defined(_WIN32)
+    unsigned long index;
+    if (v >> 32) {
+        _BitScanReverse(&index, (unsigned long)(v >> 32));
+        return 31 - (int)index;
+    }
+    _BitScanReverse(&index, (unsigned long)v);
+    return 63 - (int)index;
+#else
+    return __builtin_clzll(v);
+#endif
+}
+
+// dstには書き込む最大サイズ+8バイトの領域があること
+class WaveBitWriter {
+public:
+    WaveBitWriter(uint8_t* dst) : start(dst), ptr(dst), acc(0), nbits(0) {}
+    // bits <= 32
+    void put(uint32_t v, int bits) {
+        acc = (acc << bits) | v;
+        nbits += bits;
+        if (nbits >= 32) {
+            nbits -= 32;
+            const uint32_t w = (uint32_t)(acc >> nbits);
+            ptr[0] = (uint8_t)(w >> 24);
+            ptr[1] = (uint8_t)(w >> 16);
+            ptr[2] = (uint8_t)(w >> 8);
+            ptr[3] = (uint8_t)w;
+            ptr += 4;
+        }
+    }
+    void flush() {
+        while (nbits >= 8) {
+            nbits -= 8;
+            *ptr++ = (uint8_t)(acc >> nbits);
+        }
+        if (nbits > 0) {
+            *ptr++ = (uint8_t)(acc << (8 - nbits));
+            nbits = 0;
+        }
+    }
+    size_t size() const {
+        return ptr - start;
+    }
+private:
+    uint8_t* start;
+    uint8_t* ptr;
+    uint64_t acc;
+    int nbits;
+};
+
+// 終端以降は0が読める
+// refill()の後は57ビットまでpeek/skipできる
+class WaveBitReader {
+public:
+    WaveBitReader(const uint8_t* ptr, const uint8_t* end) : ptr(ptr), end(end), acc(0), nbits(0) {}
+    // bits <= 32
+    uint32_t peek(int bits) const {
+        return (uint32_t)((acc >> 1) >> (63 - bits));
+    }
+    // 先頭の0の数（limitまで）
+    int zeros(int limit) const {
+        int n = (acc == 0) ? 64 : countLeadingZeros64(acc);
+        return std::min(n, limit);
+    }
+    void skip(int bits) {
+        acc <<= bits;
+        nbits -= bits;
+    }
+    void refill() {
+        while (nbits <= 56) {
+            uint64_t b = (ptr < end) ? *ptr++ : 0;
+            acc |= b << (56 - nbits);
+            nbits += 8;
+        }
+    }
+private:
+    const uint8_t* ptr;
+    const uint8_t* end;
+    uint64_t acc;
+    int nbits;
+};
+
+// 同じチャンネルの前のサンプルから予測する
+// チャンネル数はブロックからは分からないのでサンプル間隔strideを変えて試す
+inline int predictSample(const int16_t* x, int i, int stride, int order) {
+    const int a = (i >= stride) ? x[i - stride] : 0;
+    if (order == 1) {
+        return a;
+    }
+    const int b = (i >= 2 * stride) ? x[i - 2 * stride] : 0;
+    return 2 * a - b;
+}
+
+// 予測残差をzigzag符号化してuに入れる
+void calcWaveResidual(const int16_t* x, int n, int stride, int order, uint16_t* u) {
+    const int head = std::min(n, 2 * stride);
+    for (int i = 0; i < head; i++) {
+        const int r = (int16_t)(x[i] - predictSample(x, i, stride, order));
+        u[i] = (uint16_t)((r << 1) ^ (r >> 15));
+    }
+    if (order == 1) {
+        for (int i = head; i < n; i++) {
+            const int r = (int16_t)(x[i] - x[i - stride]);
+            u[i] = (uint16_t)((r << 1) ^ (r >> 15));
+        }
+    } else {
+        for (int i = head; i < n; i++) {
+            const int r = (int16_t)(x[i] - 2 * x[i - stride] + x[i - 2 * stride]);
+            u[i] = (uint16_t)((r << 1) ^ (r >> 15));
+        }
+    }
+}
+
+void encodeWaveBlock(const uint8_t* src, int length, std::vector<uint8_t>& dst) {
+    const int n = length / 2;
+    std::vector<int16_t> x(n);
+    std::vector<uint16_t> u(n);
+    memcpy(x.data(), src, (size_t)n * 2);
+
+    // 先頭部分の残差が最小になる予測を使う
+    static const int STRIDES[] = { 1, 2, 6 };
+    const int numTest = std::min(n, 4096);
+    int stride = 1;
+    int order = 1;
+    int64_t bestCost = INT64_MAX;
+    for (int s : STRIDES) {
+        for (int o = 1; o <= 2; o++) {
+            calcWaveResidual(x.data(), numTest, s, o, u.data());
+            int64_t cost = 0;
+            for (int i = 0; i < numTest; i++) {
+                cost += u[i];
+            }
+            if (cost < bestCost) {
+                bestCost = cost;
+                stride = s;
+                order = o;
+            }
+        }
+    }
+    calcWaveResidual(x.data(), n, stride, order, u.data());
+
+    // 1グループの最大ビット数に余裕を加えた分を確保しておき、非圧縮より大きくなったらやめる
+    dst.resize(WAVE_STORE_BLOCK_HEADER + length + WAVE_STORE_GROUP * 5 + 16);
+    dst[0] = WAVE_BLOCK_RICE;
+    dst[1] = (uint8_t)stride;
+    dst[2] = (uint8_t)order;
+    dst[3] = (length & 1) ? src[length - 1] : 0;
+    WaveBitWriter bw(dst.data() + WAVE_STORE_BLOCK_HEADER);
+    bool compressed = true;
+    for (int g = 0; g < n; g += WAVE_STORE_GROUP) {
+        const int cnt = std::min<int>(WAVE_STORE_GROUP, n - g);
+        uint32_t sum = 0;
+        for (int i = 0; i < cnt; i++) {
+            sum += u[g + i];
+        }
+        int k = 0;
+        while (k < 15 && ((uint32_t)cnt << (k + 1)) <= sum) {
+            k++;
+        }
+        bw.put(k, 4);
+        const uint32_t mask = (1u << k) - 1;
+        for (int i = 0; i < cnt; i++) {
+            const uint32_t v = u[g + i];
+            const uint32_t q = v >> k;
+            if (q < WAVE_STORE_ESCAPE) {
+                // q個の0と1の後に下位kビット
+                const int bits = q + 1 + k;
+                if (bits <= 32) {
+                    bw.put((1u << k) | (v & mask), bits);
+                } else {
+                    bw.put(0, q);
+                    bw.put((1u << k) | (v & mask), k + 1);
+                }
+            } else {
+                bw.put(0, WAVE_STORE_ESCAPE);
+                bw.put(v, 16);
+            }
+        }
+        if ((int)bw.size() >= length) {
+            compressed = false;
+            break;
+        }
+    }
+    if (compressed) {
+        bw.flush();
+        compressed = ((int)bw.size() < length);
+    }
+    if (!compressed) {
+        // 圧縮できないときはそのまま入れる
+        dst.assign(WAVE_STORE_BLOCK_HEADER, 0);
+        dst[0] = WAVE_BLOCK_RAW;
+        dst.insert(dst.end(), src, src + length);
+        return;
+    }
+    dst.resize(WAVE_STORE_BLOCK_HEADER + bw.size());
+}
+
+bool decodeWaveBlock(const uint8_t* src, int encodedSize, uint8_t* dst, int length) {
+    if (encodedSize < WAVE_STORE_BLOCK_HEADER) {
+        return false;
+    }
+    if (src[0] == WAVE_BLOCK_RAW) {
+        if (encodedSize != length + WAVE_STORE_BLOCK_HEADER) {
+            return false;
+        }
+        memcpy(dst, src + WAVE_STORE_BLOCK_HEADER, length);
+        return true;
+    }
+    const int stride = src[1];
+    const int order = src[2];
+    if (src[0] != WAVE_BLOCK_RICE || stride <= 0 || order < 1 || order > 2) {
+        return false;
+    }
+    const int n = length / 2;
+    int16_t* x = reinterpret_cast<int16_t*>(dst);
+    WaveBitReader br(src + WAVE_STORE_BLOCK_HEADER, src + encodedSize);
+    for (int g = 0; g < n; g += WAVE_STORE_GROUP) {
+        const int cnt = std::min<int>(WAVE_STORE_GROUP, n - g);
+        br.refill();
+        const int k = br.peek(4);
+        br.skip(4);
+        for (int i = g; i < g + cnt; i++) {
+            // 1サンプルは最大40ビット
+            br.refill();
+            uint32_t v;
+            const int q = br.zeros(WAVE_STORE_ESCAPE);
+            if (q < WAVE_STORE_ESCAPE) {
+                br.skip(q + 1);
+                v = ((uint32_t)q << k) | br.peek(k);
+                br.skip(k);
+            } else {
+                br.skip(WAVE_STORE_ESCAPE);
+                v = br.peek(16);
+                br.skip(16);
+            }
+            const int r = (int)(v >> 1) ^ -(int)(v & 1);
+            const int pred = (i >= 2 * stride)
+                ? ((order == 1) ? x[i - stride] : (2 * x[i - stride] - x[i - 2 * stride]))
+                : predictSample(x, i, stride, order);
+            x[i] = (int16_t)(r + pred);
+        }
+    }
+    if (length & 1) {
+        dst[length - 1] = src[3];
+    }
+    return true;
+}
+
+} // namespace
+
+WaveStoreWriter::WaveStoreWriter(const tstring& path)
+    : file_(path, _T("wb"))
+    , pending_()
+    , encoded_()
+    , index_()
+    , fileSize_(0)
+    , waveSize_(0)
+    , finished_(false) {
+    uint8_t header[WAVE_STORE_HEADER_SIZE] = { 0 };
+    memcpy(header, WAVE_STORE_MAGIC, sizeof(WAVE_STORE_MAGIC));
+    header[8] = 1; // バージョン
+    file_.write(MemoryChunk(header, sizeof(header)));
+    fileSize_ = sizeof(header);
+}
+
+WaveStoreWriter::~WaveStoreWriter() {
+    try {
+        finish();
+    } catch (const Exception&) {
+        // デストラクタなので例外は投げない
+    }
+}
+
+void WaveStoreWriter::write(MemoryChunk mc) {
+    if (finished_) {
+        THROW(InvalidOperationException, "中間PCMファイルは書き込み完了済みです");
+    }
+    const uint8_t* ptr = mc.data;
+    size_t remain = mc.length;
+    while (remain > 0) {
+        if (pending_.empty() && remain >= WAVE_STORE_BLOCK_SIZE) {
+            writeBlock(ptr, WAVE_STORE_BLOCK_SIZE);
+            ptr += WAVE_STORE_BLOCK_SIZE;
+            remain -= WAVE_STORE_BLOCK_SIZE;
+            continue;
+        }
+        // ブロックに満たない分はためておく
+        const size_t n = std::min(remain, WAVE_STORE_BLOCK_SIZE - pending_.size());
+        pending_.insert(pending_.end(), ptr, ptr + n);
+        ptr += n;
+        remain -= n;
+        if (pending_.size() == WAVE_STORE_BLOCK_SIZE) {
+            flushPending();
+        }
+    }
+}
+
+void WaveStoreWriter::appendFrom(const tstring& srcpath) {
+    WaveStoreReader src(srcpath);
+    if (!src.compressed_) {
+        std::vector<uint8_t> buf(WAVE_STORE_BLOCK_SIZE);
+        while (size_t readBytes = src.read(MemoryChunk(buf.data(), buf.size()))) {
+            write(MemoryChunk(buf.data(), readBytes));
+        }
+        return;
+    }
+    if (finished_) {
+        THROW(InvalidOperationException, "中間PCMファイルは書き込み完了済みです");
+    }
+    // ブロックは独立に展開できるのでそのままコピーする
+    flushPending();
+    for (const WaveStoreBlock& srcBlock : src.index_) {
+        src.encoded_.resize(srcBlock.encodedSize);
+        src.file_.seek(srcBlock.fileOffset, SEEK_SET);
+        if (src.file_.read(MemoryChunk(src.encoded_.data(), src.encoded_.size())) != src.encoded_.size()) {
+            THROWF(FormatException, "中間PCMファイルが壊れています: %s", GetFullPath(srcpath));
+        }
+        file_.write(MemoryChunk(src.encoded_.data(), src.encoded_.size()));
+        WaveStoreBlock block = { fileSize_, waveSize_, srcBlock.encodedSize, srcBlock.waveLength };
+        index_.push_back(block);
+        fileSize_ += srcBlock.encodedSize;
+        waveSize_ += srcBlock.waveLength;
+    }
+}
+
+void WaveStoreWriter::finish() {
+    if (finished_) {
+        return;
+    }
+    flushPending();
+    finished_ = true;
+    const int64_t indexOffset = fileSize_;
+    if (index_.size() > 0) {
+        file_.write(MemoryChunk((uint8_t*)index_.data(), index_.size() * sizeof(WaveStoreBlock)));
+    }
+    int64_t trailer[3] = { indexOffset, (int64_t)index_.size(), 0 };
+    memcpy(&trailer[2], WAVE_STORE_MAGIC, sizeof(WAVE_STORE_MAGIC));
+    file_.write(MemoryChunk((uint8_t*)trailer, sizeof(trailer)));
+    file_.flush();
+}
+
+void WaveStoreWriter::writeBlock(const uint8_t* data, int length) {
+    encodeWaveBlock(data, length, encoded_);
+    file_.write(MemoryChunk(encoded_.data(), encoded_.size()));
+    WaveStoreBlock block = { fileSize_, waveSize_, (int32_t)encoded_.size(), length };
+    index_.push_back(block);
+    fileSize_ += encoded_.size();
+    waveSize_ += length;
+}
+
+void WaveStoreWriter::flushPending() {
+    if (pending_.size() > 0) {
+        writeBlock(pending_.data(), (int)pending_.size());
+        pending_.clear();
+    }
+}
+
+WaveStoreReader::WaveStoreReader(const tstring& path)
+    : path_(path)
+    , file_(path, _T("rb"))
+    , compressed_(false)
+    , index_()
+    , waveSize_(0)
+    , pos_(0)
+    , cachedBlock_(-1)
+    , cache_()
+    , encoded_() {
+    const int64_t fileSize = file_.size();
+    if (fileSize >= WAVE_STORE_HEADER_SIZE + WAVE_STORE_TRAILER_SIZE) {
+        char magic[sizeof(WAVE_STORE_MAGIC)];
+        file_.read(MemoryChunk((uint8_t*)magic, sizeof(magic)));
+        compressed_ = (memcmp(magic, WAVE_STORE_MAGIC, sizeof(magic)) == 0);
+    }
+    if (!compressed_) {
+        // 圧縮していないファイル
+        file_.seek(0, SEEK_SET);
+        waveSize_ = fileSize;
+        return;
+    }
+    int64_t trailer[3];
+    file_.seek(fileSize - WAVE_STORE_TRAILER_SIZE, SEEK_SET);
+    if (file_.read(MemoryChunk((uint8_t*)trailer, sizeof(trailer))) != sizeof(trailer) ||
+        memcmp(&trailer[2], WAVE_STORE_MAGIC, sizeof(WAVE_STORE_MAGIC)) != 0) {
+        THROWF(FormatException, "中間PCMファイルが完了していません: %s", GetFullPath(path_));
+    }
+    const int64_t indexOffset = trailer[0];
+    const int64_t numBlocks = trailer[1];
+    if (indexOffset < WAVE_STORE_HEADER_SIZE || numBlocks < 0 ||
+        indexOffset + numBlocks * (int64_t)sizeof(WaveStoreBlock) + WAVE_STORE_TRAILER_SIZE != fileSize) {
+        THROWF(FormatException, "中間PCMファイルが壊れています: %s", GetFullPath(path_));
+    }
+    index_.resize((size_t)numBlocks);
+    if (numBlocks > 0) {
+        file_.seek(indexOffset, SEEK_SET);
+        file_.read(MemoryChunk((uint8_t*)index_.data(), index_.size() * sizeof(WaveStoreBlock)));
+    }
+    for (const WaveStoreBlock& block : index_) {
+        if (block.encodedSize < WAVE_STORE_BLOCK_HEADER || block.waveLength <= 0 ||
+            block.fileOffset + block.encodedSize > indexOffset || block.waveOffset != waveSize_) {
+            THROWF(FormatException, "中間PCMファイルが壊れています: %s", GetFullPath(path_));
+        }
+        waveSize_ += block.waveLength;
+    }
+}
+
+void WaveStoreReader::seek(int64_t offset, int origin) {
+    if (!compressed_) {
+        file_.seek(offset, origin);
+        return;
+    }
+    switch (origin) {
+    case SEEK_SET: pos_ = offset; break;
+    case SEEK_CUR: pos_ += offset; break;
+    case SEEK_END: pos_ = waveSize_ + offset; break;
+    }
+    if (pos_ < 0) {
+        THROWF(IOException, "failed to seek file: %s", GetFullPath(path_));
+    }
+}
+
+size_t WaveStoreReader::read(MemoryChunk mc) {
+    if (!compressed_) {
+        return file_.read(mc);
+    }
+    size_t done = 0;
+    while (done < mc.length && pos_ < waveSize_) {
+        int blockIndex = cachedBlock_;
+        if (blockIndex < 0 || pos_ < index_[blockIndex].waveOffset ||
+            pos_ >= index_[blockIndex].waveOffset + index_[blockIndex].waveLength) {
+            // posを含むブロックを探す
+            auto it = std::upper_bound(index_.begin(), index_.end(), pos_,
+                [](int64_t pos, const WaveStoreBlock& block) { return pos < block.waveOffset; });
+            blockIndex = (int)(it - index_.begin()) - 1;
+        }
+        const WaveStoreBlock& block = index_[blockIndex];
+        const std::vector<uint8_t>& data = loadBlock(blockIndex);
+        const size_t offset = (size_t)(pos_ - block.waveOffset);
+        const size_t n = std::min(mc.length - done, (size_t)block.waveLength - offset);
+        memcpy(mc.data + done, data.data() + offset, n);
+        done += n;
+        pos_ += n;
+    }
+    return done;
+}
+
+int64_t WaveStoreReader::size() const {
+    return waveSize_;
+}
+
+const std::vector<uint8_t>& WaveStoreReader::loadBlock(int blockIndex) {
+    if (cachedBlock_ != blockIndex) {
+        const WaveStoreBlock& block = index_[blockIndex];
+        encoded_.resize(block.encodedSize);
+        cache_.resize(block.waveLength);
+        cachedBlock_ = -1;
+        file_.seek(block.fileOffset, SEEK_SET);
+        if (file_.read(MemoryChunk(encoded_.data(), encoded_.size())) != encoded_.size() ||
+            !decodeWaveBlock(encoded_.data(), (int)encoded_.size(), cache_.data(), (int)cache_.size())) {
+            THROWF(FormatException, "中間PCMファイルが壊れています: %s", GetFullPath(path_));
+        }
+        cachedBlock_ = blockIndex;
+    }
+    return cache_;
+}
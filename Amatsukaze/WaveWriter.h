@@ -9,6 +9,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <vector>
 
 #include "StreamUtils.h"
 
@@ -45,3 +46,63 @@ uint32_t toBigEndian(uint32_t a);
 // エラー検出のため numSamples が64bitになっているがintを超える範囲に対応している訳ではないことに注意
 void writeWaveHeader(FILE* fp, int channels, int samplerate, int bitswidth, int64_t numSamples);
 
+// 中間PCMファイルのブロック
+struct WaveStoreBlock {
+    int64_t fileOffset;  // ファイル上の位置
+    int64_t waveOffset;  // 非圧縮PCMでの位置
+    int32_t encodedSize; // ファイル上のサイズ
+    int32_t waveLength;  // 非圧縮PCMでのサイズ
+};
+
+// 中間PCM(16bit)をブロックごとに可逆圧縮して書き込む
+// 位置は全て非圧縮PCMでのバイト位置で、WaveStoreReaderで同じ位置を読める
+class WaveStoreWriter : NonCopyable {
+public:
+    WaveStoreWriter(const tstring& path);
+    ~WaveStoreWriter();
+
+    void write(MemoryChunk mc);
+    // WaveStoreWriterで書いたファイルの内容を末尾に追加する（ブロックは展開せずにコピーする）
+    void appendFrom(const tstring& srcpath);
+    // インデックスを書き込んで完了する（以降は書き込めない）
+    void finish();
+
+private:
+    File file_;
+    std::vector<uint8_t> pending_;
+    std::vector<uint8_t> encoded_;
+    std::vector<WaveStoreBlock> index_;
+    int64_t fileSize_;
+    int64_t waveSize_;
+    bool finished_;
+
+    void writeBlock(const uint8_t* data, int length);
+    void flushPending();
+};
+
+// WaveStoreWriterで書いたファイルを非圧縮PCMとして読む
+// 必要なブロックだけ展開する。ヘッダがない場合は非圧縮のファイルとしてそのまま読む
+class WaveStoreReader : NonCopyable {
+public:
+    WaveStoreReader(const tstring& path);
+
+    void seek(int64_t offset, int origin);
+    size_t read(MemoryChunk mc);
+    int64_t size() const;
+
+private:
+    friend class WaveStoreWriter;
+
+    const tstring path_; // エラーメッセージ表示用
+    File file_;
+    bool compressed_;
+    std::vector<WaveStoreBlock> index_;
+    int64_t waveSize_;
+    int64_t pos_;
+    int cachedBlock_;
+    std::vector<uint8_t> cache_;
+    std::vector<uint8_t> encoded_;
+
+    const std::vector<uint8_t>& loadBlock(int blockIndex);
+};
+
@@ -0,0 +1,67 @@
+﻿/**
+* Amtasukaze frame ring reference reader
+* Copyright (c) 2017-2019 Nekopanda
+*
+* This software is released under the MIT License.
+* http://opensource.org/licenses/mit-license.php
+*/
+
+// --frame-ring で起動されたときに共有メモリリングからフレームを受け取り、
+// 通常のY4Mストリームとして標準出力に書き出す参照実装
+// エンコーダ（ラッパー）をリング対応にするときはFrameRingReaderの使い方をこのファイルに倣えばよい
+
+#include "FrameRing.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+static bool writeAll(int fd, const void* data, size_t size) {
+    const uint8_t* ptr = (const uint8_t*)data;
+    while (size > 0) {
+        const ssize_t ret = ::write(fd, ptr, size);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        ptr += ret;
+        size -= (size_t)ret;
+    }
+    return true;
+}
+
+int main() {
+    FrameRingReader reader;
+    if (!reader.open()) {
+        fprintf(stderr, "AmatsukazeFrameRingReader: フレームリングのヘッダを読めませんでした\n");
+        return 1;
+    }
+    const std::string header = reader.y4mHeader() + "\n";
+    if (!writeAll(STDOUT_FILENO, header.data(), header.size())) {
+        fprintf(stderr, "AmatsukazeFrameRingReader: 出力に失敗 (%s)\n", strerror(errno));
+        return 1;
+    }
+    static const char frameHeader[] = "FRAME\n";
+    const uint8_t* data = nullptr;
+    size_t bytes = 0;
+    uint32_t slot = 0;
+    while (reader.next(data, bytes, slot)) {
+        if (!writeAll(STDOUT_FILENO, frameHeader, sizeof(frameHeader) - 1) ||
+            !writeAll(STDOUT_FILENO, data, bytes)) {
+            fprintf(stderr, "AmatsukazeFrameRingReader: 出力に失敗 (%s)\n", strerror(errno));
+            return 1;
+        }
+        if (!reader.release(slot)) {
+            fprintf(stderr, "AmatsukazeFrameRingReader: スロットの返却に失敗 (%s)\n", strerror(errno));
+            return 1;
+        }
+    }
+    if (errno != 0) {
+        fprintf(stderr, "AmatsukazeFrameRingReader: フレームの受信に失敗 (%s)\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,12 @@
+﻿#include "gtest/gtest.h"
+
+__declspec(dllimport) int AmatsukazeCLI(int argc, const wchar_t* argv[]);
+
+TEST(FrameCache, KeepsSeekDistanceFrames) {
+    const wchar_t* args[] = {
+        L"AmatsukazeTest.exe",
+        L"--mode",
+        L"test_frame_cache",
+    };
+    EXPECT_EQ(AmatsukazeCLI(static_cast<int>(sizeof(args) / sizeof(args[0])), args), 0);
+}
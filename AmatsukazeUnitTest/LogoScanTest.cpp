@@ -0,0 +1,21 @@
+﻿#include "gtest/gtest.h"
+
+__declspec(dllimport) int AmatsukazeCLI(int argc, const wchar_t* argv[]);
+
+TEST(LogoScan, MultiFadeKernelMatchesScalar) {
+    const wchar_t* args[] = {
+        L"AmatsukazeTest.exe",
+        L"--mode",
+        L"test_logo_score",
+    };
+    EXPECT_EQ(AmatsukazeCLI(static_cast<int>(sizeof(args) / sizeof(args[0])), args), 0);
+}
+
+TEST(LogoScan, ScanDataRoundTrip) {
+    const wchar_t* args[] = {
+        L"AmatsukazeTest.exe",
+        L"--mode",
+        L"test_logo_scan_data",
+    };
+    EXPECT_EQ(AmatsukazeCLI(static_cast<int>(sizeof(args) / sizeof(args[0])), args), 0);
+}
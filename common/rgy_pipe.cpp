@@ -389,6 +389,29 @@ bool RGYPipeProcessWin::processAlive() {
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <cstdio>
+
+int rgy_pipe_set_buffer_size(PIPE_HANDLE handle, uint32_t size) {
+#if defined(F_SETPIPE_SZ)
+    int ret = fcntl(handle, F_SETPIPE_SZ, (int)size);
+    if (ret < 0 && errno == EPERM) {
+        // 非特権プロセスはpipe-max-sizeまでしか拡張できない
+        FILE *fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (fp) {
+            unsigned int maxSize = 0;
+            if (fscanf(fp, "%u", &maxSize) == 1 && maxSize > 0 && maxSize < size) {
+                ret = fcntl(handle, F_SETPIPE_SZ, (int)maxSize);
+            }
+            fclose(fp);
+        }
+    }
+    return ret;
+#else
+    (void)handle;
+    (void)size;
+    return -1;
+#endif
+}
 #endif
 
 
@@ -537,7 +560,10 @@ int RGYAnonymousPipe::create(bool inheritReadHandle, bool inheritWriteHandle, ui
     }
     m_read = fds[0];
     m_write = fds[1];
-    (void)bufferSize;
+    if (bufferSize > 0) {
+        // 拡張できなくても既定サイズのまま使えるので失敗は無視する
+        rgy_pipe_set_buffer_size(m_write, bufferSize);
+    }
     return 0;
 #endif
 }
@@ -106,6 +106,10 @@ public:
         m_pipe.stdOut.mode = stdout_;
         m_pipe.stdErr.mode = stderr_;
     };
+    // 0以外を指定するとパイプのバッファサイズを変更する (Linuxでは上限はpipe-max-size)
+    void setStdInBufferSize(uint32_t size) {
+        m_pipe.stdIn.bufferSize = size;
+    }
     void setStdOutBufferSize(uint32_t size) {
         m_pipe.stdOut.bufferSize = size;
     }
@@ -132,6 +136,7 @@ public:
     virtual int wait(uint32_t timeout) = 0;
     virtual int waitAndGetExitCode() = 0;
     virtual int pid() const = 0;
+    PIPE_HANDLE stdInHandle() const { return m_pipe.stdIn.h_write; }
 protected:
     virtual int startPipes() = 0;
     PROCESS_HANDLE m_phandle;
@@ -209,6 +214,12 @@ protected:
 
 std::unique_ptr<RGYPipeProcess> createRGYPipeProcess();
 
+#if !(defined(_WIN32) || defined(_WIN64))
+// パイプのバッファサイズを変更する (pipe-max-sizeを超える場合は上限まで)
+// 戻り値: 設定後のサイズ、失敗時 -1
+int rgy_pipe_set_buffer_size(PIPE_HANDLE handle, uint32_t size);
+#endif
+
 // 共通無名パイプ (Windows: HANDLE, Linux: fd)
 // C++ のみ
 #ifdef __cplusplus
@@ -218,7 +229,7 @@ public:
     ~RGYAnonymousPipe();
 
     // 継承可否を個別に指定 (通常: 読み取り側のみ継承可、書き込み側は継承不可)
-    // bufferSize (Windowsのみ有効)
+    // bufferSize (0の場合は既定値、Linuxでは上限はpipe-max-size)
     int create(bool inheritReadHandle = true, bool inheritWriteHandle = false, uint32_t bufferSize = 0);
 
     // 書き込み
@@ -84,6 +84,9 @@ int RGYPipeProcessLinux::startPipes() {
             || set_cloexec((int)m_pipe.stdIn.h_write) == -1) {
             return 1;
         }
+        if (m_pipe.stdIn.bufferSize > 0) {
+            rgy_pipe_set_buffer_size(m_pipe.stdIn.h_write, m_pipe.stdIn.bufferSize);
+        }
         if (m_pipe.stdIn.mode & PIPE_MODE_ENABLE_FP) {
             m_pipe.stdIn.fp = fdopen(m_pipe.stdIn.h_write, "w");
         }